@@ -382,6 +382,7 @@ echo "\$(SOURCE_PATH)/evd.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/expression.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/field.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/fisherpedigree.o \\" >> sources.mk
+echo "\$(SOURCE_PATH)/fitcache.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/fphi.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/freq.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/function.o \\" >> sources.mk
@@ -392,6 +393,7 @@ echo "\$(SOURCE_PATH)/ibd.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/ibdoption.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/ibs.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/inorm_nifti.o \\" >> sources.mk
+echo "\$(SOURCE_PATH)/jobpool.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/key.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/listmaker.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/loadsave.o \\" >> sources.mk
@@ -402,6 +404,7 @@ echo "\$(SOURCE_PATH)/mathmatrix.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/matrix.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/maximize.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/mibd.o \\" >> sources.mk
+echo "\$(SOURCE_PATH)/mibdpack.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/model.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/mu.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/nifti_assemble.o \\" >> sources.mk
@@ -415,6 +418,7 @@ echo "\$(SOURCE_PATH)/pedigree.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/phenotypes.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/plink_converter.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/power.o \\" >> sources.mk
+echo "\$(SOURCE_PATH)/profile.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/reorder_phenotype.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/scale.o \\" >> sources.mk
 echo "\$(SOURCE_PATH)/scan.o \\" >> sources.mk
@@ -572,7 +576,7 @@ fi
 echo "include sources.mk" >> Makefile
 echo ".SUFFIXES: .f .cc .o .h" >> Makefile
 echo "FFLAGS=-m64  -O2 -fno-second-underscore -fexceptions" >> Makefile
-echo "CFLAGS=-std=c99 -m64 -O2 -I$INCLUDE_PATH -DUSE_SAFELIB -fexceptions" >> Makefile
+echo "CFLAGS=-std=c99 -m64 -O2 -fopenmp -I$INCLUDE_PATH -DUSE_SAFELIB -fexceptions" >> Makefile
 MKL_INCLUDE=
 if [ $USE_MKL -eq 1 ]
 then
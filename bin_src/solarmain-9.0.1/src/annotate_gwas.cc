@@ -1,119 +1,206 @@
 //
 //  annotate_gwas_cmd.cpp
-//  
+//
 //
 //  Created by Brian Donohue on 2/22/19.
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "solar.h"
 #include <string>
 #include <vector>
-#include <algorithm>
+#include <unordered_map>
 #include <fstream>
+#include <algorithm>
 using namespace std;
 
-static vector<string> split_line(string line){
-    char c;
-    string str;
-    vector<string> output;
-    for(unsigned i = 0 ; i < line.length(); i++){
-        c = line[i];
-        if(c != ','){
-            str += c;
-        }else{
-            output.push_back(str);
-            str.clear();
+// A text file mapped read-only into memory.  Lines are walked in place so
+// neither file is copied into strings line by line.
+class mapped_text
+{
+public:
+    const char * data;
+    size_t size;
+
+    mapped_text() : data(0), size(0) {}
+    ~mapped_text(){
+        if(data) munmap((void *) data, size);
+    }
+    bool open(const char * filename){
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) return false;
+        struct stat file_stat;
+        if(fstat(fd, &file_stat) != 0){
+            close(fd);
+            return false;
         }
+        size = file_stat.st_size;
+        if(size != 0){
+            void * base = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(base == MAP_FAILED){
+                close(fd);
+                size = 0;
+                return false;
+            }
+            madvise(base, size, MADV_SEQUENTIAL);
+            data = (const char *) base;
+        }
+        close(fd);
+        return true;
+    }
+// Sets [line, line_end) to the line starting at position, without the
+// newline or a trailing carriage return, and returns the next position.
+    size_t next_line(size_t position, const char * & line, const char * & line_end) const {
+        line = data + position;
+        const char * newline = (const char *) memchr(line, '\n', size - position);
+        const char * next = newline ? newline + 1 : data + size;
+        line_end = newline ? newline : data + size;
+        if(line_end != line && line_end[-1] == '\r') line_end--;
+        return next - data;
+    }
+};
+
+// Returns the start of field index within [line, line_end), or 0 if the
+// line has fewer fields.  The field ends at the next comma or line_end.
+static inline const char * find_field(const char * line, const char * line_end, size_t index){
+    const char * field = line;
+    while(index--){
+        field = (const char *) memchr(field, ',', line_end - field);
+        if(!field) return 0;
+        field++;
+    }
+    return field;
+}
+
+static inline const char * field_end(const char * field, const char * line_end){
+    const char * comma = (const char *) memchr(field, ',', line_end - field);
+    return comma ? comma : line_end;
+}
+
+static vector<string> split_line(const char * line, const char * line_end){
+    vector<string> output;
+    const char * field = line;
+    while(true){
+        const char * end = field_end(field, line_end);
+        output.push_back(string(field, end));
+        if(end == line_end) break;
+        field = end + 1;
     }
-    output.push_back(str);
     return output;
 }
+
 class gwas_data
 {
 private:
-    double threshold;
+    mapped_text annotation_file;
+// Annotation columns after the snp name, starting at the comma, keyed by
+// snp name.  The first line for each snp is used.
+    unordered_map<string, pair<const char *, size_t> > annotation_index;
+    string annotation_header;
+    size_t n_annotation_fields;
 public:
-    vector<string> snp_names;
-    vector<string> gwas_lines;
-    string field_line;
-    
-    gwas_data(const char * gwas_filename, const double l_threshold = 0.05){
-        threshold = l_threshold;
-        ifstream data_in(gwas_filename);
-        getline(data_in, field_line);
-        vector<string> parsed_line = split_line(field_line);
-        size_t pvalue_index;
+    gwas_data() : n_annotation_fields(0) {}
+
+    const char * load_annotation_data(const char * annotation_filename, const char * field_filename){
+        ifstream field_stream(field_filename);
+        if(!field_stream.is_open()) return "Could not open annotate field list file";
+        string line;
+        getline(field_stream, line);
+        field_stream.close();
+        if(line.length() && line[line.length() - 1] == '\r') line.erase(line.length() - 1);
+        size_t comma_index = line.find(',');
+        if(comma_index != string::npos) annotation_header = line.substr(comma_index);
+        n_annotation_fields = split_line(line.c_str(), line.c_str() + line.length()).size() - 1;
+
+        if(!annotation_file.open(annotation_filename)) return "Could not open annotate data file";
+        size_t position = 0;
+        const char * data_line;
+        const char * data_line_end;
+        while(position < annotation_file.size){
+            position = annotation_file.next_line(position, data_line, data_line_end);
+            const char * name_end = field_end(data_line, data_line_end);
+            if(name_end == data_line_end) continue;
+            annotation_index.insert(pair<string, pair<const char *, size_t> >(string(data_line, name_end),
+                                    pair<const char *, size_t>(name_end, data_line_end - name_end)));
+        }
+        return 0;
+    }
+
+// Streams the gwas file, writing each snp with a pvalue at or below
+// threshold as soon as it is read, followed by its annotation or N/A.
+    const char * write_annotation_data(const char * gwas_filename, const char * output_filename, const double threshold){
+        mapped_text gwas_file;
+        if(!gwas_file.open(gwas_filename)) return "Could not open gwas data file";
+        if(gwas_file.size == 0) return "gwas data file is empty";
+        const char * line;
+        const char * line_end;
+        size_t position = gwas_file.next_line(0, line, line_end);
+        vector<string> parsed_line = split_line(line, line_end);
+        size_t pvalue_index = parsed_line.size();
         for(unsigned i = 0; i < parsed_line.size(); i++){
             if(!StringCmp(parsed_line[i].c_str(), "pvalue", case_ins) || !StringCmp(parsed_line[i].c_str(), "p-value", case_ins)){
                 pvalue_index = i;
                 break;
             }
         }
-        size_t snp_name_index;
+        size_t snp_name_index = parsed_line.size();
         for(unsigned i = 0; i < parsed_line.size(); i++){
-            if(!StringCmp(parsed_line[i].c_str(), "snp", case_ins) || !StringCmp(parsed_line[i].c_str(), "snp", case_ins)){
+            if(!StringCmp(parsed_line[i].c_str(), "snp", case_ins)){
                 snp_name_index = i;
                 break;
             }
         }
-        string line;
-        while(getline(data_in, line)){
-            parsed_line = split_line(line);
-            double temp_pvalue = atof(parsed_line[pvalue_index].c_str());
-            if(temp_pvalue <= threshold){
-                snp_names.push_back(parsed_line[snp_name_index]);
-                gwas_lines.push_back(line);
+        if(pvalue_index == parsed_line.size()) return "No pvalue field was found in gwas data file";
+        if(snp_name_index == parsed_line.size()) return "No snp field was found in gwas data file";
 
-            }
+        string missing_annotation;
+        for(size_t field = 0; field < n_annotation_fields; field++){
+            missing_annotation += ",N/A";
         }
-        data_in.close();
-    }
-    void write_annotation_data(const char * annotation_filename, const char * field_filename, const char * output_filename){
-        ifstream field_stream(field_filename);
-        string line;
-        getline(field_stream, line);
-	vector<string> field_list = split_line(line);
-        field_stream.close();
-        size_t comma_index = 0;
-        while(line[comma_index] != ',') comma_index++;
-        line = line.substr(comma_index, line.length() - comma_index - 1);
+
         ofstream output_stream(output_filename);
-        
-        output_stream << field_line << line << endl;
-        ifstream annotation_stream(annotation_filename);
-        
-        vector<string>  temp_snp_names = snp_names;
-        vector<string> temp_gwas_lines = gwas_lines;
+        if(!output_stream.is_open()) return "Could not open output file";
+        output_stream.write(line, line_end - line);
+        output_stream << annotation_header << "\n";
+
         string snp_name;
-        vector<string>::iterator iter;
-        while(getline(annotation_stream, line) && temp_snp_names.size() != 0){
-            comma_index = 0;
-            while(line[comma_index] != ',') comma_index++;
-            iter = find(temp_snp_names.begin(), temp_snp_names.end(), line.substr(0, comma_index));
-            if(iter != temp_snp_names.end()){
-                size_t vector_index = distance(temp_snp_names.begin(), iter);
-                output_stream << temp_gwas_lines[vector_index]  << line.substr(comma_index, line.length() - comma_index - 1) << endl;
-                temp_snp_names.erase(iter);
-                temp_gwas_lines.erase(temp_gwas_lines.begin() + vector_index);
+        char pvalue_buffer[64];
+        while(position < gwas_file.size){
+            position = gwas_file.next_line(position, line, line_end);
+            if(line == line_end) continue;
+            const char * pvalue_field = find_field(line, line_end, pvalue_index);
+            const char * snp_field = find_field(line, line_end, snp_name_index);
+            if(!pvalue_field || !snp_field) continue;
+            const char * pvalue_end = field_end(pvalue_field, line_end);
+            size_t pvalue_length = min<size_t>(pvalue_end - pvalue_field, sizeof(pvalue_buffer) - 1);
+            memcpy(pvalue_buffer, pvalue_field, pvalue_length);
+            pvalue_buffer[pvalue_length] = '\0';
+            if(!(atof(pvalue_buffer) <= threshold)) continue;
+
+            snp_name.assign(snp_field, field_end(snp_field, line_end));
+            output_stream.write(line, line_end - line);
+            unordered_map<string, pair<const char *, size_t> >::const_iterator match = annotation_index.find(snp_name);
+            if(match != annotation_index.end()){
+                output_stream.write(match->second.first, match->second.second);
+            }else{
+                output_stream << missing_annotation;
             }
+            output_stream << "\n";
         }
-	for(unsigned index = 0; index < temp_snp_names.size(); index++){
-		output_stream << temp_gwas_lines[index];
-		for(size_t comma = 0; comma < field_list.size(); comma++){
-			output_stream << ",N/A";
-		}
-		output_stream << endl;
-	}
         output_stream.close();
-        annotation_stream.close();
-        
+        return 0;
     }
-    
+
 };
 static void print_help(Tcl_Interp * interp){
     Solar_Eval(interp, "help annotate_gwas");
-    
+
 }
 extern "C" int annotationCmd(ClientData clientData, Tcl_Interp *interp,
                               int argc,const char *argv[]){
@@ -140,9 +227,20 @@ extern "C" int annotationCmd(ClientData clientData, Tcl_Interp *interp,
             return TCL_ERROR;
         }
     }
-    
-    gwas_data annotator(gwas_filename, threshold);
-    annotator.write_annotation_data(annotation_filename,  field_filename, output_filename);
+    if(!gwas_filename || !annotation_filename || !output_filename){
+        RESULT_LIT("The -i, -a and -o arguments are required");
+        return TCL_ERROR;
+    }
+
+    gwas_data annotator;
+    const char * errmsg = annotator.load_annotation_data(annotation_filename, field_filename);
+    if(!errmsg){
+        errmsg = annotator.write_annotation_data(gwas_filename, output_filename, threshold);
+    }
+    if(errmsg){
+        RESULT_BUF(errmsg);
+        return TCL_ERROR;
+    }
     return TCL_OK;
-    
+
 }
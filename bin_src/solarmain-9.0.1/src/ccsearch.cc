@@ -57,6 +57,7 @@ extern "C" void search_ (...);
 extern "C" void smpoutput_ (...);
 extern "C" void dcopyped_ (...);
 extern "C" double ppnd_ (double *mu, int *ierr);
+extern "C" int omegatyp_ ();
 
 
 
@@ -647,6 +648,7 @@ double ccsearch (const char* outfilename, int get_who, bool sampledata)
 // Do phenotype input in Fortran
 
     try {
+    Profile_Timer preped_timer (prof_preped);
     preped_
       (&rarray[p5], rarray, &rarray[p2], &rarray[p3], &rarray[p4],
        iarray, carray, &absent, &LENI, &Lenr, &maxpeo, &mxtwin,
@@ -831,6 +833,32 @@ double ccsearch (const char* outfilename, int get_who, bool sampledata)
 	DIFFER[0] = 0;
 	DIFFER[1] = 0;
 
+// Option AnalyticDeriv gives exact scores and an average information
+// Hessian for univariate EVD sporadic and polygenic models; any other
+// omega, discrete traits, or ascertained pedigrees use numerical
+// derivatives as before.  ModelType is tested as ddfun sees it, with
+// the first letter capitalized by soption.
+
+	const char* modeltype = Option::get_string ("ModelType");
+	if (Option::get_int ("AnalyticDeriv") &&
+	    toupper (modeltype[0]) == 'E' && !strncmp (modeltype+1, "vd", 2) &&
+	    0 == Option::get_int ("EVDPhase") &&
+	    2 != Option::get_int ("DiscreteMethod") &&
+	    (omegatyp_() == 1 || omegatyp_() == 2) &&
+	    !if_any_discrete && !vtraits && Trait::Number_Of() == 1)
+	{
+	    int any_ascer = 0;
+	    for (int iped = 0; iped < NumIncPED; iped++)
+	    {
+		if (NASCER[iped]) any_ascer = 1;
+	    }
+	    if (!any_ascer)
+	    {
+		DIFFER[0] = 1;
+		DIFFER[1] = 1;
+	    }
+	}
+
 // VMEAN and VVAR are now at the front of rarray (as for SEARCH)
 // (Note that FORTRAN has 1-based arrays, C has 0-based arrays, so these
 //  numbers are 1 less than they would need to be in FORTRAN.)
@@ -960,6 +988,7 @@ double ccsearch (const char* outfilename, int get_who, bool sampledata)
 
 // This is optima, the heart and soul of discrete traits analysis
 
+	Profile_Timer optima_timer (prof_optima);
 	optima_(&rarray[m1],&rarray[m2],&rarray[m3],&rarray[m4],&rarray[m5],
 		&rarray[m6],&rarray[m7],&rarray[m8],&rarray[m9],&rarray[m10],
 		&rarray[m11],&rarray[m12],&rarray[m13],&rarray[m14],
@@ -983,6 +1012,7 @@ double ccsearch (const char* outfilename, int get_who, bool sampledata)
 #endif
 		,1    // Trttype string length
                 );
+	optima_timer.stop ();
 
 	if (status == 0)
 	{
@@ -1171,6 +1201,7 @@ double ccsearch (const char* outfilename, int get_who, bool sampledata)
 
 // SEARCH is the heart and soul of fisher (quantitative trait)
 
+	Profile_Timer search_timer (prof_search);
 	search_ (&rarray[m1],&rarray[m2],&rarray[m3],&rarray[m4],&rarray[m5],
     extra, &rarray[m6], &rarray[m7], &rarray[m8], &rarray[m9],
     &rarray[m10], &rarray[m11], &rarray[m12], &rarray[m13], &rarray[m14],
@@ -1190,6 +1221,7 @@ double ccsearch (const char* outfilename, int get_who, bool sampledata)
 		 namelen_,          // length of modfil string
 		 bignamelen_        // length of updfil string
 	    );
+	search_timer.stop ();
 
 	if (status != 0 && status != 4)
 	{
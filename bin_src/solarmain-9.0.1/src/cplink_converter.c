@@ -1,5 +1,14 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "plinkio.h"
 #include "safelib.h"
 /*
@@ -17,136 +26,266 @@ static int count_chromosomes(struct pio_file_t * input, size_t n_snps){
 	return n_chromo;
 }
 */
-static void write_plink_data(struct pio_file_t * input, snp_t *  snp_data, const char * output_filename, const size_t start, \
+// Values returned by pio_next_row for each two bit .bed code (3 is missing)
+static const snp_t bed_code_value[4] = {0, 3, 1, 2};
+
+// Magic string opening files written with -binary (read by tablefile.cc)
+static const char plink_binary_magic[8] = {'S', 'O', 'L', 'A', 'R', 'G', 'B', '1'};
+
+struct plink_chunk_t {
+    size_t start;
+    size_t n_snps;
+    char * filename;
+};
+
+// The locus rows of a .bed file mapped into memory, so each output chunk
+// can decode its own loci independently of the others.
+struct bed_map_t {
+    void * base;
+    size_t size;
+    const unsigned char * rows;
+    size_t row_bytes;
+};
+
+static int map_bed_file(struct pio_file_t * input, struct bed_map_t * bed){
+    const size_t n_snps = input->bed_file.header.num_loci;
+    const size_t n_samples = input->bed_file.header.num_samples;
+    size_t header_bytes = 0;
+    if(input->bed_file.header.version == PIO_VERSION_100){
+        header_bytes = 3;
+    }else if(input->bed_file.header.version == PIO_VERSION_099){
+        header_bytes = 1;
+    }
+    bed->base = NULL;
+    bed->row_bytes = (n_samples + 3)/4;
+    if(input->bed_file.fp == NULL) return 0;
+    int fd = fileno(input->bed_file.fp);
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) return 0;
+    bed->size = file_stat.st_size;
+    if(bed->size == 0 || bed->size < header_bytes + n_snps*bed->row_bytes) return 0;
+    void * base = mmap(NULL, bed->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(base == MAP_FAILED) return 0;
+    madvise(base, bed->size, MADV_SEQUENTIAL);
+    bed->base = base;
+    bed->rows = (const unsigned char *) base + header_bytes;
+    return 1;
+}
+
+// Decodes loci [start, start + n_snps) into snp_data, one column of
+// n_samples values per locus.
+static void decode_loci(const struct bed_map_t * bed, const size_t start, const size_t n_snps,
+                        const size_t n_samples, snp_t * snp_data){
+    for(size_t snp = 0; snp < n_snps; snp++){
+        const unsigned char * row = bed->rows + (start + snp)*bed->row_bytes;
+        snp_t * column = snp_data + snp*n_samples;
+        for(size_t subject = 0; subject < n_samples; subject++){
+            column[subject] = bed_code_value[(row[subject >> 2] >> ((subject & 3) << 1)) & 3];
+        }
+    }
+}
+
+static int write_header_file(struct pio_file_t * input, const char * output_filename, const size_t start, const size_t n_snps){
+    char header_filename[strlen(output_filename) + 12];
+    sprintf(header_filename, "%s.header.csv", output_filename);
+    FILE * header_file = fopen(header_filename, "w");
+    if(header_file == NULL) return 1;
+    fprintf(header_file, "SNP,0,1,2\n");
+    struct pio_locus_t * locus;
+    for(size_t snp = start; snp < start + n_snps; snp++){
+        locus = bim_get_locus(&input->bim_file, snp);
+        fprintf(header_file,"snp_%s,%s%s,%s%s,%s%s\n", locus->name , locus->allele1 , locus->allele1 \
+                , locus->allele1, locus->allele2 ,  locus->allele2 , locus->allele2);
+    }
+    fclose(header_file);
+    return 0;
+}
+
+// Writes loci [start, start + n_snps) as csv.  snp_data holds the chunk's
+// loci, one column of n_samples values per locus.  Each row is assembled
+// in memory and written with a single fwrite.
+static int write_plink_data(struct pio_file_t * input, const snp_t *  snp_data, const char * output_filename, const size_t start, \
                             const size_t n_snps, const int bin_format, const int solar_format){
     const size_t n_samples = input->bed_file.header.num_samples;
     FILE * output_file = fopen(output_filename, "w");
+    if(output_file == NULL) return 1;
+    setvbuf(output_file, NULL, _IOFBF, 1 << 20);
+    if((bin_format || solar_format) && write_header_file(input, output_filename, start, n_snps)){
+        fclose(output_file);
+        return 1;
+    }
     fprintf(output_file, "id,fid,sex");
     struct pio_locus_t * locus;
+    for(size_t snp = start; snp < start + n_snps; snp++){
+        locus = bim_get_locus(&input->bim_file, snp);
+        fprintf(output_file,",snp_%s",locus->name);
+    }
+    fprintf(output_file, "\n");
+
+// Text written for each genotype value of each locus, with its leading comma
+    static const char * bin_text[4] = {",0", ",1", ",2", ","};
+    static const char * solar_text[4] = {",1/1", ",1/2", ",2/2", ","};
+    const char ** genotype_text = (const char **) malloc(4*n_snps*sizeof(char *));
+    size_t * genotype_length = (size_t *) malloc(4*n_snps*sizeof(size_t));
+    char * allele_text = NULL;
+    if(genotype_text == NULL || genotype_length == NULL){
+        free(genotype_text);
+        free(genotype_length);
+        fclose(output_file);
+        return 1;
+    }
+    size_t row_capacity = 0;
     if(bin_format || solar_format){
-        FILE * header_file;
-        char header_filename[strlen(output_filename) + 12];
-        sprintf(header_filename, "%s.header.csv", output_filename);
-        header_file = fopen(header_filename, "w");
-        fprintf(header_file, "SNP,0,1,2\n");
-        for(size_t snp = start; snp < start + n_snps; snp++){
-            locus = bim_get_locus(&input->bim_file, snp);
-            fprintf(output_file,",snp_%s",locus->name);
-            
-            fprintf(header_file,"snp_%s,%s%s,%s%s,%s%s\n", locus->name , locus->allele1 , locus->allele1 \
-                    , locus->allele1, locus->allele2 ,  locus->allele2 , locus->allele2);
+        const char ** text = bin_format ? bin_text : solar_text;
+        for(size_t snp = 0; snp < n_snps; snp++){
+            for(int value = 0; value < 4; value++){
+                genotype_text[4*snp + value] = text[value];
+                genotype_length[4*snp + value] = strlen(text[value]);
+            }
         }
-        fprintf(output_file, "\n");
-        fclose(header_file);
+        row_capacity = n_snps*strlen(text[1]);
     }else{
+        size_t allele_bytes = 0;
         for(size_t snp = start; snp < start + n_snps; snp++){
             locus = bim_get_locus(&input->bim_file, snp);
-            fprintf(output_file,",snp_%s",locus->name);
+            allele_bytes += 3*(strlen(locus->allele1) + strlen(locus->allele2)) + 9;
+        }
+        allele_text = (char *) malloc(allele_bytes + 1);
+        if(allele_text == NULL){
+            free(genotype_text);
+            free(genotype_length);
+            fclose(output_file);
+            return 1;
+        }
+        char * next_text = allele_text;
+        for(size_t snp = 0; snp < n_snps; snp++){
+            locus = bim_get_locus(&input->bim_file, start + snp);
+            const char * allele_pairs[3][2] = {{locus->allele1, locus->allele1},
+                                              {locus->allele1, locus->allele2},
+                                              {locus->allele2, locus->allele2}};
+            size_t longest = 1;
+            for(int value = 0; value < 3; value++){
+                int length = sprintf(next_text, ",%s/%s", allele_pairs[value][0], allele_pairs[value][1]);
+                genotype_text[4*snp + value] = next_text;
+                genotype_length[4*snp + value] = length;
+                if(length > longest) longest = length;
+                next_text += length + 1;
+            }
+            genotype_text[4*snp + 3] = ",";
+            genotype_length[4*snp + 3] = 1;
+            row_capacity += longest;
         }
-        fprintf(output_file, "\n");
     }
+
     struct pio_sample_t * sample;
+    size_t id_capacity = 0;
+    for(size_t subject_index = 0; subject_index < n_samples; subject_index++){
+        sample = fam_get_sample(&input->fam_file, subject_index);
+        size_t id_length = strlen(sample->iid) + strlen(sample->fid);
+        if(id_length > id_capacity) id_capacity = id_length;
+    }
+    char * row = (char *) malloc(row_capacity + id_capacity + 8);
+    if(row == NULL){
+        free(allele_text);
+        free(genotype_text);
+        free(genotype_length);
+        fclose(output_file);
+        return 1;
+    }
     for(size_t subject_index = 0; subject_index < n_samples; subject_index++){
         sample = fam_get_sample(&input->fam_file, subject_index);
-       
+        const char * sex = "";
         if(sample->sex == PIO_MALE){
-            fprintf(output_file,"%s,%s,M",sample->iid, sample->fid);
+            sex = "M";
         }else if(sample->sex == PIO_FEMALE){
-            fprintf(output_file,"%s,%s,F",sample->iid, sample->fid);
-        }else{
-            fprintf(output_file,"%s,%s,",sample->iid, sample->fid);
+            sex = "F";
         }
-     
-        snp_t value;
-        if(bin_format){
-            for(size_t snp = start; snp < start + n_snps; snp++){
-                value = snp_data[subject_index + snp*n_samples];
-                if(value != 3)
-                    fprintf(output_file,",%u",(unsigned)value);
-                else
-                    fprintf(output_file,",");
-            }
-        }else if(solar_format){
-		for(size_t snp = start; snp < start + n_snps; snp++){
-		value = snp_data[subject_index + snp*n_samples];	
-		if(value != 3){
-			switch(value){
-				case 0:
-					fprintf(output_file,",1/1");
-					break;
-				case 1: 
-					fprintf(output_file,",1/2");
-                                        break;
-				case 2:
-					fprintf(output_file,",2/2");
-                                        break;	
-				}
-			}else{
-
-			 fprintf(output_file,",");
-			}
-			}		
-           }else{
-            for(size_t snp = start; snp < start + n_snps; snp++){
-                value = snp_data[subject_index + snp*n_samples];
-                if(value != 3){
-                    locus = bim_get_locus(&input->bim_file, snp);
-                    switch(value){
-                        case 0:
-                            fprintf(output_file, ",%s/%s",locus->allele1, locus->allele1);
-                            break;
-                        case 1:
-                            fprintf(output_file, ",%s/%s",locus->allele1, locus->allele2);
-                            break;
-                        case 2:
-                            fprintf(output_file, ",%s/%s",locus->allele2, locus->allele2);
-                            break;
-                        default:
-                            fprintf(output_file, ",");
-                            break;
-                    }
-                }else{
-                    fprintf(output_file, ",");
-                }
-            }
+        char * end = row + sprintf(row, "%s,%s,%s", sample->iid, sample->fid, sex);
+        const snp_t * value = snp_data + subject_index;
+        for(size_t snp = 0; snp < n_snps; snp++, value += n_samples){
+            const size_t text_index = 4*snp + *value;
+            memcpy(end, genotype_text[text_index], genotype_length[text_index]);
+            end += genotype_length[text_index];
         }
-        
-        fprintf(output_file, "\n");
-        
+        *end++ = '\n';
+        fwrite(row, 1, end - row, output_file);
     }
-    
-    fclose(output_file);
+    free(row);
+    free(allele_text);
+    free(genotype_text);
+    free(genotype_length);
+    return fclose(output_file) != 0;
 }
 
-int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename, const size_t max_per_file, const int bin_format,const int solar_format, const int per_chromo, char ** errmsg){
-    const size_t n_snps = input->bed_file.header.num_loci;
+// Writes loci [start, start + n_snps) in the column addressable binary
+// format read by tablefile.cc.  All integers are 64 bit:
+//     "SOLARGB1" n_samples n_snps sample_bytes name_bytes
+//     iid\0fid\0sex\0 for each sample
+//     snp_<name>\0 for each locus
+//     n_samples genotype bytes for each locus: 0, 1, 2 or 3 if missing
+// The genotype values are those written by -bin, so the .header.csv file
+// written with -bin is written here too.
+static int write_plink_binary(struct pio_file_t * input, const snp_t * snp_data, const char * output_filename, const size_t start, \
+                              const size_t n_snps){
     const size_t n_samples = input->bed_file.header.num_samples;
-    
-    snp_t * snp_data = (snp_t*)calloc(n_snps*n_samples, sizeof(snp_t));
-    if(snp_data == NULL){
-        errmsg = "Could not allocate required memory";
-        return 1;
+    if(write_header_file(input, output_filename, start, n_snps)) return 1;
+    FILE * output_file = fopen(output_filename, "wb");
+    if(output_file == NULL) return 1;
+    setvbuf(output_file, NULL, _IOFBF, 1 << 20);
+    struct pio_sample_t * sample;
+    struct pio_locus_t * locus;
+    int64_t sizes[4] = {(int64_t) n_samples, (int64_t) n_snps, 0, 0};
+    for(size_t subject_index = 0; subject_index < n_samples; subject_index++){
+        sample = fam_get_sample(&input->fam_file, subject_index);
+        sizes[2] += strlen(sample->iid) + strlen(sample->fid) + 4;
+        if(sample->sex != PIO_MALE && sample->sex != PIO_FEMALE) sizes[2]--;
     }
-    snp_t * buffer = (snp_t*)calloc(n_samples, sizeof(snp_t));
-    if(buffer == NULL){
-        free(snp_data);
-        errmsg = "Could not allocate required memory";
-        return 1;
+    for(size_t snp = start; snp < start + n_snps; snp++){
+        locus = bim_get_locus(&input->bim_file, snp);
+        sizes[3] += strlen(locus->name) + 5;
     }
-    snp_t * buffer_ptr;
-    snp_t * snp_data_ptr = snp_data;
-    for(size_t snp = 0 ; snp < n_snps; snp++){
-        pio_next_row(input, buffer);
-        buffer_ptr = buffer;
-        for(size_t row = 0; row < n_samples; row++){
-            (*snp_data_ptr++) = (*buffer_ptr++);
+    fwrite(plink_binary_magic, 1, sizeof(plink_binary_magic), output_file);
+    fwrite(sizes, sizeof(int64_t), 4, output_file);
+    for(size_t subject_index = 0; subject_index < n_samples; subject_index++){
+        sample = fam_get_sample(&input->fam_file, subject_index);
+        const char * sex = "";
+        if(sample->sex == PIO_MALE){
+            sex = "M";
+        }else if(sample->sex == PIO_FEMALE){
+            sex = "F";
         }
+        fprintf(output_file, "%s%c%s%c%s%c", sample->iid, '\0', sample->fid, '\0', sex, '\0');
+    }
+    for(size_t snp = start; snp < start + n_snps; snp++){
+        locus = bim_get_locus(&input->bim_file, snp);
+        fprintf(output_file, "snp_%s%c", locus->name, '\0');
     }
-    free(buffer);
+    fwrite(snp_data, sizeof(snp_t), n_snps*n_samples, output_file);
+    return fclose(output_file) != 0;
+}
+
+static void add_chunk(struct plink_chunk_t ** chunks, size_t * n_chunks, size_t * capacity, const size_t start, \
+                      const size_t n_snps, const char * filename){
+    if(*n_chunks == *capacity){
+        *capacity = *capacity ? 2*(*capacity) : 64;
+        *chunks = (struct plink_chunk_t *) realloc(*chunks, (*capacity)*sizeof(struct plink_chunk_t));
+    }
+    (*chunks)[*n_chunks].start = start;
+    (*chunks)[*n_chunks].n_snps = n_snps;
+    (*chunks)[*n_chunks].filename = strdup(filename);
+    (*n_chunks)++;
+}
+
+// Splits the loci into output files by chromosome and/or max_per_file
+static size_t plan_chunks(struct pio_file_t * input, const char * output_basename, const size_t max_per_file, \
+                          const int per_chromo, const char * extension, struct plink_chunk_t ** chunks){
+    const size_t n_snps = input->bed_file.header.num_loci;
+    size_t n_chunks = 0;
+    size_t capacity = 0;
+    char output_filename[strlen(output_basename) + 64];
+    *chunks = NULL;
     struct pio_locus_t * locus;
     if(per_chromo && max_per_file == 0){
-       // locus = bim_get_locus(&input->bim_file, 0);
-       // unsigned char current_chromosome = locus->chromosome;
         size_t start = 0;
         size_t batch_size;
         size_t snp_index;
@@ -162,13 +301,10 @@ int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename
                 }
             }
             batch_size = snp_index - start;
-            char output_filename[strlen(output_basename) + 12];
-            sprintf(output_filename, "%s.chr%u.csv", output_basename, (unsigned) current_chromosome);
-            write_plink_data(input, snp_data, (const char *)output_filename, start, \
-                             batch_size,  bin_format, solar_format);
+            sprintf(output_filename, "%s.chr%u.%s", output_basename, (unsigned) current_chromosome, extension);
+            add_chunk(chunks, &n_chunks, &capacity, start, batch_size, output_filename);
             start += batch_size;
         }
-        
     }else if(per_chromo){
         size_t start = 0;
         size_t batch_size;
@@ -197,10 +333,9 @@ int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename
                 next_file_index = 0;
                 batch_size = snp_index - start;
             }
-            char output_filename[strlen(output_basename) + 20];
-            sprintf(output_filename, "%s.chr%u.%u.csv", output_basename, (unsigned) current_chromosome, file_index);
-            write_plink_data(input, snp_data, (const char *)output_filename, start, \
-                             batch_size,  bin_format, solar_format);
+            sprintf(output_filename, "%s.chr%u.%u.%s", output_basename, (unsigned) current_chromosome, \
+                    (unsigned) file_index, extension);
+            add_chunk(chunks, &n_chunks, &capacity, start, batch_size, output_filename);
             start += batch_size;
         }
     }else if(max_per_file != 0){
@@ -213,23 +348,101 @@ int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename
             }else{
                 batch_size = n_snps - start;
             }
-            
-
-            char output_filename[strlen(output_basename) + 16];
-            sprintf(output_filename, "%s.%u.csv", output_basename,  file_index++);
-            write_plink_data(input, snp_data, (const char *)output_filename, start, \
-                             batch_size,  bin_format,solar_format);
+            sprintf(output_filename, "%s.%u.%s", output_basename, (unsigned) file_index++, extension);
+            add_chunk(chunks, &n_chunks, &capacity, start, batch_size, output_filename);
             start += batch_size;
         }
     }else{
-        char output_filename[strlen(output_basename) + 6];
-        sprintf(output_filename, "%s.csv", output_basename);
-        write_plink_data(input, snp_data, (const char * )output_filename, 0, n_snps, bin_format, solar_format);
+        sprintf(output_filename, "%s.%s", output_basename, extension);
+        add_chunk(chunks, &n_chunks, &capacity, 0, n_snps, output_filename);
+    }
+    return n_chunks;
+}
+
+// Each output file is decoded and written by one thread.  When the .bed file
+// can be mapped, each thread decodes only its own loci; otherwise all loci
+// are read with pio_next_row first, as before.
+int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename, const size_t max_per_file, const int bin_format, \
+                         const int solar_format, const int binary_format, const int per_chromo, const int n_threads, char ** errmsg){
+    static char error_message[1100];
+    const size_t n_snps = input->bed_file.header.num_loci;
+    const size_t n_samples = input->bed_file.header.num_samples;
+
+    struct bed_map_t bed;
+    snp_t * snp_data = NULL;
+    if(!map_bed_file(input, &bed)){
+        snp_data = (snp_t*)calloc(n_snps*n_samples, sizeof(snp_t));
+        if(snp_data == NULL){
+            *errmsg = "Could not allocate required memory";
+            return 1;
+        }
+        for(size_t snp = 0 ; snp < n_snps; snp++){
+            pio_next_row(input, snp_data + snp*n_samples);
+        }
+    }
+
+    struct plink_chunk_t * chunks;
+    const size_t n_chunks = plan_chunks(input, output_basename, max_per_file, per_chromo, \
+                                        binary_format ? "sgb" : "csv", &chunks);
+    int threads = n_threads;
+    if(threads < 1){
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#else
+        threads = 1;
+#endif
+    }
+    const char * failed_filename = NULL;
+    int out_of_memory = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+    for(size_t chunk = 0; chunk < n_chunks; chunk++){
+        const snp_t * chunk_data;
+        snp_t * decoded = NULL;
+        if(snp_data){
+            chunk_data = snp_data + chunks[chunk].start*n_samples;
+        }else{
+            decoded = (snp_t *) malloc(chunks[chunk].n_snps*n_samples*sizeof(snp_t));
+            if(decoded == NULL){
+#pragma omp atomic write
+                out_of_memory = 1;
+                continue;
+            }
+            decode_loci(&bed, chunks[chunk].start, chunks[chunk].n_snps, n_samples, decoded);
+            chunk_data = decoded;
+        }
+        int status;
+        if(binary_format){
+            status = write_plink_binary(input, chunk_data, chunks[chunk].filename, chunks[chunk].start, chunks[chunk].n_snps);
+        }else{
+            status = write_plink_data(input, chunk_data, chunks[chunk].filename, chunks[chunk].start, \
+                                      chunks[chunk].n_snps, bin_format, solar_format);
+        }
+        free(decoded);
+        if(status){
+#pragma omp critical
+            {
+                if(failed_filename == NULL) failed_filename = chunks[chunk].filename;
+            }
+        }
     }
-    
+
+    int result = 0;
+    if(out_of_memory){
+        *errmsg = "Could not allocate required memory";
+        result = 1;
+    }else if(failed_filename){
+        snprintf(error_message, sizeof(error_message), "Error writing output file %s", failed_filename);
+        *errmsg = error_message;
+        result = 1;
+    }
+    for(size_t chunk = 0; chunk < n_chunks; chunk++){
+        free(chunks[chunk].filename);
+    }
+    free(chunks);
+    if(bed.base) munmap(bed.base, bed.size);
     free(snp_data);
-    
-    return 0;
+
+    return result;
 }
 /*
 void read_and_write_to_csv(struct pio_file_t  * input, const char* output_basename,
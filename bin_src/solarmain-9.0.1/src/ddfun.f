@@ -26,6 +26,7 @@ c  returns the likelihood function for a set of pedigrees
       sqr2pi = 0.3989422804014
       udiagset = .false.
       ierr = 0
+      call profbeg (7)
 
 c  check for pedlike option
 
@@ -43,6 +44,7 @@ c  use Jeff's discrete code if requested
       if (method.eq.2.0) then
          call fun_mehd (par,f,npar,vardata,male,nvar,ntot,nind,
      &                  nascer,nped,ncumind,maxpeo)
+         call profend (7)
          return
       endif
 
@@ -87,6 +89,14 @@ c
       biglik = 0.0
       biglik_ascer = 0.0
 c
+c**   analytic derivatives (option AnalyticDeriv) are summed by evdscorec
+c
+      if (differ(1)) then
+         do i = 1, npar
+            df(i) = 0.0
+         enddo
+      endif
+c
 c**   calculate likelihood for each pedigree
 c
       do 20 i = 1, nped
@@ -176,6 +186,10 @@ C            call evdlik(nind(i),maxpeo,mu,cov,lnl(i),par(4),eval,evec)
      &     vardata(1,ifirstper),nvar,evdphase,
      &     male,vtraits,ntot,nind,nascer,nped,ncumind,ierr)
             biglik = biglik + lnl(i)
+            if (differ(1)) then
+               call evdscorec (i,maxpeo,nind(i),mu,cov,par,npar,
+     &              vardata,nvar,ntot,male,ifirstper,df)
+            endif
 C          print *,"Current likelihood is ",lnl(i)
          else
             call mvncdf(nind(i),maxpeo,affect,disc,mu,cov,lnl(i))
@@ -281,5 +295,6 @@ c**   write results to pedlike.dat if required
          close (34)
       end if
 
+      call profend (7)
       return
       end
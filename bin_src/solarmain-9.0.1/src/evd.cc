@@ -12,17 +12,40 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <Eigen/Dense>
 #include "solar.h"
 
-static int Max_allocated_index = -1;
-static double** Eval = 0;
-static double** Evec = 0;
-static int** ID = 0;
-static int* N = 0;
-static int Max_valid_index = -1;
+// EVD storage is one arena for all pedigrees.  Eigenvalues, eigenvectors
+// and IBDIDs of each pedigree (proband sets are stacked after the
+// pedigrees, as ddfun numbers them) are packed into single arrays, located
+// through the offset table EVD_Peds.  The arena is built once per
+// maximization and kept between maximizations while the sample is
+// unchanged.
+
+struct EVD_Ped
+{
+    int n;            // real people (not person-traits)
+    size_t eval_offset;
+    size_t evec_offset;
+    size_t id_offset;
+};
+
+static std::vector<EVD_Ped> EVD_Peds;
+static std::vector<double> EVD_Eval;
+static std::vector<double> EVD_Evec;
+static std::vector<int> EVD_ID;
+static bool EVD_Valid = false;
 static bool PM_valid = false;
 static bool PM2_valid = false;
 
+// Average information accumulated by evdscorec over the pedigrees of the
+// current likelihood evaluation (column-major, npar by npar)
+
+static std::vector<double> EVD_AI;
+static int EVD_AI_npar = 0;
+
 // Callthrough interfaces to Fortran
 
 extern "C" void evdlik_ (int* n, int* max, double* mu, double* cov, 
@@ -35,6 +58,13 @@ extern "C" void tred2_ (int *max, int* n, double* tphi2, double* eval,
 extern "C" void tql2_ (int* max, int* n, double* eval, double* evali,
 		       double* evec, int* ierr);
 
+extern "C" double dmean_ (int* per, int* trait, double* par, int* npar,
+			  double* vardata, int* nvar, int* ntot, int* male);
+
+extern "C" double dcovar_ (int* peri, int* perj, int* traiti, int* traitj,
+			   double* par, int* npar, double* vardata, int* nvar,
+			   int* ntot, int* malei, int* malej);
+
 
 // Internal interface
 extern "C" void evdout (int* iped, double* vardata, int* male, int* vtraits,
@@ -57,11 +87,37 @@ extern "C" int EVDCmd (ClientData clientData, Tcl_Interp *interp,
 }
 
 
+// Univariate EVD loglikelihood for one pedigree, as in evdlik.f, with the
+// eigenvector product done as one vectorized matrix-vector product.
+
+static double evd_loglike (int n, int maxpeo, const double* mu,
+			   const double* cov, double h2, const double* eval,
+			   const double* evec)
+{
+    Eigen::Map<const Eigen::MatrixXd> Evec (evec, n, n);
+    Eigen::VectorXd sd (n);
+    Eigen::VectorXd z (n);
+    for (int i = 0; i < n; i++)
+    {
+	sd(i) = sqrt (cov[i + (size_t) maxpeo*i]);
+	z(i) = mu[i] / sd(i);
+    }
+    Eigen::VectorXd tau = Evec.transpose() * z;
+    double loglike = 0;
+    for (int i = 0; i < n; i++)
+    {
+	double dp = eval[i]*h2 + 1 - h2;
+	double t = tau(i) / sqrt (dp);
+	loglike = loglike - .5*t*t - .5*log (dp) - log (sd(i));
+    }
+    return loglike;
+}
+
 // evdlikc is the EVD routine still called by ddfun
 // to calculate a likelihood for a pedigree using EVD.  If the
-// EVD matrices have not yet been created for this pedigree,
-// they are created now.  If this is EVDPhase 1, write output file
-// instead of computing likelihoods
+// EVD matrices have not yet been created for this maximization,
+// they are created now for all pedigrees.  If this is EVDPhase 1,
+// write output file instead of computing likelihoods
 
 extern "C" void evdlikc_ (int* iped, int* maxpeo, int* n,
 			  double* mu, double* cov, double* loglike, 
@@ -71,28 +127,170 @@ extern "C" void evdlikc_ (int* iped, int* maxpeo, int* n,
 			  int* ncumind, int* ierr)
 {
     int zindex = *iped - 1;
-    if (zindex > Max_valid_index)
+    if (!EVD_Valid)
     {
-	EVD::Make_Matrix (zindex,maxpeo,n,mu,vardata,nvar,ierr);
-	if (*ierr)
+
+// vardata is offset to the first person of this pedigree; recover base
+
+	int ifirstper;
+	if (*iped <= *nped)
 	{
-	    fprintf (stderr, "tql2 returned ierr=%d for pedigree %d",
-		     *ierr,*iped);
-	    throw Safe_Error_Return ("EVD Failed in tql2");
+	    ifirstper = ncumind[*iped-1] + 1;
+	}
+	else
+	{
+	    int i = *iped - *nped;
+	    ifirstper = ncumind[i] + 1 - nascer[i-1];
 	}
+	EVD::Make_Matrices (vardata - (size_t)(*nvar)*(ifirstper-1), nvar,
+			    nind, nascer, nped, ncumind);
     }
-    double *eval = Eval[zindex];
-    double *evec =  Evec[zindex];
+    const EVD_Ped& ped = EVD_Peds[zindex];
+    double *eval = &EVD_Eval[ped.eval_offset];
+    double *evec = &EVD_Evec[ped.evec_offset];
 
     if (*evdphase==0)
     {
-	evdlik_ (n, maxpeo, mu, cov, loglike, h2, eval, evec);
+	if (*n == ped.n)
+	{
+	    *loglike = evd_loglike (*n, *maxpeo, mu, cov, *h2, eval, evec);
+	}
+	else
+	{
+	    evdlik_ (n, maxpeo, mu, cov, loglike, h2, eval, evec);
+	}
     }
     else
     {
 	evdout (iped,vardata,male,vtraits,nvar,ntot,nind,nascer,nped,ncumind,
 		cov);
-	EVD::Flush();  // EVD storage no longer needed
+    }
+}
+
+
+// evdscorec is called by ddfun after evdlikc when analytic derivatives
+// are enabled (option AnalyticDeriv).  It subtracts the exact score of
+// this pedigree from df (ddfun minimizes -loglike) and adds the pedigree's
+// average information to EVD_AI, which evdhessc returns as the Hessian.
+//
+// With z = mu/sd and tau = Evec' z, the pedigree covariance is
+// S^.5 Evec D Evec' S^.5 where S is the diagonal of cov and
+// D = eval*h2 + 1 - h2, so the eigenbasis serves as the square-root factor
+// of the covariance.  Partials of each person's mean and variance are
+// taken by central differences of dmean and dcovar, which is exact for
+// the linear mean and quadratic variance of the standard models; h2
+// (par 4, as in evdlikc) also enters D directly.  vardata and male are
+// the full arrays, ifirstper the first person of this pedigree.
+
+extern "C" void evdscorec_ (int* iped, int* maxpeo, int* n, double* mu,
+			    double* cov, double* par, int* npar,
+			    double* vardata, int* nvar, int* ntot, int* male,
+			    int* ifirstper, double* df)
+{
+    int np = *npar;
+    if (*iped == 1)
+    {
+	EVD_AI.assign ((size_t) np*np, 0.0);
+	EVD_AI_npar = np;
+    }
+    int nn = *n;
+    if (nn == 0) return;
+
+    const EVD_Ped& ped = EVD_Peds[*iped-1];
+    Eigen::Map<const Eigen::MatrixXd> Evec (&EVD_Evec[ped.evec_offset],
+					    nn, nn);
+    Eigen::Map<const Eigen::VectorXd> Eval (&EVD_Eval[ped.eval_offset], nn);
+    double h2 = par[3];
+
+    Eigen::VectorXd sd (nn);
+    Eigen::VectorXd z (nn);
+    for (int i = 0; i < nn; i++)
+    {
+	sd(i) = sqrt (cov[i + (size_t) *maxpeo*i]);
+	z(i) = mu[i] / sd(i);
+    }
+    Eigen::VectorXd dp = (Eval.array()*h2 + 1 - h2).matrix();
+    Eigen::VectorXd tau = Evec.transpose() * z;
+    Eigen::VectorXd q = (tau.array() / dp.array()).matrix();
+    Eigen::VectorXd Eq = Evec * q;
+
+// Per-parameter partials, rotated into the eigenbasis
+
+    Eigen::MatrixXd mhat (nn, np);
+    Eigen::MatrixXd what (nn, np);
+    Eigen::VectorXd dmu (nn);
+    Eigen::VectorXd a (nn);
+    Eigen::VectorXd ddp (nn);
+    int trait = 1;
+    for (int ip = 0; ip < np; ip++)
+    {
+	double p = par[ip];
+	double h = 1.0e-4 * (fabs (p) > 1.0 ? fabs (p) : 1.0);
+	for (int i = 0; i < nn; i++)
+	{
+	    dmu(i) = 0;
+	    a(i) = 0;
+	}
+	for (int side = 1; side >= -1; side -= 2)
+	{
+	    par[ip] = p + side*h;
+	    for (int i = 0; i < nn; i++)
+	    {
+		int per = *ifirstper + i;
+		int* pmale = &male[per-1];
+		dmu(i) += side * dmean_ (&per, &trait, par, npar, vardata,
+					  nvar, ntot, pmale);
+		a(i) += side * dcovar_ (&per, &per, &trait, &trait, par, npar,
+					vardata, nvar, ntot, pmale, pmale);
+	    }
+	}
+	par[ip] = p;
+	for (int i = 0; i < nn; i++)
+	{
+	    dmu(i) = dmu(i) / (2*h);
+	    a(i) = a(i) / (2*h) / (2*sd(i)*sd(i));
+	}
+	if (ip == 3)
+	{
+	    ddp = (Eval.array() - 1).matrix();
+	}
+	else
+	{
+	    ddp.setZero();
+	}
+
+	Eigen::VectorXd az = Evec.transpose() * (a.array()*z.array()).matrix();
+	Eigen::VectorXd aq = Evec.transpose() * (a.array()*Eq.array()).matrix();
+	mhat.col(ip) = Evec.transpose() * (dmu.array()/sd.array()).matrix();
+	what.col(ip) = az + (dp.array()*aq.array()).matrix()
+	    + (ddp.array()*q.array()).matrix();
+
+	double score = mhat.col(ip).dot(q) + .5*q.dot(what.col(ip))
+	    - a.sum() - .5*(ddp.array()/dp.array()).sum();
+	df[ip] -= score;
+    }
+
+// Average information: mhat' D^-1 mhat + .5 what' D^-1 what
+
+    Eigen::VectorXd rdp = dp.cwiseInverse();
+    Eigen::Map<Eigen::MatrixXd> AI (&EVD_AI[0], np, np);
+    AI += mhat.transpose() * rdp.asDiagonal() * mhat;
+    AI += .5 * (what.transpose() * rdp.asDiagonal() * what);
+}
+
+// evdhessc returns the average information accumulated by evdscorec for
+// the last likelihood evaluation.  Called from hessin.
+
+extern "C" void evdhessc_ (double* hess, int* npar)
+{
+    int np = *npar;
+    for (int j = 0; j < np; j++)
+    {
+	for (int i = 0; i < np; i++)
+	{
+	    hess[i + (size_t) np*j] = (np == EVD_AI_npar) ?
+		EVD_AI[i + (size_t) np*j] : 0.0;
+	}
     }
 }
 
@@ -166,8 +364,8 @@ extern "C" void evdout (int* iped, double* vardata, int* male, int* vtraits,
     ifirstper = ncumind[ped]+1;
     ni = ncumind[ped+1]-ncumind[ped];
     int lastper = ncumind[ped+1];
-    double* eigenvec = Evec[ped];
-    double* eigenval = Eval[ped];
+    double* eigenvec = &EVD_Evec[EVD_Peds[ped].evec_offset];
+    double* eigenval = &EVD_Eval[EVD_Peds[ped].eval_offset];
 
     int idindex = ntraits;
     int covindex = ntraits + 2;
@@ -406,6 +604,7 @@ extern "C" void evdout (int* iped, double* vardata, int* male, int* vtraits,
 extern "C" void evdtrap_ (int *maxibdid)
 {
     char buf[126];
+    EVD::Flush();  // EVD storage no longer needed after phase 1 output
     sprintf (buf,"Trap EVD Phase 2  maxibdid is %d",*maxibdid);
     throw Safe_Error_Return (buf);
 }
@@ -420,33 +619,29 @@ void EVD::Reset ()
 {
     bool premax = verbose ("PREMAX");
     if (premax) printf ("**** EVD reset\n");
-    Max_valid_index = -1;
+    EVD_Valid = false;
     PM_valid = false;
     PM2_valid = false;
 }
 
 void EVD::Flush()
 {
-    for (int i = 0; i <= Max_allocated_index; i++)
-    {
-	if (Eval && Eval[i]) free (Eval[i]);
-	if (Evec && Evec[i]) free (Evec[i]);
-	if (ID && ID[i]) free (ID[i]);
-    }
-    if (Eval) {free (Eval); Eval=0;}
-    if (Evec) {free (Evec); Evec=0;}
-    if (ID) {free (ID); ID=0;}
-    if (N) {free (N); N=0;}
-    Max_allocated_index = -1;
+    std::vector<EVD_Ped>().swap (EVD_Peds);
+    std::vector<double>().swap (EVD_Eval);
+    std::vector<double>().swap (EVD_Evec);
+    std::vector<int>().swap (EVD_ID);
     EVD::Reset();
 }
 
-void EVD::Make_Matrix (int zindex, int* maxpeo, int* n,
-                       double* mu, double* vardata,
-		       int* nvar, int* ierr)
+// Make_Matrices builds or validates the eigenbases of all pedigrees at the
+// start of a maximization.  vardata is the full data array as seen by
+// ddfun.  Pedigrees whose IBDIDs match the previous arena are copied;
+// the others are decomposed in parallel.
+
+void EVD::Make_Matrices (double* vardata, int* nvar, int* nind, int* nascer,
+			 int* nped, int* ncumind)
 {
     bool premax  = verbose ("PREMAX");  // 0x80000
-    int maxpeon = *n;
 
 // get offset to ibdid position within each vardata record
 // univariate: trait,ibdid,proband/famid,
@@ -454,13 +649,8 @@ void EVD::Make_Matrix (int zindex, int* maxpeo, int* n,
 
     int ntraits = Trait::Number_Of();
     int idpos = ntraits;
-    if (ntraits>1)
-    {
-	maxpeon = maxpeon / ntraits;
-    }
 
     bool samplesame = (1==Option::get_int ("SampleSameTrustMe"));
-    bool needid = true;
 
 // SampleSameTrustMe eliminates all sample testing...not recommended anymore
 // Sample testing is now based on ID test, this is N and not N*N comparison as
@@ -470,202 +660,152 @@ void EVD::Make_Matrix (int zindex, int* maxpeo, int* n,
 
     bool dontallows = (1==Option::get_int ("DontAllowSampleChange"));
 
-    if (premax) printf ("**** Max valid index is %d\n",Max_valid_index);
-
     Matrix *pm = Matrix::find("phi2");
     if (!pm) {
 	error ("Didn't get phi2 matrix");
     }
 
-// Make root matrices if not present
-    if (!Eval)
+// Pedigrees are zindex 0..nped-1, proband sets nped..2*nped-1
+// For bi/multivariate traits:
+//   subsequent real persons are nt apart
+//   fully balanced assumption for evd
+//   n is the size of arrays, or real people, not the "person-traits"
+
+    int npeds = 2 * *nped;
+    std::vector<EVD_Ped> peds (npeds);
+    std::vector<int> first (npeds);
+    size_t neval = 0;
+    size_t nevec = 0;
+    for (int z = 0; z < npeds; z++)
     {
-	Eval = (double**) Calloc (1, sizeof(double*));
-	Evec = (double**) Calloc (1, sizeof(double*));
-	if (needid) ID = (int**) Calloc (1, sizeof(int*));
-	N = (int*) Calloc(1,sizeof(int));
+	int count;
+	if (z < *nped)
+	{
+	    first[z] = ncumind[z];
+	    count = nind[z];
+	}
+	else
+	{
+	    int i = z - *nped;
+	    first[z] = ncumind[i+1] - nascer[i];
+	    count = nascer[i];
+	}
+	peds[z].n = (ntraits>1) ? count / ntraits : count;
+	peds[z].eval_offset = neval;
+	peds[z].id_offset = neval;
+	peds[z].evec_offset = nevec;
+	neval += peds[z].n;
+	nevec += (size_t) peds[z].n * peds[z].n;
     }
 
-// Reallocate root matrices to required size
-    bool new_matrix_needed = false;
-    if (zindex > Max_allocated_index)
-   {
-       if (premax) printf ("**** Reallocating EVD matrices to zindex %d\n");
-	new_matrix_needed = true;
-	Eval = (double**) 
-	    realloc (Eval, (zindex+1)*sizeof(double*));
-	Evec = (double**) 
-	    realloc (Evec, (zindex+1)*sizeof(double*));
-	if (needid)
-	    ID = (int**) 
-		realloc (ID, (zindex+1)*sizeof(int*));
-	N = (int*) realloc (N, (zindex+1)*sizeof(int));
-	for (int i = Max_allocated_index+1; i <= zindex; i++)
+    std::vector<double> eval_arena (neval);
+    std::vector<double> evec_arena (nevec);
+    std::vector<int> id_arena (neval);
+    for (int z = 0; z < npeds; z++)
+    {
+	for (int i = 0; i < peds[z].n; i++)
 	{
-	    Eval[i] = 0;
-	    Evec[i] = 0;
-	    if (needid) ID[i] = 0;
-	    N[i] = 0;
+	    int idindex = idpos + (*nvar)*(first[z] + i*ntraits);
+	    id_arena[peds[z].id_offset + i] = (int) vardata[idindex];
 	}
     }
-    else
-    {
 
-// We have already allocated matrices for this pedigree index
-// First check if matrix if valid (created since the beginning of current
-//   maximization)
-// Next check if existing matrices are still valid or need to be change
-// First check size, if size is different, no need to check further
-// If sizes match, check all ID's
+// Reuse eigenbases from the previous arena where the pedigree is unchanged
 
-	if (Max_valid_index < zindex)
+    std::vector<char> needed (npeds, 1);
+    int nrebuilt = 0;
+    for (int z = 0; z < npeds; z++)
+    {
+	const EVD_Ped& ped = peds[z];
+	if (z < (int) EVD_Peds.size())
 	{
-	    if (premax) printf ("Testing pedigree %d\n",zindex);
-	    if (N[zindex] != maxpeon)
+	    const EVD_Ped& old = EVD_Peds[z];
+	    if (old.n == ped.n)
 	    {
-		if (premax) printf ("Matrix size wrong for %d\n",zindex);
-		new_matrix_needed = true;
-		if (samplesame)
+		if (samplesame ||
+		    !memcmp (&EVD_ID[old.id_offset], &id_arena[ped.id_offset],
+			     ped.n * sizeof(int)))
 		{
-		    throw Safe_Error_Return 
-		       ("Matrix size changed so option SampleSame is invalid");
+		    needed[z] = 0;
+		    std::copy (EVD_Eval.begin() + old.eval_offset,
+			       EVD_Eval.begin() + old.eval_offset + ped.n,
+			       eval_arena.begin() + ped.eval_offset);
+		    std::copy (EVD_Evec.begin() + old.evec_offset,
+			       EVD_Evec.begin() + old.evec_offset +
+			       (size_t) ped.n * ped.n,
+			       evec_arena.begin() + ped.evec_offset);
 		}
-	    }
-	    else
-	    {
-
-// Matrix comparison should only be done up to nxn most likely
-// but how does Fortran store them ???
-
-		if (!samplesame)
+		else if (premax)
 		{
-		    if (premax) 
-			printf ("Matrix size correct, now testing IBDIDs\n", 
-				zindex);
-		    for (int i = 0; i < maxpeon; i++)
-		    {
-			int idindex = idpos + ((*nvar)*i);
-			int ibdid = (int) vardata[idindex];
-//		    printf ("IBDID[%d] = %d\n",idindex,ibdid);
-			int lastid = ID[zindex][i];
-			if (ibdid != lastid)
-			{
-			    if (premax)
-			    {
-				printf ("**** ID DIFFERS in ped %d\n",zindex+1);
-				printf ("**** %d, %d\n",ibdid,lastid);	
-			    }
-			    new_matrix_needed = true;
-			    break;
-			}
-		    }
+		    printf ("**** ID DIFFERS in ped %d\n",z+1);
 		}
 	    }
-	    if (new_matrix_needed)
+	    else
 	    {
-		if (dontallows)
+		if (premax) printf ("Matrix size wrong for %d\n",z);
+		if (samplesame)
 		{
 		    throw Safe_Error_Return 
-			("Sample changed: ID's differ");
+		       ("Matrix size changed so option SampleSame is invalid");
 		}
-// Free previous matrix, data no longer valid
-		if (Eval[zindex]) free (Eval[zindex]);
-		if (Evec[zindex]) free (Evec[zindex]);
-		if (ID[zindex]) free (ID[zindex]);
 	    }
-	}
-    }
-    
-    if (new_matrix_needed)
-    {
-// Allocate branch matrices for this pedigree
-	if (premax) printf ("EVD: Allocating new matrix for ped %d\n",zindex+1);
-	if (premax) printf ("***** size is %d\n",maxpeon);
-	Eval[zindex] = (double*) Calloc (maxpeon,sizeof(double));
-	Evec[zindex] = (double*) Calloc ((maxpeon)*(maxpeon),sizeof(double));
-//	printf ("Evec allocated to %d\n",maxpeon*maxpeon);
-	if (needid) ID[zindex] = (int*) 
-			  Calloc ((maxpeon),sizeof(int));
-	double* eval = Eval[zindex];
-	double* evec = Evec[zindex];
-	double* tphi2 = (double*) Calloc ((maxpeon)*(maxpeon),sizeof(double));
-
-// Save the Phi2, N, and Max for later comparisons
-// The original design saved phi2 values for comparison next time around.
-// That design is adequate for earlier EVD approaches in which phenotypes
-// were used separately.  Otherwise, it has problem that sample could change,
-// say if one singleton pedigree is replaced by another.  If matrices include
-// results derived from sample data, they would need to change, even if the
-// genetic relationships are unchanged.
-//
-// So it has changed to now save IBDID's (ID).
-//
-// We still need to gather phi2 data for use in EVD calculations.  But
-// we do not need to save it.  Instead, the old variable "needphi2" is
-// now "needids" and a simple linear list of ID's (ibdid's) in
-// each pedigree.  To protect against new ibdid's, a load pedigree op
-// throws out saved id's.
-// 
-// Simultaneously, we now have greater need to detect sample changes.
-// In fact, we may go down this path partly to validate the sample.
-
-
-	N[zindex] = maxpeon;
-	int reported = 0;
-	if (premax) printf (" Creating matrix for one pedigree\n");
-
-// For bi/multivariate traits:
-//   subsequent real persons are nt apart
-//   fully balanced assumption for evd
-//   maxpeon is the size of arrays, or real people, not the "person-traits"
-
-
-// i and j are real people, adjust indexes to match
-
-	for (int i = 0; i < maxpeon; i++)
-	{
-	    if (needid)
+	    if (needed[z] && dontallows)
 	    {
-		int idindex = idpos + ((*nvar)*i*ntraits);
-//		printf ("idindex is %d\n",idindex);
-		ID[zindex][i] = (int) vardata[idindex];
-	    }
-	    for (int j = i; j < maxpeon; j++)
-	    {
-		int vindex = (int) vardata[idpos+(*nvar)*i*ntraits];
-		int vvindex = (int) vardata[idpos+(*nvar)*j*ntraits];
-
-		double value = pm->get(vindex,vvindex);
-
-		tphi2[j+(maxpeon)*i] = value;
-		tphi2[i+(maxpeon)*j] = value;
-//		printf ("phi2[%d,%d] = %g\n",vindex,vvindex,value);
+		throw Safe_Error_Return ("Sample changed: ID's differ");
 	    }
 	}
+	if (needed[z] && ped.n > 0) nrebuilt++;
+    }
+    if (premax) printf ("EVD: Creating matrices for %d of %d pedigrees\n",
+			nrebuilt, npeds);
 
 // Do the matrix decompositions
 
-	double* evali = (double*) Calloc (maxpeon, sizeof(double));
-
-	tred2_ (&maxpeon,&maxpeon,tphi2,eval,evali,evec);
-	tql2_ (&maxpeon,&maxpeon,eval,evali,evec,ierr);
-	if (*ierr)
+    std::vector<int> failed (npeds, 0);
+#pragma omp parallel
+    {
+	std::vector<double> tphi2;
+	std::vector<double> evali;
+#pragma omp for schedule(dynamic)
+	for (int z = 0; z < npeds; z++)
 	{
-	    error ("error in tql2\n");
+	    int n = peds[z].n;
+	    if (!needed[z] || n == 0) continue;
+	    tphi2.resize ((size_t) n * n);
+	    evali.assign (n, 0.0);
+	    const int* ids = &id_arena[peds[z].id_offset];
+	    for (int i = 0; i < n; i++)
+	    {
+		for (int j = i; j < n; j++)
+		{
+		    double value = pm->get (ids[i], ids[j]);
+		    tphi2[j+(size_t)n*i] = value;
+		    tphi2[i+(size_t)n*j] = value;
+		}
+	    }
+	    int ierr = 0;
+	    double* eval = &eval_arena[peds[z].eval_offset];
+	    double* evec = &evec_arena[peds[z].evec_offset];
+	    tred2_ (&n,&n,&tphi2[0],eval,&evali[0],evec);
+	    tql2_ (&n,&n,eval,&evali[0],evec,&ierr);
+	    failed[z] = ierr;
 	}
-	free (evali);
-	free (tphi2);
-    } else {
-	if (premax) printf ("New matrix not needed.\n");
     }
-    if (Max_valid_index < zindex)
+    for (int z = 0; z < npeds; z++)
     {
-	Max_valid_index = zindex;
-    }
-    if (Max_allocated_index < zindex)
-    {
-	Max_allocated_index = zindex;
+	if (failed[z])
+	{
+	    fprintf (stderr, "tql2 returned ierr=%d for pedigree %d",
+		     failed[z],z+1);
+	    throw Safe_Error_Return ("EVD Failed in tql2");
+	}
     }
+
+    EVD_Peds.swap (peds);
+    EVD_Eval.swap (eval_arena);
+    EVD_Evec.swap (evec_arena);
+    EVD_ID.swap (id_arena);
+    EVD_Valid = true;
 }
 
 // Fortran interface to phi2 for special purpose
@@ -24,6 +24,20 @@ Expression::Expression (const char *string)
     delete s;
 };
 
+// eval_rows evaluates the expression for rows 0..nrows-1 of the bound
+// columns, one batch of EXPR_BATCH_ROWS at a time so that intermediate
+// results stay in cache.
+
+void Expression::eval_rows (int nrows, double *out)
+{
+    for (int first = 0; first < nrows; first += EXPR_BATCH_ROWS)
+    {
+	int count = nrows - first;
+	if (count > EXPR_BATCH_ROWS) count = EXPR_BATCH_ROWS;
+	expr->eval_rows (first, count, &out[first]);
+    }
+}
+
 Expr *Binary_Expr::insert (Expr *new_expr, Expr **top)
 {
     if (precedence () >= new_expr->precedence ())
@@ -61,11 +75,13 @@ Named_Exp *Name_Or_Func_Expr (char *n, Scan *s)
 }
 
 Name_Node::Name_Node (const char *node_name, NAME_FUNCP node_fptr,
-		      int node_key, Name_Node **name_list)
+		      int node_key, Name_Node **name_list,
+		      const double *node_column)
 {
     name = Strdup (node_name);
     fptr = node_fptr;
     key = node_key;
+    column = node_column;
     next = *name_list;
     *name_list = this;
 }
@@ -76,6 +92,7 @@ void Name_Expr::bind (Context *c)
     nfi = c->find (name);
     fptr = nfi.fptr;
     key = nfi.key;
+    column = nfi.column;
 }
 
 name_function_id Context::find (char *name)
@@ -88,6 +105,7 @@ name_function_id Context::find (char *name)
 	    name_function_id nfi;
 	    nfi.fptr = search_list->fptr;
 	    nfi.key = search_list->key;
+	    nfi.column = search_list->column;
 	    return nfi;
 	}
 	search_list = search_list->next;
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 //#ifdef _cplusplus
 #include <functional>
+#include <vector>
 #define NAME_FUNCP std::function<double(int)>
 //typedef std::function<double(int)> NAME_FUNCP;
 //#else
@@ -43,6 +44,15 @@ public:
     Undefined_Name (char *n) {name = n;}
 };
 
+// Batched evaluation (eval_rows) works on blocks of this many rows; an
+// Expr is never asked for more, so operands are held on the stack and
+// eval_rows keeps no state in the tree (it is reentrant once bound).
+// Names must be bound to columns (Context::add_column), and missing values
+// are NaN.  NaN propagates through every operator and function, except that
+// 0*missing is 0 just as with eval, which doesn't evaluate the second factor.
+#define EXPR_BATCH_ROWS 256
+inline bool Expr_Missing (double a, double b) {return a != a || b != b;}
+
 // Precedences from lowest to highest
 enum {Eq_Precedence, Add_Precedence, Mult_Precedence, Power_Precedence, 
       Default_Precedence};
@@ -53,6 +63,7 @@ struct name_function_id
 {
     NAME_FUNCP fptr;
     int key;
+    const double *column;
 };
 
 class Name_Node  // Element in a (name) Context
@@ -60,10 +71,11 @@ class Name_Node  // Element in a (name) Context
     char *name;
     NAME_FUNCP fptr;
     int key;
+    const double *column;
     Name_Node *next;
 
     Name_Node (const char *name, NAME_FUNCP fptr, int key,
-	       Name_Node **name_list);
+	       Name_Node **name_list, const double *column=0);
     ~Name_Node () {free (name);}
     friend class Context;
 };
@@ -77,6 +89,8 @@ public:
     {Name_Node *n = name_list->next; delete name_list; name_list = n;}}
     void add (const char *name, NAME_FUNCP fptr, int key=0)
 	{new Name_Node (name, fptr, key, &name_list);}
+    void add_column (const char *name, const double *column)
+	{new Name_Node (name, NAME_FUNCP(), 0, &name_list, column);}
     name_function_id find (char *name);
 };
 
@@ -88,6 +102,7 @@ public:
     friend class Expression;
     static Expr *build (char *string);
     virtual double eval () = 0;
+    virtual void eval_rows (int first, int count, double *out) = 0;
     virtual int is_empty () {return 0;}
     virtual Expr *insert (Expr *new_expr, Expr **top)
 	{*top = new_expr; return this;}  // Default precedence handling
@@ -106,6 +121,7 @@ public:
     ~Expression () {delete user_string; delete expr;}
     char *string () {return user_string;}
     double eval () {return expr->eval();}
+    void eval_rows (int nrows, double *out);
     char *debug (char *buf) {return expr->debug (buf);}
     bool boolean() {return expr->boolean();}
     void bind (Context *c) {expr->bind (c);}
@@ -116,6 +132,8 @@ class Empty_Expr : public Expr
 public:
     virtual int is_empty () {return 1;}
     double eval () {return 0.0;} // This allows a leading unary minus
+    void eval_rows (int first, int count, double *out)
+	{for (int i = 0; i < count; i++) out[i] = 0.0;}
     void bind (Context *c) {}					
     char *debug (char *buf) {return strcpy (buf,"()");}
 };
@@ -126,6 +144,8 @@ class Constant_Expr : public Expr
 public:
     Constant_Expr (double d) {value=d;}
     double eval () {return value;}
+    void eval_rows (int first, int count, double *out)
+	{for (int i = 0; i < count; i++) out[i] = value;}
     void bind (Context *c) {}
     char *debug (char *buf) {sprintf (buf, "%g", value); return buf;}
 };
@@ -148,9 +168,13 @@ class Name_Expr : public Named_Exp
 {
     NAME_FUNCP fptr;
     int key;
+    const double *column;
 public:
-    Name_Expr (char *n) : Named_Exp (n) {}
+    Name_Expr (char *n) : Named_Exp (n) {column = 0;}
     void bind (Context *c);
+    void eval_rows (int first, int count, double *out)
+	{if (!column) throw Unresolved_Name();
+	memcpy (out, &column[first], count*sizeof(double));}
 //#ifdef _cplusplus
     virtual double eval () { if(!fptr) throw Unresolved_Name(); return fptr(key);}
 //#else
@@ -185,6 +209,12 @@ public:
     Function_Expr (char *n, Expr *argument);
     double eval () {int i = 0; double a = arg->eval(); double d = 0.; 
                     return (*fptr)(&i, &a, &d);}
+    void eval_rows (int first, int count, double *out)
+	{arg->eval_rows (first, count, out);
+	for (int j = 0; j < count; j++) {
+	    if (out[j] != out[j]) continue;
+	    int i = 0; double a = out[j]; double d = 0.;
+	    out[j] = (*fptr)(&i, &a, &d);}}
     static void list_start () {it = function_list;}
     static int list_ok () {return (0 != it);}
     static const char *list_next () {const char *t=it->name; it=it->next; 
@@ -203,6 +233,8 @@ public:
     Expr *expr;
     ~Parenthesized_Expr () {delete expr;}
     double eval () {return expr->eval();}
+    void eval_rows (int first, int count, double *out)
+	{expr->eval_rows (first, count, out);}
     void bind (Context *c) {expr->bind (c);}
     char *debug (char *buf) 
 	{strcpy (buf,"("); expr->debug(&buf[1]); return strcat (buf, ")");}
@@ -215,6 +247,9 @@ public:
     Expr *second_expr;
     ~Binary_Expr () {delete first_expr; delete second_expr;}
     virtual double eval () = 0;
+    void eval_operands (int first, int count, double *out, double *b)
+	{first_expr->eval_rows (first, count, out);
+	second_expr->eval_rows (first, count, b);}
     virtual Expr *insert (Expr *new_expr, Expr **top);
     void bind (Context *c) 
 	{first_expr->bind (c); second_expr->bind (c);}
@@ -225,6 +260,9 @@ class Addition_Expr : public Binary_Expr
 public:
     int precedence () {return Add_Precedence;}
     double eval () {return first_expr->eval() + second_expr->eval();}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] += b[i];}
     char *debug (char *buf) 
       {first_expr->debug (buf); strcat (buf, "+"); second_expr->debug 
        (&buf[strlen (buf)]); return buf;}
@@ -235,6 +273,9 @@ class Subtraction_Expr : public Binary_Expr
 public:
     int precedence () {return Add_Precedence;}
     double eval () {return first_expr->eval() - second_expr->eval();}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] -= b[i];}
     char *debug (char *buf) 
       {first_expr->debug (buf); strcat (buf, "-"); second_expr->debug 
        (&buf[strlen (buf)]); return buf;}
@@ -246,6 +287,9 @@ public:
     int precedence () {return Mult_Precedence;}
     double eval () {double d = first_expr->eval();
 	return d ? d * second_expr->eval() : d;}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) if (out[i]) out[i] *= b[i];}
     char *debug (char *buf) 
       {first_expr->debug (buf); strcat (buf, "*"); second_expr->debug 
        (&buf[strlen (buf)]); return buf;}
@@ -256,6 +300,9 @@ class Division_Expr : public Binary_Expr
 public:
     int precedence () {return Mult_Precedence;}
     double eval () {return first_expr->eval() / second_expr->eval();}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] /= b[i];}
     char *debug (char *buf) 
       {first_expr->debug (buf); strcat (buf, "/"); second_expr->debug 
        (&buf[strlen (buf)]); return buf;}
@@ -266,6 +313,10 @@ class Power_Expr : public Binary_Expr
 public:
     int precedence () {return Power_Precedence;}
     double eval () {return pow (first_expr->eval(), second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i]) ? out[i] + b[i]
+		    : pow (out[i], b[i]);}
     char *debug (char *buf) 
       {first_expr->debug (buf); strcat (buf,"**"); second_expr->debug 
        (&buf[strlen (buf)]); return buf;}
@@ -276,6 +327,10 @@ class Eq_Expr : public Binary_Expr
 public:
     int precedence () {return Eq_Precedence;}
     double eval () {return (first_expr->eval() == second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i])
+	    ? out[i] + b[i] : (out[i] == b[i]);}
     char *debug (char *buf)
 	{first_expr->debug (buf); strcat (buf,"=="); 
 	second_expr->debug (&buf[strlen (buf)]); return buf;}
@@ -287,6 +342,10 @@ class Ge_Expr : public Binary_Expr
 public:
     int precedence () {return Eq_Precedence;}
     double eval () {return (first_expr->eval() >= second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i])
+	    ? out[i] + b[i] : (out[i] >= b[i]);}
     char *debug (char *buf)
 	{first_expr->debug (buf); strcat (buf,">="); 
 	second_expr->debug (&buf[strlen (buf)]); return buf;}
@@ -298,6 +357,10 @@ class Le_Expr : public Binary_Expr
 public:
     int precedence () {return Eq_Precedence;}
     double eval () {return (first_expr->eval() <= second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i])
+	    ? out[i] + b[i] : (out[i] <= b[i]);}
     char *debug (char *buf)
 	{first_expr->debug (buf); strcat (buf,"<="); 
 	second_expr->debug (&buf[strlen (buf)]); return buf;}
@@ -309,6 +372,10 @@ class Ne_Expr : public Binary_Expr
 public:
     int precedence () {return Eq_Precedence;}
     double eval () {return (first_expr->eval() != second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i])
+	    ? out[i] + b[i] : (out[i] != b[i]);}
     char *debug (char *buf)
 	{first_expr->debug (buf); strcat (buf,"!="); 
 	second_expr->debug (&buf[strlen (buf)]); return buf;}
@@ -320,6 +387,10 @@ class Gt_Expr : public Binary_Expr
 public:
     int precedence () {return Eq_Precedence;}
     double eval () {return (first_expr->eval() > second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i])
+	    ? out[i] + b[i] : (out[i] > b[i]);}
     char *debug (char *buf)
 	{first_expr->debug (buf); strcat (buf,">"); 
 	second_expr->debug (&buf[strlen (buf)]); return buf;}
@@ -331,6 +402,10 @@ class Lt_Expr : public Binary_Expr
 public:
     int precedence () {return Eq_Precedence;}
     double eval () {return (first_expr->eval() < second_expr->eval());}
+    void eval_rows (int first, int count, double *out)
+	{double b[EXPR_BATCH_ROWS]; eval_operands (first, count, out, b);
+	for (int i = 0; i < count; i++) out[i] = Expr_Missing (out[i], b[i])
+	    ? out[i] + b[i] : (out[i] < b[i]);}
     char *debug (char *buf)
 	{first_expr->debug (buf); strcat (buf,"< "); 
 	second_expr->debug (&buf[strlen (buf)]); return buf;}
@@ -0,0 +1,205 @@
+/*
+ * fitcache.cc implements the fitkey command, which computes the signature
+ * of the current model used by the maximize fit cache (see "help fitcache").
+ *
+ * The signature is the model as it would be saved (trait, covariates,
+ * parameter starting values and bounds, constraints, omega, mu, options and
+ * matrix commands) without the results of any previous fit, followed by a
+ * checksum of each matrix file, each phenotype file and pedindex.out.  The
+ * key is a 64 bit FNV-1a hash of the signature.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <map>
+#include "solar.h"
+
+static const unsigned long long FNV_Basis = 14695981039346656037ULL;
+static const unsigned long long FNV_Prime = 1099511628211ULL;
+
+static unsigned long long fnv1a (const char *data, size_t size,
+				 unsigned long long hash = FNV_Basis)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+	hash ^= (unsigned char) data[i];
+	hash *= FNV_Prime;
+    }
+    return hash;
+}
+
+// File checksums are kept for the session, and recomputed if the size,
+// inode, or the nanosecond modification or change time of the file changes.
+// A file rewritten within the same second still gets a new ctime.  The
+// phenotype column cache (phenotypes.cc) also uses file_checksum.
+
+struct File_Checksum
+{
+    off_t size;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    unsigned long long hash;
+};
+
+static std::map<std::string, File_Checksum> Checksums;
+
+static bool same_time (const struct timespec& t1, const struct timespec& t2)
+{
+    return t1.tv_sec == t2.tv_sec && t1.tv_nsec == t2.tv_nsec;
+}
+
+bool file_checksum (const char *filename, unsigned long long *hash)
+{
+    struct stat st;
+    if (stat (filename, &st)) return false;
+    std::map<std::string, File_Checksum>::iterator it =
+	Checksums.find (filename);
+    if (it != Checksums.end() && it->second.size == st.st_size &&
+	it->second.ino == st.st_ino &&
+	same_time (it->second.mtime, st.st_mtim) &&
+	same_time (it->second.ctime, st.st_ctim))
+    {
+	*hash = it->second.hash;
+	return true;
+    }
+    FILE *file = fopen (filename, "r");
+    if (!file) return false;
+    unsigned long long h = FNV_Basis;
+    char *buffer = (char*) Malloc (1 << 20);
+    size_t got;
+    while ((got = fread (buffer, 1, 1 << 20, file)) > 0)
+    {
+	h = fnv1a (buffer, got, h);
+    }
+    free (buffer);
+    fclose (file);
+    File_Checksum entry;
+    entry.size = st.st_size;
+    entry.ino = st.st_ino;
+    entry.mtime = st.st_mtim;
+    entry.ctime = st.st_ctim;
+    entry.hash = h;
+    Checksums[filename] = entry;
+    *hash = h;
+    return true;
+}
+
+static void append_file_stamp (std::string& signature, const char *what,
+			       const char *filename)
+{
+    char buf[1024];
+    struct stat st;
+    if (stat (filename, &st))
+    {
+	snprintf (buf, sizeof(buf), "%s %s missing\n", what, filename);
+    }
+    else
+    {
+	snprintf (buf, sizeof(buf), "%s %s %lld %lld.%09ld\n", what, filename,
+		  (long long) st.st_size, (long long) st.st_mtim.tv_sec,
+		  (long) st.st_mtim.tv_nsec);
+    }
+    signature += buf;
+}
+
+// pedindex.out and phi2.gz are rewritten with the same contents whenever the
+// pedigree is loaded, and a phenotype file can be rewritten with different
+// contents of the same size within the same second, so these are all
+// identified by checksum
+
+static void append_file_checksum (std::string& signature, const char *what,
+				  const char *filename)
+{
+    unsigned long long hash;
+    if (!file_checksum (filename, &hash))
+    {
+	append_file_stamp (signature, what, filename);
+	return;
+    }
+    char buf[1024];
+    snprintf (buf, sizeof(buf), "%s %s %016llx\n", what, filename, hash);
+    signature += buf;
+}
+
+static std::string model_signature ()
+{
+    std::string signature;
+    char buf[1024];
+    if (getcwd (buf, sizeof(buf)))
+    {
+	signature += "cwd ";
+	signature += buf;
+	signature += "\n";
+    }
+
+// Saved model without loglikelihood, standard errors and scores
+
+    char *text = 0;
+    size_t size = 0;
+    FILE *file = open_memstream (&text, &size);
+    Model::write (file);
+    fclose (file);
+    char *line = text;
+    while (line && *line)
+    {
+	char *next = strchr (line, '\n');
+	next = next ? next + 1 : line + strlen (line);
+	bool fit = !strncmp (line, "loglike ", 8) ||
+	    (!strncmp (line, "parameter ", 10) && strstr (line, " score "));
+	if (!fit) signature.append (line, next - line);
+	line = next;
+    }
+    free (text);
+
+    Matrix *m;
+    for (int i = 0; (m = Matrix::index(i)) != 0; i++)
+    {
+	append_file_checksum (signature, "matrixfile", m->file());
+    }
+    const char *phenfile;
+    for (int i = 0; (phenfile = Phenotypes::filename(i)) != 0; i++)
+    {
+	append_file_checksum (signature, "phenotypes", phenfile);
+    }
+    append_file_checksum (signature, "pedigree", "pedindex.out");
+    return signature;
+}
+
+extern "C" int FitkeyCmd (ClientData clientData, Tcl_Interp *interp,
+			  int argc, char *argv[])
+{
+    if (argc == 2 && !StringCmp ("help", argv[1], case_ins))
+    {
+	return Solar_Eval (interp, "help fitkey");
+    }
+// A stored fit skips maximize, so bind the trait and phenotypes as it would
+// have done (this determines whether the trait is discrete)
+
+    if (argc == 2 && !StringCmp ("-bind", argv[1], case_ins))
+    {
+	if (Trait::Bind (interp)) return TCL_ERROR;
+	if (Phenotypes::bind (interp)) return TCL_ERROR;
+	return TCL_OK;
+    }
+    if (argc == 2 && !StringCmp ("-signature", argv[1], case_ins))
+    {
+	std::string signature = model_signature ();
+	RESULT_BUF (signature.c_str());
+	return TCL_OK;
+    }
+    if (argc != 1)
+    {
+	RESULT_LIT ("Usage: fitkey [-signature | -bind]");
+	return TCL_ERROR;
+    }
+    std::string signature = model_signature ();
+    char buf[32];
+    sprintf (buf, "%016llx", fnv1a (signature.data(), signature.size()));
+    RESULT_BUF (buf);
+    return TCL_OK;
+}
@@ -8,6 +8,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <vector>
 #include "solar.h"
 // tcl.h from solar.h
 #include "safelib.h"
@@ -212,7 +218,32 @@ Or use freq load -nosave to load allele freqs without saving MLEs.");
             return TCL_ERROR;
         }
 
-        if (argc == 5 && !StringCmp ("-nose", argv[2], case_ins)
+        if (argc >= 4 && !StringCmp ("-threads", argv[2], case_ins))
+        {
+            int nthreads = atoi(argv[3]);
+            if (nthreads < 1) {
+                RESULT_LIT ("freq mle: -threads must be a positive integer");
+                return TCL_ERROR;
+            }
+            bool get_stderr = true;
+            bool test_hwe = false;
+            int first = 4;
+            for (; first < argc && argv[first][0] == '-'; first++) {
+                if (!StringCmp ("-nose", argv[first], case_ins))
+                    get_stderr = false;
+                else if (!StringCmp ("-hwe", argv[first], case_ins))
+                    test_hwe = true;
+                else {
+                    RESULT_LIT (
+            "Usage: freq mle -threads <n> [-nose] [-hwe] <marker> ...");
+                    return TCL_ERROR;
+                }
+            }
+            return currentFreq->mlefreq_batch(argc - first, &argv[first],
+                                              get_stderr, test_hwe, nthreads,
+                                              interp);
+        }
+        else if (argc == 5 && !StringCmp ("-nose", argv[2], case_ins)
                       && !StringCmp ("-hwe", argv[3], case_ins))
         {
             if (currentFreq->mlefreq(argv[4], false, true, interp) == TCL_ERROR)
@@ -1057,8 +1088,12 @@ void Freq::remove_marker (const char *name)
     _nloci = n;
 }
 
+// If prerun is given, allfreq and genfreq have already been run for this
+// marker (by mlefreq_batch) and prerun[0] and prerun[1] are nonzero if
+// they failed; only their output is read here.
+
 int Freq::mlefreq (const char *mrkname, bool get_stderr, bool test_hwe,
-                   Tcl_Interp *interp)
+                   Tcl_Interp *interp, const int *prerun)
 {
     char errmsg[1024];
     int loc = get_marker(mrkname);
@@ -1104,29 +1139,36 @@ int Freq::mlefreq (const char *mrkname, bool get_stderr, bool test_hwe,
         return TCL_ERROR;
     }
 
-    if (test_hwe) {
+    if (test_hwe && !prerun) {
         unlink("genfreq.out");
         unlink("genfreq.frq");
     }
 
     if (locus->mle_status != 'c' && locus->mle_status != 's') {
-        printf("Running allfreq for marker %s ... ", locus->name);
-        fflush(stdout);
+        bool failed;
+        if (prerun)
+            failed = prerun[0] != 0;
+        else {
+            printf("Running allfreq for marker %s ... ", locus->name);
+            fflush(stdout);
 
-        unlink("allfreq.out");
-        unlink("allfreq.frq");
-        if (get_stderr)
-            unlink("allfreq.se");
+            unlink("allfreq.out");
+            unlink("allfreq.frq");
+            if (get_stderr)
+                unlink("allfreq.se");
 
-        char show_status = 'n';
-        FILE *fp = fopen("/dev/tty", "w");
-        if (fp) {
-            show_status = 'y';
-            fclose(fp);
-        }
+            char show_status = 'n';
+            FILE *fp = fopen("/dev/tty", "w");
+            if (fp) {
+                show_status = 'y';
+                fclose(fp);
+            }
 
-        sprintf(mle_cmd, "exec allfreq %c %c", show_status, get_stderr?'y':'n');
-        if (Solar_Eval(interp, mle_cmd) == TCL_ERROR) {
+            sprintf(mle_cmd, "exec allfreq %c %c", show_status,
+                    get_stderr?'y':'n');
+            failed = Solar_Eval(interp, mle_cmd) == TCL_ERROR;
+        }
+        if (failed) {
             sprintf(mle_cmd, "cd ..");
             if (Solar_Eval(interp, mle_cmd) == TCL_ERROR) {
                 RESULT_LIT ("\nCannot return to current working directory.");
@@ -1181,8 +1223,10 @@ int Freq::mlefreq (const char *mrkname, bool get_stderr, bool test_hwe,
             return TCL_ERROR;
 
         }
-        printf("\n");
-        fflush(stdout);
+        if (!prerun) {
+            printf("\n");
+            fflush(stdout);
+        }
     }
 
     infp = fopen("allfreq.frq", "r");
@@ -1271,18 +1315,24 @@ int Freq::mlefreq (const char *mrkname, bool get_stderr, bool test_hwe,
     }
 
     if (test_hwe) {
-        printf("Running genfreq for marker %s ... ", locus->name);
-        fflush(stdout);
+        bool failed;
+        if (prerun)
+            failed = prerun[1] != 0;
+        else {
+            printf("Running genfreq for marker %s ... ", locus->name);
+            fflush(stdout);
 
-        char show_status = 'n';
-        FILE *fp = fopen("/dev/tty", "w");
-        if (fp) {
-            show_status = 'y';
-            fclose(fp);
-        }
+            char show_status = 'n';
+            FILE *fp = fopen("/dev/tty", "w");
+            if (fp) {
+                show_status = 'y';
+                fclose(fp);
+            }
 
-        sprintf(mle_cmd, "exec genfreq %c n", show_status);
-        if (Solar_Eval(interp, mle_cmd) == TCL_ERROR) {
+            sprintf(mle_cmd, "exec genfreq %c n", show_status);
+            failed = Solar_Eval(interp, mle_cmd) == TCL_ERROR;
+        }
+        if (failed) {
             sprintf(mle_cmd, "cd ..");
             if (Solar_Eval(interp, mle_cmd) == TCL_ERROR) {
                 RESULT_LIT ("\nCannot return to current working directory.");
@@ -1348,8 +1398,10 @@ int Freq::mlefreq (const char *mrkname, bool get_stderr, bool test_hwe,
         locus->chi2_hwe = 2*(afreq - loglike0);
         fclose(infp);
 
-        printf("\n");
-        fflush(stdout);
+        if (!prerun) {
+            printf("\n");
+            fflush(stdout);
+        }
     }
 
     write_locfiles(locus, false);
@@ -1365,6 +1417,161 @@ int Freq::mlefreq (const char *mrkname, bool get_stderr, bool test_hwe,
     return TCL_OK;
 }
 
+// Runs allfreq (and genfreq for -hwe) for one marker within its d_<marker>
+// directory.  Returns nonzero if the program failed, which as with Tcl exec
+// includes writing to stderr.  The program is run directly rather than
+// through a shell, so marker names need no quoting.
+
+static int run_freq_program (const char *mrkname, const char *program,
+                             const char *arg1, const char *arg2)
+{
+    char dirname[1024], errname[1024], errfile[1024];
+    if (snprintf(dirname, sizeof(dirname), "d_%s", mrkname)
+        >= (int) sizeof(dirname))
+        return 1;
+    snprintf(errname, sizeof(errname), "%s.err", program);
+    snprintf(errfile, sizeof(errfile), "%s/%s", dirname, errname);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(dirname)) _exit(127);
+        int devnull = open("/dev/null", O_WRONLY);
+        int errfd = open(errname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (devnull < 0 || errfd < 0) _exit(127);
+        dup2(devnull, 1);
+        dup2(errfd, 2);
+        execlp(program, program, arg1, arg2, (char*) 0);
+        _exit(127);
+    }
+    int status = -1;
+    if (pid > 0) {
+        int wstatus;
+        pid_t waited;
+        while ((waited = waitpid(pid, &wstatus, 0)) < 0 && errno == EINTR)
+            ;
+        if (waited == pid && WIFEXITED(wstatus))
+            status = WEXITSTATUS(wstatus);
+    }
+    struct stat errstat;
+    bool stderr_output = !stat(errfile, &errstat) && errstat.st_size > 0;
+    unlink(errfile);
+    return (status != 0 || stderr_output) ? 1 : 0;
+}
+
+struct FreqMleJob {
+    int loc;
+    bool run_allfreq;
+    bool run_genfreq;
+    int status[2];
+};
+
+// mlefreq_batch computes MLE allele frequencies for several markers at
+// once.  The allfreq and genfreq runs, which are independent for each
+// marker directory, are carried out by up to nthreads concurrent jobs.
+// Results are then read and the locfiles written in marker order, and
+// freq.info is written once.  Markers that fail are reported in the Tcl
+// result as a list of {marker message} pairs.
+
+int Freq::mlefreq_batch (int nmrk, char **mrknames, bool get_stderr,
+                         bool test_hwe, int nthreads, Tcl_Interp *interp)
+{
+    char errmsg[1024];
+    std::vector<FreqMleJob> jobs;
+    for (int i = 0; i < nmrk; i++) {
+        int loc = get_marker(mrknames[i]);
+        if (loc < 0) {
+            sprintf(errmsg, "%s: No such marker", mrknames[i]);
+            RESULT_BUF (errmsg);
+            return TCL_ERROR;
+        }
+        if (currentPed->marker()->get_marker(mrknames[i]) < 0) {
+            sprintf(errmsg,
+                    "Genotype data have not been loaded for marker %s.",
+                    mrknames[i]);
+            RESULT_BUF (errmsg);
+            return TCL_ERROR;
+        }
+
+        struct LocusFreq *locus = _locus[loc];
+        FreqMleJob job;
+        job.loc = loc;
+        job.run_allfreq = locus->mle_status != 'c' && locus->mle_status != 's';
+        job.run_genfreq = test_hwe &&
+                          (job.run_allfreq || locus->chi2_hwe < 0);
+        job.status[0] = job.status[1] = 0;
+        if (!job.run_allfreq && !job.run_genfreq) {
+            if (test_hwe)
+                printf(
+        "The HWE test statistic has already been computed for marker %s.\n",
+                       locus->name);
+            else
+                printf(
+        "MLE allele frequencies have already been computed for marker %s.\n",
+                       locus->name);
+            continue;
+        }
+
+        char file[1024];
+        if (job.run_genfreq) {
+            sprintf(file, "d_%s/genfreq.out", locus->name);
+            unlink(file);
+            sprintf(file, "d_%s/genfreq.frq", locus->name);
+            unlink(file);
+        }
+        if (job.run_allfreq) {
+            sprintf(file, "d_%s/allfreq.out", locus->name);
+            unlink(file);
+            sprintf(file, "d_%s/allfreq.frq", locus->name);
+            unlink(file);
+            if (get_stderr) {
+                sprintf(file, "d_%s/allfreq.se", locus->name);
+                unlink(file);
+            }
+        }
+        jobs.push_back(job);
+    }
+
+    int njobs = jobs.size();
+    printf("Running allfreq%s for %d markers using %d threads ... ",
+           test_hwe ? " and genfreq" : "", njobs,
+           nthreads < njobs ? nthreads : njobs);
+    fflush(stdout);
+
+    const char *allfreq_se = get_stderr ? "y" : "n";
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for (int i = 0; i < njobs; i++) {
+        const char *name = _locus[jobs[i].loc]->name;
+        if (jobs[i].run_allfreq)
+            jobs[i].status[0] = run_freq_program(name, "allfreq", "n",
+                                                 allfreq_se);
+        if (jobs[i].run_genfreq && !jobs[i].status[0])
+            jobs[i].status[1] = run_freq_program(name, "genfreq", "n",
+                                                 "n");
+    }
+    printf("\n");
+    fflush(stdout);
+
+    Tcl_Obj *failures = Tcl_NewListObj(0, 0);
+    for (int i = 0; i < njobs; i++) {
+        const char *name = _locus[jobs[i].loc]->name;
+        if (mlefreq(name, get_stderr, test_hwe, interp, jobs[i].status)
+            == TCL_ERROR)
+        {
+            Tcl_Obj *failure = Tcl_NewListObj(0, 0);
+            Tcl_ListObjAppendElement(interp, failure,
+                                     Tcl_NewStringObj(name, -1));
+            Tcl_ListObjAppendElement(interp, failure,
+                                     Tcl_GetObjResult(interp));
+            Tcl_ListObjAppendElement(interp, failures, failure);
+        }
+    }
+
+    if (write_info(interp) == TCL_ERROR)
+        return TCL_ERROR;
+    Tcl_SetObjResult(interp, failures);
+    return TCL_OK;
+}
+
 void Freq::write_locfiles (struct LocusFreq *locus, bool allfreq)
 {
     int i, j;
@@ -25,6 +25,12 @@ C
       INTEGER CONOUT,TINDEX,TDISTP
 C
       SAVE NPBAND,NPEO,NPTOT
+C
+C     PROFILE FUNCTION AND DERIVATIVE PASSES SEPARATELY.
+C
+      IPHASE=5
+      IF (NPASS.EQ.2) IPHASE=6
+      CALL PROFBEG(IPHASE)
       VSUB = VERBOSE ('SUBITER')
       CALL DOPTION ('PEDLIKE',PEDLIKE)
       IF (PEDLIKE.EQ.1) THEN
@@ -90,11 +96,13 @@ C
 C     CALL SUBROUTINE DIRECT TO INITIATE THE COMPUTATION OF THE
 C     LOG LIKELIHOOD AND SCORE FOR THE CURRENT PEDIGREE.
 C
+      CALL PROFBEG(8)
       CALL DIRECT(DERIV,EXTRA,INFORM,KIN2,OMEGA,PAR,PARINC,QDERIV,SCORE
      1,VAR,WORK,DEPVAR,FATHER,GROUP,MOTHER,PERSON,LOGLIK,UNIFRM(PED)
      2,TOL,ITER,MAXPAR,MAXPEO,MAXVAR,MOMEGA,MWORK,NEXTRA,NPAR,NPASS
      3,NPBAND,NPED,NPEO,NPTOT,NTRAIT,NVAR,PED,UNIT3,DIAG,FORWRD,NORMAL
      4,CONOUT,RAWSD,RAWMU)
+      CALL PROFEND(8)
 C
 C     ADD THIS PEDIGREE'S INCREMENT TO F, TO THE TOTAL OF THE PEDIGREE
 C     QUADRATIC FORMS, TO THE DERIVATIVES OF F, AND TO THE HESSIAN OF F.
@@ -155,4 +163,5 @@ C     BE NOTED, THEN CALL SUBROUTINE EDFTST.
 C
       IF (OUTLIE.AND.ITER.EQ.LAST) CALL PEDTST(UNIFRM,DEGREE,PEDCUT
      1,PAR(TINDEX),NPED,UNIT3,NORMAL)
+      CALL PROFEND(IPHASE)
       END
@@ -10,6 +10,7 @@
 #include <iterator>
 #include "plinkio.h"
 #include <unordered_map>
+#include <map>
 #include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -395,6 +396,7 @@ typedef struct gwas_data{
 		SD= var.SD;
         h2r = var.h2r;
         loglik = var.loglik;
+        return *this;
 	}
 	
 }gwas_data;
@@ -453,7 +455,7 @@ static inline double calculate_quick_loglik(Eigen::VectorXd Sigma, const unsigne
 static inline double calculate_quick_loglik_2(Eigen::VectorXd residual_squared, Eigen::VectorXd sigma){
 	return -0.5*(-log(abs(sigma.array())).sum() + residual_squared.dot(sigma));
 }
-static void gwas_maximize_newton_raphson_method_with_covariates(gwas_data * result, Eigen::VectorXd Y, Eigen::MatrixXd X, Eigen::MatrixXd U, gwas_data null_result, const int precision, string & status_string){
+static void gwas_maximize_newton_raphson_method_with_covariates(gwas_data * result, Eigen::VectorXd Y, Eigen::MatrixXd X, Eigen::MatrixXd U, gwas_data null_result, const int precision, string & status_string, const bool clamp_chi = false){
 
 
 	double t = 0;
@@ -586,6 +588,17 @@ static void gwas_maximize_newton_raphson_method_with_covariates(gwas_data * resu
         result->h2r = h2;
         result->loglik = loglik;
         status_string = "Success";
+    }else if(clamp_chi && chi < 0.0 && delta == delta && iter != 50){
+    	// Test model landed marginally below the null; report it as chi 0
+    	// the way mga does instead of discarding the fit
+        result->SE = 0.0;
+        result->beta = beta(beta.rows()-1);
+        result->chi = 0.0;
+        result->SD = sqrt(variance);
+        result->pvalue = 1.0;
+        result->h2r = h2;
+        result->loglik = loglik;
+        status_string = "Success";
     }else{
         result->beta = 0.0;
         result->chi = 0.0;
@@ -1415,7 +1428,7 @@ static void calculate_eigen_data_null(Eigen::VectorXd & Y,  Eigen::MatrixXd & ei
 
 static vector<gwas_data> GWAS_MLE_fix_missing_run_with_covariates(gwas_data null_result, Eigen::VectorXd default_Y, Eigen::MatrixXd default_covariate_matrix,\
 						Eigen::MatrixXd snp_matrix,Eigen::MatrixXd default_U, \
-                                               const int n_snps,  const unsigned precision, vector<string> & status_vector){
+                                               const int n_snps,  const unsigned precision, vector<string> & status_vector, const bool clamp_chi = false){
     // const int n_subjects = Y.rows();
 
     vector<gwas_data> results(n_snps);
@@ -1450,7 +1463,7 @@ static vector<gwas_data> GWAS_MLE_fix_missing_run_with_covariates(gwas_data null
        // local_X.col(1) = default_eigenvectors_transposed*local_X.col(1);
         gwas_data result;
 	//cout << "starting newton raphson\n";
-gwas_maximize_newton_raphson_method_with_covariates(&result, default_Y, local_covariate_matrix, default_U, null_result, precision, status_vector[iteration]);
+gwas_maximize_newton_raphson_method_with_covariates(&result, default_Y, local_covariate_matrix, default_U, null_result, precision, status_vector[iteration], clamp_chi);
         //MLE_GWAS(&result,default_Y, local_X, default_U, null_result, precision);
        // if(result.chi == 0.0) result.SD = default_SD;
         results[iteration] = result;
@@ -1919,7 +1932,7 @@ typedef struct gwas_screen_data{
 	
 		beta_se = var.beta_se;
 		chi = var.chi;
-
+		return *this;
 	}
 	
 }gwas_screen_data;
@@ -2122,7 +2135,8 @@ static const char * run_gwas_screen_list(const char * phenotype_filename, const
 		
 
 	}		
-	
+	delete trait_reader;
+	return 0;
 }
 static const char *   run_gwas_list(const char * phenotype_filename, const char * list_filename, const char * evd_data_filename, const char * plink_filename, const bool fix_missing, const unsigned precision, const bool verbose, const bool use_covariates, unsigned n_permutations = 0, unsigned batch_size = GWAS_BATCH_SIZE){
 	vector<string> trait_list;// = read_trait_list(list_filename);
@@ -2572,6 +2586,303 @@ static const char * run_single_snp_gwas(const char * phenotype_filename, const c
 
 }
 
+typedef struct mga_native_data{
+	int n_subjects;
+	double chi;
+	double pvalue;
+	double beta;
+	double varexp;
+	double dosage_mean;
+	double dosage_sd;
+	bool success;
+}mga_native_data;
+/*
+ * Fits every SNP in snp_indices against the sample given by rows.  The null
+ * model is fitted once for the sample and all SNPs are then evaluated in
+ * parallel against it using the rotated covariate matrix.
+ */
+static void mga_native_fit_sample(const vector<unsigned> & rows, const vector<unsigned> & snp_indices, const Eigen::MatrixXd & dosages,\
+				  const Eigen::VectorXd & trait_vector, const Eigen::MatrixXd & covariate_matrix, \
+				  const Eigen::MatrixXd & eigenvectors_transposed, const Eigen::VectorXd & eigenvalues,\
+				  const unsigned precision, vector<mga_native_data> & results){
+	const unsigned n_subjects = rows.size();
+	const unsigned n_snps = snp_indices.size();
+	const unsigned n_columns = covariate_matrix.cols();
+	for(unsigned snp = 0; snp < n_snps; snp++){
+		results[snp_indices[snp]].success = false;
+		results[snp_indices[snp]].n_subjects = n_subjects;
+	}
+	if(n_subjects <= n_columns + 1) return;
+	
+	Eigen::VectorXd Y(n_subjects);
+	Eigen::MatrixXd X(n_subjects, n_columns + 1);
+	Eigen::MatrixXd snp_matrix(n_subjects, n_snps);
+	for(unsigned row = 0; row < n_subjects; row++){
+		Y(row) = trait_vector(rows[row]);
+		for(unsigned col = 0; col < n_columns; col++){
+			X(row, col) = covariate_matrix(rows[row], col);
+		}
+		for(unsigned snp = 0; snp < n_snps; snp++){
+			snp_matrix(row, snp) = dosages(rows[row], snp_indices[snp]);
+		}
+	}
+	for(unsigned snp = 0; snp < n_snps; snp++){
+		const double mean = snp_matrix.col(snp).mean();
+		snp_matrix.col(snp) = snp_matrix.col(snp).array() - mean;
+		results[snp_indices[snp]].dosage_mean = mean;
+		// Divisor n, as in the covariate SD that mga reads from the
+		// maximization output for its dosage_sd column
+		results[snp_indices[snp]].dosage_sd = sqrt(snp_matrix.col(snp).squaredNorm()/n_subjects);
+	}
+	Y = eigenvectors_transposed*Y;
+	X.leftCols(n_columns) = eigenvectors_transposed*X.leftCols(n_columns);
+	X.col(n_columns).setZero();
+	snp_matrix = eigenvectors_transposed*snp_matrix;
+	Eigen::MatrixXd U = Eigen::MatrixXd::Ones(n_subjects, 2);
+	U.col(1) = eigenvalues;
+	
+	gwas_data null_result = gwas_maximize_newton_raphson_method_with_covariates_null_model(Y, X.leftCols(n_columns), U, precision);
+	if(null_result.SD == 0.0) return;
+	
+	vector<string> status_vector(n_snps);
+	vector<gwas_data> fits = GWAS_MLE_fix_missing_run_with_covariates(null_result, Y, X, snp_matrix, U, n_snps, precision, status_vector, true);
+	for(unsigned snp = 0; snp < n_snps; snp++){
+		if(status_vector[snp] != "Success") continue;
+		mga_native_data & result = results[snp_indices[snp]];
+		result.success = true;
+		result.chi = fits[snp].chi;
+		result.pvalue = fits[snp].pvalue;
+		result.beta = fits[snp].beta;
+		result.varexp = 1.0 - pow(fits[snp].SD/null_result.SD, 2);
+		if(result.varexp < 0.0) result.varexp = 0.0;
+	}
+}
+/*
+ * Native backend for mga.  The trait and covariates of the current model are
+ * read from phenotype_filename, the snp_<name> dosages from snp_filename.
+ * SNPs whose dosages cover the whole null sample share its eigen
+ * decomposition; SNPs with missing dosages are grouped by sample and each
+ * group gets its own null model, as mga does when the sample changes.
+ */
+static const char * run_mga_native(const char * phenotype_filename, const char * snp_filename, vector<string> snp_names,\
+				   const unsigned precision, vector<mga_native_data> & results){
+	vector<string> trait_list;
+	trait_list.push_back(string(Trait::Name(0)));
+	int n_covariates = 0;
+	vector<string> covariate_terms;
+	Eigen::MatrixXd raw_covariate_term_matrix;
+	vector<string> covariate_term_ids;
+	Covariate * c;
+	for(int i = 0; (c = Covariate::index(i)); i++){
+		CovariateTerm * cov_term;
+		for(cov_term = c->terms(); cov_term; cov_term = cov_term->next){
+			bool found = false;
+			for(vector<string>::iterator cov_iter = covariate_terms.begin(); cov_iter != covariate_terms.end(); cov_iter++){
+				if(!StringCmp(cov_term->name, cov_iter->c_str(), case_ins)){
+					found = true;
+					break;
+				}
+			}
+			if(!found) covariate_terms.push_back(string(cov_term->name));
+		}
+		n_covariates++;
+	}
+	if(n_covariates){
+		const char * error_message = load_covariate_terms(phenotype_filename, raw_covariate_term_matrix, covariate_terms, covariate_term_ids);
+		if(error_message) return error_message;
+		if(covariate_term_ids.size() == 0) return "No individuals have complete covariate data";
+	}
+	
+	Solar_Trait_Reader * trait_reader;
+	try{
+		trait_reader = new Solar_Trait_Reader(phenotype_filename, trait_list, covariate_term_ids);
+	}catch(Solar_Trait_Reader_Exception & e){
+		return e.what();
+	}catch(...){
+		return "Unknown error occurred reading phenotype or pedigree data";
+	}
+	if(trait_reader->get_n_sets() == 0){
+		delete trait_reader;
+		return "No viable data could be read";
+	}
+	Eigen_Data * eigen_data = trait_reader->get_eigen_data_set(0);
+	vector<string> ids = eigen_data->get_ids();
+	const unsigned n_subjects = ids.size();
+	Eigen::VectorXd eigenvalues = Eigen::Map<Eigen::VectorXd>(eigen_data->get_eigenvalues(), n_subjects);
+	Eigen::MatrixXd eigenvectors_transposed = Eigen::Map<Eigen::MatrixXd>(eigen_data->get_eigenvectors_transposed(), n_subjects, n_subjects);
+	Eigen::VectorXd trait_vector = Eigen::Map<Eigen::VectorXd>(eigen_data->get_phenotype_column(0), n_subjects);
+	delete trait_reader;
+	
+	Eigen::MatrixXd covariate_matrix = Eigen::MatrixXd::Ones(n_subjects, n_covariates + 1);
+	if(n_covariates){
+		Eigen::MatrixXd model_covariates = create_covariate_matrix(ids, covariate_term_ids, covariate_terms, raw_covariate_term_matrix, n_covariates);
+		if(model_covariates.rows() == 0) return "Failure loading covariates";
+		covariate_matrix.leftCols(n_covariates) = model_covariates;
+	}
+	
+	unordered_map<string, unsigned> id_index;
+	for(unsigned row = 0; row < n_subjects; row++){
+		id_index[ids[row]] = row;
+	}
+	vector<unsigned> all_rows(n_subjects);
+	for(unsigned row = 0; row < n_subjects; row++) all_rows[row] = row;
+	Eigen::MatrixXd phi2;
+	
+	results.resize(snp_names.size());
+	for(unsigned start = 0; start < snp_names.size(); start += GWAS_BATCH_SIZE){
+		const unsigned batch_size = std::min((size_t)GWAS_BATCH_SIZE, snp_names.size() - start);
+		const char * errmsg = 0;
+		SolarFile * file_reader = SolarFile::open("mga", snp_filename, &errmsg);
+		if(errmsg) return errmsg;
+		file_reader->start_setup(&errmsg);
+		if(errmsg) { delete file_reader; return errmsg;}
+		file_reader->setup("id", &errmsg);
+		if(errmsg) { delete file_reader; return errmsg;}
+		for(unsigned snp = 0; snp < batch_size; snp++){
+			string field_name = "snp_" + snp_names[start + snp];
+			file_reader->setup(field_name.c_str(), &errmsg);
+			if(errmsg) { delete file_reader; return errmsg;}
+		}
+		Eigen::MatrixXd dosages = Eigen::MatrixXd::Constant(n_subjects, batch_size, nan(""));
+		char ** file_data;
+		while (0 != (file_data = file_reader->get (&errmsg))){
+			unordered_map<string, unsigned>::iterator find_iter = id_index.find(string(file_data[0]));
+			if(find_iter == id_index.end()) continue;
+			for(unsigned snp = 0; snp < batch_size; snp++){
+				if(StringCmp(file_data[snp + 1], 0, case_ins)){
+					dosages(find_iter->second, snp) = atof(file_data[snp + 1]);
+				}
+			}
+		}
+		delete file_reader;
+		
+		map< vector<bool>, vector<unsigned> > sample_groups;
+		for(unsigned snp = 0; snp < batch_size; snp++){
+			vector<bool> present(n_subjects);
+			for(unsigned row = 0; row < n_subjects; row++){
+				present[row] = (dosages(row, snp) == dosages(row, snp));
+			}
+			sample_groups[present].push_back(snp);
+		}
+		vector<mga_native_data> batch_results(batch_size);
+		vector< vector<bool> > subsets;
+		vector< vector<unsigned> > subset_snps;
+		for(map< vector<bool>, vector<unsigned> >::iterator group = sample_groups.begin(); group != sample_groups.end(); group++){
+			if(find(group->first.begin(), group->first.end(), false) == group->first.end()){
+				mga_native_fit_sample(all_rows, group->second, dosages, trait_vector, covariate_matrix,\
+						      eigenvectors_transposed, eigenvalues, precision, batch_results);
+			}else{
+				subsets.push_back(group->first);
+				subset_snps.push_back(group->second);
+			}
+		}
+		if(subsets.size() && phi2.rows() == 0){
+			phi2 = eigenvectors_transposed.transpose()*eigenvalues.asDiagonal()*eigenvectors_transposed;
+		}
+#pragma omp parallel for schedule(dynamic)
+		for(int subset = 0; subset < subsets.size(); subset++){
+			const vector<unsigned> & snp_indices = subset_snps[subset];
+			vector<unsigned> rows;
+			for(unsigned row = 0; row < n_subjects; row++){
+				if(subsets[subset][row]) rows.push_back(row);
+			}
+			Eigen::MatrixXd subset_phi2(rows.size(), rows.size());
+			for(unsigned col = 0; col < rows.size(); col++){
+				for(unsigned row = 0; row < rows.size(); row++){
+					subset_phi2(row, col) = phi2(rows[row], rows[col]);
+				}
+			}
+			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(subset_phi2);
+			Eigen::MatrixXd subset_eigenvectors_transposed = es.eigenvectors().transpose();
+			Eigen::VectorXd subset_eigenvalues = es.eigenvalues();
+			mga_native_fit_sample(rows, snp_indices, dosages, trait_vector, covariate_matrix,\
+					      subset_eigenvectors_transposed, subset_eigenvalues, precision, batch_results);
+		}
+		copy(batch_results.begin(), batch_results.end(), results.begin() + start);
+	}
+	
+	return 0;
+}
+/*
+ * cmga is the native engine behind "mga -native".  It returns one list per
+ * SNP: {snp NAv chi p(SNP) bSNP Varexp est_maf est_mac dosage_sd}, or {snp}
+ * alone when the SNP could not be evaluated.
+ */
+extern "C" int mgaCmd(ClientData clientData, Tcl_Interp *interp,
+                                         int argc,const char *argv[]){
+	const char * phenotype_filename = 0;
+	const char * snp_filename = 0;
+	const char * snp_list = 0;
+	unsigned precision = 8;
+	for(unsigned arg = 1; arg < argc; arg++){
+		if(!StringCmp(argv[arg], "-phenfile", case_ins) && arg + 1 < argc){
+			phenotype_filename = argv[++arg];
+		}else if(!StringCmp(argv[arg], "-snpfile", case_ins) && arg + 1 < argc){
+			snp_filename = argv[++arg];
+		}else if(!StringCmp(argv[arg], "-snps", case_ins) && arg + 1 < argc){
+			snp_list = argv[++arg];
+		}else if(!StringCmp(argv[arg], "-precision", case_ins) && arg + 1 < argc){
+			precision = atoi(argv[++arg]);
+		}else{
+			RESULT_LIT("Usage: cmga -phenfile <file> -snpfile <file> -snps <snp-tcl-list> [-precision <n>]");
+			return TCL_ERROR;
+		}
+	}
+	if(!phenotype_filename || !snp_filename || !snp_list){
+		RESULT_LIT("cmga requires -phenfile, -snpfile and -snps");
+		return TCL_ERROR;
+	}
+	if(precision < 1 || precision > 9){
+		RESULT_LIT("Precision must be between 1 and 9");
+		return TCL_ERROR;
+	}
+	if(Trait::Number_Of() != 1){
+		RESULT_LIT("Native mga requires exactly one trait");
+		return TCL_ERROR;
+	}
+	int n_snps;
+	const char ** snp_argv;
+	if(TCL_OK != Tcl_SplitList(interp, snp_list, &n_snps, &snp_argv)){
+		return TCL_ERROR;
+	}
+	vector<string> snp_names;
+	for(int snp = 0; snp < n_snps; snp++){
+		snp_names.push_back(string(snp_argv[snp]));
+	}
+	Tcl_Free((char *) snp_argv);
+	if(snp_names.size() == 0) return TCL_OK;
+	try{
+		load_phi2_matrix(interp);
+	}catch(...){
+		RESULT_LIT("phi2 matrix could not be loaded.  Check to see if pedigree has been properly loaded.");
+		return TCL_ERROR;
+	}
+	vector<mga_native_data> results;
+	const char * error = run_mga_native(phenotype_filename, snp_filename, snp_names, precision, results);
+	if(error){
+		RESULT_BUF(error);
+		return TCL_ERROR;
+	}
+	Tcl_Obj * result_list = Tcl_NewListObj(0, 0);
+	for(unsigned snp = 0; snp < results.size(); snp++){
+		Tcl_Obj * snp_list_obj = Tcl_NewListObj(0, 0);
+		Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewStringObj(snp_names[snp].c_str(), -1));
+		if(results[snp].success){
+			const mga_native_data & result = results[snp];
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewIntObj(result.n_subjects));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.chi));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.pvalue));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.beta));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.varexp));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.dosage_mean/2.0));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.dosage_mean*result.n_subjects));
+			Tcl_ListObjAppendElement(interp, snp_list_obj, Tcl_NewDoubleObj(result.dosage_sd));
+		}
+		Tcl_ListObjAppendElement(interp, result_list, snp_list_obj);
+	}
+	Tcl_SetObjResult(interp, result_list);
+	return TCL_OK;
+}
 extern "C" int gwaCmd(ClientData clientData, Tcl_Interp *interp,
                                          int argc,const char *argv[]){
 //	int n_permutations = 0;
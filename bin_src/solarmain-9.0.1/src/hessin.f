@@ -10,4 +10,8 @@ C
      &PAR(NPAR)                                                     
       LOGICAL DIFFER(2)                                              
 C                                                                    
+C     DIFFER(2) IS ONLY SET FOR EVD MODELS WITH ANALYTIC DERIVATIVES,
+C     WHOSE AVERAGE INFORMATION MATRIX IS ACCUMULATED BY EVDSCOREC.
+C
+      IF (DIFFER(2)) CALL EVDHESSC(HESS,NPAR)
       END                                                            
@@ -23,11 +23,32 @@ extern bool  MMSibs;
 
 #define MXMCALL	99	/* max alleles handled by Monte Carlo IBD method */
 
+// Marker IBD jobs queued for the JobPool and how to report them
+struct IbdJob {
+    int mrk;
+    bool mc;
+    char fname[1024];
+};
+
+struct IbdJobs {
+    Tcl_Interp *interp;
+    IbdJob *job;
+    int njob;
+    bool doall;
+    bool parallel;
+    int retval;
+};
+
 static int inf_ibd (const char*, const char*, Tcl_Interp*);
 static int mito_ibd (const char*, Tcl_Interp*);
-static int run_ibd (const char*, bool, const char *, Tcl_Interp*);
-static int run_mc (const char*, bool, const char *, Tcl_Interp*);
-static int (*ibd_func)(const char*, bool, const char*, Tcl_Interp*) = 0;
+static int run_ibd (const char*, bool, const char *, char, IbdJobs*,
+                    JobPool*, Tcl_Interp*);
+static int run_mc (const char*, bool, const char *, char, IbdJobs*,
+                   JobPool*, Tcl_Interp*);
+static int (*ibd_func)(const char*, bool, const char*, char, IbdJobs*,
+                       JobPool*, Tcl_Interp*) = 0;
+static void ibd_started (int, void*);
+static void ibd_finished (int, int, void*);
 
 extern "C" int IbdCmd (ClientData clientData, Tcl_Interp *interp, int argc,
                        char *argv[])
@@ -142,21 +163,40 @@ extern "C" int IbdCmd (ClientData clientData, Tcl_Interp *interp, int argc,
         ibd_func = MCarlo ? run_mc : run_ibd;
         int i, retval = TCL_OK;
 
+    // queue the marker jobs, then run up to IbdThreads of them at once
+        IbdJobs jobs;
+        jobs.interp = interp;
+        jobs.job = new IbdJob[marker->nloci() + 1];
+        jobs.njob = 0;
+        jobs.doall = doall;
+        jobs.parallel = doall && IbdThreads > 1;
+        jobs.retval = TCL_OK;
+
+        JobPool pool(jobs.parallel ? IbdThreads : 1);
+
+        char show_status = 'n';
+        FILE *fp = jobs.parallel ? 0 : fopen("/dev/tty", "w");
+        if (fp) {
+            show_status = 'y';
+            fclose(fp);
+        }
+
         if (doall) {
             for (i = 0; i < marker->nloci(); i++) {
                 if (marker->ntyped(i) == currentPed->nind()
                     && currentFreq->xlinked(i) == 'n')
                 {
-                    if (run_mc(marker->mrkname(i),
-                               true, ibddir, interp) == TCL_ERROR) {
+                    if (run_mc(marker->mrkname(i), true, ibddir, show_status,
+                               &jobs, &pool, interp) == TCL_ERROR) {
                         printf("%s\n", Tcl_GetStringResult (interp)); 
                         fflush(stdout);
                         Tcl_ResetResult (interp);
                         retval = TCL_ERROR;
                     }
                 }
-                else if ((*ibd_func)(marker->mrkname(i),
-                                     nomle, ibddir, interp) == TCL_ERROR) {
+                else if ((*ibd_func)(marker->mrkname(i), nomle, ibddir,
+                                     show_status, &jobs, &pool, interp)
+                         == TCL_ERROR) {
                     printf("%s\n", Tcl_GetStringResult (interp)); 
                     fflush(stdout);
                     Tcl_ResetResult (interp);
@@ -169,13 +209,21 @@ extern "C" int IbdCmd (ClientData clientData, Tcl_Interp *interp, int argc,
                 && marker->ntyped(i) == currentPed->nind()
                 && currentFreq->xlinked(i) == 'n')
             {
-                retval = run_mc(mrkname, true, ibddir, interp);
+                retval = run_mc(mrkname, true, ibddir, show_status,
+                                &jobs, &pool, interp);
             }
             else {
-                retval = (*ibd_func)(mrkname, nomle, ibddir, interp);
+                retval = (*ibd_func)(mrkname, nomle, ibddir, show_status,
+                                     &jobs, &pool, interp);
             }
         }
 
+        pool.run(ibd_started, ibd_finished, &jobs);
+        delete[] jobs.job;
+
+        if (jobs.retval == TCL_ERROR)
+            retval = TCL_ERROR;
+
         return retval;
     }
 
@@ -354,111 +402,156 @@ int mito_ibd (const char *ibddir, Tcl_Interp *interp)
     return TCL_OK;
 }
 
-int run_ibd (const char *mrkname, bool nomle, const char *ibddir, 
-             Tcl_Interp *interp)
+// Add a job for a marker, whose IBD programs run in directory d_<marker>
+static IbdJob *new_ibd_job (int mrk, bool mc, const char *ibddir,
+                            IbdJobs *jobs, Tcl_Interp *interp)
 {
-    char ibd_cmd[1024], errmsg[1024];
-
-    int mrk = currentFreq->get_marker(mrkname);
-    if (mrk < 0) {
-        sprintf(errmsg, "%s: No such marker.", mrkname);
-        RESULT_BUF (errmsg);
-        return TCL_ERROR;
-    }
+    char dirname[1024], errmsg[1024];
+    struct stat statbuf;
 
-    if (!nomle && currentFreq->mle_status(mrk) == 'n'
-               && currentFreq->whence(mrk) == 'm')
-    {
-        sprintf(errmsg,
-"The allele freqs for %s are not MLEs. Enter 'ibd -nomle' to use them.",
+    sprintf(dirname, "d_%s", currentFreq->mrkname(mrk));
+    if (stat(dirname, &statbuf) || !S_ISDIR(statbuf.st_mode)) {
+        sprintf(errmsg, "Cannot change to directory d_%s.",
                 currentFreq->mrkname(mrk));
         RESULT_BUF (errmsg);
-        return TCL_ERROR;
+        return 0;
     }
 
-    if (!nomle && currentFreq->mle_status(mrk) == 'o'
-               && currentFreq->whence(mrk) == 'f')
-    {
-        sprintf(errmsg,
-"The allele freqs for %s are old MLEs. Enter 'ibd -nomle' to use them.",
+    IbdJob *job = &jobs->job[jobs->njob++];
+    job->mrk = mrk;
+    job->mc = mc;
+    if (ibddir[0] == '/')
+        sprintf(job->fname, "%s/ibd.%s", ibddir, currentFreq->mrkname(mrk));
+    else
+        sprintf(job->fname, "../%s/ibd.%s", ibddir,
                 currentFreq->mrkname(mrk));
-        RESULT_BUF (errmsg);
-        return TCL_ERROR;
-    }
-
-    printf("Computing IBDs for %s ... ", currentFreq->mrkname(mrk));
-    fflush(stdout);
 
-    sprintf(ibd_cmd, "cd d_%s", currentFreq->mrkname(mrk));
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-        sprintf(errmsg, "\nCannot change to directory d_%s.",
-                currentFreq->mrkname(mrk));
-        RESULT_BUF (errmsg);
-        return TCL_ERROR;
-    }
+    return job;
+}
 
-    char fname[1024];
-    if (ibddir[0] == '/')
-        sprintf(fname, "%s/ibd.%s", ibddir, currentFreq->mrkname(mrk));
-    else
-        sprintf(fname, "../%s/ibd.%s", ibddir, currentFreq->mrkname(mrk));
+void ibd_started (int j, void *data)
+{
+    IbdJobs *jobs = (IbdJobs*) data;
 
-    char show_status = 'n';
-    FILE *fp = fopen("/dev/tty", "w");
-    if (fp) {
-        show_status = 'y';
-        fclose(fp);
+    if (!jobs->parallel) {
+        printf("Computing IBDs for %s ... ",
+               currentFreq->mrkname(jobs->job[j].mrk));
+        fflush(stdout);
     }
+}
 
-    sprintf(ibd_cmd, "exec ibdmat %c %c %s >& ibdmat.out",
-            currentFreq->xlinked(mrk), show_status, fname);
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-        sprintf(ibd_cmd, "cd ..");
-        if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-            RESULT_LIT ("\nCannot return to current working directory.");
-            return TCL_ERROR;
-        }
+void ibd_finished (int j, int status, void *data)
+{
+    IbdJobs *jobs = (IbdJobs*) data;
+    IbdJob *job = &jobs->job[j];
+    Tcl_Interp *interp = jobs->interp;
+    const char *mrkname = currentFreq->mrkname(job->mrk);
+    char errmsg[1024];
+
+    if (jobs->parallel)
+        printf("Computing IBDs for %s ... ", mrkname);
 
+    int retval = TCL_OK;
+    if (status) {
         char errfile[1024], errbuf[1024];
-        sprintf(errfile, "d_%s/dolink.err", currentFreq->mrkname(mrk));
+        sprintf(errfile, "d_%s/%s", mrkname,
+                job->mc ? "ibdmc.err" : "dolink.err");
         FILE *errfp = fopen(errfile, "r");
         if (errfp && fgets(errbuf, sizeof(errbuf), errfp)) {
             sprintf(errmsg, "\n%s", strtok(errbuf, "\n"));
             RESULT_BUF (errmsg);
             fclose(errfp);
         }
+        else if (job->mc) {
+            if (errfp) fclose(errfp);
+            RESULT_LIT ("\nProgram domcibd did not run.");
+        }
         else {
-            sprintf(errfile, "d_%s/ibdmat.out", currentFreq->mrkname(mrk));
+            if (errfp) fclose(errfp);
+            sprintf(errfile, "d_%s/ibdmat.out", mrkname);
             errfp = fopen(errfile, "r");
             if (errfp && fgets(errbuf, sizeof(errbuf), errfp)) {
                 sprintf(errmsg, "\n%s", strtok(errbuf, "\n"));
                 RESULT_BUF (errmsg);
-                fclose(errfp);
             }
             else
                 RESULT_LIT ("\nProgram ibdmat did not run.");
+            if (errfp) fclose(errfp);
         }
+        retval = TCL_ERROR;
+    }
+    else {
+    // a relative fname is relative to the marker directory
+        char cmd[1024];
+        if (job->fname[0] == '/')
+            sprintf(cmd, "matcrc %s.gz", job->fname);
+        else
+            sprintf(cmd, "matcrc %s.gz", job->fname + 3);
+        retval = Solar_Eval(interp, cmd);
+    }
+
+    if (retval == TCL_ERROR) {
+        jobs->retval = TCL_ERROR;
+        if (jobs->doall) {
+            printf("%s\n", Tcl_GetStringResult (interp));
+            Tcl_ResetResult (interp);
+        }
+    }
+    else {
+        Tcl_ResetResult (interp);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int run_ibd (const char *mrkname, bool nomle, const char *ibddir,
+             char show_status, IbdJobs *jobs, JobPool *pool,
+             Tcl_Interp *interp)
+{
+    char ibd_cmd[1024], errmsg[1024];
+
+    int mrk = currentFreq->get_marker(mrkname);
+    if (mrk < 0) {
+        sprintf(errmsg, "%s: No such marker.", mrkname);
+        RESULT_BUF (errmsg);
         return TCL_ERROR;
     }
 
-    sprintf(ibd_cmd, "cd ..");
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-        RESULT_LIT ("\nCannot return to current working directory.");
+    if (!nomle && currentFreq->mle_status(mrk) == 'n'
+               && currentFreq->whence(mrk) == 'm')
+    {
+        sprintf(errmsg,
+"The allele freqs for %s are not MLEs. Enter 'ibd -nomle' to use them.",
+                currentFreq->mrkname(mrk));
+        RESULT_BUF (errmsg);
         return TCL_ERROR;
     }
 
-    sprintf (ibd_cmd, "matcrc %s.gz", fname);
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-	return TCL_ERROR;
+    if (!nomle && currentFreq->mle_status(mrk) == 'o'
+               && currentFreq->whence(mrk) == 'f')
+    {
+        sprintf(errmsg,
+"The allele freqs for %s are old MLEs. Enter 'ibd -nomle' to use them.",
+                currentFreq->mrkname(mrk));
+        RESULT_BUF (errmsg);
+        return TCL_ERROR;
     }
 
-    printf("\n");
-    fflush(stdout);
+    IbdJob *job = new_ibd_job(mrk, false, ibddir, jobs, interp);
+    if (!job)
+        return TCL_ERROR;
+
+    char dirname[1024];
+    sprintf(dirname, "d_%s", currentFreq->mrkname(mrk));
+    sprintf(ibd_cmd, "ibdmat %c %c %s > ibdmat.out 2>&1",
+            currentFreq->xlinked(mrk), show_status, job->fname);
+    pool->add(dirname, ibd_cmd);
 
     return TCL_OK;
 }
 
-int run_mc (const char *mrkname, bool nomle, const char *ibddir, 
+int run_mc (const char *mrkname, bool nomle, const char *ibddir,
+            char show_status, IbdJobs *jobs, JobPool *pool,
             Tcl_Interp *interp)
 {
     char ibd_cmd[1024], errmsg[1024];
@@ -503,66 +596,18 @@ int run_mc (const char *mrkname, bool nomle, const char *ibddir,
         return TCL_ERROR;
     }
 
-    printf("Computing IBDs for %s ... ", currentFreq->mrkname(mrk));
-    fflush(stdout);
-
-    sprintf(ibd_cmd, "cd d_%s", currentFreq->mrkname(mrk));
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-        sprintf(errmsg, "\nCannot change to directory d_%s.",
-                currentFreq->mrkname(mrk));
-        RESULT_BUF (errmsg);
+    IbdJob *job = new_ibd_job(mrk, true, ibddir, jobs, interp);
+    if (!job)
         return TCL_ERROR;
-    }
-
-    char fname[1024];
-    if (ibddir[0] == '/')
-        sprintf(fname, "%s/ibd.%s", ibddir, currentFreq->mrkname(mrk));
-    else
-        sprintf(fname, "../%s/ibd.%s", ibddir, currentFreq->mrkname(mrk));
 
+    char dirname[1024];
     char maxrisk = MaxRisk ? 'y' : 'n';
-    char show_status = 'n';
-    FILE *fp = fopen("/dev/tty", "w");
-    if (fp) {
-        show_status = 'y';
-        fclose(fp);
-    }
-
-    sprintf(ibd_cmd, "exec domcibd %s %d %c %c", fname, NumImp, maxrisk,
-            show_status);
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-        sprintf(ibd_cmd, "cd ..");
-        if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-            RESULT_LIT ("\nCannot return to current working directory.");
-            return TCL_ERROR;
-        }
-
-        char errfile[1024], errbuf[1024];
-        sprintf(errfile, "d_%s/ibdmc.err", currentFreq->mrkname(mrk));
-        FILE *errfp = fopen(errfile, "r");
-        if (errfp && fgets(errbuf, sizeof(errbuf), errfp)) {
-            sprintf(errmsg, "\n%s", strtok(errbuf, "\n"));
-            RESULT_BUF (errmsg);
-            fclose(errfp);
-        }
-        else
-            RESULT_LIT ("\nProgram domcibd did not run.");
-        return TCL_ERROR;
-    }
-
-    sprintf(ibd_cmd, "cd ..");
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-        RESULT_LIT ("\nCannot return to current working directory.");
-        return TCL_ERROR;
-    }
-
-    sprintf (ibd_cmd, "matcrc %s.gz", fname);
-    if (Solar_Eval(interp, ibd_cmd) == TCL_ERROR) {
-	return TCL_ERROR;
-    }
-
-    printf("\n");
-    fflush(stdout);
+    sprintf(dirname, "d_%s", currentFreq->mrkname(mrk));
+// ibdmc spreads imputations over all cores unless markers run in parallel
+    sprintf(ibd_cmd, "%sdomcibd %s %d %c %c > /dev/null 2>&1",
+            jobs->parallel ? "OMP_NUM_THREADS=1 " : "", job->fname,
+            NumImp, maxrisk, show_status);
+    pool->add(dirname, ibd_cmd);
 
     return TCL_OK;
 }
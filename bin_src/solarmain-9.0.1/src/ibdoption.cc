@@ -21,6 +21,7 @@ bool  MaxRisk = true;
 int   NumImp = 200;
 float MibdWin = 1000.;
 bool  MMSibs = false;
+int   IbdThreads = 1;
 
 extern "C" int IbdOptCmd (ClientData clientData, Tcl_Interp *interp, int argc,
                           char *argv[])
@@ -68,6 +69,11 @@ extern "C" int IbdOptCmd (ClientData clientData, Tcl_Interp *interp, int argc,
             strcat(buf, Tcl_GetStringResult (interp));
             strcat(buf, "\n");
         }
+        if (Solar_Eval(interp, "ibdoption threads") == TCL_OK)
+        {
+            strcat(buf, Tcl_GetStringResult (interp));
+            strcat(buf, "\n");
+        }
         if (Solar_Eval(interp, "ibdoption mibdwin") == TCL_OK)
 //        {
             strcat(buf, Tcl_GetStringResult (interp));
@@ -278,6 +284,33 @@ extern "C" int IbdOptCmd (ClientData clientData, Tcl_Interp *interp, int argc,
         return TCL_ERROR;
     }
 
+    else if (argc >= 2 && !StringCmp ("threads", argv[1], case_ins)) {
+        if (argc == 3) {
+        // set number of IBD jobs run at once
+            int n;
+            if (sscanf(argv[2], "%d", &n) != 1 || n <= 0) {
+                RESULT_LIT ("Invalid number of threads");
+                return TCL_ERROR;
+            }
+            IbdThreads = n;
+            char buf[1024];
+            sprintf(buf, "IbdThreads = %d", IbdThreads);
+            RESULT_BUF (buf);
+            return TCL_OK;
+        }
+
+        else if (argc == 2) {
+        // display number of IBD jobs run at once
+            char buf[1024];
+            sprintf(buf, "IbdThreads = %d", IbdThreads);
+            RESULT_BUF (buf);
+            return TCL_OK;
+        }
+
+        RESULT_LIT ("Usage: ibdoption threads [<n>]");
+        return TCL_ERROR;
+    }
+
     else if (argc >= 2 && !StringCmp ("mmsibs", argv[1], case_ins)) {
 
 // MAPMAKER/SIBS processing not yet fully implemented
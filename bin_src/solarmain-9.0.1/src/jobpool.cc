@@ -0,0 +1,104 @@
+/*
+ * jobpool.cc implements the JobPool class, which runs independent shell
+ * commands (such as the per-marker ibdmat or domcibd jobs of the ibd
+ * command) concurrently up to a fixed number of child processes
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "solar.h"
+
+JobPool::JobPool (int max_jobs)
+{
+    _max_jobs = (max_jobs > 0) ? max_jobs : 1;
+    _count = 0;
+    _cancel = false;
+    _directories = 0;
+    _commands = 0;
+}
+
+JobPool::~JobPool ()
+{
+    for (int i = 0; i < _count; i++) {
+        free (_directories[i]);
+        free (_commands[i]);
+    }
+    free (_directories);
+    free (_commands);
+}
+
+void JobPool::add (const char *directory, const char *command)
+{
+    _directories = (char**) Realloc (_directories, (_count+1)*sizeof(char*));
+    _commands = (char**) Realloc (_commands, (_count+1)*sizeof(char*));
+    _directories[_count] = Strdup (directory);
+    _commands[_count] = Strdup (command);
+    _count++;
+}
+
+static pid_t start_job (const char *directory, const char *command)
+{
+// Anything buffered would otherwise be written again by the child
+    fflush (stdout);
+    fflush (stderr);
+
+    pid_t pid = fork ();
+    if (pid == 0) {
+        if (chdir (directory)) _exit (127);
+        execl ("/bin/sh", "sh", "-c", command, (char*) 0);
+        _exit (127);
+    }
+    return pid;
+}
+
+void JobPool::run (void (*started)(int job, void *data),
+                   void (*finished)(int job, int status, void *data),
+                   void *data)
+{
+    pid_t *pids = (pid_t*) Calloc (_max_jobs, sizeof(pid_t));
+    int *jobs = (int*) Calloc (_max_jobs, sizeof(int));
+    int next = 0;
+    int running = 0;
+
+    while ((next < _count && !_cancel) || running) {
+
+// Fill free slots; a job that cannot be forked finishes at once
+        for (int slot = 0; slot < _max_jobs && next < _count && !_cancel;
+             slot++) {
+            if (pids[slot]) continue;
+            int job = next++;
+            if (started) (*started)(job, data);
+            pid_t pid = start_job (_directories[job], _commands[job]);
+            if (pid < 0) {
+                if (finished) (*finished)(job, -1, data);
+                continue;
+            }
+            pids[slot] = pid;
+            jobs[slot] = job;
+            running++;
+        }
+
+// Reap only our own children so other subprocesses are left alone
+        bool reaped = false;
+        for (int slot = 0; slot < _max_jobs; slot++) {
+            if (!pids[slot]) continue;
+            int wstatus;
+            pid_t pid = waitpid (pids[slot], &wstatus, WNOHANG);
+            if (pid == 0) continue;
+            int status = -1;
+            if (pid > 0 && WIFEXITED (wstatus)) status = WEXITSTATUS (wstatus);
+            pids[slot] = 0;
+            running--;
+            reaped = true;
+            if (finished) (*finished)(jobs[slot], status, data);
+        }
+        if (running && !reaped) usleep (20000);
+    }
+
+    free (pids);
+    free (jobs);
+}
@@ -19,6 +19,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <omp.h>
 #include "solar.h"
 // tcl.h from solar.h
 #include "safelib.h"
@@ -28,6 +34,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <map>
 
 #ifdef TR1
 #include <tr1/random>
@@ -44,6 +51,10 @@ using namespace Eigen;
 
 int MathMatrixDebug = 0;
 std::vector<Eigen::MatrixXd*> MathMatrixV(0);
+
+// Extra references added by "matrix retain", by MathMatrixV index.
+// "matrix delete" frees a matrix only when it has none left.
+std::map<int,int> MathMatrixRetained;
 int LastIndex = 0;
 int EvaluesIndex = -1;
 int EvectorsIndex = -1;
@@ -132,9 +143,10 @@ void AdvancedRandomSeed (int option)
     }
 }
 
-int AdvancedRandomDraw (int toprange)  // 0 <= i <= toprange
+template <class Generator>
+static inline int AdvancedRandomDraw (Generator& gen, int toprange)
 {
-    unsigned int mtval = mt();
+    unsigned int mtval = gen();
 
 // Sadly, C++ uniform_int_distribution is unavailable on gcc 4.4.1 or lower
 // An alternative distribution-corrected approach follows
@@ -143,16 +155,59 @@ int AdvancedRandomDraw (int toprange)  // 0 <= i <= toprange
 //    return mtval % (toprange+1);   // fast but inaccurate cheat
 
     unsigned int fullrange = toprange + 1;
-    unsigned int copies = mt.max() / fullrange;
+    unsigned int copies = gen.max() / fullrange;
     unsigned int limit = fullrange * copies;
     while ( mtval >= limit)
     {
-	mtval = mt();
+	mtval = gen();
     }
     int result = mtval / copies;
     return result;
 }
 
+int AdvancedRandomDraw (int toprange)  // 0 <= i <= toprange
+{
+    return AdvancedRandomDraw (mt, toprange);
+}
+
+// Permutation commands give each permutation its own generator, seeded by
+// mixing (splitmix64) one base draw with the permutation number.  Results
+// then depend only on the seed (see AdvancedRandomSeed), not on the number
+// of threads or the order in which permutations are computed.
+
+static unsigned long AdvancedRandomStream (unsigned long base, int stream)
+{
+    uint64_t z = ((uint64_t) base << 32) + (uint64_t) stream;
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (unsigned long) ((z ^ (z >> 31)) & 0xffffffffUL);
+}
+
+// Fill shuffle with a random permutation of 0..n-1 using
+// Knuth aka Fisher-Yates Shuffle
+//   Inside-Out version from Wikipedia 6/2015
+
+static void AdvancedRandomShuffle (int* shuffle, int n, unsigned long base,
+				   int stream)
+{
+    STDPRE::mt19937 gen (AdvancedRandomStream (base, stream));
+    for (int i = 0; i < n; i++)
+    {
+	int r = (i == 0) ? 0 : AdvancedRandomDraw (gen, i);  // 0 <= r <= i
+	if (r != i)
+	{
+	    shuffle[i] = shuffle[r];
+	}
+	shuffle[r] = i;
+    }
+}
+
+// Columns of permuted output are done in blocks of this size, which is
+// also the width of the fused product in permutey
+
+#define PERMUTE_BLOCK 64
+
 // Utility functions for MathMatrix
 // Given MathMatrix id, return pointer to Eigen matrix
 
@@ -192,6 +247,202 @@ MatrixXd* MathMatrixGet (char* mmid, const char* fname, Tcl_Interp* interp)
     return MathMatrixV[LastIndex];
 }
 
+// Arithmetic commands may put their result in an existing matrix instead of
+// allocating a new one each time:
+//   -out <matrix>   result goes into <matrix>, reusing its storage
+//   -inplace        result goes into the first matrix operand
+
+class MathMatrixDest
+{
+public:
+    int index;        // MathMatrixV index, or -1 for a new matrix
+    bool inplace;
+    bool elementwise; // -e option of times
+    MathMatrixDest () {index=-1; inplace=false; elementwise=false;}
+};
+
+// Parse destination options, returning index of first operand or -1 on error
+
+static int MathMatrixOptions (int argc, char* argv[], MathMatrixDest* dest,
+			      bool allow_e, Tcl_Interp* interp)
+{
+    int first = 1;
+    while (first < argc)
+    {
+	if (allow_e && !Strcmp (argv[first], "-e"))
+	{
+	    dest->elementwise = true;
+	    first++;
+	}
+	else if (!Strcmp (argv[first], "-inplace"))
+	{
+	    dest->inplace = true;
+	    first++;
+	}
+	else if (!Strcmp (argv[first], "-out") && first+1 < argc)
+	{
+	    if (!MathMatrixGet (argv[first+1], "out", interp)) return -1;
+	    dest->index = LastIndex;
+	    first += 2;
+	}
+	else
+	{
+	    break;
+	}
+    }
+    return first;
+}
+
+// Return matrix to receive result, sized rows x cols.  Resizing keeps the
+// storage when the size is unchanged, which is always the case when the
+// destination is also an elementwise operand.
+
+static MatrixXd* MathMatrixResult (MathMatrixDest* dest, int rows, int cols)
+{
+    if (dest->index < 0)
+    {
+	MathMatrixV.push_back (new MatrixXd (rows, cols));
+	dest->index = MathMatrixV.size() - 1;
+    }
+    MatrixXd* mo = MathMatrixV[dest->index];
+    if (mo->rows() != rows || mo->cols() != cols)
+    {
+	mo->resize (rows, cols);
+    }
+    return mo;
+}
+
+static int MathMatrixReturn (MathMatrixDest* dest, Tcl_Interp* interp)
+{
+    char namebuf[64];
+    sprintf (namebuf,"%s%d",MathMatrix_PREFIX,dest->index+1);
+    RESULT_BUF (namebuf);
+    return TCL_OK;
+}
+
+// Delete one reference to matrix at MathMatrixV index
+
+static void MathMatrixRelease (int index)
+{
+    std::map<int,int>::iterator it = MathMatrixRetained.find (index);
+    if (it != MathMatrixRetained.end())
+    {
+	if (--it->second == 0) MathMatrixRetained.erase (it);
+	return;
+    }
+    delete MathMatrixV[index];
+    MathMatrixV[index] = 0;
+}
+
+// Binary matrix files (.mm) are a header followed by the values in column
+// major order, which is also Eigen's layout, so a load is a single copy out
+// of the mapped file.
+
+#define MathMatrix_MAGIC "SOLARMM1"
+
+struct MathMatrixFileHeader
+{
+    char magic[8];
+    int64_t rows;
+    int64_t cols;
+};
+
+static bool MathMatrixBinaryName (const char* filename)
+{
+    size_t len = strlen (filename);
+    return len > 3 && !strcmp (&filename[len-3], ".mm");
+}
+
+static int MathMatrixOutputBinary (MatrixXd* omatrix, const char* filename,
+				   Tcl_Interp* interp)
+{
+    FILE* ofile = fopen (filename, "wb");
+    if (!ofile)
+    {
+	std::string errmess("Unable to open output file: ");
+	errmess += filename;
+	RESULT_BUF (errmess.c_str());
+	return TCL_ERROR;
+    }
+    MathMatrixFileHeader header;
+    memcpy (header.magic, MathMatrix_MAGIC, 8);
+    header.rows = omatrix->rows();
+    header.cols = omatrix->cols();
+    size_t count = (size_t) header.rows * header.cols;
+    bool ok = (1 == fwrite (&header, sizeof(header), 1, ofile));
+    ok = ok && (count == fwrite (omatrix->data(), sizeof(double), count, ofile));
+    ok = (0 == fclose (ofile)) && ok;
+    if (!ok)
+    {
+	std::string errmess("Error writing matrix file: ");
+	errmess += filename;
+	RESULT_BUF (errmess.c_str());
+	return TCL_ERROR;
+    }
+    std::stringstream rmess;
+    rmess << header.rows << " rows, " << header.cols << " cols written";
+    RESULT_BUF (rmess.str().c_str());
+    return TCL_OK;
+}
+
+// If filename is a binary matrix file, load it and set *loaded.
+// Otherwise do nothing so caller reads it as CSV.
+
+static int MathMatrixLoadBinary (const char* filename, bool* loaded,
+				 bool options, Tcl_Interp* interp)
+{
+    *loaded = false;
+    int fd = open (filename, O_RDONLY);
+    if (fd < 0) return TCL_OK;  // caller reports missing file
+
+    MathMatrixFileHeader header;
+    if (sizeof(header) != read (fd, &header, sizeof(header)) ||
+	memcmp (header.magic, MathMatrix_MAGIC, 8))
+    {
+	close (fd);
+	return TCL_OK;
+    }
+    if (options)
+    {
+	close (fd);
+	RESULT_LIT ("Matrix load options not supported for binary matrix file");
+	return TCL_ERROR;
+    }
+    struct stat statbuf;
+    size_t count = (size_t) header.rows * header.cols;
+    if (fstat (fd, &statbuf) || header.rows < 0 || header.cols < 0 ||
+	statbuf.st_size != sizeof(header) + count*sizeof(double))
+    {
+	close (fd);
+	std::string errmess("Invalid binary matrix file: ");
+	errmess += filename;
+	RESULT_BUF (errmess.c_str());
+	return TCL_ERROR;
+    }
+    MatrixXd* newmatrix = new MatrixXd (header.rows, header.cols);
+    if (count)
+    {
+	void* addr = mmap (0, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+	    close (fd);
+	    delete newmatrix;
+	    RESULT_LIT ("Unable to map binary matrix file");
+	    return TCL_ERROR;
+	}
+	memcpy (newmatrix->data(), (char*) addr + sizeof(header),
+		count*sizeof(double));
+	munmap (addr, statbuf.st_size);
+    }
+    close (fd);
+    MathMatrixV.push_back (newmatrix);
+    char namebuf[64];
+    sprintf (namebuf, "%s%d", MathMatrix_PREFIX, MathMatrixV.size());
+    RESULT_BUF (namebuf);
+    *loaded = true;
+    return TCL_OK;
+}
+
 // Power command for MathMatrix
 //   power command in solar.tcl redirects here if first arg is mathmatrix
 
@@ -248,33 +499,25 @@ extern "C" int MatrixPowerCmd (ClientData clientData, Tcl_Interp *interp,
 }
 
 // Overloaded Matrix and Vector (1D Matrix) and Scalar multiplication
-// Times has options -e (elementwise)
+// Times has options -e (elementwise), -out <matrix> and -inplace
 extern "C" int TimesCmd (ClientData clientData, Tcl_Interp *interp,
 			 int argc, char* argv[])
 {
-    int option = 0;
-    int first_index = 1;
     bool scalar_1 = false;
     bool scalar_2 = false;
     double s1, s2;
+    int i1 = -1;
+    int i2 = -1;
 
-    if (argc < 3)
+    MathMatrixDest dest;
+    int first_index = MathMatrixOptions (argc, argv, &dest, true, interp);
+    if (first_index < 0) return TCL_ERROR;
+    if (argc - first_index < 2)
     {
 	RESULT_LIT (
 	    "Usage: Times <option> <matrix-or-scalar> <matrix-or-scalar>");
 	return TCL_ERROR;
     }
-    if (!Strcmp(argv[1], "-e"))
-    {
-	option = 1;
-	first_index++;
-	if (argc < 4)
-	{
-	    RESULT_LIT (
-		"Usage: Times <option> <matrix-or-scalar> <matrix-or-scalar>");
-	    return TCL_ERROR;
-	}
-    }
 
     char* eptr;
 
@@ -292,6 +535,10 @@ extern "C" int TimesCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_LIT ("");
 	scalar_1 = true;
     }
+    else
+    {
+	i1 = LastIndex;
+    }
 
     MatrixXd* m2 = MathMatrixGet (argv[first_index+1], "Times", interp);
     if (!m2)
@@ -307,11 +554,18 @@ extern "C" int TimesCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_LIT ("");
 	scalar_2 = true;
     }
+    else
+    {
+	i2 = LastIndex;
+    }
+    if (dest.inplace)
+    {
+	dest.index = (i1 >= 0) ? i1 : i2;
+    }
 
-    int mindex;
     if (!scalar_1 && !scalar_2)
     {
-	if (option==0)  // standard matrix multiply
+	if (!dest.elementwise)  // standard matrix multiply
 	{
 	    if (m1->cols() != m2->rows())
 	    {
@@ -319,14 +573,22 @@ extern "C" int TimesCmd (ClientData clientData, Tcl_Interp *interp,
 		    "Matrix dimensions not suited to multiply");
 		return TCL_ERROR;
 	    }
-	    MatrixXd* mr = new MatrixXd(m1->cols(),m2->rows());
-	    mindex = MathMatrixV.size() - 1;
 	    if (MathMatrixDebug) printf ("Beginning multiplication\n");
-	    *mr = *m1 * *m2;
+
+// Product is evaluated into a temporary if destination is an operand
+
+	    if (dest.index >= 0 && (dest.index == i1 || dest.index == i2))
+	    {
+		*MathMatrixV[dest.index] = *m1 * *m2;
+	    }
+	    else
+	    {
+		MatrixXd* mr = MathMatrixResult (&dest, m1->rows(), m2->cols());
+		mr->noalias() = *m1 * *m2;
+	    }
 	    if (MathMatrixDebug) printf ("Finished multiplication\n");
-	    MathMatrixV.push_back(mr);
 	}
-	else if (option==1)  // elementwise matrix multiply
+	else  // elementwise matrix multiply
 	{
 	    if (m1->rows() != m2->rows() || m1->cols() != m2->cols())
 	    {
@@ -334,14 +596,12 @@ extern "C" int TimesCmd (ClientData clientData, Tcl_Interp *interp,
 		    "Matrix dimensions not suited to ewise multiply");
 		return TCL_ERROR;
 	    }
-	    MathMatrixV.push_back(new MatrixXd(m1->rows(),m2->cols()));
-	    mindex = MathMatrixV.size() - 1;
-	    *MathMatrixV[mindex] = m1->cwiseProduct(*m2);
+	    MatrixXd* mr = MathMatrixResult (&dest, m1->rows(), m1->cols());
+	    *mr = m1->cwiseProduct(*m2);
 	}
     }
     else  // scalar 1 and/or 2
     {
-	int rows, cols;
 	if (scalar_1 && scalar_2)
 	{
 	    double result = s1 * s2;
@@ -355,31 +615,16 @@ extern "C" int TimesCmd (ClientData clientData, Tcl_Interp *interp,
 
 	if (scalar_1)
 	{
-	    rows = m2->rows();
-	    cols = m2->cols();
-	}
-	else
-	{
-	    rows = m1->rows();
-	    cols = m1->cols();
-	}
-	MathMatrixV.push_back(new MatrixXd(rows, cols));
-	int mindex = MathMatrixV.size() - 1;
-
-	if (scalar_1)
-	{
-	    *MathMatrixV[mindex] = *m2 * s1;
+	    MatrixXd* mr = MathMatrixResult (&dest, m2->rows(), m2->cols());
+	    *mr = *m2 * s1;
 	}
 	else
 	{
-	    *MathMatrixV[mindex] = *m1 * s2;
+	    MatrixXd* mr = MathMatrixResult (&dest, m1->rows(), m1->cols());
+	    *mr = *m1 * s2;
 	}
     }
-
-    char namebuf[64];
-    sprintf (namebuf,"%s%d",MathMatrix_PREFIX,MathMatrixV.size());
-    RESULT_BUF (namebuf);
-    return TCL_OK;
+    return MathMatrixReturn (&dest, interp);
 }
 
 extern "C" int ConcatenateCmd (ClientData clientData, Tcl_Interp *interp,
@@ -852,17 +1097,27 @@ extern "C" int MeanSumCmd (ClientData clientData, Tcl_Interp *interp,
 extern "C" int PlusCmd (ClientData clientData, Tcl_Interp *interp,
 			 int argc, char* argv[])
 {
-    int first_index = 1;
     bool scalar_1 = false;
     bool scalar_2 = false;
     double s1, s2;
     char* eptr;
+    int i1 = -1;
+    int i2 = -1;
 
     if (argc < 3)
     {
 	return MeanSumCmd (clientData, interp, argc, argv);
     }
 
+    MathMatrixDest dest;
+    int first_index = MathMatrixOptions (argc, argv, &dest, false, interp);
+    if (first_index < 0) return TCL_ERROR;
+    if (argc - first_index < 2)
+    {
+	RESULT_LIT ("Usage: plus [-out <matrix>|-inplace] <MathMatrix1> <MathMatrix2>");
+	return TCL_ERROR;
+    }
+
     MatrixXd* m1 = MathMatrixGet (argv[first_index], "plus", interp);
     if (!m1)
     {
@@ -877,6 +1132,10 @@ extern "C" int PlusCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_LIT ("");
 	scalar_1 = true;
     }
+    else
+    {
+	i1 = LastIndex;
+    }
 
     MatrixXd* m2 = MathMatrixGet (argv[first_index+1], "plus", interp);
     if (!m2)
@@ -892,9 +1151,15 @@ extern "C" int PlusCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_LIT ("");
 	scalar_2 = true;
     }
+    else
+    {
+	i2 = LastIndex;
+    }
+    if (dest.inplace)
+    {
+	dest.index = (i1 >= 0) ? i1 : i2;
+    }
 
-    int mindex;
-    
     if (!scalar_1 && !scalar_2)
     {
 	if (m1->rows() != m2->rows() || m1->cols() != m2->cols())
@@ -903,23 +1168,18 @@ extern "C" int PlusCmd (ClientData clientData, Tcl_Interp *interp,
 		"Matrix dimensions not equal as required for plus");
 	    return TCL_ERROR;
 	}
-	MathMatrixV.push_back(new MatrixXd(m1->rows(),m1->cols()));
-	mindex = MathMatrixV.size() - 1;
-
-	*MathMatrixV[mindex] = *m1 + *m2;
+	MatrixXd* mo = MathMatrixResult (&dest, m1->rows(), m1->cols());
+	*mo = *m1 + *m2;
     }
     else if (scalar_1 && !scalar_2)
     {
-	MathMatrixV.push_back(new MatrixXd(m2->rows(),m2->cols()));
-	mindex = MathMatrixV.size() - 1;
+	MatrixXd* mo = MathMatrixResult (&dest, m2->rows(), m2->cols());
 
 // Maddeningly, Eigen doesn't have scalar add and subtract for matrices but
 //   would require conversion into and out of array.  Looping here seems
 //     at least equally good.
 
 	int i,j;
-	MatrixXd* mo = MathMatrixV[mindex];
-
 	for (i=0; i < m2->rows(); i++)
 	{
 	    for (j=0; j < m2->cols(); j++)
@@ -930,12 +1190,9 @@ extern "C" int PlusCmd (ClientData clientData, Tcl_Interp *interp,
     }
     else if (!scalar_1 && scalar_2)
     {
-	MathMatrixV.push_back(new MatrixXd(m1->rows(),m1->cols()));
-	mindex = MathMatrixV.size() - 1;
+	MatrixXd* mo = MathMatrixResult (&dest, m1->rows(), m1->cols());
 
 	int i,j;
-	MatrixXd* mo = MathMatrixV[mindex];
-
 	for (i=0; i < m1->rows(); i++)
 	{
 	    for (j=0; j < m1->cols(); j++)
@@ -955,30 +1212,30 @@ extern "C" int PlusCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_BUF (numbuf);
 	return TCL_OK;
     }
-
-    char namebuf[64];
-    sprintf (namebuf,"%s%d",MathMatrix_PREFIX,MathMatrixV.size());
-    RESULT_BUF (namebuf);
-    return TCL_OK;
+    return MathMatrixReturn (&dest, interp);
 }
 
 // Matrix minus is always elementwise
 extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
 			 int argc, char* argv[])
 {
-    int first_index = 1;
     bool scalar_1 = false;
     bool scalar_2 = false;
     double s1, s2;
     char* eptr;
+    int i1 = -1;
+    int i2 = -1;
 
-    if (argc < 3)
+    MathMatrixDest dest;
+    int first_index = MathMatrixOptions (argc, argv, &dest, false, interp);
+    if (first_index < 0) return TCL_ERROR;
+    if (argc - first_index < 2)
     {
-	RESULT_LIT ("Usage: minus <MathMatrix1> <MathMatrix2>");
+	RESULT_LIT ("Usage: minus [-out <matrix>|-inplace] <MathMatrix1> <MathMatrix2>");
 	return TCL_ERROR;
     }
 
-    MatrixXd* m1 = MathMatrixGet (argv[first_index], "Minus", interp);
+    MatrixXd* m1 = MathMatrixGet (argv[first_index], "minus", interp);
     if (!m1)
     {
 	errno=0;
@@ -992,8 +1249,12 @@ extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_LIT ("");
 	scalar_1 = true;
     }
+    else
+    {
+	i1 = LastIndex;
+    }
 
-    MatrixXd* m2 = MathMatrixGet (argv[first_index+1], "Minus", interp);
+    MatrixXd* m2 = MathMatrixGet (argv[first_index+1], "minus", interp);
     if (!m2)
     {
 	errno=0;
@@ -1007,8 +1268,14 @@ extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_LIT ("");
 	scalar_2 = true;
     }
-
-    int mindex;
+    else
+    {
+	i2 = LastIndex;
+    }
+    if (dest.inplace)
+    {
+	dest.index = (i1 >= 0) ? i1 : i2;
+    }
 
     if (!scalar_1 && !scalar_2)
     {
@@ -1018,22 +1285,18 @@ extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
 		"Matrix dimensions not equal as required for minus");
 	    return TCL_ERROR;
 	}
-	MathMatrixV.push_back(new MatrixXd(m1->rows(),m1->cols()));
-	mindex = MathMatrixV.size() - 1;
-	*MathMatrixV[mindex] = *m1 - *m2;
+	MatrixXd* mo = MathMatrixResult (&dest, m1->rows(), m1->cols());
+	*mo = *m1 - *m2;
     }
     else if (scalar_1 && !scalar_2)
     {
-	MathMatrixV.push_back(new MatrixXd(m2->rows(),m2->cols()));
-	mindex = MathMatrixV.size() - 1;
+	MatrixXd* mo = MathMatrixResult (&dest, m2->rows(), m2->cols());
 
 // Maddeningly, Eigen doesn't have scalar add and subtract for matrices but
 //   would require conversion into and out of array.  Looping here seems
 //     at least equally good.
 
 	int i,j;
-	MatrixXd* mo = MathMatrixV[mindex];
-
 	for (i=0; i < m2->rows(); i++)
 	{
 	    for (j=0; j < m2->cols(); j++)
@@ -1044,12 +1307,9 @@ extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
     }
     else if (!scalar_1 && scalar_2)
     {
-	MathMatrixV.push_back(new MatrixXd(m1->rows(),m1->cols()));
-	mindex = MathMatrixV.size() - 1;
+	MatrixXd* mo = MathMatrixResult (&dest, m1->rows(), m1->cols());
 
 	int i,j;
-	MatrixXd* mo = MathMatrixV[mindex];
-
 	for (i=0; i < m1->rows(); i++)
 	{
 	    for (j=0; j < m1->cols(); j++)
@@ -1058,7 +1318,7 @@ extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
 	    }
 	}
     }
-    else  // two scalars
+    else // two scalars
     {
 	char numbuf[64];
 	char showformat[65];
@@ -1069,11 +1329,7 @@ extern "C" int MinusCmd (ClientData clientData, Tcl_Interp *interp,
 	RESULT_BUF (numbuf);
 	return TCL_OK;
     }
-
-    char namebuf[64];
-    sprintf (namebuf,"%s%d",MathMatrix_PREFIX,MathMatrixV.size());
-    RESULT_BUF (namebuf);
-    return TCL_OK;
+    return MathMatrixReturn (&dest, interp);
 }
 
 
@@ -1159,69 +1415,43 @@ extern "C" int ShuffleCmd (ClientData clientData, Tcl_Interp *interp,
 	srand48(time(NULL));
     }
     seeded = true;
+    unsigned long base = (unsigned long) lrand48();
 
-    for (int iwidth=0; iwidth < bwidth; iwidth++)
+// Each shuffled row (if row vector) or column is a gather through its own
+// shuffle index
+
+#pragma omp parallel
     {
-	if (basevector && iwidth == 0)
+	std::vector<int> shuffle (nele);
+#pragma omp for schedule(dynamic)
+	for (int iwidth=0; iwidth < bwidth; iwidth++)
 	{
+	    if (basevector && iwidth == 0)
+	    {
 
 // copy basevector into first row or column
 
-	    for (unsigned int i = 0; i < nele; i++)
-	    {
-		if (row_vector)
+		for (unsigned int i = 0; i < nele; i++)
 		{
-		    (*mout)(iwidth,i) = (*m1)(0,i);
-		}
-		else
-		{
-		    (*mout)(i,iwidth) = (*m1)(i,0);
+		    shuffle[i] = i;
 		}
 	    }
-	}
-	else
-	{
-
-// shuffle basevector into this row (if row vector) or column
-
-// Knuth aka Fisher-Yates Shuffle
-//   Inside-Out version from Wikipedia 6/2015
-
-	    unsigned int j;
-	    for (unsigned int i = 0; i < nele; i++)
+	    else
 	    {
-		if (i == 0)
-		{
-		    j = 0;
-		}
-		else
-		{
-		    double drand = drand48();
-		    while (drand >= 1) drand = drand48();  // we need < 1.0
-
-// Generate a random number 0 <= j <= i
-
-		    j = (unsigned int) floor (drand*(i+1));
-		}
-
-		if (j!=i)
-		{
-		    if (row_vector)
-		    {
-			(*mout)(iwidth,i) = (*mout)(iwidth,j);
-		    }
-		    else
-		    {
-			(*mout)(i,iwidth) = (*mout)(j,iwidth);
-		    }
-		}
-		if (row_vector)
+		AdvancedRandomShuffle (&shuffle[0], nele, base, iwidth);
+	    }
+	    if (row_vector)
+	    {
+		for (unsigned int i = 0; i < nele; i++)
 		{
-		    (*mout)(iwidth,j) = (*m1)(0,i);
+		    (*mout)(iwidth,i) = (*m1)(0,shuffle[i]);
 		}
-		else
+	    }
+	    else
+	    {
+		for (unsigned int i = 0; i < nele; i++)
 		{
-		    (*mout)(j,iwidth) = (*m1)(i,0);
+		    (*mout)(i,iwidth) = (*m1)(shuffle[i],0);
 		}
 	    }
 	}
@@ -1243,8 +1473,6 @@ extern "C" int ShuffleCmd (ClientData clientData, Tcl_Interp *interp,
 extern "C" int PermuteFCmd (ClientData clientData, Tcl_Interp *interp,
 			 int argc, char* argv[])
 {
-    static bool seeded = false;
-
     if (argc != 5)
     {
 	RESULT_LIT ("Usage: permutef <F> <XB> <Hx> <nP>");
@@ -1262,7 +1490,7 @@ extern "C" int PermuteFCmd (ClientData clientData, Tcl_Interp *interp,
     errno = 0;
     char* eptr;
     long np = strtol (argv[4], &eptr, 10);
-    if (errno || *eptr != '\0' || np < INT_MIN || np > INT_MAX)
+    if (errno || *eptr != '\0' || np < 0 || np > INT_MAX-1)
     {
 	RESULT_LIT ("permutef: invalid nP");
 	return TCL_ERROR;
@@ -1272,86 +1500,43 @@ extern "C" int PermuteFCmd (ClientData clientData, Tcl_Interp *interp,
     int rows = mHx->rows();
     int incols = mHx->cols();
     int outcols = nP + 1;
+    if (incols != rows || mF->rows() != rows || mXB->rows() != rows)
+    {
+	RESULT_LIT ("permutef: Hx must be square with rows of F and XB");
+	return TCL_ERROR;
+    }
 
     MatrixXd* mFp = new MatrixXd(rows,outcols);
 
+// Each element of column j of mFp is Hx row sum times (F+XB) element,
+// with F shuffled in columns after the first.  Row sums are done once.
 
-// First column of output matrix mFp is Hx * F+XB
-
-    int i,j;
+    VectorXd hsum = mHx->rowwise().sum();
+    VectorXd f = mF->col(0);
+    VectorXd xb = mXB->col(0);
 
-    {
-
-// Cache f and xb
+// Seed
 
-	double f[rows];
-	double xb[rows];
-	for (i = 0; i < rows; i++)
-	{
-	    f[i]  = (*mF)(i,0);
-	    xb[i] = (*mXB)(i,0);
-	}
-	
-// Compute first column
+    AdvancedRandomSeed (1); // fixed seed each time
+    unsigned long base = mt();
 
-	for (i = 0; i < rows; i++)
+#pragma omp parallel
+    {
+	std::vector<int> shuffle (rows);
+#pragma omp for schedule(dynamic)
+	for (int jout = 0; jout < outcols; jout++)
 	{
-	    double accum = 0;
-	    for (j = 0; j < incols; j++)
+	    if (jout == 0)
 	    {
-		accum += (*mHx)(i,j) * (f[i] + xb[i]);
+		for (int i = 0; i < rows; i++) shuffle[i] = i;
 	    }
-	    (*mFp)(i,0) = accum;
-	}
-
-// Remaining columns of output matrix mFp have shuffled F+XB
-// We first generate shuffle index, then do multiply as above
-
-// Seed
-
-	AdvancedRandomSeed (1); // fixed seed each time
-
-	for (int jout = 1; jout < outcols; jout++)
-	{
-
-// create shuffle index vector using
-// Knuth aka Fisher-Yates Shuffle
-//   Inside-Out version from Wikipedia 6/2015
-
-//	    if (jout % 100 == 0) printf ("Computing column %d\n",jout);
-
-	    int shuffle[incols];
-	    int r;
-
-	    for (i = 0; i < incols; i++)
+	    else
 	    {
-		if (i == 0)
-		{
-		    r = 0;
-		}
-		else
-		{
-		    r = AdvancedRandomDraw(i);  // 0 <= r <= i
-		}
-
-		if (r!=i)
-		{
-		    shuffle[i] = r;
-		}
-		shuffle[r] = i;
+		AdvancedRandomShuffle (&shuffle[0], rows, base, jout);
 	    }
-
-// Do multiply as before, but now with randomized F
-	    for (i = 0; i < rows; i++)
+	    for (int i = 0; i < rows; i++)
 	    {
-		double accum = 0;
-		for (j = 0; j < incols; j++)
-		{
-// this inner loop useful for test purposes
-//		    accum += 1.0;
-		    accum += (*mHx)(i,j) * (f[shuffle[i]] + xb[i]);
-		}
-		(*mFp)(i,jout) = accum;
+		(*mFp)(i,jout) = hsum(i) * (f(shuffle[i]) + xb(i));
 	    }
 	}
     }
@@ -1369,26 +1554,34 @@ extern "C" int PermuteFCmd (ClientData clientData, Tcl_Interp *interp,
 //      note: srF is unsquared F residuals: (Y - XB)
 //            regular F is (Y-XB)^2
 //      this allows us to shuffle the shuffle the srF part but leave XB alone
+// If matrix M is given, M * Y* is returned instead, computed a block of
+// columns at a time so Y* itself is never stored.
 
 extern "C" int PermuteYCmd (ClientData clientData, Tcl_Interp *interp,
 			 int argc, char* argv[])
 {
-    if (argc != 4)
+    if (argc != 4 && argc != 5)
     {
-	RESULT_LIT ("Usage: permutey <XB> <srF> <nP>");
+	RESULT_LIT ("Usage: permutey <XB> <srF> <nP> [<M>]");
 	return TCL_ERROR;
     }
     MatrixXd* mXB = MathMatrixGet (argv[1], "permuteY", interp);
     if (!mXB) return TCL_ERROR;
     MatrixXd* mSRF = MathMatrixGet (argv[2], "permuteY", interp);
     if (!mSRF) return TCL_ERROR;
+    MatrixXd* mM = 0;
+    if (argc == 5)
+    {
+	mM = MathMatrixGet (argv[4], "permuteY", interp);
+	if (!mM) return TCL_ERROR;
+    }
 
 // Get nP
 
     errno = 0;
     char* eptr;
     long np = strtol (argv[3], &eptr, 10);
-    if (errno || *eptr != '\0' || np < INT_MIN || np > INT_MAX)
+    if (errno || *eptr != '\0' || np < 0 || np > INT_MAX-1)
     {
 	RESULT_LIT ("permuteY: invalid nP");
 	return TCL_ERROR;
@@ -1404,58 +1597,69 @@ extern "C" int PermuteYCmd (ClientData clientData, Tcl_Interp *interp,
     if (mXB->cols() != 1)
     {
 	RESULT_LIT ("permuteY: XB is not a column vector");
+	return TCL_ERROR;
     }
     
     int rows = mXB->rows();
     int cols = nP + 1;
+    if (mSRF->rows() != rows)
+    {
+	RESULT_LIT ("permuteY: srF and XB must have same number of rows");
+	return TCL_ERROR;
+    }
+    if (mM && mM->cols() != rows)
+    {
+	RESULT_LIT ("permuteY: M columns must equal rows of XB");
+	return TCL_ERROR;
+    }
 
-    MatrixXd* mY = new MatrixXd(rows,cols);
-
-// First column of output matrix mY is srF + XB
-
-    int i,j;
-
-    mY->col(0) = mSRF->col(0) + mXB->col(0);
-
-// Remaining columns of output matrix mSRFp have shuffled F+XB
-// We first generate shuffle index, then do multiply as above
+    MatrixXd* mY = new MatrixXd((mM) ? mM->rows() : rows, cols);
 
 // Seed
 
     AdvancedRandomSeed (1); // use same fixed seed each time
+    unsigned long base = mt();
 
-    int shuffle[rows];
-    for (int jout = 1; jout < cols; jout++)
-    {
+// First column of Y* is srF + XB, remaining columns have shuffled srF.
+// Each block of columns is gathered into mY directly, or into a block
+// buffer which is then multiplied by M.
 
-// create shuffle index using
-// Knuth aka Fisher-Yates Shuffle
-//   Inside-Out version from Wikipedia 6/2015
+    int nblocks = (cols + PERMUTE_BLOCK - 1) / PERMUTE_BLOCK;
+#pragma omp parallel
+    {
+	std::vector<int> shuffle (rows);
+	MatrixXd block;
+	if (mM) block.resize (rows, PERMUTE_BLOCK);
 
-	int r;
-	for (i = 0; i < rows; i++)
+#pragma omp for schedule(dynamic)
+	for (int iblock = 0; iblock < nblocks; iblock++)
 	{
-	    if (i == 0)
+	    int first = iblock * PERMUTE_BLOCK;
+	    int count = std::min (PERMUTE_BLOCK, cols - first);
+	    for (int k = 0; k < count; k++)
 	    {
-		r = 0;
-	    }
-	    else
-	    {
-		r = AdvancedRandomDraw(i);  // 0 <= r <= i
+		int jout = first + k;
+		if (jout == 0)
+		{
+		    for (int i = 0; i < rows; i++) shuffle[i] = i;
+		}
+		else
+		{
+		    AdvancedRandomShuffle (&shuffle[0], rows, base, jout);
+		}
+		double* ycol = (mM) ? &block(0,k) : &(*mY)(0,jout);
+		const double* xb = mXB->data();
+		const double* srf = mSRF->data();
+		for (int i = 0; i < rows; i++)
+		{
+		    ycol[i] = xb[i] + srf[shuffle[i]];
+		}
 	    }
-	    
-	    if (r!=i)
+	    if (mM)
 	    {
-		shuffle[i] = r;
+		mY->middleCols (first, count).noalias() =
+		    (*mM) * block.leftCols (count);
 	    }
-	    shuffle[r] = i;
-	}
-
-// Create this column following shuffle index for mSRF part
-
-	for (i = 0; i < rows; i++)
-	{
-	    (*mY)(i,jout) = (*mXB)(i,0) + (*mSRF)(shuffle[i],0);
 	}
     }
 
@@ -1709,6 +1913,10 @@ extern "C" int MathMatrixOutputCmd (ClientData clientData, Tcl_Interp *interp,
     MatrixXd* omatrix = MathMatrixGet (argv[1], "output", interp);
     if (!omatrix) return TCL_ERROR;
     char* filename = argv[2];
+    if (MathMatrixBinaryName (filename))
+    {
+	return MathMatrixOutputBinary (omatrix, filename, interp);
+    }
 
     ofstream ofile;
     ofile.open (filename);
@@ -2019,6 +2227,14 @@ int MathMatrixLoad (int argc, char* argv[], Tcl_Interp* interp)
 
     if (MathMatrixDebug)printf("argv[%d] is %s\n",firstindex,argv[firstindex]);
 
+    bool loaded;
+    if (TCL_OK != MathMatrixLoadBinary (argv[firstindex], &loaded,
+			       SelectedColumns.size() || urows, interp))
+    {
+	return TCL_ERROR;
+    }
+    if (loaded) return TCL_OK;
+
     std::ifstream matrix_file (argv[firstindex]); // open csv file
 
     if (MathMatrixDebug) printf ("file opened\n");
@@ -2321,34 +2537,42 @@ int MathMatrixLoad (int argc, char* argv[], Tcl_Interp* interp)
 extern "C" int TransposeCmd (ClientData clientData, Tcl_Interp *interp,
 			 int argc, char* argv[])
 {
-    if (argc != 2 || strncmp (MathMatrix_PREFIX,argv[1],
-			      strlen(MathMatrix_PREFIX)))
+    MathMatrixDest dest;
+    int first_index = MathMatrixOptions (argc, argv, &dest, false, interp);
+    if (first_index < 0) return TCL_ERROR;
+    if (argc - first_index != 1 || strncmp (MathMatrix_PREFIX,
+				argv[first_index], strlen(MathMatrix_PREFIX)))
     {
-	RESULT_LIT ("transpose <MathMatrix>");
+	RESULT_LIT ("transpose [-out <matrix>|-inplace] <MathMatrix>");
 	return TCL_ERROR;
     }
 
 // Identify matrix to be transposed
 
-    MatrixXd* oldmatrix = MathMatrixGet (argv[1],"Transpose",interp);
+    MatrixXd* oldmatrix = MathMatrixGet (argv[first_index],"Transpose",interp);
     if (!oldmatrix) return TCL_ERROR;
+    if (dest.inplace)
+    {
+	dest.index = LastIndex;
+    }
 
-// Transpose is done by making new matrix of the correct size
-//   and assigning to it.
+// Transpose to a new or different matrix is done by assigning to it,
+//   transpose into the same matrix is done in place.
 
     int rows = oldmatrix->rows();
     int cols = oldmatrix->cols();
-    if (MathMatrixDebug) printf ("making new matrix(%d,%d)\n",
-				 cols,rows);
-    MatrixXd* newmatrix = new MatrixXd (cols,rows);
-    *newmatrix = oldmatrix->transpose();
-
-    MathMatrixV.push_back(newmatrix);
-
-    char namebuf[64];
-    sprintf (namebuf,"%s%d",MathMatrix_PREFIX,MathMatrixV.size());
-    RESULT_BUF (namebuf);
-    return TCL_OK;
+    if (dest.index >= 0 && MathMatrixV[dest.index] == oldmatrix)
+    {
+	oldmatrix->transposeInPlace();
+    }
+    else
+    {
+	if (MathMatrixDebug) printf ("making new matrix(%d,%d)\n",
+				     cols,rows);
+	MatrixXd* newmatrix = MathMatrixResult (&dest, cols, rows);
+	*newmatrix = oldmatrix->transpose();
+    }
+    return MathMatrixReturn (&dest, interp);
 }
 
 int MathMatrixNew (int argc, char* argv[], Tcl_Interp* interp)
@@ -2559,8 +2783,7 @@ extern "C" int MathMatrixCmd (ClientData clientData, Tcl_Interp *interp,
 	{
 	    MatrixXd* m1 = MathMatrixGet (argv[i], "Delete", interp);
 	    if (!m1) return TCL_ERROR;
-	    delete m1;
-	    MathMatrixV[LastIndex] = 0;
+	    MathMatrixRelease (LastIndex);
 	}
 	return TCL_OK;
     }
@@ -2569,8 +2792,16 @@ extern "C" int MathMatrixCmd (ClientData clientData, Tcl_Interp *interp,
     {
 	MatrixXd* m1 = MathMatrixGet (argv[1], "Delete", interp);
 	if (!m1) return TCL_ERROR;
-	delete m1;
-	MathMatrixV[LastIndex] = 0;
+	MathMatrixRelease (LastIndex);
+	return TCL_OK;
+    }
+
+    if (argc==3 && !Strcmp (argv[1], "retain"))
+    {
+	MatrixXd* m1 = MathMatrixGet (argv[2], "Retain", interp);
+	if (!m1) return TCL_ERROR;
+	MathMatrixRetained[LastIndex]++;
+	RESULT_BUF (argv[2]);
 	return TCL_OK;
     }
 
@@ -2585,6 +2816,7 @@ extern "C" int MathMatrixCmd (ClientData clientData, Tcl_Interp *interp,
 	    }
 	}
 	MathMatrixV.clear();
+	MathMatrixRetained.clear();
 	EvaluesIndex = -1;
 	EvectorsIndex = -1;
 	Min_i = INT_MIN;
@@ -17,7 +17,9 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <string>
+#include <thread>
 
 #ifdef TR1
 #include <tr1/unordered_map>
@@ -28,6 +30,7 @@
 #include "solar.h"
 #include "tablefile.h"
 #include "pipeback.h"
+#include "zlib.h"
 
 int Matrix::count = 0;
 Matrix* Matrix::Matrices[] = {0};
@@ -648,10 +651,147 @@ const char* Matrix::load_pedigree ()
     return 0;
 }
 
+// Matrix prefetch
+//   matrix prefetch <filename> inflates a matrix file into memory on a
+//   background thread, so that a later load of the same file (typically the
+//   next locus of a multipoint scan) need not wait for decompression.
+//   One file is held at a time.  The prefetched image is used only if the
+//   file has not been modified since, otherwise load reads the file as usual.
+//   zlib is used directly because pipeback is not safe to use from a thread.
+//   A location held in a packed mIBD file (see mibdpack.cc) is prefetched
+//   by decoding it from the pack, whose status then decides currency.
+
+extern std::string mibd_pack_source (const char *filename);
+extern bool mibd_pack_image (const char *filename, std::string& text,
+			     const char **message);
+
+static std::thread Prefetch_Thread;
+static std::string Prefetch_Filename;
+static std::string Prefetch_Source;
+static std::string Prefetch_Data;
+static time_t Prefetch_Mtime = 0;
+static off_t Prefetch_Size = 0;
+static bool Prefetch_Ok = false;
+
+static void prefetch_inflate ()
+{
+    Prefetch_Ok = false;
+    Prefetch_Data.clear ();
+    if (Prefetch_Source != Prefetch_Filename)
+    {
+	const char *message;
+	Prefetch_Ok = mibd_pack_image (Prefetch_Filename.c_str(),
+				       Prefetch_Data, &message);
+	return;
+    }
+    gzFile gfile = gzopen (Prefetch_Filename.c_str(), "rb");
+    if (!gfile) return;
+    char buf[65536];
+    int nread;
+    while (0 < (nread = gzread (gfile, buf, sizeof (buf))))
+    {
+	Prefetch_Data.append (buf, nread);
+    }
+    gzclose (gfile);
+    Prefetch_Ok = (nread == 0 && Prefetch_Data.size() > 0);
+}
+
+static void prefetch_join ()
+{
+    if (Prefetch_Thread.joinable()) Prefetch_Thread.join ();
+}
+
+static bool prefetch_stat (const char *filename, time_t *mtime, off_t *size)
+{
+    struct stat statbuf;
+    if (stat (filename, &statbuf)) return false;
+    *mtime = statbuf.st_mtime;
+    *size = statbuf.st_size;
+    return true;
+}
+
+const char* Matrix::prefetch (const char *specified_filename)
+{
+    char *filename = append_extension (specified_filename, ".gz");
+    prefetch_join ();
+    if (Prefetch_Ok && Prefetch_Filename == filename)
+    {
+	time_t mtime;
+	off_t size;
+	if (prefetch_stat (Prefetch_Source.c_str(), &mtime, &size) &&
+	    mtime == Prefetch_Mtime && size == Prefetch_Size)
+	{
+	    free (filename);
+	    return 0;
+	}
+    }
+    Prefetch_Ok = false;
+    Prefetch_Data.clear ();
+    Prefetch_Filename = filename;
+    Prefetch_Source = filename;
+    bool found = prefetch_stat (filename, &Prefetch_Mtime, &Prefetch_Size);
+    if (!found)
+    {
+	Prefetch_Source = mibd_pack_source (filename);
+	found = Prefetch_Source.size() &&
+	    prefetch_stat (Prefetch_Source.c_str(), &Prefetch_Mtime,
+			   &Prefetch_Size);
+    }
+    free (filename);
+    if (!found)
+    {
+	Prefetch_Filename.clear ();
+	Prefetch_Source.clear ();
+	return "Unable to open matrix file";
+    }
+    static bool exit_join = false;
+    if (!exit_join)
+    {
+	atexit (prefetch_join);
+	exit_join = true;
+    }
+    Prefetch_Thread = std::thread (prefetch_inflate);
+    return 0;
+}
+
+// Take ownership of the prefetched image of filename, if there is a
+//   current one.  Waits for the prefetch thread if it is still reading.
+
+static bool prefetch_take (const char *filename, std::string& data)
+{
+    if (Prefetch_Filename != filename) return false;
+    prefetch_join ();
+    time_t mtime;
+    off_t size;
+    bool current = Prefetch_Ok &&
+	prefetch_stat (Prefetch_Source.c_str(), &mtime, &size) &&
+	mtime == Prefetch_Mtime && size == Prefetch_Size;
+    if (current) data.swap (Prefetch_Data);
+    Prefetch_Data.clear ();
+    Prefetch_Filename.clear ();
+    Prefetch_Source.clear ();
+    Prefetch_Ok = false;
+    return current;
+}
+
+static void matrix_stream_close (FILE *mfile, bool in_memory)
+{
+    if (in_memory)
+    {
+	fclose (mfile);
+    }
+    else
+    {
+	pipeback_shell_close (mfile);
+    }
+}
+
 // May be new "load," or a "re-load" of same filename
 
 const char* Matrix::load (const char *specified_filename)
 {
+    Profile_Timer timer (prof_matrix_load);
+
 // Remove this matrix from matrix array until done
     remove ();
 
@@ -682,16 +822,43 @@ const char* Matrix::load (const char *specified_filename)
     {
 	loading_filename = Strdup (filename);
     }
-    FILE *mfile = fopen (loading_filename, "r");
-    if (!mfile)
+// Use image from matrix prefetch or mIBD pack if there is one
+
+    std::string prefetched;
+    bool in_memory = prefetch_take (loading_filename, prefetched);
+    FILE *mfile = 0;
+    if (!in_memory)
     {
-	return "Unable to open matrix file";
+	mfile = fopen (loading_filename, "r");
+	if (!mfile)
+	{
+	    const char *pack_message;
+	    in_memory = mibd_pack_image (loading_filename, prefetched,
+					 &pack_message);
+	    if (!in_memory)
+	    {
+		return pack_message ? pack_message :
+		    "Unable to open matrix file";
+	    }
+	}
+	else
+	{
+	    if (EOF == fgetc (mfile))
+	    {
+		return "Matrix file is empty";
+	    }
+	    Fclose (mfile);
+	}
     }
-    if (EOF == fgetc (mfile))
+    struct stat loadstat;
+    if (in_memory)
     {
-	return "Matrix file is empty";
+	timer.bytes (prefetched.size());
+    }
+    else if (!stat (loading_filename, &loadstat))
+    {
+	timer.bytes (loadstat.st_size);
     }
-    Fclose (mfile);
 //
 // Clear error file if it exists
 //
@@ -866,7 +1033,14 @@ const char* Matrix::load (const char *specified_filename)
 
 
 //    printf ("Opening matrix file through gunzip\n");
-      mfile = pipeback_shell_open ("gunzip", pbarg);
+      if (in_memory)
+      {
+	  mfile = fmemopen ((void*) prefetched.data(), prefetched.size(), "r");
+      }
+      else
+      {
+	  mfile = pipeback_shell_open ("gunzip", pbarg);
+      }
       if (!mfile)
       {
 	return "Unable to uncompress matrix file";
@@ -970,7 +1144,7 @@ const char* Matrix::load (const char *specified_filename)
 		(m2 && matrix2pos==-1) ||
 		(Famid_Needed && ((famid1pos==-1) || (famid2pos==-1))))
 	    {
-		pipeback_shell_close (mfile);
+		matrix_stream_close (mfile, in_memory);
 		if (id1pos==-1)
 		{
 		    printf ("matrix line: %s\n",errorsbuf);
@@ -1033,7 +1207,7 @@ const char* Matrix::load (const char *specified_filename)
 	    int dpos =  decimal_ptr - buf;  // compare pointers to get dpos
 	    if (!decimal_ptr || dpos < 4)
 	    {
-		pipeback_shell_close (mfile);
+		matrix_stream_close (mfile, in_memory);
 		printf ("matrix line: %s\n",errorsbuf);
 		return "Invalid tab matrix file format";
 	    }
@@ -1067,7 +1241,7 @@ const char* Matrix::load (const char *specified_filename)
 		{
 		    if (!strlen(rptr))
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			printf ("matrix line: %s\n",errorsbuf);
 			return "Matrix record has required last field blank\n";
 		    }
@@ -1081,7 +1255,7 @@ const char* Matrix::load (const char *specified_filename)
 		{
 		    if (!strlen(rptr))
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			printf ("matrix line: %s\n",errorsbuf);
 			return "matrix id1 value missing";
 		    }
@@ -1091,7 +1265,7 @@ const char* Matrix::load (const char *specified_filename)
 		{
 		    if (!strlen(rptr))
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			printf ("matrix line: %s\n",errorsbuf);
 			return "matrix id2 value missing";
 		    }
@@ -1124,7 +1298,7 @@ const char* Matrix::load (const char *specified_filename)
 		    matrix1 = strtof (rptr, &endptr);
 		    if (errno || endptr == rptr)
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			if (!strlen(rptr))
 			{
 			    printf ("matrix line: %s\n",errorsbuf);
@@ -1137,7 +1311,7 @@ const char* Matrix::load (const char *specified_filename)
 		    {
 			if (!isspace (*endptr++))
 			{
-			    pipeback_shell_close (mfile);
+			    matrix_stream_close (mfile, in_memory);
 			    printf ("matrix line: %s\n",errorsbuf);
 			    return "Matrix1 value has invalid suffix";
 			}
@@ -1150,7 +1324,7 @@ const char* Matrix::load (const char *specified_filename)
 		    matrix2 = strtof (rptr, &endptr);
 		    if (errno || endptr == rptr)
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			if (!strlen(rptr))
 			{
 			    printf ("matrix line: %s\n",errorsbuf);
@@ -1163,7 +1337,7 @@ const char* Matrix::load (const char *specified_filename)
 		    {
 			if (!isspace (*endptr++))
 			{
-			    pipeback_shell_close (mfile);
+			    matrix_stream_close (mfile, in_memory);
 			    printf ("matrix line: %s\n",errorsbuf);
 			    return "Matrix2 value has invalid suffix";
 			}
@@ -1173,7 +1347,7 @@ const char* Matrix::load (const char *specified_filename)
 		{
 		    if (!strlen(rptr))
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			printf ("matrix line: %s\n",errorsbuf);
 			return "matrix famid1 value missing";
 		    }
@@ -1183,7 +1357,7 @@ const char* Matrix::load (const char *specified_filename)
 		{
 		    if (!strlen(rptr))
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			printf ("matrix line: %s\n",errorsbuf);
 			return "matrix famid2 value missing";
 		    }
@@ -1201,7 +1375,7 @@ const char* Matrix::load (const char *specified_filename)
 		{
 		    if (ifield+1 < maxposneeded)
 		    {
-			pipeback_shell_close (mfile);
+			matrix_stream_close (mfile, in_memory);
 			printf ("matrix line: %s\n",errorsbuf);
 			return "Matrix record has last field blank";
 		    }
@@ -1214,7 +1388,7 @@ const char* Matrix::load (const char *specified_filename)
 	    {
 		if (!got_possible_cksum)
 		{
-		    pipeback_shell_close (mfile);
+		    matrix_stream_close (mfile, in_memory);
 		    printf ("matrix line: %s\n",errorsbuf);
 		    return "Matrix has incorrectly formatted checksum";
 		}
@@ -1326,14 +1500,14 @@ const char* Matrix::load (const char *specified_filename)
 	    scount = sscanf (buf, "%d %d %s", &ibdid1, &ibdid2, dummy);
 	    if (scount != 2)
 	    {
-		pipeback_shell_close (mfile);
+		matrix_stream_close (mfile, in_memory);
 		printf ("matrix line: %s\n",errorsbuf);
 		return "Error reading matrix file record";
 	    }
 	    if (ibdid1 > Pedindex_Highest_Ibdid ||
 		ibdid2 > Pedindex_Highest_Ibdid)
 	    {
-		pipeback_shell_close (mfile);
+		matrix_stream_close (mfile, in_memory);
 		printf ("matrix line: %s\n",errorsbuf);
 		return "Invalid ID found in matrix file";
 	    }
@@ -1344,7 +1518,7 @@ const char* Matrix::load (const char *specified_filename)
 		scount = sscanf (&buf[first_len], "%f", &matrix1);
 		if (scount != 1)
 		{
-		    pipeback_shell_close (mfile);
+		    matrix_stream_close (mfile, in_memory);
 		    printf ("matrix line: %s\n",errorsbuf);
 		    return "Error reading matrix1 value";
 		}
@@ -1353,7 +1527,7 @@ const char* Matrix::load (const char *specified_filename)
 		scount = sscanf (&buf[first_len], "%f %f", &matrix1,&matrix2);
 		if (scount != 2)
 		{
-		    pipeback_shell_close (mfile);
+		    matrix_stream_close (mfile, in_memory);
 		    printf ("matrix line: %s\n",errorsbuf);
 		    return "Error reading matrix2 value";
 		}
@@ -1443,7 +1617,7 @@ const char* Matrix::load (const char *specified_filename)
 	}
 
       } // end of file reading loop
-      pipeback_shell_close (mfile);
+      matrix_stream_close (mfile, in_memory);
 //      printf ("Closed mfile\n");
       if (must_retry) continue;
 //      printf ("breaking from read loop\n");
@@ -1651,6 +1825,11 @@ extern "C" int MatrixCmd (ClientData clientData, Tcl_Interp *interp,
     {
 	return MathMatrixCmd (clientData, interp, argc, argv);
     }
+
+    if (argc == 3 && !Strcmp ("retain", argv[1]))
+    {
+	return MathMatrixCmd (clientData, interp, argc, argv);
+    }
     
     if (argc>1 && !Strcmp ("load", argv[1]))
     {
@@ -1734,6 +1913,19 @@ extern "C" int MatrixCmd (ClientData clientData, Tcl_Interp *interp,
 	return TCL_OK;
     }
 
+    if (argc == 3 && !StringCmp (argv[1], "prefetch", case_ins))
+    {
+	const char *message = Matrix::prefetch (argv[2]);
+	if (message)
+	{
+	    char buf[1024];
+	    sprintf (buf, "%s:  %s", message, argv[2]);
+	    RESULT_BUF (buf);
+	    return TCL_ERROR;
+	}
+	return TCL_OK;
+    }
+
     if ((argc >= 4 && argc <= 6) && !StringCmp (argv[1], "load", case_ins))
     {
     // Setup new Matrices
@@ -183,6 +183,7 @@ extern "C" int MaximizeCmd (ClientData clientData, Tcl_Interp *interp,
 
 int Loglike::maximize (Tcl_Interp *interp, const char *outfilename)
 {
+    Profile_Timer timer (prof_maximize);
     Save_Maximize_Interp = interp;
 
     Loglike::_status = failed;
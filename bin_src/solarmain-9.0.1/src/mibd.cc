@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <math.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "solar.h"
 #include "tcl.h"
@@ -20,11 +21,32 @@
 extern bool  XLinked;
 extern float MibdWin;
 extern bool  MMSibs;
+extern int   IbdThreads;
 
 static int run_relate (Tcl_Interp*, int);
 static int run_merge (Tcl_Interp*);
 static int run_means (Tcl_Interp*, bool);
 
+static bool multipnt_has_locations (Tcl_Interp*);
+static int run_multipnt_all (Tcl_Interp*, const char*, double, double, double);
+static int run_multipnt_each (Tcl_Interp*, const char*, double, double,
+                              double);
+
+// Multipoint IBD location jobs run by the JobPool
+struct MibdJobs {
+    Tcl_Interp *interp;
+    JobPool *pool;
+    const char *mibddir;
+    const char *chrnum;
+    char **clocn;
+    int nloc;
+    bool parallel;
+    char *errors;
+};
+
+static void mibd_finished (int, int, void*);
+static void format_locn (double, char*);
+
 // DEC doesn't have this header file
 //#include <sunmath.h>
 #include "math.h"
@@ -390,89 +412,258 @@ Use the ibdoption command to increase MibdWin.",
             }
         }
 
-        char show_status = 'n';
-        FILE *ttyfp = fopen("/dev/tty", "w");
-        if (ttyfp) {
-            show_status = 'y';
-            fprintf(ttyfp, "Computing multi-point IBDs: ");
-            fclose(ttyfp);
-        }
+    // a multipnt with -locations computes the whole chromosome in one run;
+    // an older multipnt (such as a precompiled one) is run once per location
+        int status;
+        if (multipnt_has_locations(interp))
+            status = run_multipnt_all(interp, mibddir, from, to, incr);
+        else
+            status = run_multipnt_each(interp, mibddir, from, to, incr);
+        printf("\n"); fflush(stdout);
+        return status;
+    }
 
-        for (locn = from; locn <= to + 0.000001; locn += incr)
+    RESULT_LIT ("Invalid mibd command");
+    return TCL_ERROR;
+}
+
+// Returns true if the multipnt on the PATH has the -locations mode, which
+// is shown in its usage message.  The answer is kept for the session.
+bool multipnt_has_locations (Tcl_Interp *interp)
+{
+    static int has_locations = -1;
+    if (has_locations < 0) {
+        Solar_Eval(interp, "catch {exec multipnt} multipnt_usage");
+        Solar_Eval(interp, "set multipnt_usage");
+        has_locations = strstr(Tcl_GetStringResult (interp), "-locations")
+                        ? 1 : 0;
+        Solar_Eval(interp, "unset multipnt_usage");
+        Tcl_ResetResult (interp);
+    }
+    return has_locations;
+}
+
+// One multipnt run reads the merged IBDs once and computes all the
+// locations, IbdThreads at a time, writing each mibd file directly
+int run_multipnt_all (Tcl_Interp *interp, const char *mibddir, double from,
+                      double to, double incr)
+{
+    char mibd_cmd[1024];
+    double locn;
+
+    char show_status = 'n';
+    FILE *ttyfp = fopen("/dev/tty", "w");
+    if (ttyfp) {
+        show_status = 'y';
+        fprintf(ttyfp, "Computing multi-point IBDs: ");
+        fclose(ttyfp);
+    }
+
+    char *run_cmd = Strdup ("exec multipnt -locations");
+    sprintf(mibd_cmd,
+" %s/mibdchr%s.loc %s/mibdchr%s.mrg.gz %s/mibdchr%s.mean %f %c %d %s/mibd.%s",
+            mibddir, currentMap->chrnum(),
+            mibddir, currentMap->chrnum(),
+            mibddir, currentMap->chrnum(),
+            MibdWin, show_status, IbdThreads,
+            mibddir, currentMap->chrnum());
+    StringAppend (&run_cmd, mibd_cmd);
+
+    char clocn[100];
+    for (locn = from; locn <= to + 0.000001; locn += incr)
+    {
+        format_locn (locn, clocn);
+        StringAppend (&run_cmd, " ");
+        StringAppend (&run_cmd, clocn);
+    }
+    StringAppend (&run_cmd, " >& multipnt.out");
+
+    int status = Solar_Eval(interp, run_cmd);
+    free (run_cmd);
+    if (status == TCL_ERROR) {
+        if (Solar_Eval(interp, "exec cat multipnt.out") == TCL_ERROR)
         {
-            char *p, clocn[100];
-            sprintf(clocn, "%f", locn);
-            for (p = clocn + strlen(clocn) - 1; p > clocn; p--) {
-                if (*p == '0')
-                    *p = '\0';
-                else
-                    break;
-            }
-            for ( ; p > clocn; p--) {
-                if (*p == '.')
-                    *p = '\0';
-                else
-                    break;
-            }
+            RESULT_LIT ("Cannot cat multipnt.out");
+            return TCL_ERROR;
+        }
+        if (!strlen(Tcl_GetStringResult (interp)))
+            RESULT_LIT ("Program multipnt did not run.");
+        return TCL_ERROR;
+    }
 
-            sprintf(mibd_cmd,
-"exec multipnt %s/mibdchr%s.loc %s/mibdchr%s.mrg.gz %s/mibdchr%s.mean %f %s %f %c >& multipnt.out",
-                    mibddir, currentMap->chrnum(),
-                    mibddir, currentMap->chrnum(),
-                    mibddir, currentMap->chrnum(),
-                    locn, clocn, MibdWin, show_status);
+    unlink("multipnt.out");
 
-            if (Solar_Eval(interp, mibd_cmd) == TCL_ERROR) {
-                printf("\n"); fflush(stdout);
-                if (Solar_Eval(interp, "exec cat multipnt.out") == TCL_ERROR)
-                {
-                    RESULT_LIT ("Cannot cat multipnt.out");
-                    return TCL_ERROR;
-                }
-                if (!strlen(Tcl_GetStringResult (interp)))
-                    RESULT_LIT ("Program multipnt did not run.");
-                return TCL_ERROR;
-            }
+    for (locn = from; locn <= to + 0.000001; locn += incr)
+    {
+        format_locn (locn, clocn);
+        sprintf(mibd_cmd, "matcrc %s/mibd.%s.%s.gz", mibddir,
+                currentMap->chrnum(), clocn);
+        if (Solar_Eval(interp, mibd_cmd) == TCL_ERROR)
+            return TCL_ERROR;
+    }
+    return TCL_OK;
+}
 
-            unlink("multipnt.out");
+// Each location runs multipnt in its own scratch directory under mibddir,
+// IbdThreads locations at a time
+int run_multipnt_each (Tcl_Interp *interp, const char *mibddir, double from,
+                       double to, double incr)
+{
+    MibdJobs jobs;
+    jobs.interp = interp;
+    jobs.mibddir = mibddir;
+    jobs.chrnum = currentMap->chrnum();
+    jobs.nloc = 0;
+    jobs.clocn = 0;
+    jobs.parallel = IbdThreads > 1;
+    jobs.errors = 0;
+
+    char show_status = 'n';
+    FILE *ttyfp = fopen("/dev/tty", "w");
+    if (ttyfp) {
+        if (!jobs.parallel)
+            show_status = 'y';
+        fprintf(ttyfp, "Computing multi-point IBDs: ");
+        fclose(ttyfp);
+    }
 
-            sprintf(fname, "mibd.%s.%s", currentMap->chrnum(), clocn);
-            sprintf(mibd_cmd, "exec mv mibd.out %s/%s", mibddir, fname);
-            if (Solar_Eval(interp, mibd_cmd) == TCL_ERROR) {
-                RESULT_LIT ("Cannot rename mibd.out");
-                return TCL_ERROR;
-            }
+// the scratch directories need absolute paths to the shared input files
+    char absdir[1024];
+    if (mibddir[0] == '/')
+        strcpy(absdir, mibddir);
+    else if (getcwd(absdir, sizeof(absdir)))
+        sprintf(absdir + strlen(absdir), "/%s", mibddir);
+    else {
+        RESULT_LIT ("Cannot get current working directory");
+        return TCL_ERROR;
+    }
 
-            sprintf(mibd_cmd, "exec gzip -f %s/%s", mibddir, fname);
-            if (Solar_Eval(interp, mibd_cmd) == TCL_ERROR) {
-                RESULT_LIT ("gzip failed");
-                return TCL_ERROR;
-            }
+    JobPool pool(IbdThreads);
+    jobs.pool = &pool;
 
-	    sprintf (mibd_cmd, "matcrc %s/%s.gz", mibddir, fname);
-	    if (Solar_Eval(interp, mibd_cmd) == TCL_ERROR) {
-		return TCL_ERROR;
-	    }
-
-            FILE *ttyfp = fopen("/dev/tty", "w");
-            if (ttyfp) {
-                int i;
-                for (i = 0; i < 10 + strlen(clocn); i++)
-                    fputc('\b', ttyfp);
-                for (i = 0; i < 10 + strlen(clocn); i++)
-                    fputc(' ', ttyfp);
-                for (i = 0; i < 10 + strlen(clocn); i++)
-                    fputc('\b', ttyfp);
-                fclose(ttyfp);
-            }
+    for (double locn = from; locn <= to + 0.000001; locn += incr)
+    {
+        char clocn[100], fname[1024], job_cmd[8192];
+        format_locn (locn, clocn);
+        sprintf(fname, "mibd.%s.%s", currentMap->chrnum(), clocn);
+        sprintf(job_cmd,
+"mkdir -p tmp.%s.%s && cd tmp.%s.%s || exit 4; \
+multipnt %s/mibdchr%s.loc %s/mibdchr%s.mrg.gz %s/mibdchr%s.mean %f %s %f %c \
+> multipnt.out 2>&1 || exit 1; mv mibd.out %s/%s || exit 2; \
+gzip -f %s/%s || exit 3",
+                currentMap->chrnum(), clocn, currentMap->chrnum(), clocn,
+                absdir, currentMap->chrnum(),
+                absdir, currentMap->chrnum(),
+                absdir, currentMap->chrnum(),
+                locn, clocn, MibdWin, show_status,
+                absdir, fname, absdir, fname);
+        pool.add(mibddir, job_cmd);
+
+        jobs.clocn = (char**) Realloc (jobs.clocn,
+                                       (jobs.nloc+1)*sizeof(char*));
+        jobs.clocn[jobs.nloc++] = Strdup (clocn);
+    }
+
+    pool.run(0, mibd_finished, &jobs);
+
+    for (int i = 0; i < jobs.nloc; i++)
+        free (jobs.clocn[i]);
+    free (jobs.clocn);
+
+    if (jobs.errors) {
+        RESULT_BUF (jobs.errors);
+        free (jobs.errors);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+// Report a location, removing its scratch directory if multipnt succeeded.
+// After an error no more locations are started.
+void mibd_finished (int j, int status, void *data)
+{
+    MibdJobs *jobs = (MibdJobs*) data;
+    Tcl_Interp *interp = jobs->interp;
+    const char *clocn = jobs->clocn[j];
+    char dirname[1024], fname[1024], cmd[1024];
+
+    sprintf(dirname, "%s/tmp.%s.%s", jobs->mibddir, jobs->chrnum, clocn);
+    sprintf(fname, "%s/multipnt.out", dirname);
+
+    const char *errmsg = 0;
+    if (status == 1) {
+        sprintf(cmd, "exec cat %s", fname);
+        if (Solar_Eval(interp, cmd) == TCL_ERROR)
+            errmsg = "Cannot cat multipnt.out";
+        else if (!strlen(Tcl_GetStringResult (interp)))
+            errmsg = "Program multipnt did not run.";
+        else
+            errmsg = Tcl_GetStringResult (interp);
+    }
+    else if (status == 2)
+        errmsg = "Cannot rename mibd.out";
+    else if (status == 3)
+        errmsg = "gzip failed";
+    else if (status == 4) {
+        sprintf(cmd, "Cannot create directory %s", dirname);
+        errmsg = cmd;
+    }
+    else if (status)
+        errmsg = "Program multipnt did not run.";
+    else {
+        unlink(fname);
+        rmdir(dirname);
+        sprintf(cmd, "matcrc %s/mibd.%s.%s.gz", jobs->mibddir, jobs->chrnum,
+                clocn);
+        if (Solar_Eval(interp, cmd) == TCL_ERROR)
+            errmsg = Tcl_GetStringResult (interp);
+    }
+
+    if (errmsg) {
+        if (jobs->errors)
+            StringAppend (&jobs->errors, "\n");
+        if (jobs->parallel) {
+            StringAppend (&jobs->errors, "location ");
+            StringAppend (&jobs->errors, clocn);
+            StringAppend (&jobs->errors, ": ");
         }
+        StringAppend (&jobs->errors, errmsg);
+        jobs->pool->cancel();
+    }
+    Tcl_ResetResult (interp);
 
-        printf("\n"); fflush(stdout);
-        return TCL_OK;
+    if (!jobs->parallel && !status) {
+        FILE *ttyfp = fopen("/dev/tty", "w");
+        if (ttyfp) {
+            int i;
+            for (i = 0; i < 10 + strlen(clocn); i++)
+                fputc('\b', ttyfp);
+            for (i = 0; i < 10 + strlen(clocn); i++)
+                fputc(' ', ttyfp);
+            for (i = 0; i < 10 + strlen(clocn); i++)
+                fputc('\b', ttyfp);
+            fclose(ttyfp);
+        }
     }
+}
 
-    RESULT_LIT ("Invalid mibd command");
-    return TCL_ERROR;
+// Format a location as in mibd file names, without trailing zeros
+void format_locn (double locn, char *clocn)
+{
+    char *p;
+    sprintf(clocn, "%f", locn);
+    for (p = clocn + strlen(clocn) - 1; p > clocn; p--) {
+        if (*p == '0')
+            *p = '\0';
+        else
+            break;
+    }
+    for ( ; p > clocn; p--) {
+        if (*p == '.')
+            *p = '\0';
+        else
+            break;
+    }
 }
 
 int run_relate (Tcl_Interp *interp, int mxnrel)
@@ -0,0 +1,774 @@
+/*
+ * mibdpack.cc implements the packed per-chromosome mIBD store
+ *
+ * A pack file mibd.<chromo>.pack holds the multipoint IBDs (and D7's) of
+ * every location on one chromosome, replacing the separate gzipped
+ * mibd.<chromo>.<locn>.gz files.  Layout (native byte order):
+ *
+ *   header    "SOLMIBD1", flags, keyint, npos, npairs, index offset,
+ *             length and text of the checksum record (may be empty)
+ *   blocks    one zlib block per location
+ *   index     npos entries of location label, pair count, offset, length
+ *   pairs     npairs IBDID pairs
+ *
+ * The pair table only grows from one location to the next, so each
+ * location uses a prefix of it.  A block holds the IBD values then the D7
+ * values as float (or half float with -half) bit patterns; absent entries
+ * are NaN.  Every keyint'th location is stored whole, the others are XOR'd
+ * with the previous location, which leaves mostly zero bytes since
+ * adjacent locations differ little.  Byte planes are then separated before
+ * compression.
+ *
+ * Matrix::load asks for a location by its usual filename; the location is
+ * decoded and presented in the original matrix file format, so all the
+ * usual checks (checksum, pedigree membership) still apply.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include "solar.h"
+#include "zlib.h"
+
+static const char Pack_Magic[8] = {'S','O','L','M','I','B','D','1'};
+static const int PACK_D7 = 1;
+static const int PACK_HALF = 2;
+static const int PACK_KEYINT = 16;
+static const int PACK_LABEL = 24;
+static const unsigned int FLOAT_NAN_BITS = 0x7fc00000;
+static const unsigned int HALF_NAN_BITS = 0x7e00;
+
+struct pack_header
+{
+    char magic[8];
+    int flags;
+    int keyint;
+    int npos;
+    int npairs;
+    long long index_offset;
+    int cksum_len;
+};
+
+struct pack_index
+{
+    char label[PACK_LABEL];
+    int npairs;
+    long long offset;
+    int length;
+};
+
+static unsigned int float_bits (float f)
+{
+    unsigned int u;
+    memcpy (&u, &f, 4);
+    return u;
+}
+
+static float bits_float (unsigned int u)
+{
+    float f;
+    memcpy (&f, &u, 4);
+    return f;
+}
+
+// IEEE half float conversion, round to nearest even
+
+static unsigned int float_to_half (float f)
+{
+    unsigned int u = float_bits (f);
+    unsigned int sign = (u >> 16) & 0x8000;
+    int exp = (u >> 23) & 0xff;
+    unsigned int mant = u & 0x7fffff;
+    if (exp == 0xff) return sign | (mant ? HALF_NAN_BITS : 0x7c00);
+    int hexp = exp - 127 + 15;
+    if (hexp >= 0x1f) return sign | 0x7c00;
+    if (hexp <= 0)
+    {
+	if (hexp < -10) return sign;
+	mant |= 0x800000;
+	int shift = 14 - hexp;
+	unsigned int half = mant >> shift;
+	unsigned int rem = mant & ((1u << shift) - 1);
+	unsigned int mid = 1u << (shift - 1);
+	if (rem > mid || (rem == mid && (half & 1))) half++;
+	return sign | half;
+    }
+    unsigned int half = (hexp << 10) | (mant >> 13);
+    unsigned int rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+    return sign | half;
+}
+
+static float half_to_float (unsigned int h)
+{
+    unsigned int sign = (h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    unsigned int mant = h & 0x3ff;
+    if (exp == 0x1f) return bits_float (sign | 0x7f800000 | (mant << 13));
+    if (exp == 0)
+    {
+	float f = ldexp ((float) mant, -24);
+	return sign ? -f : f;
+    }
+    return bits_float (sign | ((exp - 15 + 127) << 23) | (mant << 13));
+}
+
+static std::string pack_filename (const std::string& dir, const char *chromo)
+{
+    return dir + "/mibd." + chromo + ".pack";
+}
+
+// Split "<dir>/mibd.<chromo>.<locn>.gz" into pack filename and label
+
+static bool pack_split_name (const char *filename, std::string& packname,
+			     std::string& label)
+{
+    std::string name = filename;
+    std::string dir = ".";
+    size_t slash = name.rfind ('/');
+    if (slash != std::string::npos)
+    {
+	dir = name.substr (0, slash);
+	name = name.substr (slash+1);
+    }
+    if (name.compare (0, 5, "mibd.") ||
+	name.size() < 9 || name.compare (name.size()-3, 3, ".gz"))
+    {
+	return false;
+    }
+    std::string body = name.substr (5, name.size()-8);
+    size_t dot = body.find ('.');
+    if (dot == std::string::npos || dot == 0 || dot+1 == body.size())
+    {
+	return false;
+    }
+    packname = pack_filename (dir, body.substr (0, dot).c_str());
+    label = body.substr (dot+1);
+    return label.size() < PACK_LABEL;
+}
+
+// Byte plane shuffle of width-byte values so that like bytes are adjacent
+
+static void shuffle_planes (const unsigned char *in, unsigned char *out,
+			    size_t count, int width)
+{
+    for (size_t i = 0; i < count; i++)
+	for (int b = 0; b < width; b++)
+	    out[b*count + i] = in[i*width + b];
+}
+
+static void unshuffle_planes (const unsigned char *in, unsigned char *out,
+			      size_t count, int width)
+{
+    for (size_t i = 0; i < count; i++)
+	for (int b = 0; b < width; b++)
+	    out[i*width + b] = in[b*count + i];
+}
+
+// Store one record by pair index, adding new pairs to the table
+
+static void pack_store (int id1, int id2, float v1, float v2, int count,
+	std::map<std::pair<int,int>,int>& pair_index,
+	std::vector<std::pair<int,int> >& pairs,
+	std::vector<float>& ibd, std::vector<float>& d7, bool& have_d7)
+{
+    std::pair<int,int> key (id1, id2);
+    std::map<std::pair<int,int>,int>::iterator it = pair_index.find (key);
+    int index;
+    if (it == pair_index.end())
+    {
+	index = pairs.size();
+	pair_index[key] = index;
+	pairs.push_back (key);
+	ibd.push_back (bits_float (FLOAT_NAN_BITS));
+	d7.push_back (bits_float (FLOAT_NAN_BITS));
+    }
+    else
+    {
+	index = it->second;
+    }
+    ibd[index] = v1;
+    if (count == 4)
+    {
+	d7[index] = v2;
+	have_d7 = true;
+    }
+}
+
+// Read one matrix file in original format
+
+static const char* pack_read_matrix (const char *filename,
+	std::map<std::pair<int,int>,int>& pair_index,
+	std::vector<std::pair<int,int> >& pairs,
+	std::vector<float>& ibd, std::vector<float>& d7, bool& have_d7,
+	std::string& cksum_line)
+{
+    gzFile gfile = gzopen (filename, "rb");
+    if (!gfile) return "Unable to open matrix file";
+
+    char buf[1024];
+    char first[1024];
+    int first_id1 = 0, first_id2 = 0, first_count = 0;
+    float first_v1 = 0, first_v2 = 0;
+    int linenumber = 0;
+    cksum_line.clear ();
+    ibd.assign (pairs.size(), bits_float (FLOAT_NAN_BITS));
+    d7.assign (pairs.size(), bits_float (FLOAT_NAN_BITS));
+
+    while (gzgets (gfile, buf, sizeof (buf)))
+    {
+	int len = strlen (buf);
+	while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r'))
+	{
+	    buf[--len] = '\0';
+	}
+	if (!len) continue;
+	if (strchr (buf, ','))
+	{
+	    gzclose (gfile);
+	    return "CSV matrix files cannot be packed";
+	}
+	int id1, id2;
+	float v1 = 0, v2 = 0;
+	int count = sscanf (buf, "%d %d %f %f", &id1, &id2, &v1, &v2);
+	if (count < 3)
+	{
+	    gzclose (gfile);
+	    return "Error reading matrix file record";
+	}
+
+// First record is a checksum if the second has the same ID pair,
+//   so it is held until the second record is seen
+
+	if (++linenumber == 1)
+	{
+	    strcpy (first, buf);
+	    first_id1 = id1; first_id2 = id2; first_count = count;
+	    first_v1 = v1; first_v2 = v2;
+	    continue;
+	}
+	if (linenumber == 2)
+	{
+	    if (id1 == first_id1 && id2 == first_id2)
+	    {
+		cksum_line = first;
+	    }
+	    else
+	    {
+		pack_store (first_id1, first_id2, first_v1, first_v2,
+			    first_count, pair_index, pairs, ibd, d7, have_d7);
+	    }
+	}
+	pack_store (id1, id2, v1, v2, count, pair_index, pairs, ibd, d7,
+		    have_d7);
+    }
+    gzclose (gfile);
+    if (linenumber == 1)
+    {
+	pack_store (first_id1, first_id2, first_v1, first_v2, first_count,
+		    pair_index, pairs, ibd, d7, have_d7);
+    }
+    if (!linenumber)
+    {
+	return "Matrix file is empty";
+    }
+    return 0;
+}
+
+// Encode one location: bits, XOR against previous (unless keyframe),
+//   byte planes, zlib
+
+static const char* pack_encode (const std::vector<float>& ibd,
+				const std::vector<float>& d7, int flags,
+				bool keyframe, std::vector<unsigned int>& prev,
+				std::vector<unsigned char>& block)
+{
+    int width = (flags & PACK_HALF) ? 2 : 4;
+    size_t n = ibd.size();
+    size_t count = (flags & PACK_D7) ? 2*n : n;
+    std::vector<unsigned int> bits (count);
+    for (size_t i = 0; i < n; i++)
+    {
+	bits[i] = (width == 2) ? float_to_half (ibd[i]) : float_bits (ibd[i]);
+	if (flags & PACK_D7)
+	{
+	    bits[n+i] = (width == 2) ? float_to_half (d7[i]) :
+		float_bits (d7[i]);
+	}
+    }
+
+// Previous location's layout is IBD[nprev] D7[nprev]
+
+    std::vector<unsigned int> delta (bits);
+    if (!keyframe)
+    {
+	size_t nprev = (flags & PACK_D7) ? prev.size()/2 : prev.size();
+	for (size_t i = 0; i < nprev; i++)
+	{
+	    delta[i] ^= prev[i];
+	    if (flags & PACK_D7) delta[n+i] ^= prev[nprev+i];
+	}
+    }
+    prev.swap (bits);
+
+    std::vector<unsigned char> raw (count*width);
+    for (size_t i = 0; i < count; i++)
+    {
+	if (width == 2)
+	{
+	    unsigned short h = delta[i];
+	    memcpy (&raw[i*2], &h, 2);
+	}
+	else
+	{
+	    memcpy (&raw[i*4], &delta[i], 4);
+	}
+    }
+    std::vector<unsigned char> planes (raw.size());
+    if (count) shuffle_planes (&raw[0], &planes[0], count, width);
+
+    uLongf clen = compressBound (planes.size());
+    block.resize (clen);
+    if (Z_OK != compress2 (&block[0], &clen,
+			   planes.size() ? &planes[0] : (const Bytef*) "",
+			   planes.size(), 6))
+    {
+	return "Error compressing mIBD location";
+    }
+    block.resize (clen);
+    return 0;
+}
+
+// Write mibd.<chromo>.pack from the mibd.<chromo>.*.gz files in mibddir
+
+const char* mibd_pack_write (const char *mibddir, const char *chromo,
+			     bool half, int *npacked)
+{
+    std::string dir = mibddir;
+    std::string prefix = std::string ("mibd.") + chromo + ".";
+    std::vector<std::pair<double,std::string> > locations;
+
+    DIR *dirp = opendir (mibddir);
+    if (!dirp) return "Unable to open mibddir";
+    struct dirent *dp;
+    while ((dp = readdir (dirp)))
+    {
+	std::string name = dp->d_name;
+	if (name.size() <= prefix.size() + 3 ||
+	    name.compare (0, prefix.size(), prefix) ||
+	    name.compare (name.size()-3, 3, ".gz"))
+	{
+	    continue;
+	}
+	std::string label = name.substr (prefix.size(),
+					 name.size() - prefix.size() - 3);
+	char *endptr;
+	double locn = strtod (label.c_str(), &endptr);
+	if (*endptr || label.size() >= (size_t) PACK_LABEL) continue;
+	locations.push_back (std::make_pair (locn, label));
+    }
+    closedir (dirp);
+    std::sort (locations.begin(), locations.end());
+    if (!locations.size())
+    {
+	return "No mIBD files found for chromosome";
+    }
+
+    std::string packname = pack_filename (dir, chromo);
+    std::string tempname = packname + ".tmp";
+    FILE *pfile = fopen (tempname.c_str(), "wb");
+    if (!pfile) return "Unable to create mIBD pack file";
+
+// First pass determines whether D7 is present and the checksum record
+
+    std::map<std::pair<int,int>,int> pair_index;
+    std::vector<std::pair<int,int> > pairs;
+    std::vector<float> ibd, d7;
+    std::string cksum_line;
+    bool have_d7 = false;
+    const char *message = pack_read_matrix (
+	(dir + "/mibd." + chromo + "." + locations[0].second + ".gz").c_str(),
+	pair_index, pairs, ibd, d7, have_d7, cksum_line);
+    if (message)
+    {
+	fclose (pfile);
+	unlink (tempname.c_str());
+	return message;
+    }
+    std::string first_cksum = cksum_line;
+
+    pack_header header;
+    memcpy (header.magic, Pack_Magic, 8);
+    header.flags = (have_d7 ? PACK_D7 : 0) | (half ? PACK_HALF : 0);
+    header.keyint = PACK_KEYINT;
+    header.npos = locations.size();
+    header.npairs = 0;
+    header.index_offset = 0;
+    header.cksum_len = first_cksum.size();
+    fwrite (&header, sizeof (header), 1, pfile);
+    fwrite (first_cksum.data(), 1, first_cksum.size(), pfile);
+
+    std::vector<pack_index> index (locations.size());
+    std::vector<unsigned int> prev;
+    std::vector<unsigned char> block;
+    for (size_t ipos = 0; ipos < locations.size(); ipos++)
+    {
+	if (ipos > 0)
+	{
+	    bool file_d7 = false;
+	    message = pack_read_matrix ((dir + "/mibd." + chromo + "." +
+					 locations[ipos].second + ".gz").c_str(),
+					pair_index, pairs, ibd, d7, file_d7,
+					cksum_line);
+	    if (!message && file_d7 != have_d7)
+	    {
+		message = "mIBD files differ in presence of D7";
+	    }
+	    if (!message && cksum_line != first_cksum)
+	    {
+		message = "mIBD files have different checksums";
+	    }
+	    if (message)
+	    {
+		fclose (pfile);
+		unlink (tempname.c_str());
+		return message;
+	    }
+	}
+	message = pack_encode (ibd, d7, header.flags,
+			       0 == ipos % PACK_KEYINT, prev, block);
+	if (message)
+	{
+	    fclose (pfile);
+	    unlink (tempname.c_str());
+	    return message;
+	}
+	memset (index[ipos].label, 0, PACK_LABEL);
+	strcpy (index[ipos].label, locations[ipos].second.c_str());
+	index[ipos].npairs = ibd.size();
+	index[ipos].offset = ftello (pfile);
+	index[ipos].length = block.size();
+	fwrite (&block[0], 1, block.size(), pfile);
+    }
+
+    header.npairs = pairs.size();
+    header.index_offset = ftello (pfile);
+    fwrite (&index[0], sizeof (pack_index), index.size(), pfile);
+    std::vector<int> ids (2*pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+	ids[2*i] = pairs[i].first;
+	ids[2*i+1] = pairs[i].second;
+    }
+    if (ids.size()) fwrite (&ids[0], sizeof (int), ids.size(), pfile);
+    fseeko (pfile, 0, SEEK_SET);
+    fwrite (&header, sizeof (header), 1, pfile);
+    if (ferror (pfile) | fclose (pfile))
+    {
+	unlink (tempname.c_str());
+	return "Error writing mIBD pack file";
+    }
+    if (rename (tempname.c_str(), packname.c_str()))
+    {
+	unlink (tempname.c_str());
+	return "Unable to rename mIBD pack file";
+    }
+    *npacked = locations.size();
+    return 0;
+}
+
+// Reader
+//   The most recently used pack stays open, along with the last location
+//   decoded, so a scan along the chromosome decodes one block per location.
+//   Guarded by a mutex because matrix prefetch reads on another thread.
+
+class MibdPack
+{
+public:
+    std::string filename;
+    time_t mtime;
+    off_t size;
+    pack_header header;
+    std::string cksum_line;
+    std::vector<pack_index> index;
+    std::vector<int> ids;
+    std::map<std::string,int> label_index;
+    int last_pos;
+    std::vector<unsigned int> last_bits;
+    FILE *pfile;
+
+    MibdPack () : mtime(0), size(0), last_pos(-1), pfile(0) {}
+    ~MibdPack () {if (pfile) fclose (pfile);}
+    const char* open (const std::string& name);
+    const char* decode (int ipos, std::vector<unsigned int>& bits);
+    const char* image (int ipos, std::string& text);
+};
+
+static std::mutex Pack_Mutex;
+static MibdPack *Current_Pack = 0;
+
+const char* MibdPack::open (const std::string& name)
+{
+    struct stat statbuf;
+    if (stat (name.c_str(), &statbuf)) return "Unable to open mIBD pack file";
+    filename = name;
+    mtime = statbuf.st_mtime;
+    size = statbuf.st_size;
+    pfile = fopen (name.c_str(), "rb");
+    if (!pfile) return "Unable to open mIBD pack file";
+    if (1 != fread (&header, sizeof (header), 1, pfile) ||
+	memcmp (header.magic, Pack_Magic, 8) || header.keyint < 1 ||
+	header.npos < 0 || header.npairs < 0 || header.cksum_len < 0)
+    {
+	return "Invalid mIBD pack file";
+    }
+    cksum_line.resize (header.cksum_len);
+    if (header.cksum_len &&
+	1 != fread (&cksum_line[0], header.cksum_len, 1, pfile))
+    {
+	return "Invalid mIBD pack file";
+    }
+    index.resize (header.npos);
+    ids.resize (2*header.npairs);
+    if (fseeko (pfile, header.index_offset, SEEK_SET) ||
+	(header.npos && header.npos != (int) fread (&index[0],
+	    sizeof (pack_index), header.npos, pfile)) ||
+	(header.npairs && (size_t) 2*header.npairs !=
+	    fread (&ids[0], sizeof (int), 2*header.npairs, pfile)))
+    {
+	return "Invalid mIBD pack file";
+    }
+    for (int i = 0; i < header.npos; i++)
+    {
+	index[i].label[PACK_LABEL-1] = '\0';
+	label_index[index[i].label] = i;
+    }
+    return 0;
+}
+
+const char* MibdPack::decode (int ipos, std::vector<unsigned int>& bits)
+{
+    int width = (header.flags & PACK_HALF) ? 2 : 4;
+    bool d7 = header.flags & PACK_D7;
+    int start = ipos - ipos % header.keyint;
+    if (last_pos >= start && last_pos < ipos) start = last_pos + 1;
+    for (int p = start; p <= ipos; p++)
+    {
+	size_t n = index[p].npairs;
+	size_t count = d7 ? 2*n : n;
+	std::vector<unsigned char> block (index[p].length);
+	if (fseeko (pfile, index[p].offset, SEEK_SET) ||
+	    (block.size() && 1 != fread (&block[0], block.size(), 1, pfile)))
+	{
+	    last_pos = -1;
+	    return "Error reading mIBD pack file";
+	}
+	std::vector<unsigned char> planes (count*width);
+	uLongf rawlen = planes.size();
+	if (planes.size() &&
+	    (Z_OK != uncompress (&planes[0], &rawlen, &block[0], block.size())
+	     || rawlen != planes.size()))
+	{
+	    last_pos = -1;
+	    return "Error uncompressing mIBD pack file";
+	}
+	std::vector<unsigned char> raw (planes.size());
+	if (count) unshuffle_planes (&planes[0], &raw[0], count, width);
+	std::vector<unsigned int> cur (count);
+	for (size_t i = 0; i < count; i++)
+	{
+	    if (width == 2)
+	    {
+		unsigned short h;
+		memcpy (&h, &raw[i*2], 2);
+		cur[i] = h;
+	    }
+	    else
+	    {
+		memcpy (&cur[i], &raw[i*4], 4);
+	    }
+	}
+	if (p % header.keyint)
+	{
+	    size_t nprev = d7 ? last_bits.size()/2 : last_bits.size();
+	    for (size_t i = 0; i < nprev; i++)
+	    {
+		cur[i] ^= last_bits[i];
+		if (d7) cur[n+i] ^= last_bits[nprev+i];
+	    }
+	}
+	last_bits.swap (cur);
+	last_pos = p;
+    }
+    bits = last_bits;
+    return 0;
+}
+
+// Present one location in original matrix file format
+//   %#.9g reproduces each stored float exactly
+
+const char* MibdPack::image (int ipos, std::string& text)
+{
+    std::vector<unsigned int> bits;
+    const char *message = decode (ipos, bits);
+    if (message) return message;
+    bool half = header.flags & PACK_HALF;
+    bool d7 = header.flags & PACK_D7;
+    size_t n = index[ipos].npairs;
+    unsigned int nan_bits = half ? HALF_NAN_BITS : FLOAT_NAN_BITS;
+
+    text.clear ();
+    text.reserve (48*n + cksum_line.size() + 1);
+    if (cksum_line.size())
+    {
+	text += cksum_line;
+	text += '\n';
+    }
+    char buf[128];
+    for (size_t i = 0; i < n; i++)
+    {
+	if (bits[i] == nan_bits) continue;
+	float v1 = half ? half_to_float (bits[i]) : bits_float (bits[i]);
+	if (d7 && bits[n+i] != nan_bits)
+	{
+	    float v2 = half ? half_to_float (bits[n+i]) :
+		bits_float (bits[n+i]);
+	    sprintf (buf, "%5d %5d %#.9g %#.9g\n", ids[2*i], ids[2*i+1],
+		     v1, v2);
+	}
+	else
+	{
+	    sprintf (buf, "%5d %5d %#.9g\n", ids[2*i], ids[2*i+1], v1);
+	}
+	text += buf;
+    }
+    return 0;
+}
+
+// Open pack (or reuse current one if unchanged); called with mutex held
+
+static MibdPack* pack_current (const std::string& packname,
+			       const char **message)
+{
+    struct stat statbuf;
+    if (stat (packname.c_str(), &statbuf))
+    {
+	*message = 0;
+	return 0;
+    }
+    if (Current_Pack && Current_Pack->filename == packname &&
+	Current_Pack->mtime == statbuf.st_mtime &&
+	Current_Pack->size == statbuf.st_size)
+    {
+	return Current_Pack;
+    }
+    delete Current_Pack;
+    Current_Pack = new MibdPack;
+    if ((*message = Current_Pack->open (packname)))
+    {
+	delete Current_Pack;
+	Current_Pack = 0;
+    }
+    return Current_Pack;
+}
+
+// Name of pack file holding the location named by a mibd filename, or ""
+
+std::string mibd_pack_source (const char *filename)
+{
+    std::string packname, label;
+    if (!pack_split_name (filename, packname, label)) return "";
+    std::lock_guard<std::mutex> lock (Pack_Mutex);
+    const char *message;
+    MibdPack *pack = pack_current (packname, &message);
+    if (!pack || !pack->label_index.count (label)) return "";
+    return packname;
+}
+
+// Get original format image of location named by a mibd filename
+//   returns false if there is no such location in a pack
+
+bool mibd_pack_image (const char *filename, std::string& text,
+		      const char **message)
+{
+    *message = 0;
+    std::string packname, label;
+    if (!pack_split_name (filename, packname, label)) return false;
+    std::lock_guard<std::mutex> lock (Pack_Mutex);
+    MibdPack *pack = pack_current (packname, message);
+    if (!pack) return false;
+    std::map<std::string,int>::iterator it = pack->label_index.find (label);
+    if (it == pack->label_index.end()) return false;
+    *message = pack->image (it->second, text);
+    return !*message;
+}
+
+// cmibdpack write <mibddir> <chromo> [-half]
+// cmibdpack locations <mibddir> <chromo>
+
+extern "C" int MibdPackCmd (ClientData clientData, Tcl_Interp *interp,
+			    int argc, char *argv[])
+{
+    if ((argc == 4 || argc == 5) && !StringCmp ("write", argv[1], case_ins))
+    {
+	bool half = false;
+	if (argc == 5)
+	{
+	    if (StringCmp ("-half", argv[4], case_ins))
+	    {
+		RESULT_LIT ("Invalid cmibdpack option");
+		return TCL_ERROR;
+	    }
+	    half = true;
+	}
+	int npacked = 0;
+	const char *message = mibd_pack_write (argv[2], argv[3], half,
+					       &npacked);
+	if (message)
+	{
+	    char buf[1024];
+	    sprintf (buf, "%s:  chromosome %.100s", message, argv[3]);
+	    RESULT_BUF (buf);
+	    return TCL_ERROR;
+	}
+	char buf[64];
+	sprintf (buf, "%d", npacked);
+	RESULT_BUF (buf);
+	return TCL_OK;
+    }
+
+    if (argc == 4 && !StringCmp ("locations", argv[1], case_ins))
+    {
+	std::string packname = pack_filename (argv[2], argv[3]);
+	std::lock_guard<std::mutex> lock (Pack_Mutex);
+	const char *message;
+	MibdPack *pack = pack_current (packname, &message);
+	if (!pack)
+	{
+	    if (message)
+	    {
+		RESULT_BUF (message);
+		return TCL_ERROR;
+	    }
+	    return TCL_OK;
+	}
+	for (int i = 0; i < pack->header.npos; i++)
+	{
+	    Solar_AppendElement (interp, pack->index[i].label);
+	}
+	return TCL_OK;
+    }
+
+    RESULT_LIT ("Invalid cmibdpack command");
+    return TCL_ERROR;
+}
@@ -14,6 +14,7 @@
 #include "solar.h"
 
 bool Model::_loading = {false};
+ModelContext *ModelContext::First = 0;
 
 extern "C" int ModelCmd (ClientData clientData, Tcl_Interp *interp,
 		  int argc, char *argv[])
@@ -34,6 +35,33 @@ extern "C" int ModelCmd (ClientData clientData, Tcl_Interp *interp,
 	return Model::renew (interp);
     }
 
+    if (argc >= 2 && !StringCmp (argv[1], "context", case_ins))
+    {
+	if (argc == 3 && !StringCmp (argv[2], "names", case_ins))
+	{
+	    return ModelContext::names (interp);
+	}
+	if (argc == 4 && !StringCmp (argv[2], "save", case_ins))
+	{
+	    return ModelContext::save (argv[3]);
+	}
+	if (argc == 4 && !StringCmp (argv[2], "load", case_ins))
+	{
+	    return ModelContext::load (argv[3], interp);
+	}
+	if (argc == 4 && !StringCmp (argv[2], "delete", case_ins))
+	{
+	    if (ModelContext::remove (argv[3]))
+	    {
+		RESULT_LIT ("No such model context");
+		return TCL_ERROR;
+	    }
+	    return TCL_OK;
+	}
+	RESULT_LIT ("Invalid model context command");
+	return TCL_ERROR;
+    }
+
     if (argc == 3)
     {
 	if (!StringCmp (argv[1], "save", case_ins))
@@ -68,11 +96,11 @@ extern "C" int ModelCmd (ClientData clientData, Tcl_Interp *interp,
     return TCL_ERROR;
 }
 
-int Model::write (FILE *file)
+int Model::write (FILE *file, bool matrices)
 {
     fprintf (file, "solarmodel %s\n", SolarVersion ());
     Definition::Write_Commands (file);
-    Matrix::write_commands (file);
+    if (matrices) Matrix::write_commands (file);
     Trait::Write_Commands (file);
     Parameter::write_commands (file);
     Covariate::write_commands (file);
@@ -158,6 +186,179 @@ void Model::reset()
 }
 
 
+ModelContext::ModelContext (const char *name)
+{
+    _name = Strdup (name);
+    _commands = 0;
+    _matrix_commands = 0;
+    _matrix_count = 0;
+    _parameters = 0;
+    _parameter_count = 0;
+    _next = 0;
+}
+
+ModelContext::~ModelContext ()
+{
+    free (_name);
+    if (_commands) free (_commands);
+    for (int i = 0; i < _matrix_count; i++)
+    {
+	free (_matrix_commands[i]);
+    }
+    delete [] _matrix_commands;
+    delete [] _parameters;
+}
+
+ModelContext *ModelContext::find (const char *name)
+{
+    for (ModelContext *c = First; c; c = c->_next)
+    {
+	if (!StringCmp (name, c->_name, case_ins)) return c;
+    }
+    return 0;
+}
+
+// Save a copy of the current model, replacing any context of the same name.
+//   The matrix commands are kept apart, and parameter values are kept in
+//   binary since the commands only have ParameterFormat digits.
+
+int ModelContext::save (const char *name)
+{
+    remove (name);
+    ModelContext *c = new ModelContext (name);
+
+    char *buffer = 0;
+    size_t size = 0;
+    FILE *file = open_memstream (&buffer, &size);
+    Model::write (file, false);
+    fclose (file);
+    c->_commands = buffer;
+
+    char buf[1024];
+    c->_matrix_count = Matrix::count;
+    c->_matrix_commands = new char* [Matrix::count+1];
+    for (int i = 0; i < Matrix::count; i++)
+    {
+	c->_matrix_commands[i] = Strdup (Matrix::Matrices[i]->command (buf));
+    }
+
+    c->_parameter_count = Parameter::count ();
+    c->_parameters = new double [5*c->_parameter_count+1];
+    for (int i = 0; i < c->_parameter_count; i++)
+    {
+	Parameter *p = Parameter::index (i);
+	double *values = &c->_parameters[5*i];
+	values[0] = p->start;
+	values[1] = p->lower;
+	values[2] = p->upper;
+	values[3] = p->se;
+	values[4] = p->score;
+    }
+
+    c->_next = First;
+    First = c;
+    return TCL_OK;
+}
+
+// Make a copy of a saved model current.  Matrices loaded by the same
+//   command are taken over from the current model; the others are loaded.
+
+int ModelContext::load (const char *name, Tcl_Interp *interp)
+{
+    ModelContext *c = find (name);
+    if (!c)
+    {
+	RESULT_LIT ("No such model context");
+	return TCL_ERROR;
+    }
+
+    char buf[1024];
+    Matrix *kept[MAX_MATRICES];
+    int nkept = 0;
+    bool *loaded = new bool[c->_matrix_count+1];
+    for (int j = 0; j < c->_matrix_count; j++) loaded[j] = false;
+    for (int i = 0; i < Matrix::count; i++)
+    {
+	Matrix::Matrices[i]->command (buf);
+	for (int j = 0; j < c->_matrix_count; j++)
+	{
+	    if (!loaded[j] && !strcmp (buf, c->_matrix_commands[j]))
+	    {
+		loaded[j] = true;
+		kept[nkept++] = Matrix::Matrices[i];
+		break;
+	    }
+	}
+    }
+    for (int i = 0; i < nkept; i++)
+    {
+	kept[i]->remove ();
+    }
+    Model::reset ();
+    for (int i = 0; i < nkept; i++)
+    {
+	kept[i]->add ();
+    }
+
+    Model::_loading = true;
+    int status = TCL_OK;
+    try
+    {
+	for (int j = 0; status == TCL_OK && j < c->_matrix_count; j++)
+	{
+	    if (!loaded[j])
+	    {
+		status = Solar_Eval (interp, c->_matrix_commands[j]);
+	    }
+	}
+	if (status == TCL_OK)
+	{
+	    status = Solar_Eval (interp, c->_commands);
+	}
+    }
+    catch (Safe_Error_Return& ser)
+    {
+	RESULT_BUF (ser.message());
+	status = TCL_ERROR;
+    }
+    Model::_loading = false;
+    delete [] loaded;
+
+    if (status == TCL_OK && Parameter::count () == c->_parameter_count)
+    {
+	for (int i = 0; i < c->_parameter_count; i++)
+	{
+	    double *values = &c->_parameters[5*i];
+	    Parameter::set (i, values[0], values[1], values[2], values[3],
+			    values[4]);
+	}
+    }
+    return status;
+}
+
+int ModelContext::remove (const char *name)
+{
+    ModelContext **link = &First;
+    while (*link && StringCmp (name, (*link)->_name, case_ins))
+    {
+	link = &(*link)->_next;
+    }
+    if (!*link) return 1;
+    ModelContext *c = *link;
+    *link = c->_next;
+    delete c;
+    return 0;
+}
+
+int ModelContext::names (Tcl_Interp *interp)
+{
+    for (ModelContext *c = First; c; c = c->_next)
+    {
+	Solar_AppendElement (interp, c->_name);
+    }
+    return TCL_OK;
+}
+
 char *append_extension (const char *given_filename, const char *extension)
 {
     int elen = strlen (extension);
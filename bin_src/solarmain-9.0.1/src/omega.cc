@@ -160,6 +160,7 @@ extern "C" double omegac_ (int *i, int *j, double *vari, double *varj,
 			    int *itsd_index, int *ntrait, int *malei,
 			    int *malej, int *traiti, int *traitj)
 {
+    Profile_Timer timer (prof_omega);
     I = *i;
     J = *j;
     Par = par;
@@ -424,6 +424,7 @@ void Option::setup ()
     add ("CorrectDeltas","0");
     add ("EnforceBounds","1");
     add ("BounDiff","0");
+    add ("AnalyticDeriv","0");
     add ("EnforceConstraints","0");
     add ("AbsVarianceParms","1");
     add ("SingularTrait","0");
@@ -448,6 +449,7 @@ void Option::setup ()
     add   ("ResetRandom", "0");
     addses ("CsvBufSize","0");
     addses ("ExpNotation","0");
+    addses ("FitCache","1");
     addi ("PedLike","0");
     addi ("LenInteger", "64000");
     addi ("LenReal", "64000");
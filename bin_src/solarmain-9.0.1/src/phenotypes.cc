@@ -20,13 +20,28 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
 #include "solar.h"
 // tcl.h from solar.h
 #include "safelib.h"
 
+extern bool file_checksum (const char *filename, unsigned long long *hash);
 
 /*
- * For each phenotypes file, there is an index of pointers to each record
+ * For each phenotypes file, there is an index of pointers to each record,
+ * and a hash from ID (and FAMID) to record number.
+ *
+ * Each phenotype that is set up also gets a typed column: the value of
+ * every record as a double, with bitmaps marking blank fields and fields
+ * which are not plain numbers.  The latter are still read as text so
+ * getpheno_ reports them exactly as before.  Columns are parsed once and
+ * saved in <phenotypes file>.pcol; the saved columns are used only while
+ * the modification time and size of the phenotypes file are unchanged.
  */
 
 class PhenoPointers
@@ -34,24 +49,56 @@ class PhenoPointers
 public:
     char *_id;
     char *_famid;
-    int _fposition;
+    long _fposition;
+};
+
+class PhenoColumn
+{
+public:
+    std::vector<double> Value;
+    std::vector<unsigned char> Missing;  // bitmaps, one bit per record
+    std::vector<unsigned char> Text;
+    void resize (int nrec);
+    void set (int rec, const char *field);
+    bool missing (int rec) {return Missing[rec>>3] & (1 << (rec&7));}
+    bool text (int rec) {return Text[rec>>3] & (1 << (rec&7));}
 };
 
 class PhenoFileIndex
 {
+    bool Cache_Read;
+    void read_cache (const char *filename, const struct stat& statbuf,
+		     unsigned long long checksum);
+    void write_cache (const char *filename, const struct stat& statbuf,
+		      unsigned long long checksum);
 public:
-    PhenoFileIndex() {Pointers=0; Count=0;}
+    PhenoFileIndex() {Pointers=0; Count=0; Cache_Read=false;}
     PhenoPointers* Pointers;
     int Count;
-    void add (const char *id, const char *famid, int fposition);
+    std::unordered_map<std::string,int> Lookup;
+    std::map<int,PhenoColumn> Columns;
+    void add (const char *id, const char *famid, long fposition);
+    int find (const char *id, const char *famid);
     void reset ();
     bool established () {return (0!=Pointers) ? true : false;}
+    void load_columns (const char *filename, time_t mtime,
+		       std::vector<int>& need);
+    PhenoColumn* column (int col);
 
     static void Reset_All ();
 };
 
 PhenoFileIndex* Pheno_Index[MAX_PHENOTYPE_FILES] = {0};
 
+// Record of the current person in each file (-1 if none), and the file
+// column and cached column for each setup phenotype (-1 and 0 if virtual)
+
+static int Current_Record[MAX_PHENOTYPE_FILES];
+static std::string Pheno_Path[MAX_PHENOTYPE_FILES];  // absolute, for cache
+static int File_Column[MAX_PHENOTYPES];
+static PhenoColumn* Column_Of[MAX_PHENOTYPES];
+static bool Columns_Ready = false;
+
 
 int Phenotypes::Filecount = 0;
 const char **Phenotypes::PhenoNames[] = {0};
@@ -163,8 +210,10 @@ void Phenotypes::reset(ResetMode rm)
 	PhenoNames[i] = 0;
 	PhenoCount[i] = 0;
 	Current_Person_Phenotypes[i] = 0;
+	Current_Record[i] = -1;
     }
     Filecount = 0;
+    Columns_Ready = false;
     PhenoFileIndex::Reset_All();
     _proband_pindex = -1;
     Setup_Names = 0;
@@ -253,6 +302,13 @@ void Phenotypes::reload_files (char** filenames, int nfiles,
 	    return;
 	}
 	Last_Modified[i] = statbuf.st_mtime;
+
+// Maximization may run in another directory, so the column cache
+// needs the absolute path
+
+	char *fullpath = realpath (filenames[i], 0);
+	Pheno_Path[i] = fullpath ? fullpath : "";
+	if (fullpath) free (fullpath);
 	PhenoNames[i] = Sfile[i]->names (&PhenoCount[i], errmsg);
 	if (*errmsg)
 	{
@@ -395,6 +451,7 @@ int Phenotypes::bind (Tcl_Interp *interp)
 
 int Phenotypes::build_index (Tcl_Interp *interp)
 {
+    Profile_Timer timer (prof_build_index);
 
 // build_index builds pointers to each record of each phenotypes
 // file, AND checks the discrete trait coding.
@@ -507,6 +564,11 @@ int Phenotypes::build_index (Tcl_Interp *interp)
 		message_shown = true;
 	    }
 	    
+	    struct stat filestat;
+	    if (!stat (Sfile[ifile]->filename(), &filestat))
+	    {
+		timer.bytes (filestat.st_size);
+	    }
 	    if (Pheno_Index[ifile])
 	    {
 		Pheno_Index[ifile]->reset ();
@@ -625,7 +687,7 @@ int Phenotypes::build_index (Tcl_Interp *interp)
 		}
 
 // Now actually add this record to index
-		int position = Sfile[ifile]->get_position ();
+		long position = Sfile[ifile]->get_position ();
 		if (found_famid())
 		{
 		    Pheno_Index[ifile]->add 
@@ -652,6 +714,7 @@ int Phenotypes::build_index (Tcl_Interp *interp)
 		return TCL_ERROR;
 	    }
 	}
+	Columns_Ready = false;
 
 // Now that we've seen all the values, determine if each trait is binary
 // and if coded correctly
@@ -752,6 +815,11 @@ int Phenotypes::build_index (Tcl_Interp *interp)
 
 extern "C" double getpheno_ (int *pindex)
 {
+    double cached;
+    if (Phenotypes::get_indexed_value (*pindex-1, &cached))
+    {
+	return cached;
+    }
     const char *phenotype = Phenotypes::get_indexed_phenotype (*pindex-1);
     if (!phenotype)
     {
@@ -796,7 +864,13 @@ const char *Phenotypes::test_proband ()
     if (_proband_pindex < 0) return "0";
     int findex = File_Index[_proband_pindex];
     int pindex = File_Pos[_proband_pindex];
-    if (!Current_Person_Phenotypes[findex])
+    int rec = Current_Record[findex];
+    PhenoColumn* col = Column_Of[_proband_pindex];
+    if (Columns_Ready && col && rec >= 0 && !col->text (rec))
+    {
+	return (col->missing (rec) || col->Value[rec] == 0.) ? "0" : "1";
+    }
+    if (!person_record (findex))
     {
 	return "0";  // If no vars available, assume not a proband
     }
@@ -913,7 +987,7 @@ const char *Phenotypes::get_indexed_phenotype (int pindex)
 // Now virtual traits are included in the virtual index
 
 	    int findex = File_Index[pindex];
-	    if (!Current_Person_Phenotypes[findex])
+	    if (!person_record (findex))
 	    {
 		return MISSING_PHENOTYPE_STRING;
 	    }
@@ -966,7 +1040,7 @@ const char *Phenotypes::get_indexed_phenotype (int pindex)
 // Now retrieve data from tablefile vector
 
 	int findex = File_Index[pindex];
-	if (!Current_Person_Phenotypes[findex])
+	if (!person_record (findex))
 	{
 	    return MISSING_PHENOTYPE_STRING;
 	}
@@ -975,33 +1049,108 @@ const char *Phenotypes::get_indexed_phenotype (int pindex)
     }
 }
 
-void Phenotypes::seek (const char *id, const char *famid)
+// get_indexed_value returns a phenotype from the column cache, or false
+// if it must be read as text (expressions, pseudovariables, and fields
+// that are not plain numbers)
+
+bool Phenotypes::get_indexed_value (int pindex, double *value)
 {
-    const char* errmsg = 0;
-    int j;
-    for (j = 0; j < Filecount; j++)
+    if (!Columns_Ready || pindex < 0 || pindex >= Setup_Count)
     {
-	Current_Person_Phenotypes[j] = 0;
-	PhenoFileIndex* pf = Pheno_Index[j];
-	for (int i = 0; i < pf->Count; i++)
+	return false;
+    }
+    int ntrait = Trait::Number_Of();
+    if (pindex < ntrait)
+    {
+	if (Trait::expression(pindex)) return false;
+    }
+    else if (pindex <= ntrait+1 || Expressions[pindex])
+    {
+	return false;
+    }
+    PhenoColumn* col = Column_Of[pindex];
+    if (!col) return false;
+
+    int rec = Current_Record[File_Index[pindex]];
+    if (rec < 0)
+    {
+	*value = MISSING_PHENOTYPE;
+	return true;
+    }
+    if (col->text (rec)) return false;
+    *value = col->missing (rec) ? MISSING_PHENOTYPE : col->Value[rec];
+    return true;
+}
+
+// person_record reads the current person's record as text when needed
+
+char **Phenotypes::person_record (int findex)
+{
+    if (!Current_Person_Phenotypes[findex] && Current_Record[findex] >= 0)
+    {
+	const char* errmsg = 0;
+	PhenoPointers* pp =
+	    &Pheno_Index[findex]->Pointers[Current_Record[findex]];
+	Sfile[findex]->set_position (pp->_fposition, &errmsg);
+	Current_Person_Phenotypes[findex] = Sfile[findex]->get (&errmsg);
+	if (errmsg)
 	{
-	    if (strcmp (pf->Pointers[i]._id, id)) continue;
-	    if ( found_famid() )
-	    {
-		if (strcmp (pf->Pointers[i]._famid, famid)) continue;
-	    }
+	    char buf [256];
+	    sprintf (buf, "Phenotype file error: %s", errmsg);
+	    throw Safe_Error_Return (buf);
+	}
+    }
+    return Current_Person_Phenotypes[findex];
+}
 
-// Found position, now "set" it
+// load_columns makes sure every setup phenotype has a cached column.
+// A file whose columns cannot be read is simply read as text.
 
-	    Sfile[j]->set_position (pf->Pointers[i]._fposition, &errmsg);
-	    Current_Person_Phenotypes[j] = Sfile[j]->get (&errmsg);
-	    if (errmsg)
+void Phenotypes::load_columns ()
+{
+    int i;
+    for (int ifile = 0; ifile < Filecount; ifile++)
+    {
+	if (!Pheno_Index[ifile] || Pheno_Path[ifile].empty()) continue;
+	std::vector<int> need;
+	for (i = 0; i < Setup_Count; i++)
+	{
+	    if (File_Column[i] >= 0 && File_Index[i] == ifile)
 	    {
-		char buf [256];
-		sprintf (buf, "Phenotype file error: %s", errmsg);
-		throw Safe_Error_Return (errmsg);
+		need.push_back (File_Column[i]);
 	    }
 	}
+	Pheno_Index[ifile]->load_columns (Pheno_Path[ifile].c_str(),
+					  Last_Modified[ifile], need);
+    }
+    for (i = 0; i < Setup_Count; i++)
+    {
+	Column_Of[i] = 0;
+	if (File_Column[i] >= 0 && Pheno_Index[File_Index[i]])
+	{
+	    Column_Of[i] = Pheno_Index[File_Index[i]]->column (File_Column[i]);
+	}
+    }
+    Columns_Ready = true;
+}
+
+void Phenotypes::seek (const char *id, const char *famid)
+{
+    Profile_Timer timer (prof_phen_seek);
+    int j;
+    if (!Columns_Ready)
+    {
+	load_columns ();
+    }
+
+// Find this individual's record in each file; the record itself is read
+// only if some value must be read as text (see person_record)
+
+    for (j = 0; j < Filecount; j++)
+    {
+	Current_Person_Phenotypes[j] = 0;
+	Current_Record[j] = Pheno_Index[j]->find (id,
+						  found_famid() ? famid : "");
     }
 
 // Load this individual's inverse normals if applicable
@@ -1077,12 +1226,17 @@ void Phenotypes::start_setup ()
 	    throw Safe_Error_Return (errmsg);
 	}
 	File_Useage[i] = 0;
+	Current_Person_Phenotypes[i] = 0;
+	Current_Record[i] = -1;
     }
     for (i=0; i < MAX_PHENOTYPES; i++)
     {
 	File_Index[i] = 0;
 	File_Pos[i] = 0;
+	File_Column[i] = -1;
+	Column_Of[i] = 0;
     }
+    Columns_Ready = false;
     Setup_Count = 0;
     if (Setup_Names) delete Setup_Names;
     Setup_Names = new StringArray;
@@ -1120,6 +1274,7 @@ void Phenotypes::setup (const char *name)
     char* justname = Strdup (name);
     char* colonpos = strchr (justname, ':');
     if (colonpos) *colonpos = '\0';
+    int column = -1;
 
     for (i = 0; i < Filecount; i++)
     {
@@ -1133,7 +1288,7 @@ void Phenotypes::setup (const char *name)
 		free (justname);
 	        throw Safe_Error_Return (buf);
 	    }
-	    Sfile[i]->setup (justname, &errmsg);
+	    column = Sfile[i]->setup (justname, &errmsg);
 	    found = i+1;
 	}
 	if (errmsg)
@@ -1154,7 +1309,9 @@ void Phenotypes::setup (const char *name)
     free (justname);
     File_Index[Setup_Count] = found - 1;
     File_Pos[Setup_Count] = File_Useage[found - 1];
+    File_Column[Setup_Count] = column;
     File_Useage[found-1]++;
+    Columns_Ready = false;
     setup_virtual_position (name);
 }
 
@@ -1219,7 +1376,7 @@ const char* Phenotypes::filenames ()
     return filenamebuf;
 }
 
-void PhenoFileIndex::add (const char *id, const char *famid, int fposition)
+void PhenoFileIndex::add (const char *id, const char *famid, long fposition)
 {
     if (0==Pointers)
     {
@@ -1233,6 +1390,22 @@ void PhenoFileIndex::add (const char *id, const char *famid, int fposition)
     Pointers[Count-1]._id = Strdup (id);
     Pointers[Count-1]._famid = Strdup (famid);
     Pointers[Count-1]._fposition = fposition;
+
+// As in a linear search through the file, the last matching record wins
+
+    std::string key (famid);
+    key += '\0';
+    key += id;
+    Lookup[key] = Count-1;
+}
+
+int PhenoFileIndex::find (const char *id, const char *famid)
+{
+    std::string key (famid);
+    key += '\0';
+    key += id;
+    std::unordered_map<std::string,int>::iterator it = Lookup.find (key);
+    return (it == Lookup.end()) ? -1 : it->second;
 }
 
 
@@ -1250,6 +1423,234 @@ void PhenoFileIndex::reset ()
 	Pointers = 0;
     }
     Count = 0;
+    Lookup.clear ();
+    Columns.clear ();
+    Cache_Read = false;
+}
+
+PhenoColumn* PhenoFileIndex::column (int col)
+{
+    std::map<int,PhenoColumn>::iterator it = Columns.find (col);
+    return (it == Columns.end()) ? 0 : &it->second;
+}
+
+// load_columns parses any needed columns not already cached, in one pass
+// through the file, then saves all cached columns for later sessions
+
+void PhenoFileIndex::load_columns (const char *filename, time_t mtime,
+				   std::vector<int>& need)
+{
+    struct stat statbuf;
+    if (stat (filename, &statbuf) || statbuf.st_mtime != mtime) return;
+
+    unsigned long long checksum;
+    bool checked = file_checksum (filename, &checksum);
+    if (!Cache_Read && checked)
+    {
+	read_cache (filename, statbuf, checksum);
+    }
+    std::vector<int> todo;
+    int i;
+    for (i = 0; i < (int) need.size(); i++)
+    {
+	if (!column (need[i]) &&
+	    std::find (todo.begin(), todo.end(), need[i]) == todo.end())
+	{
+	    todo.push_back (need[i]);
+	}
+    }
+    if (todo.empty()) return;
+
+    const char *errmsg = 0;
+    TableFile *tf = TableFile::open (filename, &errmsg);
+    int count;
+    const char **names = 0;
+    if (!errmsg) names = tf->names (&count, &errmsg);
+    if (!errmsg) tf->start_setup (&errmsg);
+    for (i = 0; !errmsg && i < (int) todo.size(); i++)
+    {
+	tf->setup (names[todo[i]], &errmsg);
+    }
+
+    std::vector<PhenoColumn*> cols;
+    for (i = 0; i < (int) todo.size(); i++)
+    {
+	Columns[todo[i]].resize (Count);
+	cols.push_back (&Columns[todo[i]]);
+    }
+
+    int rec = 0;
+    char **data;
+    while (!errmsg && 0 != (data = tf->get (&errmsg)) && rec < Count)
+    {
+	for (i = 0; i < (int) cols.size(); i++)
+	{
+	    cols[i]->set (rec, data[i]);
+	}
+	rec++;
+    }
+    bool ok = (!errmsg || !strcmp (errmsg, "EOF")) && rec == Count;
+    delete tf;
+
+    if (!ok)
+    {
+	for (i = 0; i < (int) todo.size(); i++)
+	{
+	    Columns.erase (todo[i]);
+	}
+	return;
+    }
+    if (checked) write_cache (filename, statbuf, checksum);
+}
+
+// A cache is used only if it was written for this phenotype file as it is
+// now: same size, inode, nanosecond modification and change times, and
+// checksum of the contents.  The times alone would miss a rewrite of the
+// same size within the same second (or on a filesystem keeping seconds).
+
+struct PhenoCacheHeader
+{
+    char magic[8];
+    long long mtime;
+    long long mtime_nsec;
+    long long ctime;
+    long long ctime_nsec;
+    long long ino;
+    long long size;
+    unsigned long long checksum;
+    int nrec;
+    int ncol;
+};
+
+static const char Pheno_Cache_Magic[8] = {'S','O','L','P','C','O','L','2'};
+
+static void pheno_cache_stamp (PhenoCacheHeader& header,
+			       const struct stat& statbuf,
+			       unsigned long long checksum)
+{
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, Pheno_Cache_Magic, 8);
+    header.mtime = statbuf.st_mtim.tv_sec;
+    header.mtime_nsec = statbuf.st_mtim.tv_nsec;
+    header.ctime = statbuf.st_ctim.tv_sec;
+    header.ctime_nsec = statbuf.st_ctim.tv_nsec;
+    header.ino = statbuf.st_ino;
+    header.size = statbuf.st_size;
+    header.checksum = checksum;
+}
+
+void PhenoFileIndex::read_cache (const char *filename,
+				 const struct stat& statbuf,
+				 unsigned long long checksum)
+{
+    Cache_Read = true;
+    std::string cachename = std::string (filename) + ".pcol";
+    FILE *cfile = fopen (cachename.c_str(), "rb");
+    if (!cfile) return;
+
+    PhenoCacheHeader header;
+    PhenoCacheHeader expected;
+    pheno_cache_stamp (expected, statbuf, checksum);
+    if (1 != fread (&header, sizeof (header), 1, cfile) ||
+	memcmp (header.magic, expected.magic, 8) ||
+	header.mtime != expected.mtime ||
+	header.mtime_nsec != expected.mtime_nsec ||
+	header.ctime != expected.ctime ||
+	header.ctime_nsec != expected.ctime_nsec ||
+	header.ino != expected.ino ||
+	header.size != expected.size ||
+	header.checksum != expected.checksum ||
+	header.nrec != Count || Count == 0)
+    {
+	fclose (cfile);
+	return;
+    }
+    for (int i = 0; i < header.ncol; i++)
+    {
+	int col;
+	PhenoColumn pc;
+	pc.resize (Count);
+	if (1 != fread (&col, sizeof (col), 1, cfile) ||
+	    Count != (int) fread (&pc.Value[0], sizeof (double), Count, cfile) ||
+	    pc.Missing.size() != fread (&pc.Missing[0], 1, pc.Missing.size(),
+					cfile) ||
+	    pc.Text.size() != fread (&pc.Text[0], 1, pc.Text.size(), cfile))
+	{
+	    break;
+	}
+	Columns[col].Value.swap (pc.Value);
+	Columns[col].Missing.swap (pc.Missing);
+	Columns[col].Text.swap (pc.Text);
+    }
+    fclose (cfile);
+}
+
+// The cache is written to a temporary file and renamed, so that
+// another process reading it never sees a partial file.  Failure to
+// write (e.g. read-only directory) is not an error.
+
+void PhenoFileIndex::write_cache (const char *filename,
+				  const struct stat& statbuf,
+				  unsigned long long checksum)
+{
+    if (Count == 0) return;
+    std::string cachename = std::string (filename) + ".pcol";
+    char suffix[64];
+    sprintf (suffix, ".%d.tmp", (int) getpid());
+    std::string tmpname = cachename + suffix;
+    FILE *cfile = fopen (tmpname.c_str(), "wb");
+    if (!cfile) return;
+
+    PhenoCacheHeader header;
+    pheno_cache_stamp (header, statbuf, checksum);
+    header.nrec = Count;
+    header.ncol = Columns.size();
+    fwrite (&header, sizeof (header), 1, cfile);
+
+    std::map<int,PhenoColumn>::iterator it;
+    for (it = Columns.begin(); it != Columns.end(); it++)
+    {
+	PhenoColumn& pc = it->second;
+	fwrite (&it->first, sizeof (int), 1, cfile);
+	fwrite (&pc.Value[0], sizeof (double), Count, cfile);
+	fwrite (&pc.Missing[0], 1, pc.Missing.size(), cfile);
+	fwrite (&pc.Text[0], 1, pc.Text.size(), cfile);
+    }
+    bool ok = !ferror (cfile);
+    if (fclose (cfile)) ok = false;
+    if (!ok || rename (tmpname.c_str(), cachename.c_str()))
+    {
+	unlink (tmpname.c_str());
+    }
+}
+
+void PhenoColumn::resize (int nrec)
+{
+    Value.assign (nrec, 0.);
+    Missing.assign ((nrec+7)/8, 0);
+    Text.assign ((nrec+7)/8, 0);
+}
+
+// A field is cached as a number only if getpheno_ would read it as one
+// number with nothing following; anything else is left for getpheno_
+
+void PhenoColumn::set (int rec, const char *field)
+{
+    if (!field[0])
+    {
+	Value[rec] = MISSING_PHENOTYPE;
+	Missing[rec>>3] |= 1 << (rec&7);
+	return;
+    }
+    char *end;
+    double value = strtod (field, &end);
+    while (isspace (*end)) end++;
+    if (end == field || *end)
+    {
+	Text[rec>>3] |= 1 << (rec&7);
+	return;
+    }
+    Value[rec] = value;
 }
 
 void PhenoFileIndex::Reset_All ()
@@ -16,7 +16,8 @@ static void print_help(Tcl_Interp * interp){
 }
 
 
-extern "C" int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename, const size_t max_per_file, const int bin_format, const int solar_format,  const int per_chromo, char ** errmsg);
+extern "C" int convert_plink_to_csv(struct pio_file_t * input, const char * output_basename, const size_t max_per_file, const int bin_format, const int solar_format, \
+                                    const int binary_format, const int per_chromo, const int n_threads, char ** errmsg);
 
 
 extern "C" int RunPlinkConverter(ClientData clientData, Tcl_Interp *interp,
@@ -27,6 +28,8 @@ extern "C" int RunPlinkConverter(ClientData clientData, Tcl_Interp *interp,
     int per_chromo = 0;
     int bin_format = 0; 
     int solar_format = 0;
+    int binary_format = 0;
+    int n_threads = 0;
     size_t max_per_file = 0;
     for(int arg = 1; arg < argc; arg++){
         if(!StringCmp("--help", argv[arg], case_ins) || !StringCmp("-help", argv[arg], case_ins)\
@@ -49,6 +52,15 @@ extern "C" int RunPlinkConverter(ClientData clientData, Tcl_Interp *interp,
             max_per_file = strtol(argv[++arg], NULL, 10);
         }else if(!StringCmp("--solar", argv[arg], case_ins) || !StringCmp("-solar", argv[arg], case_ins)){
 		solar_format = 1;
+	}else if(!StringCmp("--binary", argv[arg], case_ins) || !StringCmp("-binary", argv[arg], case_ins)){
+            binary_format = 1;
+        }else if((!StringCmp("--threads", argv[arg], case_ins) || !StringCmp("-threads", argv[arg], case_ins))\
+                 && arg + 1 < argc){
+            n_threads = strtol(argv[++arg], NULL, 10);
+            if(n_threads < 1){
+                RESULT_LIT("-threads must be a positive integer");
+                return TCL_ERROR;
+            }
 	} else{
             RESULT_LIT("Invalid argument was entered");
             return TCL_ERROR;
@@ -66,6 +78,11 @@ extern "C" int RunPlinkConverter(ClientData clientData, Tcl_Interp *interp,
         RESULT_LIT("The output base filename must be specified with -o <base filename> argument");
         return TCL_ERROR;
     }
+
+    if(binary_format && (bin_format || solar_format)){
+        RESULT_LIT("-binary cannot be combined with -bin or -solar");
+        return TCL_ERROR;
+    }
     
     
     pio_file_t input;
@@ -117,7 +134,13 @@ extern "C" int RunPlinkConverter(ClientData clientData, Tcl_Interp *interp,
       }
     }
     char * errmsg = 0;
-    convert_plink_to_csv(&input, output_basename,  max_per_file,  bin_format, solar_format,  per_chromo, &errmsg);
+    int failed = convert_plink_to_csv(&input, output_basename,  max_per_file,  bin_format, solar_format, \
+                                      binary_format, per_chromo, n_threads, &errmsg);
+    pio_close(&input);
+    if(failed){
+        RESULT_BUF(errmsg);
+        return TCL_ERROR;
+    }
     return TCL_OK;
 }
 
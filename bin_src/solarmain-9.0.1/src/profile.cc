@@ -0,0 +1,197 @@
+/*
+ * profile.cc implements the profile command and the Profile class, which
+ * accumulates the time spent in each phase of maximization (see
+ * "help profile")
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include "solar.h"
+
+static const char *Phase_Names[prof_phases] = {
+    "maximize", "build_index", "preped", "optima", "search", "fun",
+    "fun_deriv", "ddfun", "direct", "omegac", "scratch_read", "matrix_load",
+    "phen_seek"};
+
+bool Profile::Enabled = false;
+int Profile::Calls[prof_phases] = {0};
+double Profile::Seconds[prof_phases] = {0};
+long long Profile::Bytes[prof_phases] = {0};
+double Profile::Enabled_At = 0;
+double Profile::Total = 0;
+
+// Start times for the FORTRAN interfaces, which cannot hold a timer object
+
+static double Started[prof_phases] = {0};
+
+/****************************************************************************\
+ *                  FORTRAN interfaces                                      *
+\****************************************************************************/
+
+// phase is the index in profile_phase: 5 fun, 6 fun_deriv, 7 ddfun, 8 direct
+
+extern "C" void profbeg_ (int *phase)
+{
+    if (Profile::Enabled) Started[*phase] = Profile::now ();
+}
+
+extern "C" void profend_ (int *phase)
+{
+    if (Profile::Enabled && Started[*phase] > 0)
+    {
+	Profile::add (*phase, Started[*phase]);
+	Started[*phase] = 0;
+    }
+}
+
+// ***************************************************************************
+//                            Implementation
+// ***************************************************************************
+
+double Profile::now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+void Profile::reset ()
+{
+    for (int i = 0; i < prof_phases; i++)
+    {
+	Calls[i] = 0;
+	Seconds[i] = 0;
+	Bytes[i] = 0;
+	Started[i] = 0;
+    }
+    Total = 0;
+    if (Enabled) Enabled_At = now ();
+}
+
+void Profile::enable ()
+{
+    if (Enabled) return;
+    Enabled = true;
+    Enabled_At = now ();
+}
+
+void Profile::disable ()
+{
+    if (!Enabled) return;
+    Enabled = false;
+    Total += now () - Enabled_At;
+}
+
+int Profile::report (Tcl_Interp *interp, bool json, const char *filename)
+{
+    double total = Total;
+    if (Enabled) total += now () - Enabled_At;
+
+    std::string text;
+    char buf[256];
+    if (json)
+    {
+	snprintf (buf, sizeof(buf), "{\n  \"enabled\": %s,\n"
+		  "  \"wall_seconds\": %.6f,\n  \"phases\": [\n",
+		  Enabled ? "true" : "false", total);
+	text += buf;
+	for (int i = 0; i < prof_phases; i++)
+	{
+	    snprintf (buf, sizeof(buf), "    {\"name\": \"%s\", \"calls\": %d, "
+		      "\"seconds\": %.6f, \"bytes\": %lld}%s\n",
+		      Phase_Names[i], Calls[i], Seconds[i], Bytes[i],
+		      (i < prof_phases-1) ? "," : "");
+	    text += buf;
+	}
+	text += "  ]\n}\n";
+    }
+    else
+    {
+	snprintf (buf, sizeof(buf),
+		  "Profiled wall time: %.3f seconds (profiling is %s)\n\n",
+		  total, Enabled ? "on" : "off");
+	text += buf;
+	snprintf (buf, sizeof(buf), "%-14s %12s %12s %8s %14s\n",
+		  "Phase", "Calls", "Seconds", "Percent", "Bytes read");
+	text += buf;
+	for (int i = 0; i < prof_phases; i++)
+	{
+	    snprintf (buf, sizeof(buf), "%-14s %12d %12.3f %7.1f%% %14lld\n",
+		      Phase_Names[i], Calls[i], Seconds[i],
+		      (total > 0) ? 100 * Seconds[i] / total : 0.0, Bytes[i]);
+	    text += buf;
+	}
+    }
+
+    if (filename)
+    {
+	FILE *file = fopen (filename, "w");
+	if (!file)
+	{
+	    RESULT_LIT ("Unable to open profile output file");
+	    return TCL_ERROR;
+	}
+	fputs (text.c_str(), file);
+	fclose (file);
+	return TCL_OK;
+    }
+    if (text.length() && text[text.length()-1] == '\n')
+    {
+	text.erase (text.length()-1);
+    }
+    RESULT_BUF (text.c_str());
+    return TCL_OK;
+}
+
+extern "C" int ProfileCmd (ClientData clientData, Tcl_Interp *interp,
+			   int argc, char *argv[])
+{
+    if (argc == 2 && !StringCmp ("help", argv[1], case_ins))
+    {
+	return Solar_Eval (interp, "help profile");
+    }
+    if (argc == 2 && !StringCmp ("on", argv[1], case_ins))
+    {
+	Profile::enable ();
+	Profile::reset ();
+	return TCL_OK;
+    }
+    if (argc == 2 && !StringCmp ("off", argv[1], case_ins))
+    {
+	Profile::disable ();
+	return TCL_OK;
+    }
+    if (argc == 2 && !StringCmp ("reset", argv[1], case_ins))
+    {
+	Profile::reset ();
+	return TCL_OK;
+    }
+    if (argc == 1 || !StringCmp ("report", argv[1], case_ins))
+    {
+	bool json = false;
+	const char *filename = 0;
+	for (int i = 2; i < argc; i++)
+	{
+	    if (!StringCmp ("-json", argv[i], case_ins))
+	    {
+		json = true;
+	    }
+	    else if (!StringCmp ("-out", argv[i], case_ins) && i+1 < argc)
+	    {
+		filename = argv[++i];
+	    }
+	    else
+	    {
+		RESULT_LIT ("Usage: profile report [-json] [-out <filename>]");
+		return TCL_ERROR;
+	    }
+	}
+	return Profile::report (interp, json, filename);
+    }
+    RESULT_LIT (
+	"Usage: profile on | off | reset | report [-json] [-out <filename>]");
+    return TCL_ERROR;
+}
@@ -25,7 +25,9 @@ extern "C" void rscrat_ (double* stuff, int* len, int* unit, int* rite,
     }
     else
     {
+	Profile_Timer timer (prof_scratch);
 	ScratchFile::Read (*unit, *len, Real, 0, stuff);
+	timer.bytes (*len * (long long) sizeof(double));
     }
 }
 
@@ -37,7 +39,9 @@ extern "C" void iscrat_ (int* stuff, int* len, int* unit, int* rite)
     }
     else
     {
+	Profile_Timer timer (prof_scratch);
 	ScratchFile::Read (*unit, *len, Int, stuff, 0);
+	timer.bytes (*len * (long long) sizeof(int));
     }
 }
 
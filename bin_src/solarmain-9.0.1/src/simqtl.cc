@@ -5,6 +5,9 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <omp.h>
+#include <string>
+#include <vector>
 #include "solar.h"
 #include "pipeback.h"
 
@@ -74,25 +77,83 @@ struct Ego {
     double *cov;
     bool *missing;
     int hap[2];
-    Ego()   {cov = 0;}
+    Ego()   {cov = 0; missing = 0;}
     ~Ego()  {if (cov) delete[] cov; if (missing) delete[] missing;}
 };
 
-static int do_sim (Tcl_Interp*, bool, bool);
+/*
+ * Random number source for the simulation.  The base class draws from
+ * drand48(), so a single simulation follows the seed set by drand.
+ * SimStreamRng is a counter-based generator (SplitMix64) whose stream is
+ * fixed by the seed, the replicate, and the pedigree, so replicates give
+ * the same results no matter how many threads run them.
+ */
+
+class SimRng {
+    double gset;
+    bool iset;
+public:
+    SimRng()  {iset = false;}
+    virtual ~SimRng() {}
+    virtual double uniform (void) {return drand48();}
+    double gasdev (void);
+};
+
+class SimStreamRng : public SimRng {
+    unsigned long long key;
+    unsigned long long counter;
+public:
+    SimStreamRng (unsigned long long seed, int rep, int ped);
+    double uniform (void);
+    static unsigned long long mix (unsigned long long z);
+};
+
+static SimRng Drand_Rng;
+
+static const char *Age_Term_Message =
+"The model contains a non-zero regression coefficient for an age term,\n\
+but there is no AGE field in the phenotypes file.";
+
+struct SimPed {
+    int nind;
+    int tnind;          // individuals in preceding pedigrees
+    int ntwin;
+    Ego *ego;
+    std::vector<int> ifa, imo, itwin;
+    std::vector<double> amat;
+};
+
+struct SimDraw {
+    std::vector<double> gdev, edev;     // ntrt x nind
+    std::vector<int> patgene, matgene;
+};
+
+static int do_sim (Tcl_Interp*, bool, bool, int nrep = 0, int nthreads = 0,
+                   unsigned long long seed = 0);
+static void close_outputs (FILE*, FILE*, FILE*);
 static int get_ego (Tcl_Interp*, char**, int, int, int, int, bool, SimPars*,
                     Ego*);
 static int sim_ped (Tcl_Interp*, FILE*, bool, FILE*, FILE*, bool, int, int,
                     int, int, int*, SimPars*, int, Ego*, double*, double*,
                     FILE*);
+static int ped_setup (Tcl_Interp*, SimPed&, FILE*);
+static void ped_simulate (SimPed&, SimPars*, double*, double*, bool, SimRng&,
+                          SimDraw&);
+static bool ped_output (SimPed&, SimDraw&, SimPars*, int, int, int, bool,
+                        std::string&, std::string&, std::string&);
+static int sim_replicates (Tcl_Interp*, std::vector<SimPed>&, SimPars*,
+                           double*, double*, bool, bool, int, int, int,
+                           const std::string*, int, int, unsigned long long);
 static void factor (double*, int, int*, int);
 static int kincoef (double*, int*, int*, int*, int, int, FILE*);
-static void simva (double*, double*, double**, int, int);
-static void simve (double*, double**, int, int);
+static void simva (double*, double*, double**, int, int, SimRng&);
+static void simve (double*, double**, int, int, SimRng&);
 static void dropgenel (int*, int*, int*, int, double*, double*, double,
-                       double, int*, int*, int, int);
-static void dropgene (int*, int*, int*, int, double*, int*, int*, int);
-static double gasdev (void);
+                       double, int*, int*, int, int, SimRng&);
+static void dropgene (int*, int*, int*, int, double*, int*, int*, int,
+                      SimRng&);
 static char *fp2str (double);
+static char *fp2str (double, char*);
 
 extern "C" void dppfa_ (double*, int*, int*);
 extern "C" void eigstruc_ (double*, int*, int*);
@@ -146,6 +207,61 @@ extern "C" int SimqtlCmd (ClientData clientData, Tcl_Interp *interp,
         return TCL_OK;
     }
 
+    int i;
+    for (i = 1; i < argc; i++)
+        if (!StringCmp ("-nrep", argv[i], case_ins))
+            break;
+
+    if (i < argc)
+    {
+        bool inform = false, gfile = false;
+        int nrep = 0, nthreads = 0;
+        long seed = 0;
+        bool seed_given = false;
+        for (i = 1; i < argc; i++) {
+            if (!StringCmp ("-inform", argv[i], case_ins))
+                inform = true;
+            else if (!StringCmp ("-gfile", argv[i], case_ins))
+                gfile = true;
+            else if (!StringCmp ("-seed", argv[i], case_ins) && i+1 < argc) {
+                if (sscanf(argv[++i], "%ld", &seed) != 1) {
+                    RESULT_LIT ("The seed must be an integer");
+                    return TCL_ERROR;
+                }
+                seed_given = true;
+            }
+            else if (!StringCmp ("-nrep", argv[i], case_ins) && i+1 < argc) {
+                if (sscanf(argv[++i], "%d", &nrep) != 1 || nrep <= 0) {
+                    RESULT_LIT (
+                        "The number of replicates must be a positive integer");
+                    return TCL_ERROR;
+                }
+            }
+            else if (!StringCmp ("-threads", argv[i], case_ins) && i+1 < argc)
+            {
+                if (sscanf(argv[++i], "%d", &nthreads) != 1 || nthreads < 0) {
+                    RESULT_LIT (
+                        "The number of threads must be a non-negative integer");
+                    return TCL_ERROR;
+                }
+            }
+            else {
+                RESULT_LIT ("Invalid simqtl command");
+                return TCL_ERROR;
+            }
+        }
+
+    // Without a seed, take one from drand so the run can be repeated
+    // after "drand <seed>"
+
+        if (!seed_given) {
+            if (!random_number_generator_seeded)
+                Solar_Eval(interp, "drand 0");
+            seed = lrand48();
+        }
+        return do_sim(interp, inform, gfile, nrep, nthreads, seed);
+    }
+
     if (argc == 1)
     {
         return do_sim(interp, false, false);
@@ -260,7 +376,8 @@ SimPars::~SimPars ()
     if (nmrk) delete[] mfreq;
 }
 
-int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
+int do_sim (Tcl_Interp *interp, bool inform, bool gfile, int nrep, int nthreads,
+            unsigned long long seed)
 {
     struct storage {
         double *gmat, *emat;
@@ -458,7 +575,12 @@ int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
         nrec++;
     }
 
-    try { s.ego = new Ego[mxind]; }
+// Replicates keep every pedigree in memory; a single simulation reuses
+// storage for the largest one.
+
+    int nego = nrep ? nrec : mxind;
+
+    try { s.ego = new Ego[nego]; }
     catch (...) {
         RESULT_LIT ("Out of memory");
         delete Tfile;
@@ -466,7 +588,7 @@ int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
     }
 
     if (ncov) {
-        for (i = 0; i < mxind; i++) {
+        for (i = 0; i < nego; i++) {
             try { s.ego[i].cov = new double[ncov]; }
             catch (...) {
                 RESULT_LIT ("Out of memory");
@@ -476,7 +598,7 @@ int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
         }
     }
 
-    for (i = 0; i < mxind; i++) {
+    for (i = 0; i < nego; i++) {
         try { s.ego[i].missing = new bool[ncov+1]; }
         catch (...) {
             RESULT_LIT ("Out of memory");
@@ -486,70 +608,78 @@ int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
     }
 
     Tfile->rewind(&errmsg);
-    unlink("simqtl.phn");
-    unlink("simqtl.qtl");
-    unlink("simqtl.mrk");
 
-    FILE *phnfp = fopen("simqtl.phn", "w");
-    if (!phnfp) {
-        RESULT_LIT ("Cannot open output file simqtl.phn");
-        delete Tfile;
-        return TCL_ERROR;
-    }
+// Output file headers
 
+    std::string header[3];
     if (need_famid)
-        fprintf(phnfp, "%s,", Field::Map("FAMID"));
-    fprintf(phnfp, "%s", Field::Map("ID"));
+        header[0] = header[1] = header[2] =
+            std::string(Field::Map("FAMID")) + ",";
+    header[0] += Field::Map("ID");
     if (age_avail)
-        fprintf(phnfp, ",AGE");
-    for (i = 0; i < ncov; i++)
-        fprintf(phnfp, ",%s", names[count-ncov+i]);
+        header[0] += ",AGE";
+    for (i = 0; i < ncov; i++) {
+        header[0] += ",";
+        header[0] += names[count-ncov+i];
+    }
     if (pars.ntrt == 1)
-        fprintf(phnfp, ",SIMQT");
+        header[0] += ",SIMQT";
     else {
-        for (i = 0; i < pars.ntrt; i++)
-            fprintf(phnfp, ",SIMQT%d", i+1);
+        for (i = 0; i < pars.ntrt; i++) {
+            char buf[32];
+            sprintf(buf, ",SIMQT%d", i+1);
+            header[0] += buf;
+        }
     }
-    fprintf(phnfp, "\n");
-
-    FILE *qtlfp = fopen("simqtl.qtl", "w");
-    if (!qtlfp) {
-        RESULT_LIT ("Cannot open output file simqtl.qtl");
-        fclose(phnfp);
-        delete Tfile;
-        return TCL_ERROR;
+    header[0] += "\n";
+    header[1] += Field::Map("ID");
+    header[1] += ",QTL\n";
+    if (inform)
+        header[2] = "";
+    else {
+        header[2] += Field::Map("ID");
+        header[2] += ",SIMMRK\n";
     }
 
-    if (need_famid)
-        fprintf(qtlfp, "%s,", Field::Map("FAMID"));
-    fprintf(qtlfp, "%s,QTL\n", Field::Map("ID"));
+    FILE *phnfp = 0, *qtlfp = 0, *mrkfp = 0;
+    if (!nrep) {
+        unlink("simqtl.phn");
+        unlink("simqtl.qtl");
+        unlink("simqtl.mrk");
 
-    FILE *mrkfp;
-    if (pars.nmrk) {
-        mrkfp = fopen("simqtl.mrk", "w");
-        if (!fp) {
-            RESULT_LIT ("Cannot open output file simqtl.mrk");
-            fclose(qtlfp);
-            fclose(phnfp);
+        phnfp = fopen("simqtl.phn", "w");
+        if (!phnfp) {
+            RESULT_LIT ("Cannot open output file simqtl.phn");
+            delete Tfile;
+            return TCL_ERROR;
+        }
+        fputs(header[0].c_str(), phnfp);
+
+        qtlfp = fopen("simqtl.qtl", "w");
+        if (!qtlfp) {
+            RESULT_LIT ("Cannot open output file simqtl.qtl");
+            close_outputs(phnfp, qtlfp, mrkfp);
             delete Tfile;
             return TCL_ERROR;
         }
+        fputs(header[1].c_str(), qtlfp);
 
-        if (!inform) {
-            if (need_famid)
-                fprintf(mrkfp, "%s,", Field::Map("FAMID"));
-            fprintf(mrkfp, "%s,SIMMRK\n", Field::Map("ID"));
+        if (pars.nmrk) {
+            mrkfp = fopen("simqtl.mrk", "w");
+            if (!mrkfp) {
+                RESULT_LIT ("Cannot open output file simqtl.mrk");
+                close_outputs(phnfp, qtlfp, mrkfp);
+                delete Tfile;
+                return TCL_ERROR;
+            }
+            fputs(header[2].c_str(), mrkfp);
         }
     }
 
     FILE *kinfp = fopen("phi2.gz", "r");
     if (!kinfp) {
         RESULT_LIT ("Cannot open phi2.gz");
-        if (pars.nmrk) {
-            fclose(mrkfp);
-        }
-        fclose(qtlfp);
-        fclose(phnfp);
+        close_outputs(phnfp, qtlfp, mrkfp);
         delete Tfile;
         return TCL_ERROR;
     }
@@ -564,75 +694,71 @@ int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
     kinfp = pipeback_shell_open("gunzip", pbarg);
     if (!kinfp) {
         RESULT_LIT ("Cannot uncompress phi2");
-        if (pars.nmrk) {
-            fclose(mrkfp);
-        }
-        fclose(qtlfp);
-        fclose(phnfp);
+        close_outputs(phnfp, qtlfp, mrkfp);
         delete Tfile;
         return TCL_ERROR;
     }
 
+    std::vector<SimPed> peds;
     nind = 0;
     nped = 1;
     int tnind = 0;
-    while (1) {
+    bool more = true;
+    while (more) {
         record = Tfile->get(&errmsg);
-        if (errmsg && !strcmp("EOF", errmsg)) {
-            if (sim_ped(interp, phnfp, gfile, qtlfp, mrkfp, inform, need_famid,
-                        age_avail, nped, nind, &tnind, &pars, ncov, s.ego,
-                        s.gmat, s.emat, kinfp) == TCL_ERROR)
-            {
-                if (pars.nmrk) {
-                    fclose(mrkfp);
-                }
-                fclose(qtlfp);
-                fclose(phnfp);
-                delete Tfile;
-                return TCL_ERROR;
-            }
-            break;
-        }
+        if (errmsg && !strcmp("EOF", errmsg))
+            more = false;
 
-        if (errmsg) {
+        else if (errmsg) {
             char mbuf[1024];
             sprintf (mbuf, "do_sim: simqtl.dat: %s", errmsg);
             RESULT_BUF (mbuf);
+            pipeback_shell_close(kinfp);
+            close_outputs(phnfp, qtlfp, mrkfp);
             delete Tfile;
             return TCL_ERROR;
         }
 
-        if (sscanf(record[1+need_famid], "%d", &ped) != 1) {
+        else if (sscanf(record[1+need_famid], "%d", &ped) != 1) {
             RESULT_LIT ("do_sim: simqtl.dat: Pedigree numbers must be integer");
+            pipeback_shell_close(kinfp);
+            close_outputs(phnfp, qtlfp, mrkfp);
             delete Tfile;
             return TCL_ERROR;
         }
 
-        if (ped != nped) {
-            if (sim_ped(interp, phnfp, gfile, qtlfp, mrkfp, inform, need_famid,
-                        age_avail, nped, nind, &tnind, &pars, ncov, s.ego,
-                        s.gmat, s.emat, kinfp) == TCL_ERROR)
-            {
-                if (pars.nmrk) {
-                    fclose(mrkfp);
-                }
-                fclose(qtlfp);
-                fclose(phnfp);
+        if (!more || ped != nped) {
+            int status;
+            if (nrep) {
+                SimPed p;
+                p.nind = nind;
+                p.tnind = tnind;
+                p.ego = s.ego + tnind;
+                peds.push_back(p);
+                status = ped_setup(interp, peds.back(), kinfp);
+                tnind += nind;
+            }
+            else
+                status = sim_ped(interp, phnfp, gfile, qtlfp, mrkfp, inform,
+                                 need_famid, age_avail, nped, nind, &tnind,
+                                 &pars, ncov, s.ego, s.gmat, s.emat, kinfp);
+            if (status == TCL_ERROR) {
+                pipeback_shell_close(kinfp);
+                close_outputs(phnfp, qtlfp, mrkfp);
                 delete Tfile;
                 return TCL_ERROR;
             }
+            if (!more)
+                break;
             nped = ped;
             nind = 0;
         }
 
         if (get_ego(interp, record, need_famid, age_avail, nind, ncov, gfile,
-                    &pars, s.ego) == TCL_ERROR)
+                    &pars, nrep ? s.ego + tnind : s.ego) == TCL_ERROR)
         {
-            if (pars.nmrk) {
-                fclose(mrkfp);
-            }
-            fclose(qtlfp);
-            fclose(phnfp);
+            pipeback_shell_close(kinfp);
+            close_outputs(phnfp, qtlfp, mrkfp);
             delete Tfile;
             return TCL_ERROR;
         }
@@ -641,13 +767,111 @@ int do_sim (Tcl_Interp *interp, bool inform, bool gfile)
     }
 
     pipeback_shell_close(kinfp);
+    close_outputs(phnfp, qtlfp, mrkfp);
+    delete Tfile;
+
+    if (nrep)
+        return sim_replicates(interp, peds, &pars, s.gmat, s.emat, gfile,
+                              inform, need_famid, age_avail, ncov, header,
+                              nrep, nthreads, seed);
+
+    return TCL_OK;
+}
+
+void close_outputs (FILE *phnfp, FILE *qtlfp, FILE *mrkfp)
+{
+    if (mrkfp) fclose(mrkfp);
+    if (qtlfp) fclose(qtlfp);
+    if (phnfp) fclose(phnfp);
+}
 
-    if (pars.nmrk) {
-        fclose(mrkfp);
+/*
+ * Simulate nrep replicates of all pedigrees.  Each (replicate, pedigree)
+ * pair is an independent task with its own random number stream.
+ * Replicates are run in batches so that only a batch of output is held
+ * in memory; each replicate is written to simqtl.<rep>.phn, .qtl, and
+ * .mrk with a single write per file.
+ */
+
+int sim_replicates (Tcl_Interp *interp, std::vector<SimPed> &peds,
+                    SimPars *pars, double *gmat, double *emat, bool gfile,
+                    bool inform, int need_famid, int age_avail, int ncov,
+                    const std::string *header, int nrep, int nthreads,
+                    unsigned long long seed)
+{
+    const char *ext[3] = {"phn", "qtl", "mrk"};
+    int nfile = pars->nmrk ? 3 : 2;
+    int nped = peds.size();
+
+    if (nthreads <= 0)
+        nthreads = omp_get_max_threads();
+
+    int batch = 4*nthreads;
+    for (int first = 0; first < nrep; first += batch) {
+        int nb = nrep - first < batch ? nrep - first : batch;
+        std::vector<std::string> out[3];
+        for (int f = 0; f < 3; f++)
+            out[f].resize(nb*nped);
+
+        const char *errmsg = 0;
+        std::string errbuf;
+
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+        for (int task = 0; task < nb*nped; task++) {
+            int rep = first + task/nped;
+            int ped = task % nped;
+            SimStreamRng rng(seed, rep, ped);
+            SimDraw d;
+            try {
+                ped_simulate(peds[ped], pars, gmat, emat, gfile, rng, d);
+                if (!ped_output(peds[ped], d, pars, ncov, need_famid,
+                                age_avail, inform, out[0][task],
+                                out[1][task], out[2][task]))
+                {
+#pragma omp critical
+                    errmsg = Age_Term_Message;
+                }
+            }
+            catch (Safe_Error_Return &ser) {
+#pragma omp critical
+                {
+                    errbuf = ser.message();
+                    errmsg = errbuf.c_str();
+                }
+            }
+            catch (...) {
+#pragma omp critical
+                errmsg = "Out of memory";
+            }
+        }
+
+        if (errmsg) {
+            RESULT_BUF (errmsg);
+            return TCL_ERROR;
+        }
+
+        for (int r = 0; r < nb; r++) {
+            for (int f = 0; f < nfile; f++) {
+                char fname[64];
+                sprintf(fname, "simqtl.%d.%s", first + r + 1, ext[f]);
+                std::string text = header[f];
+                for (int ped = 0; ped < nped; ped++)
+                    text += out[f][r*nped+ped];
+
+                FILE *fp = fopen(fname, "w");
+                if (!fp || fwrite(text.data(), 1, text.size(), fp)
+                                != text.size())
+                {
+                    if (fp) fclose(fp);
+                    char mbuf[1024];
+                    sprintf(mbuf, "Cannot write output file %s", fname);
+                    RESULT_BUF (mbuf);
+                    return TCL_ERROR;
+                }
+                fclose(fp);
+            }
+        }
     }
-    fclose(qtlfp);
-    fclose(phnfp);
-    delete Tfile;
 
     return TCL_OK;
 }
@@ -733,89 +957,39 @@ int get_ego(Tcl_Interp *interp, char **record, int need_famid, int age_avail,
     return TCL_OK;
 }
 
-int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
-             FILE *mrkfp, bool inform, int need_famid, int age_avail,
-             int ped, int nind, int *tnind, SimPars *pars, int ncov,
-             Ego *ego, double *gmat, double *emat, FILE *kinfp)
-{
-    struct storage {
-        int *ifa, *imo, *itwin;
-        int *twinid, *twin1;
-        double *amat;
-        int ntrt;
-        double **gdev, **edev;
-        int *patgene, *matgene;
-        storage() {
-		ifa = 0;	
-		imo = 0;
-		itwin = 0;
-		twinid = 0;
-		twin1 =0;
-		amat =0;
-		gdev = 0;
-		edev = 0;
-		patgene =0;
-		matgene =0;
-	}
-        ~storage() {
-            if (patgene) delete[] patgene;
-            if (matgene) delete[] matgene;
-            for (int i = 0; i < ntrt; i++) {
-                if (edev[i]) delete[] edev[i];
-                if (gdev[i]) delete[] gdev[i];
-            }
-            if (edev) delete[] edev;
-            if (gdev) delete[] gdev;
-            if (amat) delete[] amat;
-            if (twin1) delete[] twin1;
-            if (twinid) delete[] twinid;
-            if (itwin) delete[] itwin;
-            if (imo) delete[] imo;
-            if (ifa) delete[] ifa;
-        }
-    } s;
+/*
+ * A pedigree is simulated in three steps: setup builds the parent and
+ * twin indices and the factored kinship matrix (read once, in phi2
+ * order); simulate draws the deviations and genes from a given random
+ * number stream; output formats the records.  Only simulate and output
+ * are repeated for each replicate.
+ */
 
+int ped_setup (Tcl_Interp *interp, SimPed &p, FILE *kinfp)
+{
     int i, j;
-    int ntwin, nfou;
-
-    try { s.ifa = new int[nind]; }
-    catch (...) {
-        RESULT_LIT ("Out of memory");
-        return TCL_ERROR;
-    }
-
-    try { s.imo = new int[nind]; }
-    catch (...) {
-        RESULT_LIT ("Out of memory");
-        return TCL_ERROR;
-    }
-
-    try { s.itwin = new int[nind]; }
-    catch (...) {
-        RESULT_LIT ("Out of memory");
-        return TCL_ERROR;
-    }
+    int nind = p.nind;
+    Ego *ego = p.ego;
+    std::vector<int> twinid, twin1;
 
-    try { s.twinid = new int[nind/2]; }
-    catch (...) {
-        RESULT_LIT ("Out of memory");
-        return TCL_ERROR;
+    try {
+        p.ifa.resize(nind);
+        p.imo.resize(nind);
+        p.itwin.resize(nind);
+        p.amat.resize(nind*nind);
     }
-
-    try { s.twin1 = new int[nind/2]; }
     catch (...) {
         RESULT_LIT ("Out of memory");
         return TCL_ERROR;
     }
 
-    nfou = 0;
-    ntwin = 0;
+    p.ntwin = 0;
     for (i = 0; i < nind; i++) {
-        s.ifa[i] = 0;
+        p.ifa[i] = 0;
         if (ego[i].fibdid) {
             for (j = 0; j < nind; j++) {
                 if (ego[j].ibdid == ego[i].fibdid) {
-                    s.ifa[i] = j + 1;
+                    p.ifa[i] = j + 1;
                     break;
                 }
             }
@@ -824,14 +998,12 @@ int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
                 return TCL_ERROR;
             }
         }
-        else
-            nfou++;
 
-        s.imo[i] = 0;
+        p.imo[i] = 0;
         if (ego[i].mibdid) {
             for (j = 0; j < nind; j++) {
                 if (ego[j].ibdid == ego[i].mibdid) {
-                    s.imo[i] = j + 1;
+                    p.imo[i] = j + 1;
                     break;
                 }
             }
@@ -841,34 +1013,30 @@ int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
             }
         }
 
-        s.itwin[i] = i + 1;
+        p.itwin[i] = i + 1;
         if (ego[i].mztwin) {
-            for (j = 0; j < ntwin; j++)
-                if (s.twinid[j] == ego[i].mztwin)
+            for (j = 0; j < p.ntwin; j++)
+                if (twinid[j] == ego[i].mztwin)
                     break;
-            if (j == ntwin) {
-                s.twinid[ntwin] = ego[i].mztwin;
-                s.twin1[ntwin] = i + 1;
-                ntwin++;
+            if (j == p.ntwin) {
+                twinid.push_back(ego[i].mztwin);
+                twin1.push_back(i + 1);
+                p.ntwin++;
             }
             else
-                s.itwin[i] = s.twin1[j];
+                p.itwin[i] = twin1[j];
         }
     }
 
-    try { s.amat = new double[nind*nind]; }
-    catch (...) {
-        RESULT_LIT ("Out of memory");
-        return TCL_ERROR;
-    }
-
-    if (!kincoef(s.amat, s.ifa, s.imo, s.itwin, nind, *tnind, kinfp)) {
+    if (!kincoef(&p.amat[0], &p.ifa[0], &p.imo[0], &p.itwin[0], nind,
+                 p.tnind, kinfp))
+    {
         RESULT_LIT ("Error encountered reading phi2.");
         return TCL_ERROR;
     }
 
     int info;
-    factor(s.amat, nind, &info, ntwin);
+    factor(&p.amat[0], nind, &info, p.ntwin);
     if (info) {
         if (info == -1) {
             RESULT_LIT ("Out of memory");
@@ -881,60 +1049,80 @@ int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
         return TCL_ERROR;
     }
 
+    return TCL_OK;
+}
+
+void ped_simulate (SimPed &p, SimPars *pars, double *gmat, double *emat,
+                   bool gfile, SimRng &rng, SimDraw &d)
+{
+    int i;
+    int nind = p.nind;
+    std::vector<double*> gdev, edev;
+
     try {
-        s.ntrt = pars->ntrt;
-        s.gdev = new double*[pars->ntrt];
-        s.edev = new double*[pars->ntrt];
+        d.gdev.resize(pars->ntrt*nind);
+        d.edev.resize(pars->ntrt*nind);
+        d.patgene.resize(2*nind);
+        d.matgene.resize(2*nind);
         for (i = 0; i < pars->ntrt; i++) {
-            s.gdev[i] = new double[nind];
-            s.edev[i] = new double[nind];
+            gdev.push_back(&d.gdev[i*nind]);
+            edev.push_back(&d.edev[i*nind]);
         }
-        s.patgene = new int[2*nind];
-        s.matgene = new int[2*nind];
     }
     catch (...) {
-        RESULT_LIT ("Out of memory");
-        return TCL_ERROR;
+        throw Safe_Error_Return("Out of memory");
     }
 
-    try {
-        simva(s.amat, gmat, s.gdev, nind, pars->ntrt);
-        simve(emat, s.edev, nind, pars->ntrt);
-        if (gfile) {
-            for (i = 0; i < nind; i++) {
-                s.patgene[2*i] = ego[i].hap[0];
-                s.matgene[2*i] = ego[i].hap[1];
-            }
-        }
-        else {
-            if (pars->nmrk) {
-                dropgenel(s.ifa, s.imo, s.itwin, nind, pars->loc[0]->freq,
-                          pars->mfreq, pars->theta, pars->theta, s.patgene,
-                          s.matgene, pars->loc[0]->nall, pars->nmall);
-            } else {
-                dropgene(s.ifa, s.imo, s.itwin, nind, pars->loc[0]->freq,
-                         s.patgene, s.matgene, pars->loc[0]->nall);
-            }
+    simva(&p.amat[0], gmat, &gdev[0], nind, pars->ntrt, rng);
+    simve(emat, &edev[0], nind, pars->ntrt, rng);
+    if (gfile) {
+        for (i = 0; i < nind; i++) {
+            d.patgene[2*i] = p.ego[i].hap[0];
+            d.matgene[2*i] = p.ego[i].hap[1];
         }
     }
-    catch (Safe_Error_Return &ser) {
-        RESULT_BUF (ser.message());
-        return TCL_ERROR;
+    else {
+        if (pars->nmrk) {
+            dropgenel(&p.ifa[0], &p.imo[0], &p.itwin[0], nind,
+                      pars->loc[0]->freq, pars->mfreq, pars->theta,
+                      pars->theta, &d.patgene[0], &d.matgene[0],
+                      pars->loc[0]->nall, pars->nmall, rng);
+        } else {
+            dropgene(&p.ifa[0], &p.imo[0], &p.itwin[0], nind,
+                     pars->loc[0]->freq, &d.patgene[0], &d.matgene[0],
+                     pars->loc[0]->nall, rng);
+        }
     }
+}
+
+/*
+ * Returns false if the model has an age term but there is no AGE field.
+ */
+
+bool ped_output (SimPed &p, SimDraw &d, SimPars *pars, int ncov,
+                 int need_famid, int age_avail, bool inform,
+                 std::string &phn, std::string &qtl, std::string &mrk)
+{
+    int i, j;
+    int nind = p.nind;
+    Ego *ego = p.ego;
+    char buf[256];
 
     for (i = 0; i < nind; i++) {
         int qtlgen;
-        if (s.patgene[2*i] >= s.matgene[2*i])
-            qtlgen = s.patgene[2*i]*(s.patgene[2*i] + 1)/2 + s.matgene[2*i];
+        if (d.patgene[2*i] >= d.matgene[2*i])
+            qtlgen = d.patgene[2*i]*(d.patgene[2*i] + 1)/2 + d.matgene[2*i];
         else
-            qtlgen = s.matgene[2*i]*(s.matgene[2*i] + 1)/2 + s.patgene[2*i];
+            qtlgen = d.matgene[2*i]*(d.matgene[2*i] + 1)/2 + d.patgene[2*i];
 
         if (need_famid) {
-            fprintf(phnfp, "%s,", ego[i].famid);
-            fprintf(qtlfp, "%s,", ego[i].famid);
+            phn += ego[i].famid;
+            phn += ',';
+            qtl += ego[i].famid;
+            qtl += ',';
         }
-        fprintf(phnfp, "%s", ego[i].id);
-        fprintf(qtlfp, "%s", ego[i].id);
+        phn += ego[i].id;
+        qtl += ego[i].id;
 
         bool has_data = true;
         if (age_avail) has_data = !ego[i].missing[0];
@@ -943,25 +1131,25 @@ int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
 
         double trait;
         if (age_avail) {
+            phn += ',';
             if (!ego[i].missing[0])
-                fprintf(phnfp, ",%s", fp2str(ego[i].age));
-            else
-                fprintf(phnfp, ",");
+                phn += fp2str(ego[i].age, buf);
         }
         for (j = 0; j < ncov; j++) {
+            phn += ',';
             if (!ego[i].missing[j+1])
-                fprintf(phnfp, ",%s", fp2str(ego[i].cov[j]));
-            else
-                fprintf(phnfp, ",");
+                phn += fp2str(ego[i].cov[j], buf);
         }
         if (has_data) {
             for (j = 0; j < pars->ntrt; j++) {
-                if (s.itwin[i] != i + 1)
+                const double *gdev = &d.gdev[j*nind];
+                const double *edev = &d.edev[j*nind];
+                if (p.itwin[i] != i + 1)
                     trait = pars->trt[j]->mean[qtlgen] +
-                            s.gdev[j][s.itwin[i]-1] + s.edev[j][i];
+                            gdev[p.itwin[i]-1] + edev[i];
                 else
                     trait = pars->trt[j]->mean[qtlgen] +
-                            s.gdev[j][i] + s.edev[j][i];
+                            gdev[i] + edev[i];
                 trait += pars->trt[j]->beta[0][qtlgen] * (ego[i].sex - 1);
 
                 if (!age_avail &&
@@ -970,10 +1158,7 @@ int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
                      pars->trt[j]->beta[3][qtlgen] != 0 ||
                      pars->trt[j]->beta[4][qtlgen] != 0))
                 {
-                     RESULT_LIT (
-"The model contains a non-zero regression coefficient for an age term,\n\
-but there is no AGE field in the phenotypes file.");
-                     return TCL_ERROR;
+                     return false;
                 }
 
                 double age = ego[i].age - pars->trt[j]->cmean[1];
@@ -989,52 +1174,92 @@ but there is no AGE field in the phenotypes file.");
                     trait += pars->trt[j]->beta[5+k][qtlgen]
                              * (ego[i].cov[k] - pars->trt[j]->cmean[5+k]);
                 }
-                fprintf(phnfp, ",%s", fp2str(trait));
+                phn += ',';
+                phn += fp2str(trait, buf);
             }
         }
         else {
             for (j = 0; j < pars->ntrt; j++)
-                fprintf(phnfp, ",");
+                phn += ',';
         }
-        fprintf(phnfp, "\n");
+        phn += '\n';
 
-        if (s.patgene[2*i] >= s.matgene[2*i])
-            fprintf(qtlfp, ",%d/%d\n", s.matgene[2*i] + 1, s.patgene[2*i] + 1);
+        if (d.patgene[2*i] >= d.matgene[2*i])
+            sprintf(buf, ",%d/%d\n", d.matgene[2*i] + 1, d.patgene[2*i] + 1);
         else
-            fprintf(qtlfp, ",%d/%d\n", s.patgene[2*i] + 1, s.matgene[2*i] + 1);
+            sprintf(buf, ",%d/%d\n", d.patgene[2*i] + 1, d.matgene[2*i] + 1);
+        qtl += buf;
 
         if (pars->nmrk) {
-            int mrkgen, patmrk, matmrk;
-            patmrk = s.patgene[2*i+1] % pars->nmall;
-            matmrk = s.matgene[2*i+1] % pars->nmall;
-            if (patmrk >= matmrk)
-                mrkgen = patmrk*(patmrk + 1)/2 + matmrk;
-            else
-                mrkgen = matmrk*(matmrk + 1)/2 + patmrk;
+            int patmrk, matmrk;
+            patmrk = d.patgene[2*i+1] % pars->nmall;
+            matmrk = d.matgene[2*i+1] % pars->nmall;
 
             if (inform) {
-                fprintf(mrkfp, "%d ", ego[i].ibdid);
-                if (s.patgene[2*i+1] >= s.matgene[2*i+1])
-                    fprintf(mrkfp, "%d/%d\n",
-                            2*(*tnind) + s.matgene[2*i+1]/pars->nmall + 1,
-                            2*(*tnind) + s.patgene[2*i+1]/pars->nmall + 1);
+                int pa = 2*p.tnind + d.patgene[2*i+1]/pars->nmall + 1;
+                int ma = 2*p.tnind + d.matgene[2*i+1]/pars->nmall + 1;
+                if (d.patgene[2*i+1] >= d.matgene[2*i+1])
+                    sprintf(buf, "%d %d/%d\n", ego[i].ibdid, ma, pa);
                 else
-                    fprintf(mrkfp, "%d/%d\n",
-                            2*(*tnind) + s.patgene[2*i+1]/pars->nmall + 1,
-                            2*(*tnind) + s.matgene[2*i+1]/pars->nmall + 1);
+                    sprintf(buf, "%d %d/%d\n", ego[i].ibdid, pa, ma);
+                mrk += buf;
             }
             else {
-                if (need_famid)
-                    fprintf(mrkfp, "%s,", ego[i].famid);
-                fprintf(mrkfp, "%s,", ego[i].id);
+                if (need_famid) {
+                    mrk += ego[i].famid;
+                    mrk += ',';
+                }
+                mrk += ego[i].id;
                 if (patmrk >= matmrk)
-                    fprintf(mrkfp, "%d/%d\n", matmrk + 1, patmrk + 1);
+                    sprintf(buf, ",%d/%d\n", matmrk + 1, patmrk + 1);
                 else
-                    fprintf(mrkfp, "%d/%d\n", patmrk + 1, matmrk + 1);
+                    sprintf(buf, ",%d/%d\n", patmrk + 1, matmrk + 1);
+                mrk += buf;
             }
         }
     }
 
+    return true;
+}
+
+int sim_ped (Tcl_Interp *interp, FILE *phnfp, bool gfile, FILE *qtlfp,
+             FILE *mrkfp, bool inform, int need_famid, int age_avail,
+             int ped, int nind, int *tnind, SimPars *pars, int ncov,
+             Ego *ego, double *gmat, double *emat, FILE *kinfp)
+{
+    SimPed p;
+    p.nind = nind;
+    p.tnind = *tnind;
+    p.ego = ego;
+
+    if (ped_setup(interp, p, kinfp) == TCL_ERROR)
+        return TCL_ERROR;
+
+    SimDraw d;
+    std::string phn, qtl, mrk;
+    try {
+        ped_simulate(p, pars, gmat, emat, gfile, Drand_Rng, d);
+        if (!ped_output(p, d, pars, ncov, need_famid, age_avail, inform,
+                        phn, qtl, mrk))
+        {
+            RESULT_LIT (Age_Term_Message);
+            return TCL_ERROR;
+        }
+    }
+    catch (Safe_Error_Return &ser) {
+        RESULT_BUF (ser.message());
+        return TCL_ERROR;
+    }
+    catch (...) {
+        RESULT_LIT ("Out of memory");
+        return TCL_ERROR;
+    }
+
+    fputs(phn.c_str(), phnfp);
+    fputs(qtl.c_str(), qtlfp);
+    if (pars->nmrk)
+        fputs(mrk.c_str(), mrkfp);
+
     *tnind += nind;
 
     return TCL_OK;
@@ -1140,7 +1365,8 @@ int kincoef (double *kin2, int *fa, int *mo, int *itwin, int nind, int tnind,
  *
  */
 
-void simva (double *amat, double *gmat, double **gdev, int nind, int ntrt)
+void simva (double *amat, double *gmat, double **gdev, int nind, int ntrt,
+            SimRng &rng)
 {
     int i, j, it, jt;
 
@@ -1158,7 +1384,7 @@ void simva (double *amat, double *gmat, double **gdev, int nind, int ntrt)
 
     for (i = 0; i < nind; i++) {
         for (it = 0; it < ntrt; it++)
-            t[it] = gasdev();
+            t[it] = rng.gasdev();
         for (it = 0; it < ntrt; it++) {
             z[it][i] = 0;
             for (jt = 0; jt <= it; jt++)
@@ -1195,7 +1421,7 @@ void simva (double *amat, double *gmat, double **gdev, int nind, int ntrt)
  *
  */
 
-void simve (double *emat, double **edev, int nind, int ntrt)
+void simve (double *emat, double **edev, int nind, int ntrt, SimRng &rng)
 {
     int i, j, it, jt;
 
@@ -1205,7 +1431,7 @@ void simve (double *emat, double **edev, int nind, int ntrt)
 
     for (i = 0; i < nind; i++) {
         for (it = 0; it < ntrt; it++)
-            t[it] = gasdev();
+            t[it] = rng.gasdev();
         for (it = 0; it < ntrt; it++) {
             edev[it][i] = 0;
             for (jt = 0; jt <= it; jt++)
@@ -1218,7 +1444,7 @@ void simve (double *emat, double **edev, int nind, int ntrt)
 
 void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
                 double *mfreq, double xtheta, double ytheta, int *patgene,
-                int *matgene, int nall, int nmall)
+                int *matgene, int nall, int nmall, SimRng &rng)
 {
     double *hfreq, *sumfreq;
     try {
@@ -1262,7 +1488,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
 
         if (!ifa) {
             int haplo = 0;
-            z = drand48();
+            z = rng.uniform();
             for (j = 0; j < nall*nmall; j++) {
                 if (z > sumfreq[j] && z <= sumfreq[j+1]) {
                     haplo = j;
@@ -1272,7 +1498,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
             patgene[2*i] = haplo/nmall;
             patgene[2*i+1] = i*2*nmall + haplo%nmall;
 
-            z = drand48();
+            z = rng.uniform();
             for (j = 0; j < nall*nmall; j++) {
                 if (z > sumfreq[j] && z <= sumfreq[j+1]) {
                     haplo = j;
@@ -1301,7 +1527,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
                 patgene[2*i+1] = patgene[2*ifa+1];
                 break;
             case 1:
-                z = drand48();
+                z = rng.uniform();
                 if (z <= 0.5) {
                     patgene[2*i] = patgene[2*ifa];
                     patgene[2*i+1] = patgene[2*ifa+1];
@@ -1312,7 +1538,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
                 }
                 break;
             default:
-                z = drand48();
+                z = rng.uniform();
                 if (z <= sumytheta[0]) {
                     patgene[2*i] = patgene[2*ifa];
                     patgene[2*i+1] = patgene[2*ifa+1];
@@ -1337,7 +1563,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
                 matgene[2*i+1] = patgene[2*imo+1];
                 break;
             case 1:
-                z = drand48();
+                z = rng.uniform();
                 if (z <= 0.5) {
                     matgene[2*i] = patgene[2*imo];
                     matgene[2*i+1] = patgene[2*imo+1];
@@ -1348,7 +1574,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
                 }
                 break;
             default:
-                z = drand48();
+                z = rng.uniform();
                 if (z <= sumxtheta[0]) {
                     matgene[2*i] = patgene[2*imo];
                     matgene[2*i+1] = patgene[2*imo+1];
@@ -1374,7 +1600,7 @@ void dropgenel (int *fa, int *mo, int *twin, int nind, double *gfreq,
 }
 
 void dropgene (int *fa, int *mo, int *twin, int nind, double *freq,
-               int *patgene, int *matgene, int nall)
+               int *patgene, int *matgene, int nall, SimRng &rng)
 {
     double *sumfreq;
     try {
@@ -1399,7 +1625,7 @@ void dropgene (int *fa, int *mo, int *twin, int nind, double *freq,
 
         if (!fa[i]) {
             patgene[2*i] = 0;
-            z = drand48();
+            z = rng.uniform();
             for (j = 0; j < nall; j++) {
                 if (z > sumfreq[j] && z <= sumfreq[j+1]) {
                     patgene[2*i] = j;
@@ -1408,7 +1634,7 @@ void dropgene (int *fa, int *mo, int *twin, int nind, double *freq,
             }
 
             matgene[2*i] = 0;
-            z = drand48();
+            z = rng.uniform();
             for (j = 0; j < nall; j++) {
                 if (z > sumfreq[j] && z <= sumfreq[j+1]) {
                     matgene[2*i] = j;
@@ -1418,13 +1644,13 @@ void dropgene (int *fa, int *mo, int *twin, int nind, double *freq,
         }
 
         else {
-            z = drand48();
+            z = rng.uniform();
             if (z <= 0.5)
                 patgene[2*i] = patgene[2*(fa[i]-1)];
             else
                 patgene[2*i] = matgene[2*(fa[i]-1)];
 
-            z = drand48();
+            z = rng.uniform();
             if (z <= 0.5)
                 matgene[2*i] = patgene[2*(mo[i]-1)];
             else
@@ -1435,33 +1661,53 @@ void dropgene (int *fa, int *mo, int *twin, int nind, double *freq,
     delete[] sumfreq;
 }
 
-double gasdev (void)
+double SimRng::gasdev (void)
 {
-    static double gset;		/* save to return at next call */
-    static int iset = 0;	/* saved return value? */
-
     double v1, v2, r, fac, gret;
 
     if (!iset) {
         do {
-            v1 = 2*drand48() - 1;
-            v2 = 2*drand48() - 1;
+            v1 = 2*uniform() - 1;
+            v2 = 2*uniform() - 1;
             r = v1*v1 + v2*v2;
         } while (r >= 1);
         fac = sqrt(-2*log(r)/r);
         gset = v1*fac;
         gret = v2*fac;
-        iset = 1;
+        iset = true;
     }
 
     else {
         gret = gset;
-        iset = 0;
+        iset = false;
     }
 
     return gret;
 }
 
+unsigned long long SimStreamRng::mix (unsigned long long z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+SimStreamRng::SimStreamRng (unsigned long long seed, int rep, int ped)
+{
+    const unsigned long long golden = 0x9e3779b97f4a7c15ULL;
+    key = mix(mix(mix(seed + golden) + rep + golden) + ped + golden);
+    counter = 0;
+}
+
+double SimStreamRng::uniform (void)
+{
+    unsigned long long z = key + ++counter * 0x9e3779b97f4a7c15ULL;
+
+// 53 random bits, offset by half a step so that 0 is never returned
+
+    return ((mix(z) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
 void SimPars::get_pars (FILE *fp)
 {
     char rec[1024];
@@ -1799,6 +2045,11 @@ void SimPars::prt_pars (FILE *fp)
 char *fp2str (double num)
 {
     static char str[128];
+    return fp2str(num, str);
+}
+
+char *fp2str (double num, char *str)
+{
     char *p;
     sprintf(str, "%f", num);
     p = str + strlen(str);
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <sys/time.h>
 #include "solar.h"
 #include "tclInt.h"
 
@@ -93,20 +94,58 @@ if {!$found} { \n\
 } \n\
 # newtcl always looks in solar.tcl first, then in other files \n\
 # this may change in future release \n\
-proc newtcl {} { \n\
-  if {[llength [glob -nocomplain ./*.tcl]]} { \n\
+# At startup (newtcl -stale) an existing tclIndex is reused unless a script \n\
+# is newer than it, a script it names has gone away, or a script is not \n\
+# named in it (such as one copied in keeping an older mtime).  Scripts \n\
+# without procs are listed in a comment so they are not indexed again. \n\
+proc tclindex_make {d} { \n\
+  auto_mkindex $d solar.tcl *.tcl \n\
+  set files {} \n\
+  foreach f [glob -nocomplain $d/*.tcl] {lappend files [file tail $f]} \n\
+  set ifile [open $d/tclIndex a] \n\
+  puts $ifile \"# indexed files: $files\" \n\
+  close $ifile \n\
+} \n\
+proc tclindex_stale {d} { \n\
+  if {![file exists $d/tclIndex]} {return 1} \n\
+  set itime [file mtime $d/tclIndex] \n\
+  foreach f [glob -nocomplain $d/*.tcl] { \n\
+    if {[file mtime $f] >= $itime} {return 1} \n\
+  } \n\
+  set ifile [open $d/tclIndex r] \n\
+  set index [read $ifile] \n\
+  close $ifile \n\
+  set named {} \n\
+  foreach {all f} [regexp -all -inline {file join \\$dir ([^]]+)\\]} $index] { \n\
+    set f [eval file join [list $d] $f] \n\
+    if {![file exists $f]} {return 1} \n\
+    lappend named [file tail $f] \n\
+  } \n\
+  foreach {all files} [regexp -all -inline {\n# indexed files: ([^\n]*)} $index] { \n\
+    eval lappend named $files \n\
+  } \n\
+  foreach f [glob -nocomplain $d/*.tcl] { \n\
+    if {-1 == [lsearch -exact $named [file tail $f]]} {return 1} \n\
+  } \n\
+  return 0 \n\
+} \n\
+proc newtcl {{when -always}} { \n\
+  set always [string compare $when -stale] \n\
+  if {[llength [glob -nocomplain ./*.tcl]] && \
+      ($always || [tclindex_stale .])} { \n\
 #   puts stderr \"Indexing tcl scripts in working directory\" \n\
-    auto_mkindex . solar.tcl *.tcl \n\
+    tclindex_make . \n\
   } \n\
   if {![key -is-key-on-command-line?] && \
-       [llength [glob -nocomplain ~/lib/*.tcl]]} { \n\
+       [llength [glob -nocomplain ~/lib/*.tcl]] && \
+       ($always || [tclindex_stale ~/lib])} { \n\
 #   puts stderr \"Indexing tcl scripts in ~/lib\" \n\
-    auto_mkindex ~/lib solar.tcl *.tcl \n\
+    tclindex_make ~/lib \n\
   } \n\
   auto_reset \n\
   return {} \n\
 } \n\
-newtcl \n\
+newtcl -stale \n\
 set first_flag [llength [info globals finished_first_time]] \n\
 global DEFAULT_LIB \n\
 if [file exists .solar] { \n\
@@ -167,6 +206,7 @@ DECL(IbsCmd)
 DECL(IbdCmd)
 DECL(IbdOptCmd)
 DECL(MibdCmd)
+DECL(MibdPackCmd)
 DECL(SimqtlCmd)
 DECL(DrandCmd)
 DECL(SolarBinaryVersionCmd)
@@ -175,6 +215,8 @@ DECL(SolarCompiledTimeCmd)
 DECL(TclgrCmd)
 DECL(AlnormCmd)
 DECL(EVDCmd)
+DECL(FitkeyCmd)
+DECL(ProfileCmd)
 DECL(MaskCmd)
 DECL(VoxelCmd)
 DECL(ImoutCmd)
@@ -210,6 +252,7 @@ DECL(RunPlinkConverter);
 DECL(pedfromsnpsCmd);
 //DECL(Runconnfphicmd);
 DECL(gwaCmd);
+DECL(mgaCmd);
 //DECL (inormNiftiCmd);
 DECL (nifti_to_csv_command);
 DECL (sporadicNormalizeCmd);
@@ -225,6 +268,7 @@ DECL(pedigree_power_command);
 DECL(run_genetic_correlation);
 DECL(transfer_pedigree_filename);
 //DECL(print_phi2);
+DECL(StartupTimeCmd);
 int validate_solar (Tcl_Interp *interp);
 
 extern void setup_functions ();
@@ -235,8 +279,52 @@ void add_solar_command (const char *name, Tcl_CmdProc proc, Tcl_Interp *interp)
 			 (Tcl_CmdDeleteProc *) NULL);
 }
 
+/*
+ * Startup phase timing
+ *   Each phase is the wall time since the previous mark.  The table is
+ *   returned by solar_startup_time, and written to stderr at the end of
+ *   startup if SOLAR_STARTUP_PROFILE is set in the environment.
+ */
+const int MAX_STARTUP_PHASES = 16;
+static const char *Startup_Phase_Name[MAX_STARTUP_PHASES];
+static double Startup_Phase_Time[MAX_STARTUP_PHASES];
+static int Startup_Phases = 0;
+static double Startup_Begin = 0;
+static double Startup_Last = 0;
+
+static double wall_seconds ()
+{
+    struct timeval tv;
+    gettimeofday (&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+static void startup_mark (const char *phase)
+{
+    double now = wall_seconds ();
+    if (Startup_Phases < MAX_STARTUP_PHASES)
+    {
+	Startup_Phase_Name[Startup_Phases] = phase;
+	Startup_Phase_Time[Startup_Phases++] = now - Startup_Last;
+    }
+    Startup_Last = now;
+}
+
+static void startup_report ()
+{
+    if (!getenv ("SOLAR_STARTUP_PROFILE")) return;
+    for (int i = 0; i < Startup_Phases; i++)
+    {
+	fprintf (stderr, "startup %-20s %9.3f ms\n", Startup_Phase_Name[i],
+		 1000*Startup_Phase_Time[i]);
+    }
+    fprintf (stderr, "startup %-20s %9.3f ms\n", "total",
+	     1000*(Startup_Last-Startup_Begin));
+}
+
 extern "C" int Solar_Init (Tcl_Interp *interp)
 {
+    Startup_Begin = Startup_Last = wall_seconds ();
     TclRenameCommand (interp, (char*) "load", (char*) "loadbinary");
     add_solar_command ("define", DefinitionCmd, interp);
     add_solar_command ("solar_binary_version", SolarBinaryVersionCmd, interp);
@@ -252,6 +340,7 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
     add_solar_command ("help", HelpCmd, interp);
     add_solar_command ("field", FieldCmd, interp);
     add_solar_command ("cmibd", MibdCmd, interp);
+    add_solar_command ("cmibdpack", MibdPackCmd, interp);
     add_solar_command ("ibdoption", IbdOptCmd, interp);
     add_solar_command ("cibd", IbdCmd, interp);
     add_solar_command ("cibs", IbsCmd, interp);
@@ -286,6 +375,8 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
     add_solar_command ("model", ModelCmd, interp);
     add_solar_command ("alnorm", AlnormCmd, interp);
     add_solar_command ("evd", EVDCmd, interp);
+    add_solar_command ("fitkey", FitkeyCmd, interp);
+    add_solar_command ("profile", ProfileCmd, interp);
     add_solar_command ("voxel", VoxelCmd, interp);
     add_solar_command ("mask", MaskCmd, interp);
     add_solar_command ("imout", ImoutCmd, interp);
@@ -320,6 +411,7 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
     add_solar_command ("fphi", runfphiCmd, interp);
 //    add_solar_command ("gpu_fphi", gpufphiCmd , interp);
     add_solar_command ("gwas", gwaCmd, interp);
+    add_solar_command ("cmga", mgaCmd, interp);
 //    add_solar_command ("gpu_gwas", GPU_GWAS_Cmd, interp);
 
     add_solar_command ("nifti_to_csv", nifti_to_csv_command, interp);
@@ -332,10 +424,12 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
     add_solar_command("gen_corr",run_genetic_correlation,interp);
     add_solar_command("ped_filename",transfer_pedigree_filename,interp);
 //    add_solar_command("print_phi2", print_phi2, interp);
+    add_solar_command("solar_startup_time", StartupTimeCmd, interp);
 //  internal initializations (not subject to error)
 
     setup_functions ();
     Option::setup ();
+    startup_mark ("commands");
 
 //  Copyright message
 
@@ -358,6 +452,7 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
 	exit (EXIT_FAILURE);
     }
     if (StartingFile) unlink (StartingFile);
+    startup_mark ("internal_startup");
 
     if ( TCL_OK != Solar_Eval (interp, "solar_tcl_startup"))
     {
@@ -365,6 +460,7 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
 	fprintf (stderr, "%s\n", Tcl_GetStringResult (interp));
 	exit (EXIT_FAILURE);
     }
+    startup_mark ("solar_tcl_startup");
 
     if ( TCL_OK != Solar_Eval (interp, "make_solar_aliases"))
     {
@@ -372,19 +468,21 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
 	fprintf (stderr, "%s\n", Tcl_GetStringResult (interp));
 	exit (EXIT_FAILURE);
     }
+    startup_mark ("aliases");
 
     Phenotypes::start();  // Loads phenotypes.info
     Field::Start();      // Loads field.info
+    startup_mark ("info_files");
 
     Solar_Eval (interp, "Start_Dirs");
-
-    
+    startup_mark ("start_dirs");
 
     if ( TCL_OK != Model::renew(interp))
     {
 	fprintf (stderr, "%s\n", Tcl_GetStringResult (interp));
 	exit (EXIT_FAILURE);
     }
+    startup_mark ("model");
 
     if ( TCL_OK != Solar_Eval (interp, "fatal_error_checks") )
     {
@@ -404,6 +502,8 @@ extern "C" int Solar_Init (Tcl_Interp *interp)
     Tcl_ResetResult (interp);
 	
     validate_solar (interp);
+    startup_mark ("checks");
+    startup_report ();
 
     if (Argc > 1)
     {
@@ -435,6 +535,22 @@ int SolarBinaryVersionCmd (ClientData clientData, Tcl_Interp *interp,
     return TCL_OK;
 }
 
+int StartupTimeCmd (ClientData clientData, Tcl_Interp *interp,
+		    int argc, const char *argv[])
+{
+    char buf[64];
+    for (int i = 0; i < Startup_Phases; i++)
+    {
+	Solar_AppendElement (interp, Startup_Phase_Name[i]);
+	sprintf (buf, "%.3f", 1000*Startup_Phase_Time[i]);
+	Solar_AppendElement (interp, buf);
+    }
+    Solar_AppendElement (interp, "total");
+    sprintf (buf, "%.3f", 1000*(Startup_Last-Startup_Begin));
+    Solar_AppendElement (interp, buf);
+    return TCL_OK;
+}
+
 int SolarCompiledDateCmd (ClientData clientData, Tcl_Interp *interp,
 		     int argc, const char *argv[])
 {
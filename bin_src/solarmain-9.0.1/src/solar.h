@@ -155,7 +155,7 @@ public:
 	{checkerr; tf->rewind (errmsg);}
     const char *filename () {return tf->filename();}
     long get_position () {return tf->get_position();}
-    virtual void set_position (int pos, const char **errmsg)
+    virtual void set_position (long pos, const char **errmsg)
 	{checkerr; tf->set_position(pos, errmsg);}
     virtual int *widths (int *count, const char **errmsg)
 	{checkerr0; return tf->widths (count, errmsg);}
@@ -476,6 +476,8 @@ class Phenotypes
     static int _proband_pindex;
     static void position (int fpos);
     static int build_index (Tcl_Interp *interp);
+    static char **person_record (int findex);
+    static void load_columns ();
 public:
     static const char* get_var_name (int index);
     static char* maxphen_index (int index);
@@ -487,9 +489,12 @@ public:
 			     const char **errmsg);
     static int describe (Tcl_Interp* interp, bool showall);
     static void write_commands (FILE *file);
+    static const char* filename (int i) {
+	return (i < Filecount && Sfile[i]) ? Sfile[i]->filename() : 0;}
     static bool available (const char *name);
     static int bind (Tcl_Interp *interp);
     static const char* get_indexed_phenotype (int pindex);
+    static bool get_indexed_value (int pindex, double *value);
     static void seek (const char *id, const char *famid="");
     static void start_setup ();
     static void setup (const char *name);
@@ -705,15 +710,46 @@ Tcl_Interp* get_maximize_interp ();
 
 class Model
 {
+    friend class ModelContext;
     static bool _loading;
 public:
-    static int write (FILE *file);
+    static int write (FILE *file, bool matrices=true);
     static int load (const char *filename, Tcl_Interp *interp);
     static int renew (Tcl_Interp *interp);
     static void reset ();
     static bool loading () {return _loading;}
 };
 
+/*
+ * Model contexts are copies of models kept in memory by "model context
+ * save".  Loading a context makes its model current again without reading
+ * a model file.  Matrices it had that are still loaded with the same
+ * command are kept rather than read again, and parameter values are
+ * restored exactly.  A context does not own the global model state
+ * (Trait, Parameter, Omega, Matrix statics and the Fortran COMMON blocks),
+ * so only the current model can be maximized.
+ */
+
+class ModelContext
+{
+    char *_name;
+    char *_commands;
+    char **_matrix_commands;
+    int _matrix_count;
+    double *_parameters;
+    int _parameter_count;
+    ModelContext *_next;
+    static ModelContext *First;
+    ModelContext (const char *name);
+    ~ModelContext ();
+    static ModelContext *find (const char *name);
+public:
+    static int save (const char *name);
+    static int load (const char *name, Tcl_Interp *interp);
+    static int remove (const char *name);
+    static int names (Tcl_Interp *interp);
+};
+
 /*
  *Generic fast dynamic array with automatic expansion
  *   but no automatic element creation or deletion (takes time)
@@ -772,6 +808,7 @@ class Matrix
     friend int Omega::bind (Tcl_Interp *interp);
     friend double user_matrix (int key);
     friend double user_second_matrix (int key);
+    friend class ModelContext;
     char *_name;
     char *filename;
     bool _ibd;
@@ -816,9 +853,11 @@ public:
     float get (int id1, int id2);
     static const char* setup (int option, const char *filename,
 			      const char *name1, const char *name2=0);
+    static const char* prefetch (const char *filename);
     static void write_commands (FILE *file);
     static Matrix *index (int i) {return (i<count) ? Matrices[i] : 0;}
     const char *name () {return _name;}
+    const char *file () {return filename;}
 
     ~Matrix ();
 
@@ -994,9 +1033,8 @@ class EVD
 public:
     static void Reset();
     static void Flush();
-    static void Make_Matrix (int zindex, int* maxpeo, int* n, 
-			     double* mu, double* vvar, int* nvar,
-			     int* ierr);
+    static void Make_Matrices (double* vardata, int* nvar, int* nind,
+			       int* nascer, int* nped, int* ncumind);
 };
 
 int verbose (const char *keyword);
@@ -1098,7 +1136,8 @@ public:
     int get_freqs (const char*, char, Tcl_Interp*);
     void write_locfiles (struct LocusFreq*, bool);
     bool unload (Tcl_Interp*);
-    int mlefreq (const char*, bool, bool, Tcl_Interp*);
+    int mlefreq (const char*, bool, bool, Tcl_Interp*, const int *prerun=0);
+    int mlefreq_batch (int, char**, bool, bool, int, Tcl_Interp*);
     int save (const char*, Tcl_Interp*);
     const char *show (char*);
     const char *filename () {return _filename;}
@@ -1200,7 +1239,7 @@ public:
     void delete_marker ();
     void delete_Tfile ();
     static int HasSex ();
-    static int SexVar (int SexStatus) {_Has_Sex=SexStatus;}
+    static int SexVar (int SexStatus) {return _Has_Sex=SexStatus;}
 
 // Other classes can add hooks here for when pedigree is being changed
     static void Changing_Pedigree () {
@@ -1220,6 +1259,79 @@ extern bool NoMLE;
 extern bool XLinked;
 extern bool MCarlo;
 extern bool MMSibs;
+extern int IbdThreads;
+
+/*
+ * JobPool runs independent shell commands, each in its own directory, as
+ * child processes, keeping up to max_jobs of them running at once.  The
+ * started and finished callbacks are called in the parent with the index
+ * of the job (in the order added); finished also gets its exit status,
+ * which is -1 if the job could not be started or was killed.  After
+ * cancel, no more jobs are started but those running are waited for.
+ */
+
+class JobPool
+{
+    int _max_jobs;
+    int _count;
+    bool _cancel;
+    char **_directories;
+    char **_commands;
+public:
+    JobPool (int max_jobs);
+    ~JobPool ();
+    void add (const char *directory, const char *command);
+    int count () {return _count;}
+    void cancel () {_cancel = true;}
+    void run (void (*started)(int job, void *data),
+              void (*finished)(int job, int status, void *data), void *data);
+};
+
+/*
+ * Profile accumulates wall time, call counts and bytes read for the phases
+ * of maximization while the profile command has it enabled.  A
+ * Profile_Timer charges the time from its construction to its destruction
+ * (or stop) to one phase; when profiling is off it does nothing else.  The FORTRAN
+ * routines FUN, DDFUN and DIRECT use the profbeg and profend interfaces.
+ */
+
+enum profile_phase {prof_maximize=0, prof_build_index, prof_preped,
+		    prof_optima, prof_search, prof_fun, prof_fun_deriv,
+		    prof_ddfun, prof_direct, prof_omega, prof_scratch,
+		    prof_matrix_load, prof_phen_seek, prof_phases};
+
+class Profile
+{
+    static int Calls[prof_phases];
+    static double Seconds[prof_phases];
+    static long long Bytes[prof_phases];
+    static double Enabled_At;
+    static double Total;
+public:
+    static bool Enabled;
+    static double now ();
+    static void enable ();
+    static void disable ();
+    static void reset ();
+    static void add (int phase, double start)
+	{Calls[phase]++; Seconds[phase] += now() - start;}
+    static void add_bytes (int phase, long long count)
+	{Bytes[phase] += count;}
+    static int report (Tcl_Interp *interp, bool json, const char *filename);
+};
+
+class Profile_Timer
+{
+    profile_phase _phase;
+    bool _on;
+    double _start;
+public:
+    Profile_Timer (profile_phase phase) : _phase (phase),
+	_on (Profile::Enabled) {if (_on) _start = Profile::now();}
+    ~Profile_Timer () {stop ();}
+    void stop () {if (_on) Profile::add (_phase, _start); _on = false;}
+    void bytes (long long count) {if (_on) Profile::add_bytes (_phase, count);}
+};
 
 class Voxel {
 public:
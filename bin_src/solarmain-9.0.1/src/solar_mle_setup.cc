@@ -98,25 +98,70 @@ vector<string> solar_mle_setup::get_expression_names(){
     return expression_names;
 }
 
+// Each name the expressions refer to is bound to a column over all subjects,
+// then every expression is evaluated a batch of rows at a time.  Columns
+// hold NaN where the data has MISSING_PHENOTYPE, so missing values propagate
+// as missing, and NaN results are written back as MISSING_PHENOTYPE.
+
+static inline double missing_to_nan(double value){
+    return value == MISSING_PHENOTYPE ? NAN : value;
+}
+
 void solar_mle_setup::create_output_matrix(){
-    id_index = 0;
     Eigen::MatrixXd output_matrix_temp(n_subjects, n_expressions);
-    CURRENT_LOADER = this;
+    const int n_phenotypes = phenotype_names.size();
+    vector< vector<double> > columns(1 + n_phenotypes + zscore_names.size() + inorm_names.size());
+    for(int col = 0; col < columns.size(); col++){
+        columns[col].resize(n_subjects);
+    }
     for(int row_idx = 0; row_idx < n_subjects; row_idx++){
-        for(int col_idx = 0; col_idx < n_expressions; col_idx++){
-            try{
-                output_matrix_temp(row_idx, col_idx) = expressions[col_idx]->eval();
-
-            }catch(...){
-                CURRENT_LOADER = 0;
-                string error_message = "Expression Eval Error id: " + ids[row_idx] + " term: " + expression_names[col_idx] + " row_index: " + to_string(row_idx) + " col_index: " + to_string(col_idx);  
-                throw Expression_Eval_Error(error_message);
-           }
+        const vector<double> & row_values = term_map[ids[row_idx]];
+        columns[0][row_idx] = NAN;
+        for(int index = 0; index < n_phenotypes; index++){
+            columns[1 + index][row_idx] = missing_to_nan(row_values[index]);
+        }
+        for(int index = 0; index < zscore_names.size(); index++){
+            columns[1 + n_phenotypes + index][row_idx] = (missing_to_nan(row_values[zscore_indices[index]]) - zscore_means[index])/zscore_sd[index];
+        }
+        if(inorm_names.size() != 0){
+            const vector<double> & inorm_values = inorm_map[ids[row_idx]];
+            for(int index = 0; index < inorm_names.size(); index++){
+                columns[1 + n_phenotypes + zscore_names.size() + index][row_idx] = missing_to_nan(inorm_values[index]);
+            }
+        }
+    }
+    Context column_context;
+    column_context.add_column("blank", columns[0].data());
+    for(int index = 0; index < n_phenotypes; index++){
+        column_context.add_column(phenotype_names[index].c_str(), columns[1 + index].data());
+    }
+    for(int index = 0; index < zscore_names.size(); index++){
+        column_context.add_column(zscore_names[index].c_str(), columns[1 + n_phenotypes + index].data());
+    }
+    for(int index = 0; index < inorm_names.size(); index++){
+        column_context.add_column(inorm_names[index].c_str(), columns[1 + n_phenotypes + zscore_names.size() + index].data());
+    }
+    for(int col_idx = 0; col_idx < n_expressions; col_idx++){
+        try{
+            expressions[col_idx]->bind(&column_context);
+            expressions[col_idx]->eval_rows(n_subjects, output_matrix_temp.col(col_idx).data());
+            expressions[col_idx]->bind(_Context);
+        }catch(...){
+            // column_context goes away with this frame, so restore the
+            // expression's own binding before reporting the error
+            expressions[col_idx]->bind(_Context);
+            string error_message = "Expression Eval Error term: " + expression_names[col_idx] + " col_index: " + to_string(col_idx);
+            throw Expression_Eval_Error(error_message);
+        }
+    }
+    for(int col_idx = 0; col_idx < n_expressions; col_idx++){
+        for(int row_idx = 0; row_idx < n_subjects; row_idx++){
+            if(output_matrix_temp(row_idx, col_idx) != output_matrix_temp(row_idx, col_idx)){
+                output_matrix_temp(row_idx, col_idx) = MISSING_PHENOTYPE;
+            }
         }
-        id_index++;
     }
-   CURRENT_LOADER = 0;
-   output_matrix = output_matrix_temp;
+    output_matrix = output_matrix_temp;
 }
 
 Eigen::MatrixXd solar_mle_setup::return_output_matrix(){
@@ -191,15 +191,15 @@ extern "C" int SolarFileCmd (ClientData clientData, Tcl_Interp *interp,
 	}
 	if (!Strcmp (argv[2], "get_position"))
 	{
-	    int position = tf->get_position ();
+	    long position = tf->get_position ();
 	    char buf[128];
-	    sprintf (buf, "%d", position);
+	    sprintf (buf, "%ld", position);
 	    RESULT_BUF (buf);
 	    return TCL_OK;
 	}
 	if (!Strcmp (argv[2], "set_position"))
 	{
- 	    tf->set_position (atoi(argv[3]), &errmsg);
+ 	    tf->set_position (atol(argv[3]), &errmsg);
 	    if (errmsg) break;
 	    return TCL_OK;
 	}
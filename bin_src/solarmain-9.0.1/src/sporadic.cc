@@ -12,6 +12,8 @@
 #include <fstream>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <algorithm>
 #include <queue>
 #include <omp.h>
 #include <chrono>
@@ -406,100 +408,164 @@ static inline double compute_inverse_normal(double  pct){
     return x;
 }
 
-static void inormalize(vector< pair<double, size_t> > data_in, unordered_map<size_t, size_t> output_map, double * output_data){
+// Traits are residualized and inormalized in blocks of this many columns,
+// and output rows are formatted in blocks of SPORADIC_WRITE_ROWS.
+#define SPORADIC_BLOCK 64
+#define SPORADIC_WRITE_ROWS 256
+
+// Rank-based inverse normal of one residual column.  ztable[k] holds the
+// normal quantile of rank k+1 out of count, which is the same for every
+// trait with the same set of included rows, so cdfnor_ is only called once
+// per rank rather than once per value.  Tied values share the mean quantile.
+static void inormalize(const double * residual, const int * rows, size_t count, const double * ztable,
+                       double * output_data, vector< pair<double, int> > & data_in){
+    data_in.resize(count);
+    for(size_t index = 0; index < count; index++){
+        data_in[index] = pair<double, int>(residual[index], rows[index]);
+    }
     sort(data_in.begin(), data_in.end(),
-         [] (const pair<double, size_t> & lhs, const pair<double, size_t> & rhs) {return lhs.first < rhs.first;
+         [] (const pair<double, int> & lhs, const pair<double, int> & rhs) {return lhs.first < rhs.first;
          });
-    double pct, z;
-    const size_t count = data_in.size();
-    size_t position = 1;
-    size_t current_id;
-    double shared_value, sum = 0.0;
-    vector< pair<double,size_t> >::iterator data_iter = data_in.begin();
-    while(data_iter != data_in.end()){
-        shared_value = data_iter->first;
-        queue<size_t> volume_ids;
-        while(shared_value == data_iter->first && data_iter != data_in.end()){
-            volume_ids.push(data_iter->second);
-            data_iter++;
-            pct = double(position++)/(count + 1);
-            z = compute_inverse_normal(pct);
-            sum += z;
+    size_t position = 0;
+    while(position < count){
+        const double shared_value = data_in[position].first;
+        size_t last = position;
+        double sum = 0.0;
+        while(last < count && data_in[last].first == shared_value){
+            sum += ztable[last++];
         }
-        sum /= volume_ids.size();
-        while(volume_ids.size() != 0){
-            current_id = volume_ids.front();
-            volume_ids.pop();
-            output_data[output_map[current_id]] = sum;
+        sum /= (last - position);
+        for(; position < last; position++){
+            output_data[data_in[position].second] = sum;
         }
-        
-        sum = 0.0;
-        
     }
 }
 
-
-
-static int sporadic_normalize(Tcl_Interp * interp,  vector<string> ids, vector<string> covariates, unordered_map<string, vector<double> > covariate_map,
-                             const char * phenotype_filename, double * array_Y, double * residuals, int n_covariates){
-    const char * errmsg = 0;
-    vector<string> id_list;
-    for(int row = 0; row < ids.size(); row++){
-        double value = array_Y[row];
-        string id = ids[row];
-        if((value == value && (covariate_map[id].size() != 0)) || (value == value && n_covariates == 0)) {
-            id_list.push_back(id);
+// Residualizes and inormalizes n_traits columns of Y (ids.size() rows each)
+// into residuals.  Traits are grouped by their set of usable rows; each
+// group shares one covariate design and QR factorization, so the
+// coefficients for a block of traits come from one multiple right hand
+// side solve.  Blocks are processed in parallel.
+static void sporadic_normalize(vector<string> & ids, vector<string> & covariates, unordered_map<string, vector<double> > & covariate_map,
+                               double * Y, double * residuals, int n_traits, int n_covariates){
+    const size_t n_rows = ids.size();
+    vector<char> covariates_present(n_rows, 1);
+    if(n_covariates != 0){
+        for(size_t row = 0; row < n_rows; row++){
+            unordered_map<string, vector<double> >::iterator cov_iter = covariate_map.find(ids[row]);
+            covariates_present[row] = (cov_iter != covariate_map.end() && cov_iter->second.size() != 0);
         }
     }
-    Eigen::VectorXd residual; 
-    if(n_covariates != 0){
-        
     
-        Eigen::MatrixXd covariate_matrix = create_covariate_matrix(id_list, covariates,
-                        covariate_map,  n_covariates);
-        Eigen::VectorXd Y(id_list.size());
-        vector<double> covariate_vector;
-        int index = 0;
-        for(int row = 0 ; row < ids.size(); row++){
-            double value = array_Y[row];
-            string id = ids[row];
-            if(value == value && covariate_map[id].size() != 0)
-                Y(index++) = value;
+    map< vector<char>, vector<int> > groups;
+    vector<char> included(n_rows);
+    for(int column = 0; column < n_traits; column++){
+        const double * trait = Y + column*n_rows;
+        for(size_t row = 0; row < n_rows; row++){
+            included[row] = covariates_present[row] && trait[row] == trait[row];
+        }
+        groups[included].push_back(column);
+    }
+    
+    for(map< vector<char>, vector<int> >::iterator group_iter = groups.begin(); group_iter != groups.end(); group_iter++){
+        const vector<char> & mask = group_iter->first;
+        const vector<int> & columns = group_iter->second;
+        vector<int> rows;
+        vector<string> id_list;
+        for(size_t row = 0; row < n_rows; row++){
+            if(mask[row]){
+                rows.push_back(row);
+                id_list.push_back(ids[row]);
+            }else{
+                for(size_t column = 0; column < columns.size(); column++){
+                    residuals[columns[column]*n_rows + row] = nan("");
+                }
+            }
         }
-                  
-        Eigen::VectorXd beta  = covariate_matrix.colPivHouseholderQr().solve(Y);
-      
+        const size_t count = rows.size();
+        if(count == 0) continue;
         
+        vector<double> ztable(count);
+        for(size_t rank = 0; rank < count; rank++){
+            ztable[rank] = compute_inverse_normal(double(rank + 1)/(count + 1));
+        }
         
-
-        residual = Y - covariate_matrix*beta;
+        Eigen::MatrixXd covariate_matrix;
+        Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr;
+        if(n_covariates != 0){
+            covariate_matrix = create_covariate_matrix(id_list, covariates, covariate_map, n_covariates);
+            qr.compute(covariate_matrix);
+        }
         
-    }else{
-        Eigen::VectorXd Y(id_list.size());
-        int index = 0;
-        for(int row = 0 ; row < ids.size(); row++){
-            double value = array_Y[row];
-            string id = ids[row];
-            if(value == value)
-                Y(index++) = value;
+        const int n_blocks = (columns.size() + SPORADIC_BLOCK - 1)/SPORADIC_BLOCK;
+#pragma omp parallel
+        {
+            Eigen::MatrixXd block;
+            vector< pair<double, int> > data_in;
+#pragma omp for schedule(dynamic)
+            for(int block_index = 0; block_index < n_blocks; block_index++){
+                const int first = block_index*SPORADIC_BLOCK;
+                const int width = min<int>(SPORADIC_BLOCK, columns.size() - first);
+                block.resize(count, width);
+                for(int column = 0; column < width; column++){
+                    const double * trait = Y + columns[first + column]*n_rows;
+                    for(size_t index = 0; index < count; index++){
+                        block(index, column) = trait[rows[index]];
+                    }
+                }
+                if(n_covariates != 0){
+// Residuals are formed one covariate column at a time rather than with a
+// matrix product so that rows with identical data stay exactly tied.
+                    Eigen::MatrixXd beta = qr.solve(block);
+                    for(int column = 0; column < width; column++){
+                        for(int term = 0; term < covariate_matrix.cols(); term++){
+                            block.col(column) -= covariate_matrix.col(term)*beta(term, column);
+                        }
+                    }
+                }
+                for(int column = 0; column < width; column++){
+                    inormalize(block.col(column).data(), &rows[0], count, &ztable[0],
+                               residuals + columns[first + column]*n_rows, data_in);
+                }
+            }
         }
-        residual = Y;
     }
-    vector< pair<double, size_t> > data_in;
-    unordered_map<size_t, size_t> output_map;
-    vector<string>::iterator bad_id_iter;
-    size_t row = 0;
-    for(int index = 0 ; index < ids.size(); index++){
-        if(find(id_list.begin(), id_list.end(), ids[index]) != id_list.end()){
-            data_in.push_back(pair<double, size_t>(residual(row), row));
-            output_map[row++] = index;
-        }else{
-            residuals[index] = nan("");
+}
+
+// Writes one CSV line per id: the id, id_suffix, then the value of each
+// trait.  Blocks of rows are formatted in parallel and written in order.
+static void write_residuals(ofstream & file_out, vector<string> & ids, string id_suffix,
+                            const double * residuals, int n_traits){
+    const size_t n_rows = ids.size();
+    const int n_blocks = (n_rows + SPORADIC_WRITE_ROWS - 1)/SPORADIC_WRITE_ROWS;
+    const int blocks_per_pass = omp_get_max_threads()*4;
+    vector<string> buffers(blocks_per_pass);
+    for(int pass_start = 0; pass_start < n_blocks; pass_start += blocks_per_pass){
+        const int pass_end = min(n_blocks, pass_start + blocks_per_pass);
+#pragma omp parallel for schedule(dynamic)
+        for(int block_index = pass_start; block_index < pass_end; block_index++){
+            string & buffer = buffers[block_index - pass_start];
+            buffer.clear();
+            char value_buffer[64];
+            const size_t row_end = min(n_rows, size_t(block_index + 1)*SPORADIC_WRITE_ROWS);
+            for(size_t row = size_t(block_index)*SPORADIC_WRITE_ROWS; row < row_end; row++){
+                buffer += ids[row];
+                buffer += id_suffix;
+                for(int column = 0; column < n_traits; column++){
+                    double value = residuals[column*n_rows + row];
+                    buffer += ',';
+                    if(value == value){
+                        snprintf(value_buffer, sizeof(value_buffer), "%g", value);
+                        buffer += value_buffer;
+                    }
+                }
+                buffer += '\n';
+            }
+        }
+        for(int block_index = pass_start; block_index < pass_end; block_index++){
+            file_out << buffers[block_index - pass_start];
         }
     }
-    inormalize(data_in, output_map, residuals);
-    
-    return TCL_OK;
 }
 
 static void print_help(Tcl_Interp * interp){
@@ -681,10 +747,7 @@ extern "C" int sporadicNormalizeCmd(ClientData clientData, Tcl_Interp * interp,
                 if(load_traits_per_inclusion(interp, file, headers, lines_included, Y, 0, headers.size(), ids.size()) == TCL_ERROR){
                     return TCL_ERROR;
                 }
-                for(int column = 0; column < headers.size(); column++){
-                    sporadic_normalize(interp,  ids, covariate_terms, covariate_map,
-                                       phenotype_filename.c_str(), Y + column*ids.size(), residuals + column*ids.size(),  n_covariates);
-                }
+                delete file;
                 
             }else{
 		const int max_omp_threads = omp_get_max_threads();
@@ -705,29 +768,11 @@ extern "C" int sporadicNormalizeCmd(ClientData clientData, Tcl_Interp * interp,
                    delete file;
            }
                     
-                   
-                    
-#pragma omp parallel for
-                    for(int column = 0; column < headers.size(); column++){
-                        sporadic_normalize(interp,  ids, covariate_terms, covariate_map,
-                                           phenotype_filename.c_str(), Y + column*ids.size(), residuals + column*ids.size(),  n_covariates);
-                    }
-                    
-                
- 
+
             }
+            sporadic_normalize(ids, covariate_terms, covariate_map, Y, residuals, headers.size(), n_covariates);
             delete [] Y;
-            for(int row = 0; row < ids.size(); row++){
-                output_stream << ids[row] << "," << *class_iter;
-                for(int column = 0; column < headers.size(); column++){
-                    double value = residuals[column*ids.size() + row];
-                    if(value == value)
-                        output_stream << "," << value;
-                    else
-                        output_stream << ",";
-                }
-                output_stream << endl;
-            }
+            write_residuals(output_stream, ids, "," + to_string(*class_iter), residuals, headers.size());
             
             delete [] residuals;
  
@@ -768,10 +813,7 @@ extern "C" int sporadicNormalizeCmd(ClientData clientData, Tcl_Interp * interp,
             if(load_traits(interp, file, headers, Y, 0, headers.size(), ids.size()) == TCL_ERROR){
                 return TCL_ERROR;
             }
-            for(int column = 0; column < headers.size(); column++){
-                sporadic_normalize(interp,  ids, covariate_terms, covariate_map,
-                                   phenotype_filename.c_str(), Y + column*ids.size(), residuals + column*ids.size(),  n_covariates);
-            }
+            delete file;
             
         }else{
                 const int max_omp_threads = omp_get_max_threads();
@@ -802,19 +844,9 @@ extern "C" int sporadicNormalizeCmd(ClientData clientData, Tcl_Interp * interp,
                  delete file;
              }   
                // delete [] files;
-                
-#pragma omp parallel for
-                for(int column = 0; column < headers.size(); column++){
-                    sporadic_normalize(interp,  ids, covariate_terms, covariate_map,
-                                       phenotype_filename.c_str(), Y + column*ids.size(), residuals + column*ids.size(),  n_covariates);
-                }
-                
-           // }
-          //  delete [] files;
-            
-            
             
         }
+        sporadic_normalize(ids, covariate_terms, covariate_map, Y, residuals, headers.size(), n_covariates);
         
         delete [] Y;
         
@@ -825,18 +857,8 @@ extern "C" int sporadicNormalizeCmd(ClientData clientData, Tcl_Interp * interp,
         for(vector<string>::iterator trait_iter = headers.begin(); trait_iter != headers.end(); trait_iter++){
             file_out << "," << *trait_iter;
         }
-        file_out << endl;
-        for(int row = 0; row < ids.size(); row++){
-            file_out << ids[row];
-            for(int column = 0; column < headers.size(); column++){
-                double value = residuals[column*ids.size() + row];
-                if(value == value)
-                    file_out << "," << value;
-                else
-                    file_out << ",";
-            }
-            file_out << endl;
-        }
+        file_out << "\n";
+        write_residuals(file_out, ids, "", residuals, headers.size());
         file_out.close();
         delete [] residuals;
     }
@@ -1039,10 +1061,7 @@ extern "C" int rviCmd(ClientData clientData, Tcl_Interp * interp,
          if(load_traits(interp, file, headers, Y, 0, headers.size(), ids.size()) == TCL_ERROR){
            	return TCL_ERROR;
           }
-          for(int column = 0; column < headers.size(); column++){
-              sporadic_normalize(interp,  ids, covariate_terms, covariate_map,\
-			  phenotype_filename.c_str(), Y + column*ids.size(), residuals + column*ids.size(),  n_covariates);
-          }
+          sporadic_normalize(ids, covariate_terms, covariate_map, Y, residuals, headers.size(), n_covariates);
     
           errmsg = 0;
 	file->rewind(&errmsg);
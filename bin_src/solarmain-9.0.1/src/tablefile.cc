@@ -4,8 +4,15 @@
 #include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "solar.h"
 #include "tablefile.h"
@@ -136,6 +143,20 @@ class CommaDelimitedFile : public TableFile
     char** freelist;
     size_t freelistcnt;
     short* _types;
+
+// Memory mapped reading (see get_mapped)
+    const char* map_base;
+    size_t map_size;
+    size_t map_pos;
+    size_t* field_offsets;
+    int field_offset_count;
+    char* field_buffer;
+    size_t field_buffer_size;
+    void map_file ();
+    char **get_mapped (const char **errmsg);
+    int index_fields (const char *rec, const char *end, int highest,
+		      const char **recend);
+    char *volume_datum (const char *datum, const char **errmsg);
 public:
     CommaDelimitedFile (const char *fname) : TableFile () 
       {user_indexes=0; highest_user_index=-1; 
@@ -143,19 +164,56 @@ public:
           prestring=0; getwidths=false; user_array=0;
 	  table_pointers=0;table_pointer_count=0;record_buffers=0;
 	  record_buffer_count=0;suggested_bufsize=10000;
-          freelist=0;freelistcnt=0;_types=0;}
+          freelist=0;freelistcnt=0;_types=0;
+	  map_base=0;map_size=0;map_pos=0;field_offsets=0;
+	  field_offset_count=0;field_buffer=0;field_buffer_size=0;}
     ~CommaDelimitedFile ();
     int *widths (int *count, const char **errmsg);
     void start_setup (const char **errmsg);
     int setup (const char *name, const char **errmsg);
     char **get(const char **errmsg);
     void rewind (const char **errmsg);
+    void set_position (long pos, const char **errmsg);
 #ifdef RICVOLUMESET
     static RicVolumeSet* GlobalBin;
     static char* GlobalBinFilename;
 #endif
 };
 
+// Column addressable genotype file written by plink_converter -binary.
+// The file is mapped and read in place; see cplink_converter.c for layout.
+
+class GenotypeBinaryFile : public TableFile
+{
+    int *user_indexes;
+    char** user_array;
+    char* field_buffer;
+    size_t field_buffer_size;
+    const char* map_base;
+    size_t map_size;
+    size_t n_samples;
+    size_t n_snps;
+    const char** sample_fields;  // iid, fid and sex for each sample
+    const unsigned char* genotypes;
+    size_t current_row;
+    void load_names(const char **errmsg) {*errmsg=_errmsg;}
+    const char *read_header ();
+    friend TableFile *TableFile::open (const char*,const char**);
+public:
+    GenotypeBinaryFile (const char *fname) : TableFile ()
+      {user_indexes=0; user_array=0; field_buffer=0; field_buffer_size=0;
+	  _filename=Strdup(fname); map_base=0; map_size=0; n_samples=0;
+	  n_snps=0; sample_fields=0; genotypes=0; current_row=0;}
+    ~GenotypeBinaryFile ();
+    static bool test_magic (const char *fname);
+    int *widths (int *count, const char **errmsg);
+    void start_setup (const char **errmsg);
+    int setup (const char *name, const char **errmsg);
+    char **get(const char **errmsg);
+    void rewind (const char **errmsg);
+    void set_position (long pos, const char **errmsg);
+};
+
 #ifdef RICVOLUMESET
 char* CommaDelimitedFile::GlobalBinFilename = 0;
 RicVolumeSet* CommaDelimitedFile::GlobalBin = 0;
@@ -281,7 +339,7 @@ TableFile::~TableFile ()
     if (fptr) fclose (fptr);
 }
 
-void TableFile::set_position (int pos, const char **errmsg)
+void TableFile::set_position (long pos, const char **errmsg)
 {
     if (_errmsg && !Strcmp (_errmsg, "EOF")) _errmsg = 0;
     if (0 != (*errmsg = _errmsg)) return;
@@ -375,6 +433,17 @@ TableFile *TableFile::open (const char *input_filename, const char **errmsg)
 // down comma delimited files, we try to make CommaDelimitedFile object
 //   If that fails with no comma error, we do Pedsys last ditch test
 
+	if (GenotypeBinaryFile::test_magic (input_filename))
+	{
+	    ft = new GenotypeBinaryFile (input_filename);
+	    if ((*errmsg = ((GenotypeBinaryFile*) ft)->read_header ()))
+	    {
+		delete ft;
+		return 0;
+	    }
+	    return ft;
+	}
+
 	ft = new CommaDelimitedFile (input_filename);
 	CommaDelimitedFile *cdf = (CommaDelimitedFile*) ft;
 	if ((*errmsg = cdf->read_header ()))
@@ -869,6 +938,47 @@ void CommaDelimitedFile::rewind (const char **errmsg)
     if (0 != (*errmsg = _errmsg)) return;
 
     fseek (fptr, data_starting_position, SEEK_SET);
+    map_pos = data_starting_position;
+}
+
+void CommaDelimitedFile::set_position (long pos, const char **errmsg)
+{
+    if (!map_base)
+    {
+	TableFile::set_position (pos, errmsg);
+	return;
+    }
+    if (_errmsg && !Strcmp (_errmsg, "EOF")) _errmsg = 0;
+    if (0 != (*errmsg = _errmsg)) return;
+    if (pos < 0 || (size_t) pos > map_size)
+    {
+	*errmsg = _errmsg = "Error setting position in data file";
+	return;
+    }
+    map_pos = pos;
+}
+
+// map_file maps the data file into memory once the header has been read.
+// If it can't be mapped (e.g. a pipe), records are read with fgets.
+
+void CommaDelimitedFile::map_file ()
+{
+    struct stat statbuf;
+    int fd = fileno (fptr);
+    if (fstat (fd, &statbuf) || !S_ISREG (statbuf.st_mode) ||
+	statbuf.st_size == 0)
+    {
+	return;
+    }
+    void* addr = mmap (0, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+	return;
+    }
+    madvise (addr, statbuf.st_size, MADV_SEQUENTIAL);
+    map_base = (const char*) addr;
+    map_size = statbuf.st_size;
+    map_pos = data_starting_position;
 }
 
 const char *CommaDelimitedFile::read_header ()
@@ -1058,6 +1168,7 @@ const char *CommaDelimitedFile::read_header ()
 		_names[field_count] = 0;
 		_short_names[field_count] = 0;
 		data_starting_position = ftell (fptr);
+		map_file ();
 		return 0;
 	    }
 	    pointer = end_pointer+1;
@@ -1085,7 +1196,7 @@ int *CommaDelimitedFile::widths (int *count, const char **errmsg)
 
 // Save file position
 
-    int save_position = ftell (fptr);
+    long save_position = (map_base) ? (long) map_pos : ftell (fptr);
     if (save_position < 0)
     {
 	*errmsg = _errmsg = "Save position error during field width scanning";
@@ -1114,7 +1225,11 @@ int *CommaDelimitedFile::widths (int *count, const char **errmsg)
 
 // Restore file position
 
-    if (fseek (fptr, save_position, 0))
+    if (map_base)
+    {
+	map_pos = save_position;
+    }
+    else if (fseek (fptr, save_position, 0))
     {
 	*errmsg = _errmsg = 
 	    "Restore position error during field width scanning";
@@ -1170,9 +1285,331 @@ int CommaDelimitedFile::setup (const char *name, const char **errmsg)
 
 #define DEBUGGET 1
 
+// This field is not raw numeric data.
+// Instead, it is the filename of a binary file.
+// We obtain the data by employing the required method on the file
+//   Currently, RicVolumeSet is the only supported filetype so we don't check
+//   Otherwise, the binary filetype would be specified by the field type
+
+// We need to pull out arguments from the data string here:
+//    the NIFTI filename, and the Volume number, like this:
+//
+//    images.gz:5
+//
+// These are combined with the current voxel to get the actual datum.
+
+char *CommaDelimitedFile::volume_datum (const char *datum, const char **errmsg)
+{
+#ifndef RICVOLUMESET
+    _errmsg = *errmsg = "RicVolumeSet not yet supported on this system";
+    return 0;
+#else
+
+    char* data_string = Strdup (datum);
+
+    int volume_number = 0;
+    char* valstring;
+    char* colonpos;
+
+    char* scanpos = data_string;
+    if (0 != (colonpos = strchr (scanpos,':')))
+    {
+	*colonpos = '\0';
+	scanpos = valstring = colonpos+1;
+    }
+    else
+    {
+	printf ("Binary filename but no volume spec: %s\n"
+		,data_string);
+	_errmsg = *errmsg= "Missing volume spec";
+	free (data_string);
+	return 0;
+    }
+    char* endptr;
+    errno = 0;
+    long larg = strtol (valstring, &endptr, 0);
+    if (errno || larg > INT_MAX || larg < INT_MIN)
+    {
+	*colonpos = ':';
+	printf (
+	    "Invalid volume spec %s in file %s\n",
+		    valstring, _filename);
+	_errmsg = *errmsg = 
+	    "Invalid binary volume specified";
+	free (data_string);
+	return 0;
+    }
+    volume_number = (int) larg;
+    int volume_adjust = Option::get_int ("RicVolOffset");
+    volume_number -= volume_adjust;
+
+// Get the current voxel value
+
+    if (!Voxel::Valid())
+    {
+	printf ("Voxel not defined.\n");
+	_errmsg = *errmsg =
+	    "Voxel not defined";
+	free (data_string);
+	return 0;
+    }
+
+// Get value from RicVolumeSet
+
+    if (0==GlobalBinFilename ||
+	strcmp(GlobalBinFilename,data_string))
+    {
+	if (GlobalBinFilename)
+	{
+	    free (GlobalBinFilename);
+	    GlobalBinFilename = 0;
+	    delete GlobalBin;
+	    GlobalBin = 0;
+	}
+	printf ("Opening data RicVolumeSet %s...\n",
+	    data_string);
+	try
+	{
+			    GlobalBin = new RicVolumeSet (data_string);
+	}
+	catch (...)
+	{
+	    printf ("Unable to read binary file\n");
+	    _errmsg = *errmsg = "Unknown binary file type";
+	    free (data_string);
+	    return 0;
+	}
+	printf ("Got new RicVolumeSet: %ld\n",(long) GlobalBin);
+	printf ("This image has %d volumes\n",
+		GlobalBin->nvol);
+
+	GlobalBinFilename = Strdup (data_string);
+    }
+    free (data_string);
+    float val = 1e-10;
+
+    if (GlobalBin->nvol <= volume_number)
+    {
+	printf ("Invalid volume number %d\n",volume_number);
+	_errmsg = *errmsg = "Invalid volume number";
+	return 0;
+    }
+    try 
+    {
+//			    printf ("pointer is %ld\n", (long) &GlobalBin->VolSet[volume_number]);
+	int x = Voxel::X;
+	int y = Voxel::Y;
+	int z = Voxel::Z;
+	val = 
+	    GlobalBin->VolSet[volume_number].vox[x][y][z];
+    }
+    catch (...)
+    {
+	printf ("Got to catch statement\n");
+	return 0;
+    }
+
+    char fbuf[64];
+    sprintf (fbuf,"%14.8g", (double) val);
+
+    char* sptr = Strdup (fbuf);
+    freelist = (char**) Realloc (
+	freelist,(freelistcnt+2)*sizeof(char**));
+    freelist[freelistcnt++] = sptr;
+    return sptr;
+#endif
+}
+
+// find_delimiter returns a bitmask of the ',', '\r' and '\n' characters
+// in the 16 bytes starting at p (bit 0 is p[0]).
+
+#ifdef __SSE2__
+static inline unsigned find_delimiters (const char* p)
+{
+    static const __m128i comma = _mm_set1_epi8 (',');
+    static const __m128i cr = _mm_set1_epi8 ('\r');
+    static const __m128i lf = _mm_set1_epi8 ('\n');
+    __m128i block = _mm_loadu_si128 ((const __m128i*) p);
+    __m128i hits = _mm_or_si128 (_mm_cmpeq_epi8 (block, comma),
+				 _mm_or_si128 (_mm_cmpeq_epi8 (block, cr),
+					       _mm_cmpeq_epi8 (block, lf)));
+    return (unsigned) _mm_movemask_epi8 (hits);
+}
+#endif
+
+// index_fields records the offset of each field in the record beginning
+// at rec in field_offsets, stopping after field "highest" or at end of
+// record, whichever comes first.  The number of fields found is returned,
+// and *recend is set to the character ending the last field found.
+// One extra offset is stored so field i always spans
+// field_offsets[i] to field_offsets[i+1]-1.
+
+int CommaDelimitedFile::index_fields (const char *rec, const char *end,
+				      int highest, const char **recend)
+{
+    if (field_offset_count < highest+2)
+    {
+	field_offset_count = highest+2;
+	field_offsets = (size_t*) Realloc (field_offsets, 
+					   field_offset_count*sizeof(size_t));
+    }
+    int nfields = 0;
+    field_offsets[nfields++] = 0;
+    const char* scan = rec;
+
+#ifdef __SSE2__
+    while (end - scan >= 16)
+    {
+	unsigned mask = find_delimiters (scan);
+	while (mask)
+	{
+	    int bit = __builtin_ctz (mask);
+	    const char* dptr = scan + bit;
+	    if (*dptr != ',' || nfields > highest)
+	    {
+		*recend = dptr;
+		field_offsets[nfields] = dptr+1-rec;
+		return nfields;
+	    }
+	    field_offsets[nfields++] = dptr+1-rec;
+	    mask &= mask - 1;
+	}
+	scan += 16;
+    }
+#endif
+    for (; scan < end; scan++)
+    {
+	if (*scan == ',' || *scan == '\r' || *scan == '\n')
+	{
+	    if (*scan != ',' || nfields > highest)
+	    {
+		break;
+	    }
+	    field_offsets[nfields++] = scan+1-rec;
+	}
+    }
+    *recend = scan;
+    field_offsets[nfields] = scan+1-rec;
+    return nfields;
+}
+
+// get_mapped is get for a memory mapped file.  Only the fields actually
+// requested are copied (into field_buffer, retained until the next get).
+// There are no limits on record length or number of fields.  A last record
+// without a terminating newline is accepted.
+
+char **CommaDelimitedFile::get_mapped (const char **errmsg)
+{
+    const char* end = map_base + map_size;
+    const char* rec = map_base + map_pos;
+    _last_position = map_pos;
+
+// Skip comments and blank lines
+
+    while (rec < end && (*rec == '#' || *rec == '\n' || *rec == '\r' ||
+			 *rec == '\0'))
+    {
+	const char* eol = (const char*) memchr (rec, '\n', end-rec);
+	rec = (eol) ? eol+1 : end;
+    }
+    if (rec >= end)
+    {
+	map_pos = map_size;
+	*errmsg = _errmsg = "EOF";
+	return 0;
+    }
+
+    int highest_index = highest_user_index;
+    if (getwidths)
+    {
+	highest_index = field_count-1;
+    }
+
+    const char* recend;
+    int nfields = index_fields (rec, end, highest_index, &recend);
+
+// Next record begins after newline
+
+    const char* eol = recend;
+    if (eol < end && *eol != '\n')
+    {
+	eol = (const char*) memchr (eol, '\n', end-eol);
+    }
+    map_pos = (eol && eol < end) ? eol+1-map_base : map_size;
+
+    if (nfields <= highest_index)
+    {
+	char showbuf[40];
+	int showlen = (recend-rec < 39) ? recend-rec : 39;
+	strncpy (showbuf, rec, showlen);
+	showbuf[showlen] = '\0';
+	fprintf (stderr,"Short record: %s ...\n",showbuf);
+	_errmsg = *errmsg = "Short record in input file";
+	return 0;
+    }
+
+    if (getwidths)
+    {
+	for (int i = 0; i <= highest_index; i++)
+	{
+	    const char* first = rec + field_offsets[i];
+	    const char* last = rec + field_offsets[i+1] - 1;
+	    while (first < last && (*first == ' ' || *first == '\t')) first++;
+	    while (last > first && (last[-1] == ' ' || last[-1] == '\t')) last--;
+	    int newwidth = last - first;
+	    if (newwidth > _widths[i])
+	    {
+		_widths[i] = newwidth;
+	    }
+	}
+	return 0;  // No return needed for getwidths
+    }
+
+// Copy requested fields into one buffer, then null terminate and trim
+
+    size_t needsize = 0;
+    int icopy;
+    for (icopy = 0; icopy < user_field_count; icopy++)
+    {
+	int needindex = user_indexes[icopy];
+	needsize += field_offsets[needindex+1] - field_offsets[needindex];
+    }
+    if (needsize > field_buffer_size)
+    {
+	field_buffer_size = needsize + needsize/2;
+	field_buffer = (char*) Realloc (field_buffer, field_buffer_size);
+    }
+    char* copyp = field_buffer;
+    for (icopy = 0; icopy < user_field_count; icopy++)
+    {
+	int needindex = user_indexes[icopy];
+	size_t len = field_offsets[needindex+1] - field_offsets[needindex] - 1;
+	memcpy (copyp, rec + field_offsets[needindex], len);
+	copyp[len] = '\0';
+	if (_types[needindex] < 11)
+	{
+	    trim_blank_sides (copyp);
+	    user_array[icopy] = copyp;
+	}
+	else
+	{
+	    char* datum = volume_datum (copyp, errmsg);
+	    if (!datum) return 0;
+	    user_array[icopy] = datum;
+	}
+	copyp += len+1;
+    }
+    user_array[user_field_count] = 0;
+    return user_array;
+}
+
 char **CommaDelimitedFile::get (const char **errmsg)
 {
     if (0 != (*errmsg = (const char*) _errmsg)) return 0; 
+    if (map_base)
+    {
+	return get_mapped (errmsg);
+    }
     _last_position = ftell (fptr);
 
 
@@ -1431,139 +1868,10 @@ char **CommaDelimitedFile::get (const char **errmsg)
 		    }
 		    else
 		    {
-
-// This field is not raw numeric data.
-// Instead, it is the filename of a binary file.
-// We obtain the data by employing the required method on the file
-//   Currently, RicVolumeSet is the only supported filetype so we don't check
-//   Otherwise, the binary filetype would be specified by the field type
-
-// We need to pull out arguments from the data string here:
-//    the NIFTI filename, and the Volume number, like this:
-//
-//    images.gz:5
-//
-// These are combined with the current voxel to get the actual datum.
-
-#ifndef RICVOLUMESET
-			_errmsg = *errmsg = "RicVolumeSet not yet supported on this system";
-			return 0;
-#else
-
-			char* data_string = Strdup 
-			    (&buf[table_pointers[needindex]]);
-			
-			int volume_number = 0;
-			char* valstring;
-			char* colonpos;
-
-			char* scanpos = data_string;
-			if (0 != (colonpos = strchr (scanpos,':')))
-			{
-			    *colonpos = '\0';
-			    scanpos = valstring = colonpos+1;
-			}
-			else
-			{
-			    printf ("Binary filename but no volume spec: %s\n"
-				    ,data_string);
-			    _errmsg = *errmsg= "Missing volume spec";
-			    free (data_string);
-                            return 0;
-			}
-			char* endptr;
-			errno = 0;
-			long larg = strtol (valstring, &endptr, 0);
-			if (errno || larg > INT_MAX || larg < INT_MIN)
-			{
-			    *colonpos = ':';
-			    printf (
-				"Invalid volume spec %s in file %s\n",
-					valstring, _filename);
-			    _errmsg = *errmsg = 
-				"Invalid binary volume specified";
-			    free (data_string);
-			    return 0;
-			}
-			volume_number = (int) larg;
-			int volume_adjust = Option::get_int ("RicVolOffset");
-			volume_number -= volume_adjust;
-
-// Get the current voxel value
-
-			if (!Voxel::Valid())
-			{
-			    printf ("Voxel not defined.\n");
-			    _errmsg = *errmsg =
-				"Voxel not defined";
-			    free (data_string);
-			    return 0;
-			}
-
-// Get value from RicVolumeSet
-
-			if (0==GlobalBinFilename ||
-			    strcmp(GlobalBinFilename,data_string))
-			{
-			    if (GlobalBinFilename)
-			    {
-				free (GlobalBinFilename);
-				GlobalBinFilename = 0;
-				delete GlobalBin;
-				GlobalBin = 0;
-			    }
-			    printf ("Opening data RicVolumeSet %s...\n",
-				data_string);
-			    try
-			    {
- 				GlobalBin = new RicVolumeSet (data_string);
-			    }
-			    catch (...)
-			    {
-				printf ("Unable to read binary file\n");
-				_errmsg = *errmsg = "Unknown binary file type";
-				free (data_string);
-				return 0;
-			    }
-			    printf ("Got new RicVolumeSet: %ld\n",(long) GlobalBin);
-			    printf ("This image has %d volumes\n",
-				    GlobalBin->nvol);
-
-			    GlobalBinFilename = Strdup (data_string);
-			}
-			free (data_string);
-			float val = 1e-10;
-
-			if (GlobalBin->nvol <= volume_number)
-			{
-			    printf ("Invalid volume number %d\n",volume_number);
-			    _errmsg = *errmsg = "Invalid volume number";
-			    return 0;
-			}
-			try 
-			{
-//			    printf ("pointer is %ld\n", (long) &GlobalBin->VolSet[volume_number]);
-			    int x = Voxel::X;
-			    int y = Voxel::Y;
-			    int z = Voxel::Z;
-			    val = 
-				GlobalBin->VolSet[volume_number].vox[x][y][z];
-			}
-			catch (...)
-			{
-			    printf ("Got to catch statement\n");
-			    return 0;
-			}
-
-			char fbuf[64];
-			sprintf (fbuf,"%14.8g", (double) val);
-			
-			char* sptr = Strdup (fbuf);
-			user_array[icopy] = sptr;
-			freelist = (char**) Realloc (
-			    freelist,(freelistcnt+2)*sizeof(char**));
-			freelist[freelistcnt++] = sptr;
-#endif
+			char* datum = volume_datum
+			    (&buf[table_pointers[needindex]], errmsg);
+			if (!datum) return 0;
+			user_array[icopy] = datum;
 		    }
 		}
 
@@ -1650,6 +1958,13 @@ char **CommaDelimitedFile::get (const char **errmsg)
 CommaDelimitedFile::~CommaDelimitedFile()
 {
     int i;
+    if (map_base) munmap ((void*) map_base, map_size);
+    map_base = 0;
+    if (field_offsets) free (field_offsets);
+    field_offsets = 0;
+    if (field_buffer) free (field_buffer);
+    field_buffer = 0;
+
     for (i = 0; i < freelistcnt; i++)
     {
 	free (freelist[i]);
@@ -1690,6 +2005,235 @@ CommaDelimitedFile::~CommaDelimitedFile()
 }
 
 
+static const char Genotype_Binary_Magic[8] = {'S','O','L','A','R','G','B','1'};
+
+bool GenotypeBinaryFile::test_magic (const char *fname)
+{
+    char magic[sizeof (Genotype_Binary_Magic)];
+    FILE *testfile = fopen (fname, "r");
+    if (!testfile) return false;
+    size_t got = fread (magic, 1, sizeof (magic), testfile);
+    fclose (testfile);
+    return got == sizeof (magic) &&
+	!memcmp (magic, Genotype_Binary_Magic, sizeof (magic));
+}
+
+const char *GenotypeBinaryFile::read_header ()
+{
+    fptr = fopen (_filename, "r");
+    if (!fptr)
+    {
+	return "File not Found";
+    }
+    struct stat statbuf;
+    int64_t sizes[4];
+    size_t header_size = sizeof (Genotype_Binary_Magic) + sizeof (sizes);
+    if (fstat (fileno (fptr), &statbuf) || (size_t) statbuf.st_size < header_size)
+    {
+	return "Invalid binary genotype file";
+    }
+    void* addr = mmap (0, statbuf.st_size, PROT_READ, MAP_PRIVATE,
+		       fileno (fptr), 0);
+    if (addr == MAP_FAILED)
+    {
+	return "Unable to map binary genotype file";
+    }
+    map_base = (const char*) addr;
+    map_size = statbuf.st_size;
+    memcpy (sizes, map_base + sizeof (Genotype_Binary_Magic), sizeof (sizes));
+    n_samples = sizes[0];
+    n_snps = sizes[1];
+    if (sizes[0] < 0 || sizes[1] < 0 || sizes[2] < 0 || sizes[3] < 0 ||
+	header_size + sizes[2] + sizes[3] + n_samples * n_snps != map_size)
+    {
+	return "Invalid binary genotype file";
+    }
+
+// Index sample strings, which are null terminated in place
+
+    const char* sample_block = map_base + header_size;
+    const char* name_block = sample_block + sizes[2];
+    sample_fields = (const char**) Calloc (3*n_samples+1, sizeof (char*));
+    const char* next = sample_block;
+    size_t i;
+    for (i = 0; i < 3*n_samples; i++)
+    {
+	const char* nul = (const char*) memchr (next, '\0', name_block-next);
+	if (!nul) return "Invalid binary genotype file";
+	sample_fields[i] = next;
+	next = nul+1;
+    }
+    genotypes = (const unsigned char*) name_block + sizes[3];
+
+// Names are id, fid, sex, then snp names
+
+    field_count = 3 + n_snps;
+    _names = (char**) Calloc (field_count+1, sizeof (char*));
+    _short_names = (char**) Calloc (field_count+1, sizeof (char*));
+    const char* sample_names[3] = {"id", "fid", "sex"};
+    next = name_block;
+    for (i = 0; i < (size_t) field_count; i++)
+    {
+	const char* name = sample_names[i < 3 ? i : 0];
+	if (i >= 3)
+	{
+	    const char* nul = (const char*) memchr (next, '\0',
+					      (const char*) genotypes-next);
+	    if (!nul) return "Invalid binary genotype file";
+	    name = next;
+	    next = nul+1;
+	}
+	_names[i] = Strdup (name);
+	_short_names[i] = Strdup (name);
+	if (strlen (name) > SHORT_NAME_LENGTH)
+	{
+	    _short_names[i][SHORT_NAME_LENGTH] = '\0';
+	}
+    }
+    fclose (fptr);
+    fptr = 0;
+    return 0;
+}
+
+int *GenotypeBinaryFile::widths (int *count, const char **errmsg)
+{
+    if (0 != (*errmsg = _errmsg)) return 0;
+    *count = field_count;
+    if (_widths)
+    {
+	return _widths;
+    }
+    _widths = (int *) Calloc ((1+field_count), sizeof (int));
+    for (size_t row = 0; row < n_samples; row++)
+    {
+	for (int i = 0; i < 3; i++)
+	{
+	    int width = strlen (sample_fields[3*row+i]);
+	    if (width > _widths[i]) _widths[i] = width;
+	}
+    }
+    for (int i = 3; i < field_count; i++)
+    {
+	_widths[i] = 1;
+    }
+    return _widths;
+}
+
+void GenotypeBinaryFile::start_setup (const char **errmsg)
+{
+    if (0 != (*errmsg = _errmsg)) return;
+
+    if (user_indexes) free (user_indexes);
+    user_indexes = (int *) Calloc (1, sizeof (int));
+    user_array = (char **) Realloc (user_array, sizeof(char*));
+    user_field_count = 0;
+}
+
+int GenotypeBinaryFile::setup (const char *name, const char **errmsg)
+{
+    if (0 != (*errmsg = _errmsg)) return 0;
+
+    char **test_names = (short_names_switch) ? _short_names : _names;
+    for (int i = 0; i < field_count; i++)
+    {
+	if (!Strcmp (name, test_names[i]))
+	{
+	    user_field_count++;
+	    user_indexes = (int *) Realloc (user_indexes,
+					    user_field_count*sizeof(int));
+	    user_indexes[user_field_count-1] = i;
+	    user_array = (char **) Realloc (user_array,
+				       (1+user_field_count)*sizeof(char*));
+	    return i;
+	}
+    }
+    sprintf (error_message, "Name not found: %s", name);
+    *errmsg = _errmsg = error_message;
+    return 0;
+}
+
+// Genotypes are read from each snp's column at the current row, and
+// returned as the 0, 1 or 2 written by plink_converter -bin (blank if missing)
+
+char **GenotypeBinaryFile::get (const char **errmsg)
+{
+    if (0 != (*errmsg = (const char*) _errmsg)) return 0;
+    if (current_row >= n_samples)
+    {
+	*errmsg = _errmsg = "EOF";
+	return 0;
+    }
+    _last_position = current_row;
+
+    const char** sample = sample_fields + 3*current_row;
+    size_t needsize = 0;
+    int i;
+    for (i = 0; i < user_field_count; i++)
+    {
+	int index = user_indexes[i];
+	needsize += (index < 3) ? strlen (sample[index]) + 1 : 2;
+    }
+    if (needsize > field_buffer_size)
+    {
+	field_buffer_size = needsize + needsize/2;
+	field_buffer = (char*) Realloc (field_buffer, field_buffer_size);
+    }
+    char* copyp = field_buffer;
+    for (i = 0; i < user_field_count; i++)
+    {
+	int index = user_indexes[i];
+	user_array[i] = copyp;
+	if (index < 3)
+	{
+	    size_t len = strlen (sample[index]);
+	    memcpy (copyp, sample[index], len+1);
+	    copyp += len+1;
+	}
+	else
+	{
+	    unsigned char value = genotypes[(index-3)*n_samples + current_row];
+	    if (value < 3)
+	    {
+		*copyp++ = '0' + value;
+	    }
+	    *copyp++ = '\0';
+	}
+    }
+    user_array[user_field_count] = 0;
+    current_row++;
+    return user_array;
+}
+
+void GenotypeBinaryFile::rewind (const char **errmsg)
+{
+    if (_errmsg && !Strcmp (_errmsg,"EOF")) _errmsg = 0;
+    if (0 != (*errmsg = _errmsg)) return;
+    current_row = 0;
+}
+
+void GenotypeBinaryFile::set_position (long pos, const char **errmsg)
+{
+    if (_errmsg && !Strcmp (_errmsg, "EOF")) _errmsg = 0;
+    if (0 != (*errmsg = _errmsg)) return;
+    if (pos < 0 || (size_t) pos > n_samples)
+    {
+	*errmsg = _errmsg = "Error setting position in data file";
+	return;
+    }
+    current_row = pos;
+}
+
+GenotypeBinaryFile::~GenotypeBinaryFile ()
+{
+    if (map_base) munmap ((void*) map_base, map_size);
+    map_base = 0;
+    if (sample_fields) free (sample_fields);
+    if (field_buffer) free (field_buffer);
+    if (user_indexes) free (user_indexes);
+    if (user_array) free (user_array);
+}
+
+
 void squeeze (char *s)  // Squeeze out whitespace
 {
     char *s2 = s;
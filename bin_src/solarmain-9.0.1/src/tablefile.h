@@ -11,7 +11,8 @@
  *   physically exist in different formats.  The library figures out
  *   the correct format automatically.
  *
- * Currently supported formats are PEDSYS and Comma Delimited.
+ * Currently supported formats are PEDSYS and Comma Delimited, and the
+ * binary genotype files written by plink_converter -binary.
  * Comma Delimited files must have first record having field names.
  * (Fisher2 format files are also supported, though inefficiently.)
  *
@@ -227,7 +228,7 @@ public:
     virtual void rewind (const char **errmsg) = 0;
     const char *filename () {return (const char*) _filename;}
     long get_position () {return _last_position;}
-    virtual void set_position (int pos, const char **errmsg);
+    virtual void set_position (long pos, const char **errmsg);
 };
 
 void inline trim_blank_sides (char *buffer)
@@ -6,51 +6,67 @@
 #include <math.h>
 #include <limits.h>
 #include <float.h>
+#ifdef _OPENMP
+#include <omp.h>
+#define thread_num()    omp_get_thread_num()
+#else
+#define thread_num()    0
+#endif
 
 #define MAXID   30000
 #define MAXALL  99
 #define MAXGEN  MAXALL*(MAXALL+1)/2
 
+/* pedigree data, which is not changed by the imputations */
 struct _ego {
-    short id;
-    short fa;
-    short mo;
-    short fam;
-    short gener;
-    char sex[2];
+    int id;
+    int fa;
+    int mo;
+    int gener;
     char twin[4];
-    short twin1;
+    int twin1;
     char geno[7];
-    char igeno[7];
-    short lgen;
-    short npgen;
-    short tnpgen;
-    unsigned char posgen[MAXGEN];
-    unsigned char tposgen[MAXGEN];
-    unsigned char savegen[MAXGEN];
+    int gen;
+    int all[2];
 } *ego;
 
-short locid[MAXID+1];
+int locid[MAXID+1];
 
 struct _fam {
-    short fa;
-    short mo;
-    short nkid;
-    short kid1;
+    int fa;
+    int mo;
+    int nkid;
+    int kid1;
 } *fam;
 
+/* Working data for one thread's imputations.  The possible genotypes of
+   all individuals are kept in flat ntot x ngen arrays, one row per ego,
+   and each imputation draws from its own erand48 stream. */
+struct _state {
+    unsigned char *posgen;
+    unsigned char *tposgen;
+    unsigned char *savegen;
+    int *npgen;
+    int *tnpgen;
+    int *lgen;
+    int *gene[2];
+    int *imputed;
+    int *infam;
+    int *istack, *jstack;
+    double *lstack;
+    double *risk, *cumrskl, *cumrsku;
+    double *alpha, *ibd, *cumibd;
+    unsigned short xsubi[3];
+};
+
 int maxrisk;
-short *infam;
-int stack;
-short *istack, *jstack;
-double *lstack;
 
 int ntot, nfound, nfam;
 int nall, ngen, nuntyped;
-short *untyped, *imputed;
+int *untyped;
+int *pfa, *pmo;
 double freq[MAXALL], *gfreq;
-short *iall, *jall;
-char *genotyp[MAXGEN];
+int *iall, *jall;
 char *solarbin;
 
 #define max(a,b)        ( (a) > (b) ? (a) : (b) )
@@ -64,27 +80,38 @@ char *solarbin;
 
 #define alpha(a,b,c,d)  alpha[(((a*ntot) + b)*2 + c)*ntot + d]
 
-void set_posgen (void);
-double calc_risk (int, int);
+int get_freqs (void);
+int read_ped (void);
+void set_untyped (void);
+struct _state *new_state (void);
+void seed_stream (struct _state*, long, int);
+void set_posgen (struct _state*);
+int run_imputation (struct _state*, int);
+int check_genotypes (struct _state*);
+int impute_genotype (struct _state*, int, int);
+double calc_risk (struct _state*, int, int);
+int make_ibds (struct _state*);
+int write_ibds (int, double*, int*);
 double sumlog (double, double);
-void getibd (double*, double*);
-void getalpha (double*, short**, short*, short*, short, short, short, short);
-void wgt (double*, short, short, short, short, short, short);
-void wgt2 (double*, short, short, short, short, short, short);
+void getibd (struct _state*);
+void getalpha (double*, int*[2], int*, int*, int, int, int, int);
+void wgt (double*, int, int, int, int, int, int);
+void wgt2 (double*, int, int, int, int, int, int);
 
 void *allocMem (size_t);
 
-main (int argc, char **argv)
+int main (int argc, char **argv)
 {
-    int i, j, k, nimp, ndx;
-    int imp, tries, ok, done;
-    int nlast, lastgen;
-    short *typed;
-    double *alpha, *cumibd, *ibd;
-    double *risk, *cumrskl, *cumrsku;
-
-    if (argc != 3) {
-        printf("usage: %s #imputations maxrisk(y/n)\n", argv[0]);
+    int i, j, t, nimp, imp;
+    int nthreads = 0, nstate, failed = 0;
+    long seed;
+    int *typed;
+    double *cumibd;
+    struct _state **state;
+
+    if (argc < 3 || argc > 5) {
+        printf("usage: %s #imputations maxrisk(y/n) [#threads [seed]]\n",
+               argv[0]);
         exit(1);
     }
 
@@ -105,21 +132,32 @@ main (int argc, char **argv)
         exit(1);
     }
 
+    /* 0 threads means the OpenMP default */
+    if (argc > 3 && (sscanf(argv[3], "%d", &nthreads) != 1 || nthreads < 0))
+    {
+        printf("Number of threads must be a non-negative integer.\n");
+        exit(1);
+    }
+
+    seed = time(NULL);
+    if (argc > 4 && sscanf(argv[4], "%ld", &seed) != 1) {
+        printf("Seed must be an integer.\n");
+        exit(1);
+    }
+
     solarbin =  getenv("SOLAR_BIN");
     if (!solarbin) {
         printf("Environment variable SOLAR_BIN not defined.\n");
         exit(1);
     }
 
-    srand48(time(NULL));
-
     if (!get_freqs())
         exit(1);
 
     if (!read_ped())
         exit(1);
 
-    set_posgen();
+    set_untyped();
 
     if (nuntyped == ntot) {
         FILE *fp = fopen("ibd.mat", "w");
@@ -137,99 +175,72 @@ main (int argc, char **argv)
         exit(0);
     }
 
-    infam = (short *) allocMem(ntot * sizeof(short));
-    istack = (short *) allocMem(ntot * sizeof(short));
-    jstack = (short *) allocMem(ntot * sizeof(short));
-    lstack = (double *) allocMem(ntot * sizeof(double));
-
-    typed = (short *) allocMem(ntot*(ntot + 1)/2 * sizeof(short));
-	for (i = 0; i < ntot; i++) {
-	    for (j = 0; j <= i; j++) {
-            if (!strcmp(ego[i].geno, "      ")
-                || !strcmp(ego[j].geno, "      "))
-            {
-                typed(i,j) = (short) 0;
-            }
+    typed = (int *) allocMem(ntot*(ntot + 1)/2 * sizeof(int));
+    for (i = 0; i < ntot; i++) {
+        for (j = 0; j <= i; j++) {
+            if (ego[i].gen < 0 || ego[j].gen < 0)
+                typed(i,j) = 0;
             else
-                typed(i,j) = (short) 1;
+                typed(i,j) = 1;
         }
     }
 
-    alpha = (double *) allocMem(4*ntot*ntot * sizeof(double));
-    ibd = (double *) allocMem(ntot*(ntot + 1)/2 * sizeof(double));
-    cumibd = (double *) allocMem(ntot*(ntot + 1)/2 * sizeof(double));
-    for (i = 0; i < ntot*(ntot + 1)/2; i++)
-        cumibd[i] = 0;
-
-    risk = (double *) allocMem(ngen * sizeof(double));
-    cumrskl = (double *) allocMem(ngen * sizeof(double));
-    cumrsku = (double *) allocMem(ngen * sizeof(double));
+    pfa = (int *) allocMem(ntot * sizeof(int));
+    pmo = (int *) allocMem(ntot * sizeof(int));
+    for (i = 0; i < ntot; i++) {
+        pfa[i] = -1;
+        pmo[i] = -1;
+    }
+    for (i = nfound; i < ntot; i++) {
+        pfa[i] = locid[ego[i].fa];
+        pmo[i] = locid[ego[i].mo];
+    }
 
+    /* with everyone typed, every imputation gives the same IBDs */
+    if (!nuntyped)
+        nimp = 1;
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+    nstate = omp_get_max_threads();
+#else
+    nstate = 1;
+#endif
+    if (nstate > nimp)
+        nstate = nimp;
+
+    state = (struct _state **) allocMem(nstate * sizeof(struct _state *));
+    for (t = 0; t < nstate; t++)
+        state[t] = new_state();
+
+    /* each thread sums the IBDs of a fixed block of imputations */
+#pragma omp parallel for num_threads(nstate) schedule(static)
     for (imp = 0; imp < nimp; imp++)
     {
-        set_posgen();
-
-        for (j = 0; j < nuntyped; j++)
-            imputed[j] = 0;
-        i = nuntyped;
-        if (!check_genotypes()) {
-            printf("impossible initial genotype vector, bailing out\n");
-            exit(1);
-        }
-
-        tries = 0;
-        nlast = 0;
-        while (i > 0) {
-            if (!nlast) {
-                lastgen = 0;
-                for (k = 0; k < nuntyped; k++) {
-                    if (!imputed[k] && ego[untyped[k]].gener > lastgen)
-                        lastgen = ego[untyped[k]].gener;
-                }
-                for (k = 0; k < nuntyped; k++) {
-                    if (!imputed[k] && ego[untyped[k]].gener == lastgen)
-                        nlast++;
-                }
-            }
-            j = drand48() * nlast;
-            if (j == nlast) j--;
-            for (k = 0; k < nuntyped; k++) {
-                if (!imputed[k] && ego[untyped[k]].gener == lastgen) {
-                    if (!j) {
-                        ndx = untyped[k];
-                        ok = impute_genotype(ndx, risk, cumrskl, cumrsku, !imp);
-                        imputed[k] = 1;
-                        break;
-                    }
-                    j--;
-                }
-            }
-            if (!ok || !(ok = check_genotypes())) {
-                strcpy(ego[ndx].igeno, ego[ndx].geno);
-                imputed[k] = 0;
-                tries++;
-                if (tries == 10) break;
-            }
-            else {
-                tries = 0;
-                nlast--;
-                i--;
-            }
-        }
-
-        if (nuntyped && !ok) {
-            imp--;
+        struct _state *st = state[thread_num()];
+        int stop;
+#pragma omp atomic read
+        stop = failed;
+        if (stop)
             continue;
-        }
 
-        if (!make_ibds(alpha, cumibd, ibd))
-            exit(1);
+        seed_stream(st, seed, imp);
+        if (!run_imputation(st, !imp)) {
+#pragma omp atomic write
+            failed = 1;
+        }
+    }
 
-        if (!write_ibds(imp + 1, cumibd, typed))
-            exit(1);
+    if (failed) {
+        printf("impossible initial genotype vector, bailing out\n");
+        exit(1);
+    }
 
-        if (!nuntyped)
-            exit(0);
+    cumibd = state[0]->cumibd;
+    for (t = 1; t < nstate; t++) {
+        for (i = 0; i < ntot*(ntot + 1)/2; i++)
+            cumibd[i] += state[t]->cumibd[i];
     }
 
     if (!write_ibds(nimp, cumibd, typed))
@@ -238,7 +249,7 @@ main (int argc, char **argv)
     exit(0);
 }
 
-int write_ibds (int nimp, double *cumibd, short *typed)
+int write_ibds (int nimp, double *cumibd, int *typed)
 {
     int i, j;
     FILE *fp = fopen("ibd.mat", "w");
@@ -309,25 +320,19 @@ int get_freqs (void)
 
     ngen = nall*(nall + 1)/2;
     gfreq = allocMem(ngen * sizeof(double));
-    iall = allocMem(ngen * sizeof(short));
-    jall = allocMem(ngen * sizeof(short));
-    for (i = 0; i < ngen; i++)
-        genotyp[i] = (char *) allocMem(7);
+    iall = allocMem(ngen * sizeof(int));
+    jall = allocMem(ngen * sizeof(int));
 
     for (i = 1; i <= nall; i++) {
         for (j = 1; j < i; j++) {
             k = i*(i - 1)/2 + j - 1;
             iall[k] = i;
             jall[k] = j;
-            sprintf(genotyp[k], "%3d%3d", j, i);
-            genotyp[k][6] = '\0';
             gfreq[k] = 2*freq[i-1]*freq[j-1];
         }
         k = i*(i + 1)/2 - 1;
         iall[k] = i;
         jall[k] = i;
-        sprintf(genotyp[k], "%3d%3d", i, i);
-        genotyp[k][6] = '\0';
         gfreq[k] = freq[i-1]*freq[i-1];
     }
 
@@ -373,8 +378,7 @@ int read_ped (void)
     fam = (struct _fam *) allocMem(ntot * sizeof(struct _fam));
     nfam = 0;
 
-    untyped = (short *) allocMem(ntot * sizeof(short));
-    imputed = (short *) allocMem(ntot * sizeof(short));
+    untyped = (int *) allocMem(ntot * sizeof(int));
 
     nfound = 0;
     for (i = 0; i < ntot; i++) {
@@ -427,9 +431,6 @@ int read_ped (void)
         else
             ego[i].mo = 0;
 
-        sex[1] = '\0';
-        strcpy(ego[i].sex, sex);
-
         twin[3] = '\0';
         strcpy(ego[i].twin, twin);
 
@@ -481,39 +482,167 @@ int read_ped (void)
     return 1;
 }
 
-void set_posgen (void)
+void set_untyped (void)
 {
-    int i, j, ia, ja;
+    int i, ia, ja;
 
     nuntyped = 0;
     for (i = 0; i < ntot; i++) {
         if (strcmp(ego[i].geno, "      ")) {
-            for (j = 0; j < ngen; j++)
-                ego[i].posgen[j] = 0;
             sscanf(ego[i].geno, "%3d%3d", &ia, &ja);
-            ego[i].posgen[ja*(ja-1)/2+ia-1] = 1;
-            ego[i].npgen = 1;
+            ego[i].gen = ja*(ja-1)/2+ia-1;
+            ego[i].all[0] = ia;
+            ego[i].all[1] = ja;
         }
         else {
             untyped[nuntyped] = i;
             nuntyped++;
-            for (j = 0; j < ngen; j++)
-                ego[i].posgen[j] = 1;
-            ego[i].npgen = ngen;
+            ego[i].gen = -1;
+            ego[i].all[0] = 0;
+            ego[i].all[1] = 0;
         }
-        strcpy(ego[i].igeno, ego[i].geno);
-        ego[i].tnpgen = ego[i].npgen;
-        for (j = 0; j < ngen; j++)
-            ego[i].tposgen[j] = ego[i].posgen[j];
     }
 }
 
-int check_genotypes (void)
+struct _state *new_state (void)
+{
+    int i;
+    struct _state *st = (struct _state *) allocMem(sizeof(struct _state));
+
+    st->posgen = (unsigned char *) allocMem(ntot * ngen);
+    st->tposgen = (unsigned char *) allocMem(ntot * ngen);
+    st->savegen = (unsigned char *) allocMem(ntot * ngen);
+    st->npgen = (int *) allocMem(ntot * sizeof(int));
+    st->tnpgen = (int *) allocMem(ntot * sizeof(int));
+    st->lgen = (int *) allocMem(ntot * sizeof(int));
+    st->gene[0] = (int *) allocMem(ntot * sizeof(int));
+    st->gene[1] = (int *) allocMem(ntot * sizeof(int));
+    st->imputed = (int *) allocMem(ntot * sizeof(int));
+    st->infam = (int *) allocMem(ntot * sizeof(int));
+    st->istack = (int *) allocMem(ntot * sizeof(int));
+    st->jstack = (int *) allocMem(ntot * sizeof(int));
+    st->lstack = (double *) allocMem(ntot * sizeof(double));
+    st->risk = (double *) allocMem(ngen * sizeof(double));
+    st->cumrskl = (double *) allocMem(ngen * sizeof(double));
+    st->cumrsku = (double *) allocMem(ngen * sizeof(double));
+    st->alpha = (double *) allocMem(4*ntot*ntot * sizeof(double));
+    st->ibd = (double *) allocMem(ntot*(ntot + 1)/2 * sizeof(double));
+    st->cumibd = (double *) allocMem(ntot*(ntot + 1)/2 * sizeof(double));
+    for (i = 0; i < ntot*(ntot + 1)/2; i++)
+        st->cumibd[i] = 0;
+
+    return st;
+}
+
+/* Seed the erand48 stream for imputation imp from the run's seed, so the
+   results do not depend on how the imputations are divided among threads */
+void seed_stream (struct _state *st, long seed, int imp)
+{
+    unsigned long long z;
+
+    z = (unsigned long long) seed + (imp + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+
+    st->xsubi[0] = (unsigned short) z;
+    st->xsubi[1] = (unsigned short) (z >> 16);
+    st->xsubi[2] = (unsigned short) (z >> 32);
+}
+
+void set_posgen (struct _state *st)
+{
+    int i;
+    unsigned char *posgen;
+
+    for (i = 0; i < ntot; i++) {
+        posgen = st->posgen + i*ngen;
+        if (ego[i].gen >= 0) {
+            memset(posgen, 0, ngen);
+            posgen[ego[i].gen] = 1;
+            st->npgen[i] = 1;
+        }
+        else {
+            memset(posgen, 1, ngen);
+            st->npgen[i] = ngen;
+        }
+        st->gene[0][i] = ego[i].all[0];
+        st->gene[1][i] = ego[i].all[1];
+        st->tnpgen[i] = st->npgen[i];
+    }
+    memcpy(st->tposgen, st->posgen, ntot*ngen);
+}
+
+/* Impute genotypes for the untyped individuals, starting over whenever
+   the imputed genotypes become inconsistent, and add the resulting IBDs
+   to the thread's cumulative IBDs.  Returns 0 if the initial genotypes
+   are inconsistent. */
+int run_imputation (struct _state *st, int first_imp)
+{
+    int i, j, k, ndx;
+    int tries, ok, nlast, lastgen;
+
+    do {
+        set_posgen(st);
+
+        for (j = 0; j < nuntyped; j++)
+            st->imputed[j] = 0;
+        i = nuntyped;
+        if (!check_genotypes(st))
+            return 0;
+
+        ok = 1;
+        tries = 0;
+        nlast = 0;
+        while (i > 0) {
+            if (!nlast) {
+                lastgen = 0;
+                for (k = 0; k < nuntyped; k++) {
+                    if (!st->imputed[k] && ego[untyped[k]].gener > lastgen)
+                        lastgen = ego[untyped[k]].gener;
+                }
+                for (k = 0; k < nuntyped; k++) {
+                    if (!st->imputed[k] && ego[untyped[k]].gener == lastgen)
+                        nlast++;
+                }
+            }
+            j = erand48(st->xsubi) * nlast;
+            if (j == nlast) j--;
+            for (k = 0; k < nuntyped; k++) {
+                if (!st->imputed[k] && ego[untyped[k]].gener == lastgen) {
+                    if (!j) {
+                        ndx = untyped[k];
+                        ok = impute_genotype(st, ndx, first_imp);
+                        st->imputed[k] = 1;
+                        break;
+                    }
+                    j--;
+                }
+            }
+            if (!ok || !(ok = check_genotypes(st))) {
+                st->gene[0][ndx] = ego[ndx].all[0];
+                st->gene[1][ndx] = ego[ndx].all[1];
+                st->imputed[k] = 0;
+                tries++;
+                if (tries == 10) break;
+            }
+            else {
+                tries = 0;
+                nlast--;
+                i--;
+            }
+        }
+    } while (nuntyped && !ok);
+
+    return make_ibds(st);
+}
+
+int check_genotypes (struct _state *st)
 {
     int i, j, k, ig;
     int ifa, imo, ifg, img, ikg;
-    int ia, ja, iaf, jaf, iam, jam;
     int redo, ok;
+    unsigned char *ftpos, *mtpos, *ktpos, *fsave, *msave, *ksave;
 
     do
     {
@@ -522,24 +651,25 @@ int check_genotypes (void)
         {
             ifa = fam[i].fa;
             imo = fam[i].mo;
-            for (ig = 0; ig < ngen; ig++) {
-                ego[ifa].savegen[ig] = 0;
-                ego[imo].savegen[ig] = 0;
-                for (j = 0; j < fam[i].nkid; j++) {
-                    k = fam[i].kid1 + j;
-                    ego[k].savegen[ig] = 0;
-                }
-            }
+            ftpos = st->tposgen + ifa*ngen;
+            mtpos = st->tposgen + imo*ngen;
+            fsave = st->savegen + ifa*ngen;
+            msave = st->savegen + imo*ngen;
+
+            memset(fsave, 0, ngen);
+            memset(msave, 0, ngen);
+            memset(st->savegen + fam[i].kid1*ngen, 0, fam[i].nkid*ngen);
 
             for (ifg = 0; ifg < ngen; ifg++) {
-                if (!ego[ifa].tposgen[ifg]) continue;
+                if (!ftpos[ifg]) continue;
                 for (img = 0; img < ngen; img++) {
-                    if (!ego[imo].tposgen[img]) continue;
+                    if (!mtpos[img]) continue;
                     for (j = 0; j < fam[i].nkid; j++) {
                         ok = 0;
                         k = fam[i].kid1 + j;
+                        ktpos = st->tposgen + k*ngen;
                         for (ikg = 0; ikg < ngen; ikg++) {
-                            if (!ego[k].tposgen[ikg]) continue;
+                            if (!ktpos[ikg]) continue;
                             if (ikg == ign(iall[ifg],iall[img]) ||
                                 ikg == ign(iall[ifg],jall[img]) ||
                                 ikg == ign(jall[ifg],iall[img]) ||
@@ -555,18 +685,20 @@ int check_genotypes (void)
                     if (!ok)
                         continue;
 
-                    ego[ifa].savegen[ifg] = 1;
-                    ego[imo].savegen[img] = 1;
+                    fsave[ifg] = 1;
+                    msave[img] = 1;
                     for (j = 0; j < fam[i].nkid; j++) {
                         k = fam[i].kid1 + j;
+                        ktpos = st->tposgen + k*ngen;
+                        ksave = st->savegen + k*ngen;
                         for (ikg = 0; ikg < ngen; ikg++) {
-                            if (!ego[k].tposgen[ikg]) continue;
+                            if (!ktpos[ikg]) continue;
                             if (ikg == ign(iall[ifg],iall[img]) ||
                                 ikg == ign(iall[ifg],jall[img]) ||
                                 ikg == ign(jall[ifg],iall[img]) ||
                                 ikg == ign(jall[ifg],jall[img]))
                             {
-                                ego[k].savegen[ikg] = 1;
+                                ksave[ikg] = 1;
                             }
                         }
                     }
@@ -574,28 +706,28 @@ int check_genotypes (void)
             }
 
             for (ig = 0; ig < ngen; ig++) {
-                if (!ego[ifa].savegen[ig]) {
-                    if (ego[ifa].tposgen[ig]) {
-                        ego[ifa].tposgen[ig] = 0;
-                        ego[ifa].tnpgen--;
+                if (!fsave[ig]) {
+                    if (ftpos[ig]) {
+                        ftpos[ig] = 0;
+                        st->tnpgen[ifa]--;
                         redo++;
                     }
                 }
 
-                if (!ego[imo].savegen[ig]) {
-                    if (ego[imo].tposgen[ig]) {
-                        ego[imo].tposgen[ig] = 0;
-                        ego[imo].tnpgen--;
+                if (!msave[ig]) {
+                    if (mtpos[ig]) {
+                        mtpos[ig] = 0;
+                        st->tnpgen[imo]--;
                         redo++;
                     }
                 }
 
                 for (j = 0; j < fam[i].nkid; j++) {
                     k = fam[i].kid1 + j;
-                    if (!ego[k].savegen[ig]) {
-                        if (ego[k].tposgen[ig]) {
-                            ego[k].tposgen[ig] = 0;
-                            ego[k].tnpgen--;
+                    if (!st->savegen[k*ngen + ig]) {
+                        if (st->tposgen[k*ngen + ig]) {
+                            st->tposgen[k*ngen + ig] = 0;
+                            st->tnpgen[k]--;
                             redo++;
                         }
                     }
@@ -606,41 +738,38 @@ int check_genotypes (void)
     } while (redo);
 
     for (i = 0; i < ntot; i++) {
-        if (!ego[i].tnpgen)
+        if (!st->tnpgen[i])
             return 0;
     }
 
-    for (i = 0; i < ntot; i++) {
-        ego[i].npgen = ego[i].tnpgen;
-        for (ig = 0; ig < ngen; ig++)
-            ego[i].posgen[ig] = ego[i].tposgen[ig];
-    }
+    memcpy(st->npgen, st->tnpgen, ntot * sizeof(int));
+    memcpy(st->posgen, st->tposgen, ntot*ngen);
 
     return 1;
 }
 
-int impute_genotype (int ndx, double *risk, double *cumrskl, double *cumrsku,
-                     int first_imp)
+int impute_genotype (struct _state *st, int ndx, int first_imp)
 {
     int i, j, k, imax, nmax;
     double zmxrisk, gprb, sumrisk;
-    FILE *fp;
+    double *risk = st->risk, *cumrskl = st->cumrskl, *cumrsku = st->cumrsku;
+    unsigned char *posgen = st->posgen + ndx*ngen;
+    unsigned char *tposgen = st->tposgen + ndx*ngen;
 
-    for (i = 0; i < ntot; i++) {
-        ego[i].tnpgen = ego[i].npgen;
-        for (j = 0; j < ngen; j++)
-            ego[i].tposgen[j] = ego[i].posgen[j];
-    }
+    memcpy(st->tnpgen, st->npgen, ntot * sizeof(int));
+    memcpy(st->tposgen, st->posgen, ntot*ngen);
 
     if (strcmp(ego[ndx].twin, "   ")) {
         for (i = 0; i < ndx; i++) {
             if (!strcmp(ego[ndx].twin, ego[i].twin)) {
                 for (j = 0; j < ngen; j++) {
-                    ego[ndx].tposgen[j] = ego[i].posgen[j];
-                    if (ego[i].posgen[j])
-                        strcpy(ego[ndx].igeno, genotyp[j]);
+                    tposgen[j] = st->posgen[i*ngen + j];
+                    if (tposgen[j]) {
+                        st->gene[0][ndx] = jall[j];
+                        st->gene[1][ndx] = iall[j];
+                    }
                 }
-                ego[ndx].tnpgen = ego[i].npgen;
+                st->tnpgen[ndx] = st->npgen[i];
                 return 1;
             }
         }
@@ -652,20 +781,20 @@ int impute_genotype (int ndx, double *risk, double *cumrskl, double *cumrsku,
         if (!gfreq[i])
             continue;
 
-        if (!ego[ndx].posgen[i])
+        if (!posgen[i])
             continue;
 
-        if (ego[ndx].npgen == 1) {
+        if (st->npgen[ndx] == 1) {
             risk[i] = 0;
             continue;
         }
 
-        if (ego[ndx].npgen == ngen) {
+        if (st->npgen[ndx] == ngen) {
             risk[i] = log(gfreq[i]);
             continue;
         }
 
-        risk[i] = calc_risk(ndx, i);
+        risk[i] = calc_risk(st, ndx, i);
     }
 
     sumrisk = -DBL_MAX;
@@ -697,14 +826,15 @@ int impute_genotype (int ndx, double *risk, double *cumrskl, double *cumrsku,
     nmax = 0;
     for (j = 0; j < ngen; j++) {
         if (risk[j] == zmxrisk) nmax++;
-        ego[ndx].tposgen[j] = 0;
+        tposgen[j] = 0;
     }
 
-    gprb = drand48();
+    gprb = erand48(st->xsubi);
     if ((maxrisk && first_imp) || zmxrisk >= 1) {
         if (nmax == 1) {
-            strcpy(ego[ndx].igeno, genotyp[imax]);
-            ego[ndx].tposgen[imax] = 1;
+            st->gene[0][ndx] = jall[imax];
+            st->gene[1][ndx] = iall[imax];
+            tposgen[imax] = 1;
         }
         else {
             gprb *= nmax;
@@ -713,8 +843,9 @@ int impute_genotype (int ndx, double *risk, double *cumrskl, double *cumrsku,
                 if (risk[j] == zmxrisk) {
                     k++;
                     if (gprb >= k-1 && gprb < k) {
-                        strcpy(ego[ndx].igeno, genotyp[j]);
-                        ego[ndx].tposgen[j] = 1;
+                        st->gene[0][ndx] = jall[j];
+                        st->gene[1][ndx] = iall[j];
+                        tposgen[j] = 1;
                     }
                 }
             }
@@ -723,29 +854,34 @@ int impute_genotype (int ndx, double *risk, double *cumrskl, double *cumrsku,
     else {
         for (j = 0; j < ngen; j++) {
             if (gprb >= cumrskl[j] && gprb < cumrsku[j]) {
-                strcpy(ego[ndx].igeno, genotyp[j]);
-                ego[ndx].tposgen[j] = 1;
+                st->gene[0][ndx] = jall[j];
+                st->gene[1][ndx] = iall[j];
+                tposgen[j] = 1;
             }
         }
     }
 
-    ego[ndx].tnpgen = 1;
+    st->tnpgen[ndx] = 1;
 
     return 1;
 }
 
-double calc_risk (int ndx, int gt)
+double calc_risk (struct _state *st, int ndx, int gt)
 {
-    int i, j;
+    int i, j, stack;
     int i0, j0;
     double lnlik, tlnlik;
     int ia, ja, iaf, jaf, iam, jam;
     double trnprb;
+    int *npgen = st->npgen, *lgen = st->lgen, *infam = st->infam;
+    int *istack = st->istack, *jstack = st->jstack;
+    double *lstack = st->lstack;
+    unsigned char *posgen;
 
     int ftyped = 0, mtyped = 0;
-    if (ego[ndx].fa && ego[locid[ego[ndx].fa]].npgen == 1)
+    if (ego[ndx].fa && npgen[locid[ego[ndx].fa]] == 1)
         ftyped = 1;
-    if (ego[ndx].mo && ego[locid[ego[ndx].mo]].npgen == 1)
+    if (ego[ndx].mo && npgen[locid[ego[ndx].mo]] == 1)
         mtyped = 1;
 
     for (i = 0; i < ntot; i++)
@@ -763,32 +899,32 @@ double calc_risk (int ndx, int gt)
         }
         else if (ego[ndx].fa && (!ftyped || !mtyped) &&
                  ego[i].fa == ego[ndx].fa && ego[i].mo == ego[ndx].mo &&
-                 ego[i].npgen == 1)
+                 npgen[i] == 1)
         {
             infam[i] = 1;
         }
         else if (ego[ndx].fa && ego[i].fa == ego[ndx].fa && !ftyped &&
-                 ego[i].mo != ego[ndx].mo && ego[i].npgen == 1 &&
-                 ego[locid[ego[i].mo]].npgen == 1)
+                 ego[i].mo != ego[ndx].mo && npgen[i] == 1 &&
+                 npgen[locid[ego[i].mo]] == 1)
         {
             infam[i] = 1;
             infam[locid[ego[i].mo]] = 1;
         }
         else if (ego[ndx].fa && ego[i].mo == ego[ndx].mo && !mtyped &&
-                 ego[i].fa != ego[ndx].fa && ego[i].npgen == 1 &&
-                 ego[locid[ego[i].fa]].npgen == 1)
+                 ego[i].fa != ego[ndx].fa && npgen[i] == 1 &&
+                 npgen[locid[ego[i].fa]] == 1)
         {
             infam[i] = 1;
             infam[locid[ego[i].fa]] = 1;
         }
-        else if (ego[i].fa == ego[ndx].id && ego[i].npgen < ngen &&
-                 ego[locid[ego[i].mo]].npgen == 1)
+        else if (ego[i].fa == ego[ndx].id && npgen[i] < ngen &&
+                 npgen[locid[ego[i].mo]] == 1)
         {
             infam[i] = 1;
             infam[locid[ego[i].mo]] = 1;
         }
-        else if (ego[i].mo == ego[ndx].id && ego[i].npgen < ngen &&
-                 ego[locid[ego[i].fa]].npgen == 1)
+        else if (ego[i].mo == ego[ndx].id && npgen[i] < ngen &&
+                 npgen[locid[ego[i].fa]] == 1)
         {
             infam[i] = 1;
             infam[locid[ego[i].fa]] = 1;
@@ -811,9 +947,10 @@ double calc_risk (int ndx, int gt)
         for (i = i0; i < ntot; i++) {
             if (!infam[i]) continue;
             if (i != ndx) {
+                posgen = st->posgen + i*ngen;
                 for (j = j0; j < ngen; j++) {
-                    if (ego[i].posgen[j]) {
-                        if (ego[i].npgen > 1) {
+                    if (posgen[j]) {
+                        if (npgen[i] > 1) {
                             istack[stack] = i;
                             jstack[stack] = j + 1;
                             lstack[stack] = lnlik;
@@ -834,20 +971,20 @@ double calc_risk (int ndx, int gt)
             else
                 j = gt;
 
-            ego[i].lgen = j;
+            lgen[i] = j;
 
             if (!ego[i].fa ||
                 !infam[locid[ego[i].fa]] || !infam[locid[ego[i].mo]])
             {
-                lnlik += log(gfreq[ego[i].lgen]);
+                lnlik += log(gfreq[lgen[i]]);
             }
             else {
-                ia = iall[ego[i].lgen];
-                ja = jall[ego[i].lgen];
-                iaf = iall[ego[locid[ego[i].fa]].lgen];
-                jaf = jall[ego[locid[ego[i].fa]].lgen];
-                iam = iall[ego[locid[ego[i].mo]].lgen];
-                jam = jall[ego[locid[ego[i].mo]].lgen];
+                ia = iall[lgen[i]];
+                ja = jall[lgen[i]];
+                iaf = iall[lgen[locid[ego[i].fa]]];
+                jaf = jall[lgen[locid[ego[i].fa]]];
+                iam = iall[lgen[locid[ego[i].mo]]];
+                jam = jall[lgen[locid[ego[i].mo]]];
                 trnprb = 0;
                 if (ia == iaf && ja == iam || ia == iam && ja == iaf)
                     trnprb += .25;
@@ -875,11 +1012,12 @@ double calc_risk (int ndx, int gt)
     return tlnlik;
 }
 
-int make_ibds (double *alpha, double *cumibd, double *ibd)
+int make_ibds (struct _state *st)
 {
     int i, j, k, ii, jj;
+    double *ibd = st->ibd, *cumibd = st->cumibd;
 
-    getibd(ibd, alpha);
+    getibd(st);
 
     for (i = 0; i < ntot; i++) {
 
@@ -932,39 +1070,19 @@ double sumlog (double x, double y)
         return x;
 }
 
-void getibd (double *ibd, double *alpha)
+void getibd (struct _state *st)
 {
-    short i, j, ia, ja;
-    short *gene[2], *fa, *mo;
-
-    gene[0] = (short *) allocMem(ntot * sizeof(short));
-    gene[1] = (short *) allocMem(ntot * sizeof(short));
-    fa = (short *) allocMem(ntot * sizeof(short));
-    mo = (short *) allocMem(ntot * sizeof(short));
-
-    for (i = 0; i < ntot; i++) {
-        sscanf(ego[i].igeno, "%3hd%3hd", &gene[0][i], &gene[1][i]);
-        fa[i] = -1;
-        mo[i] = -1;
-
-        for (j = 0; j < ntot; j++) {
-            alpha(0,i,0,j) = -1;
-            alpha(0,i,1,j) = -1;
-            alpha(1,i,0,j) = -1;
-            alpha(1,i,1,j) = -1;
-        }
-    }
+    int i, j, ia, ja;
+    double *alpha = st->alpha, *ibd = st->ibd;
 
-    for (i = nfound; i < ntot; i++) {
-        fa[i] = locid[ego[i].fa];
-        mo[i] = locid[ego[i].mo];
-    }
+    for (i = 0; i < 4*ntot*ntot; i++)
+        alpha[i] = -1;
 
     for (i = ntot - 1; i >= 0; i--) {
         for (j = i; j >= 0; j--) {
             for (ia = 0; ia < 2; ia++) {
                 for (ja = 0; ja < 2; ja++) {
-                    getalpha(alpha,gene,fa,mo,j,ja,i,ia);
+                    getalpha(alpha,st->gene,pfa,pmo,j,ja,i,ia);
                 }
             }
         }
@@ -976,15 +1094,10 @@ void getibd (double *ibd, double *alpha)
                         alpha(0,i,1,j) + alpha(1,i,1,j)) / 2;
         }
     }
-
-    free(mo);
-    free(fa);
-    free(gene[1]);
-    free(gene[0]);
 }
 
-void getalpha (double *alpha, short *gene[2], short *fa, short *mo, short i,
-               short ia, short j, short ja)
+void getalpha (double *alpha, int *gene[2], int *fa, int *mo, int i, int ia,
+               int j, int ja)
 {
     double w[4];
 
@@ -1059,8 +1172,7 @@ void getalpha (double *alpha, short *gene[2], short *fa, short *mo, short i,
     alpha(ia,i,ja,j) = alpha(ja,j,ia,i);
 }
 
-void wgt (double *w, short c1, short c2, short f1, short f2, short m1,
-          short m2)
+void wgt (double *w, int c1, int c2, int f1, int f2, int m1, int m2)
 {
     int i;
     double sumw;
@@ -1091,8 +1203,7 @@ void wgt (double *w, short c1, short c2, short f1, short f2, short m1,
         w[i] = w[i] / sumw;
 }
 
-void wgt2 (double *w, short c1, short c2, short f1, short f2, short m1,
-           short m2)
+void wgt2 (double *w, int c1, int c2, int f1, int f2, int m1, int m2)
 {
     int i;
     double sumw;
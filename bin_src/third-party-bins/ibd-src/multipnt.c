@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <math.h>
 #ifdef __sun
@@ -8,7 +10,12 @@
 #include <sunmath.h>
 #endif
 #endif
-#include "pipeback.h"
+#ifdef _OPENMP
+#include <omp.h>
+#define thread_num()    omp_get_thread_num()
+#else
+#define thread_num()    0
+#endif
 
 /* make sure that Int4 is a 4-byte integer! */
 typedef int Int4;
@@ -16,6 +23,8 @@ typedef int Int4;
 #define NCOEFF 14
 #define MCLASS 1000
 #define MLOCI  5000
+#define MOPEN  64       /* locations written per pass over the merged IBDs */
+#define NBATCH 256      /* pairs read into memory at a time */
 
 struct _class {
     int ikin;
@@ -26,46 +35,91 @@ struct _class {
     double c[NCOEFF];
 } *classes[MCLASS];
 
+/* a QTL location, with the betas saved for pairs typed at every marker */
+struct _locn {
+    char *label;
+    double qtloc;
+    int *inwindow;
+    int done[MCLASS];
+    double *s_beta[MCLASS];
+    FILE *mibdfp;
+};
+
+/* scratch space for one thread */
+struct _work {
+    double *beta;
+    double *cov;
+    double *ri;
+    double *work;
+    int *mrk;
+    Int4 *ipvt;
+};
+
+/* a batch of pairs from the merged IBD file */
+struct _batch {
+    int npair;
+    int id1[NBATCH];
+    int id2[NBATCH];
+    int class[NBATCH];
+    double phi2[NBATCH];
+    double *ibd;
+};
+
+static Int4 nloci;
+static double mrklocn[MLOCI];
+static char map_func = 'k';
+static double *mu[MCLASS], *sd[MCLASS];
+static double *difmat;
+
 void *allocMem (size_t);
+double corr (int, double);
+int interpolate (struct _locn*, struct _work*, int, double, double*, double*);
+int readBatch (struct _batch*, FILE*, FILE*, FILE*, int*);
 
 #define ri(a,b)       (ri[(a)*nloci + (b)])
 #define difmat(a,b)   (difmat[(a)*nloci + (b)])
 
+/*
+ * With -locations, IBDs are interpolated at each of the listed locations
+ * and written to <outprefix>.<cqtloc>.gz, each through its own gzip.  The
+ * merged IBD file is uncompressed and parsed only once: when there are more
+ * than MOPEN locations, the pairs are saved in binary form to
+ * <outprefix>.mrg.bin for the later passes.  Locations are computed in
+ * parallel, one thread per location at a time.
+ */
 main (int argc, char **argv)
 {
-    int i, j, line, id1, id2, class;
-    Int4 nloci;
-    double qtloc, mrklocn[MLOCI];
+    int i, j, k, line, class, nlocn, first, last, nthreads, failed;
+    Int4 info;
     double window;
-    int inwindow[MLOCI];
-    char map_func = 'k';
-    double phi2, *ibd, *tmu, *tsd;
-    double *mu[MCLASS], *sd[MCLASS];
-    double theta, *beta, *cov, dis, *difmat;
-    double betasum, ibdadj, corr();
-    int *mrk;
-    int done[MCLASS];
-    double *s_beta[MCLASS];
-    Int4 nloc, info, one = 1;
-    Int4 *ipvt;
-    double *ri, *work, det[2];
-    char rec[100000];
-    FILE *locfp, *ibdfp, *meanfp, *ttyfp, *mibdfp;
-    const char *pbarg[4];
-
-    if (argc != 8) {
+    double *tmu, *tsd;
+    char rec[100000], cmd[10000];
+    char *ibdname, *outprefix, *binname, *showstat;
+    struct _locn *locn;
+    struct _work *wk;
+    struct _batch *batch;
+    FILE *locfp, *ibdfp, *meanfp, *ttyfp, *binfp, *savefp;
+    int multi = argc > 1 && !strcmp(argv[1], "-locations");
+
+    if (multi ? argc < 10 : argc != 8) {
         printf(
-"usage: multipnt locus_file ibd_file mean_file qtloc cqtloc window showstat\n");
+"usage: multipnt locus_file ibd_file mean_file qtloc cqtloc window showstat\n\
+       multipnt -locations locus_file ibd_file mean_file window showstat\n\
+                nthreads outprefix cqtloc [cqtloc ...]\n");
         exit(1);
     }
 
+    if (multi)
+        argv++;
+
     locfp = fopen(argv[1], "r");
     if (!locfp) {
         printf("Locus file not found.\n");
         exit(1);
     }
 
-    ibdfp = fopen(argv[2], "r");
+    ibdname = argv[2];
+    ibdfp = fopen(ibdname, "r");
     if (!ibdfp) {
         printf(
 "Merged IBD file not found. Use the command \"mibd merge\" to create it.\n");
@@ -73,17 +127,6 @@ main (int argc, char **argv)
     }
     fclose(ibdfp);
 
-    pbarg[0] = "gunzip";
-    pbarg[1] = "-c";
-    pbarg[2] = argv[2];
-    pbarg[3] = 0;
-
-    ibdfp = pipeback_shell_open("gunzip", pbarg);
-    if (!ibdfp) {
-        printf("Cannot uncompress merged IBD file.\n");
-        exit(1);
-    }
-
     meanfp = fopen(argv[3], "r");
     if (!meanfp) {
         printf(
@@ -91,63 +134,97 @@ main (int argc, char **argv)
         exit(1);
     }
 
-    mibdfp = fopen("mibd.out", "w");
-    if (!mibdfp) {
-        printf("Cannot open mibd.out.\n");
-        exit(1);
-    }
-
-    if (sscanf(argv[4], "%lf", &qtloc) != 1) {
-        printf("Invalid QTL location [%s]\n", argv[4]);
-        exit(1);
-    }
+    if (multi) {
+        if (sscanf(argv[4], "%lf", &window) != 1) {
+            printf("Invalid window size [%s]\n", argv[4]);
+            exit(1);
+        }
+        showstat = argv[5];
+        if (sscanf(argv[6], "%d", &nthreads) != 1 || nthreads < 1) {
+            printf("Invalid number of threads [%s]\n", argv[6]);
+            exit(1);
+        }
+        outprefix = argv[7];
+        nlocn = argc - 9;
+        locn = (struct _locn *) allocMem(nlocn*sizeof(struct _locn));
+        for (k = 0; k < nlocn; k++) {
+            locn[k].label = argv[8 + k];
+            if (sscanf(locn[k].label, "%lf", &locn[k].qtloc) != 1) {
+                printf("Invalid QTL location [%s]\n", locn[k].label);
+                exit(1);
+            }
+        }
 
-    if (sscanf(argv[6], "%lf", &window) != 1) {
-        printf("Invalid window size [%s]\n", argv[6]);
-        exit(1);
+        /* a failed gzip is reported when its pipe is closed */
+        signal(SIGPIPE, SIG_IGN);
     }
-
-    if (argv[7][0] == 'y') {
-        ttyfp = fopen("/dev/tty", "w");
-        if (!ttyfp) {
-            printf("Cannot open /dev/tty\n");
+    else {
+        if (sscanf(argv[6], "%lf", &window) != 1) {
+            printf("Invalid window size [%s]\n", argv[6]);
+            exit(1);
+        }
+        showstat = argv[7];
+        nthreads = 1;
+        outprefix = 0;
+        nlocn = 1;
+        locn = (struct _locn *) allocMem(sizeof(struct _locn));
+        locn[0].label = argv[5];
+        if (sscanf(argv[4], "%lf", &locn[0].qtloc) != 1) {
+            printf("Invalid QTL location [%s]\n", argv[4]);
             exit(1);
         }
-        fprintf(ttyfp, "location %s ", argv[5]);
-        fclose(ttyfp);
     }
 
     if (!(nloci = getLocInfo(locfp, mrklocn, &map_func))) {
         exit(1);
     }
 
-    for (i = 0; i < nloci; i++) {
-        inwindow[i] = 0;
-        if (fabs(mrklocn[i] - qtloc) <= .5*window)
-            inwindow[i] = 1;
+    for (k = 0; k < nlocn; k++) {
+        locn[k].inwindow = (int *) allocMem(nloci*sizeof(int));
+        for (i = 0; i < nloci; i++) {
+            locn[k].inwindow[i] = 0;
+            if (fabs(mrklocn[i] - locn[k].qtloc) <= .5*window)
+                locn[k].inwindow[i] = 1;
+        }
+        for (i = 0; i < MCLASS; i++) {
+            locn[k].done[i] = 0;
+            locn[k].s_beta[i] = 0;
+        }
+    }
+
+#ifdef _OPENMP
+    if (nthreads > MOPEN)
+        nthreads = MOPEN;
+    if (nthreads > nlocn)
+        nthreads = nlocn;
+#else
+    nthreads = 1;
+#endif
+
+    wk = (struct _work *) allocMem(nthreads*sizeof(struct _work));
+    for (i = 0; i < nthreads; i++) {
+        wk[i].beta = (double *) allocMem(nloci*sizeof(double));
+        wk[i].cov = (double *) allocMem(nloci*sizeof(double));
+        wk[i].mrk = (int *) allocMem(nloci*sizeof(int));
+        wk[i].ipvt = (Int4 *) allocMem(nloci*sizeof(Int4));
+        wk[i].work = (double *) allocMem(nloci*sizeof(double));
+        wk[i].ri = (double *) allocMem(nloci*nloci*sizeof(double));
     }
 
-    ibd = (double *) allocMem(nloci*sizeof(double));
+    batch = (struct _batch *) allocMem(sizeof(struct _batch));
+    batch->ibd = (double *) allocMem(NBATCH*nloci*sizeof(double));
+
     tmu = (double *) allocMem(nloci*sizeof(double));
     tsd = (double *) allocMem(nloci*sizeof(double));
-    beta = (double *) allocMem(nloci*sizeof(double));
-    cov = (double *) allocMem(nloci*sizeof(double));
-    mrk = (int *) allocMem(nloci*sizeof(int));
-    ipvt = (Int4 *) allocMem(nloci*sizeof(Int4));
-    work = (double *) allocMem(nloci*sizeof(double));
-
     difmat = (double *) allocMem(nloci*nloci*sizeof(double));
-    ri = (double *) allocMem(nloci*nloci*sizeof(double));
 
     if (!getClasses()) {
         exit(1);
     }
 
     for (i = 0; i < MCLASS; i++) {
-        done[i] = 0;
         mu[i] = (double *) allocMem(nloci*sizeof(double));
         sd[i] = (double *) allocMem(nloci*sizeof(double));
-        s_beta[i] = (double *) allocMem(nloci*sizeof(double));
         for (j = 0; j < nloci; j++) {
             mu[i][j] = 0;
             sd[i][j] = 0;
@@ -173,128 +250,323 @@ main (int argc, char **argv)
         }
     }
 
-    line = 0;
-    while (fgets(rec, sizeof(rec), ibdfp)) {
-        line++;
-        if (!readIbdRec(rec, line, nloci, &id1, &id2, &class, &phi2, ibd))
-            exit(1);
-
-        nloc = 0;
-        j = 0;
-        for (i = 0; i < nloci; i++) {
-            if (inwindow[i]) {
-                if (ibd[i] != -1) {
-                    mrk[j] = i;
-                    nloc++;
-                    j++;
-                }
-            }
-        }
+    binname = 0;
+    if (nlocn > MOPEN) {
+        binname = (char *) allocMem(strlen(outprefix) + 10);
+        sprintf(binname, "%s.mrg.bin", outprefix);
+    }
 
-        if (class <= 2 || class == 300) {
-            ibdadj = phi2;
-        }
+    failed = 0;
+    info = 0;
+    for (first = 0; first < nlocn; first += MOPEN) {
+        last = first + MOPEN < nlocn ? first + MOPEN : nlocn;
 
-        else if (nloc == 0) {
-            ibdadj = phi2;
+        for (k = first; k < last; k++) {
+            if (multi) {
+                sprintf(cmd, "gzip -c > '%s.%s.gz'", outprefix, locn[k].label);
+                locn[k].mibdfp = popen(cmd, "w");
+            }
+            else
+                locn[k].mibdfp = fopen("mibd.out", "w");
+            if (!locn[k].mibdfp) {
+                if (multi)
+                    printf("Cannot open %s.%s.gz.\n", outprefix,
+                           locn[k].label);
+                else
+                    printf("Cannot open mibd.out.\n");
+                exit(1);
+            }
         }
 
-        else if (nloci == 1) {
-            dis = fabs(qtloc - mrklocn[0]) / 100.;
-            if (map_func == 'h')
-                theta = .5 * (1 - exp(-2*dis));
+        if (showstat[0] == 'y') {
+            ttyfp = fopen("/dev/tty", "w");
+            if (!ttyfp) {
+                printf("Cannot open /dev/tty\n");
+                exit(1);
+            }
+            if (multi)
+                fprintf(ttyfp, "locations %s to %s ", locn[first].label,
+                        locn[last-1].label);
             else
-                theta = .5 * (exp(4*dis) - 1) / (exp(4*dis) + 1);
-            ibdadj = phi2 + (ibd[0] - phi2)*corr(class, theta);
+                fprintf(ttyfp, "location %s ", locn[first].label);
+            fclose(ttyfp);
         }
 
-        else if (nloc == nloci && done[class]) {
-            for (i = 0; i < nloc; i++)
-                beta[i] = s_beta[class][i];
-
-            betasum = 0;
-            ibdadj = 0;
-            for (i = 0; i < nloc; i++) {
-                betasum += beta[i] * mu[class][mrk[i]];
-                ibdadj += beta[i] * ibd[mrk[i]];
+        /* the first pass reads the merged file, saving it for later passes */
+        ibdfp = binfp = savefp = 0;
+        if (!first) {
+            sprintf(cmd, "gunzip -c '%s'", ibdname);
+            ibdfp = popen(cmd, "r");
+            if (!ibdfp) {
+                printf("Cannot uncompress merged IBD file.\n");
+                exit(1);
             }
-
-            ibdadj += phi2 - betasum;
-            if (ibdadj < 0) ibdadj = 0;
-            if (ibdadj > 1) ibdadj = 1;
-            if (classes[class]->cnstr && ibdadj > .5) ibdadj = .5;
+            if (binname && !(savefp = fopen(binname, "wb"))) {
+                printf("Cannot open %s.\n", binname);
+                exit(1);
+            }
+        }
+        else if (!(binfp = fopen(binname, "rb"))) {
+            printf("Cannot open %s.\n", binname);
+            exit(1);
         }
 
-        else {
-            for (i = 0; i < nloc; i++) {
-                for (j = i; j < nloc; j++) {
-                    dis = difmat(mrk[i],mrk[j]);
-                    if (dis == 0) dis = 0.0001;
-                    if (map_func == 'h')
-                        theta = .5 * (1 - exp(-2*dis));
-                    else
-                        theta = .5 * (exp(4*dis) - 1) / (exp(4*dis) + 1);
-                    if (i == j)
-                        ri(i,j) = sd[class][mrk[i]] * sd[class][mrk[i]];
+        line = 0;
+        while (readBatch(batch, ibdfp, binfp, savefp, &line) > 0) {
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+            for (k = first; k < last; k++)
+            {
+                struct _work *wp = &wk[thread_num()];
+                double ibdadj;
+                int p, stop;
+#pragma omp atomic read
+                stop = failed;
+                if (stop)
+                    continue;
+
+                for (p = 0; p < batch->npair; p++) {
+                    if (!(stop = interpolate(&locn[k], wp, batch->class[p],
+                                             batch->phi2[p],
+                                             &batch->ibd[p*nloci], &ibdadj)))
+                    {
+                        fprintf(locn[k].mibdfp, "%5d %5d %10.7f %10.7f\n",
+                                batch->id1[p], batch->id2[p], ibdadj,
+                                batch->phi2[p]);
+                    }
                     else {
-                        ri(i,j) = (1 / classes[class]->evar)
-                                   * sd[class][mrk[i]] * sd[class][mrk[i]]
-                                   * sd[class][mrk[j]] * sd[class][mrk[j]]
-                                   * corr(class, theta);
-                        ri(j,i) = ri(i,j);
+#pragma omp critical
+                        {
+                            failed = 1;
+                            info = stop;
+                        }
+                        break;
                     }
                 }
             }
 
-            dgefa_(ri, &nloci, &nloc, ipvt, &info);
-            if (info) {
+            if (failed) {
                 printf("Matrix inversion failed, info = %d\n", info);
                 exit(1);
             }
-            dgedi_(ri, &nloci, &nloc, ipvt, det, work, &one);
+        }
+
+        if (ibdfp && pclose(ibdfp)) {
+            printf("Cannot uncompress merged IBD file.\n");
+            exit(1);
+        }
+        if (binfp)
+            fclose(binfp);
+        if (savefp && fclose(savefp)) {
+            printf("Error writing %s.\n", binname);
+            exit(1);
+        }
+
+        for (k = first; k < last; k++) {
+            if (multi ? pclose(locn[k].mibdfp) : fclose(locn[k].mibdfp)) {
+                if (multi)
+                    printf("Error writing %s.%s.gz.\n", outprefix,
+                           locn[k].label);
+                else
+                    printf("Error writing mibd.out.\n");
+                exit(1);
+            }
+        }
+
+        if (multi && showstat[0] == 'y' && (ttyfp = fopen("/dev/tty", "w")))
+        {
+            j = 15 + strlen(locn[first].label) + strlen(locn[last-1].label);
+            for (i = 0; i < j; i++)
+                fputc('\b', ttyfp);
+            for (i = 0; i < j; i++)
+                fputc(' ', ttyfp);
+            for (i = 0; i < j; i++)
+                fputc('\b', ttyfp);
+            fclose(ttyfp);
+        }
+    }
+
+    if (binname)
+        unlink(binname);
+
+    exit(0);
+}
+
+/*
+ * Compute the multipoint IBD of one pair at a QTL location.  Returns 0, or
+ * the dgefa info code if the marker covariance matrix cannot be inverted.
+ */
+int interpolate (struct _locn *lp, struct _work *wp, int class, double phi2,
+                 double *ibd, double *ibdadj)
+{
+    int i, j;
+    Int4 nloc, info, one = 1;
+    double theta, dis, betasum, det[2];
+    double *beta = wp->beta, *cov = wp->cov, *ri = wp->ri;
+    int *mrk = wp->mrk;
+
+    nloc = 0;
+    j = 0;
+    for (i = 0; i < nloci; i++) {
+        if (lp->inwindow[i]) {
+            if (ibd[i] != -1) {
+                mrk[j] = i;
+                nloc++;
+                j++;
+            }
+        }
+    }
+
+    if (class <= 2 || class == 300) {
+        *ibdadj = phi2;
+    }
+
+    else if (nloc == 0) {
+        *ibdadj = phi2;
+    }
+
+    else if (nloci == 1) {
+        dis = fabs(lp->qtloc - mrklocn[0]) / 100.;
+        if (map_func == 'h')
+            theta = .5 * (1 - exp(-2*dis));
+        else
+            theta = .5 * (exp(4*dis) - 1) / (exp(4*dis) + 1);
+        *ibdadj = phi2 + (ibd[0] - phi2)*corr(class, theta);
+    }
+
+    else if (nloc == nloci && lp->done[class]) {
+        for (i = 0; i < nloc; i++)
+            beta[i] = lp->s_beta[class][i];
 
-            for (i = 0; i < nloc; i++) {
-                dis = fabs(qtloc - mrklocn[mrk[i]]) / 100.;
+        betasum = 0;
+        *ibdadj = 0;
+        for (i = 0; i < nloc; i++) {
+            betasum += beta[i] * mu[class][mrk[i]];
+            *ibdadj += beta[i] * ibd[mrk[i]];
+        }
+
+        *ibdadj += phi2 - betasum;
+        if (*ibdadj < 0) *ibdadj = 0;
+        if (*ibdadj > 1) *ibdadj = 1;
+        if (classes[class]->cnstr && *ibdadj > .5) *ibdadj = .5;
+    }
+
+    else {
+        for (i = 0; i < nloc; i++) {
+            for (j = i; j < nloc; j++) {
+                dis = difmat(mrk[i],mrk[j]);
+                if (dis == 0) dis = 0.0001;
                 if (map_func == 'h')
                     theta = .5 * (1 - exp(-2*dis));
                 else
                     theta = .5 * (exp(4*dis) - 1) / (exp(4*dis) + 1);
-                cov[i] = sd[class][mrk[i]] * sd[class][mrk[i]]
-                         * corr(class, theta);
+                if (i == j)
+                    ri(i,j) = sd[class][mrk[i]] * sd[class][mrk[i]];
+                else {
+                    ri(i,j) = (1 / classes[class]->evar)
+                               * sd[class][mrk[i]] * sd[class][mrk[i]]
+                               * sd[class][mrk[j]] * sd[class][mrk[j]]
+                               * corr(class, theta);
+                    ri(j,i) = ri(i,j);
+                }
             }
+        }
 
-            for (i = 0; i < nloc; i++) {
-                beta[i] = 0;
-                for (j = 0; j < nloc; j++)
-                    beta[i] += ri(i,j) * cov[j];
-            }
+        dgefa_(ri, &nloci, &nloc, wp->ipvt, &info);
+        if (info) {
+            return info;
+        }
+        dgedi_(ri, &nloci, &nloc, wp->ipvt, det, wp->work, &one);
 
-            if (nloc == nloci) {
-                done[class] = 1;
-                for (i = 0; i < nloc; i++)
-                    s_beta[class][i] = beta[i];
-            }
+        for (i = 0; i < nloc; i++) {
+            dis = fabs(lp->qtloc - mrklocn[mrk[i]]) / 100.;
+            if (map_func == 'h')
+                theta = .5 * (1 - exp(-2*dis));
+            else
+                theta = .5 * (exp(4*dis) - 1) / (exp(4*dis) + 1);
+            cov[i] = sd[class][mrk[i]] * sd[class][mrk[i]]
+                     * corr(class, theta);
+        }
 
-            betasum = 0;
-            ibdadj = 0;
-            for (i = 0; i < nloc; i++) {
-                betasum += beta[i] * mu[class][mrk[i]];
-                ibdadj += beta[i] * ibd[mrk[i]];
-            }
+        for (i = 0; i < nloc; i++) {
+            beta[i] = 0;
+            for (j = 0; j < nloc; j++)
+                beta[i] += ri(i,j) * cov[j];
+        }
 
-            ibdadj += phi2 - betasum;
-            if (ibdadj < 0) ibdadj = 0;
-            if (ibdadj > 1) ibdadj = 1;
-            if (classes[class]->cnstr && ibdadj > .5) ibdadj = .5;
+        if (nloc == nloci) {
+            if (!lp->s_beta[class])
+                lp->s_beta[class] = (double *) allocMem(nloci*sizeof(double));
+            lp->done[class] = 1;
+            for (i = 0; i < nloc; i++)
+                lp->s_beta[class][i] = beta[i];
         }
 
-        fprintf(mibdfp, "%5d %5d %10.7f %10.7f\n", id1, id2, ibdadj, phi2);
+        betasum = 0;
+        *ibdadj = 0;
+        for (i = 0; i < nloc; i++) {
+            betasum += beta[i] * mu[class][mrk[i]];
+            *ibdadj += beta[i] * ibd[mrk[i]];
+        }
+
+        *ibdadj += phi2 - betasum;
+        if (*ibdadj < 0) *ibdadj = 0;
+        if (*ibdadj > 1) *ibdadj = 1;
+        if (classes[class]->cnstr && *ibdadj > .5) *ibdadj = .5;
     }
 
-    pipeback_shell_close(ibdfp);
-    fclose(mibdfp);
+    return 0;
+}
 
-    exit(0);
+/*
+ * Read the next batch of pairs, either from the merged IBD file (saving
+ * them in binary form if savefp is open) or from a saved binary file.
+ * Returns the number of pairs read, which is 0 at the end of the file.
+ */
+int readBatch (struct _batch *batch, FILE *ibdfp, FILE *binfp, FILE *savefp,
+               int *line)
+{
+    int ids[3];
+    double *ibd;
+    char rec[100000];
+
+    batch->npair = 0;
+    while (batch->npair < NBATCH) {
+        ibd = &batch->ibd[batch->npair*nloci];
+        if (binfp) {
+            if (fread(ids, sizeof(int), 3, binfp) != 3)
+                break;
+            if (fread(&batch->phi2[batch->npair], sizeof(double), 1, binfp)
+                    != 1 || fread(ibd, sizeof(double), nloci, binfp) != nloci)
+            {
+                printf("Read error on saved merged IBDs.\n");
+                exit(1);
+            }
+        }
+        else {
+            if (!fgets(rec, sizeof(rec), ibdfp))
+                break;
+            (*line)++;
+            if (!readIbdRec(rec, *line, nloci, &ids[0], &ids[1], &ids[2],
+                            &batch->phi2[batch->npair], ibd))
+                exit(1);
+            if (savefp &&
+                (fwrite(ids, sizeof(int), 3, savefp) != 3 ||
+                 fwrite(&batch->phi2[batch->npair], sizeof(double), 1, savefp)
+                    != 1 ||
+                 fwrite(ibd, sizeof(double), nloci, savefp) != nloci))
+            {
+                printf("Error writing saved merged IBDs.\n");
+                exit(1);
+            }
+        }
+        batch->id1[batch->npair] = ids[0];
+        batch->id2[batch->npair] = ids[1];
+        batch->class[batch->npair] = ids[2];
+        batch->npair++;
+    }
+
+    return batch->npair;
 }
 
 int getLocInfo (FILE *locfp, double *mrklocn, char *map_func)
@@ -420,6 +420,30 @@ fi
 cp -R $SCRIPT_PATH/lib/* $SOLAR_RELEASE_PATH/lib
 cp $SCRIPT_PATH/bin/* $SOLAR_RELEASE_PATH/bin
 
+# Split solar.tcl into per-procedure autoload files so that startup and the
+# first call of each command only compile the procedures actually used
+SPLIT_DIR=$(mktemp -d)
+cd $SPLIT_DIR
+SOLAR_LIB=$SOLAR_RELEASE_PATH/lib TCL_LIBRARY=$SOLAR_RELEASE_PATH/lib/tcl8.4 $SOLAR_RELEASE_PATH/bin/solarmain split_solar_tcl $SOLAR_RELEASE_PATH/lib
+SPLIT_STATUS=$?
+cd $SCRIPT_PATH
+rm -rf $SPLIT_DIR
+if [ $SPLIT_STATUS -ne 0 ]
+then
+	echo "Failed to split solar.tcl into autoload files"
+	exit 1
+fi
+
+# Every procedure in solar.tcl must now be indexed from its own file
+PROC_COUNT=$(grep -c "^proc " $SOLAR_RELEASE_PATH/lib/solar.tcl)
+INDEX_COUNT=$(grep -c "^set auto_index(.*solar\.d" $SOLAR_RELEASE_PATH/lib/tclIndex)
+UNIT_COUNT=$(ls $SOLAR_RELEASE_PATH/lib/solar.d | wc -l)
+if [ $PROC_COUNT -ne $INDEX_COUNT ] || [ $PROC_COUNT -ne $UNIT_COUNT ]
+then
+	echo "solar.tcl has $PROC_COUNT procedures but tclIndex has $INDEX_COUNT entries for $UNIT_COUNT files in solar.d"
+	exit 1
+fi
+
 mkdir -p $SOLAR_SCRIPT_PATH
 echo "#!/bin/sh" >$SOLAR_SCRIPT_PATH/$SOLAR_SCRIPT_NAME
 echo "" >>$SOLAR_SCRIPT_PATH/$SOLAR_SCRIPT_NAME
@@ -1221,7 +1221,7 @@ proc global_mibd_list {} {
 
 proc get_all_chromos {mdir} {
     set chromolist {}
-    set all_mibds [glob -nocomplain $mdir/mibd.*.*.gz]
+    set all_mibds [glob -nocomplain $mdir/mibd.*.*.gz $mdir/mibd.*.pack]
     set plength [string length "$mdir/mibd."]
     foreach mibd $all_mibds {
 	set tail [string range $mibd $plength end]
@@ -1250,6 +1250,19 @@ proc mibd_list {mibddir chromolist increment begin_range end_range} {
     foreach chromo $chromolist {
 	set wildcard [format "%s/mibd.%s.*.gz" $mdir $chromo]
 	set full_vector [glob -nocomplain $wildcard]
+
+# Locations in a packed mibd file are named as if they were separate files
+
+	set packed {}
+	if {[file exists $mdir/mibd.$chromo.pack]} {
+	    foreach loc [cmibdpack locations $mdir $chromo] {
+		set packname $mdir/mibd.$chromo.$loc.gz
+		lappend packed $packname
+		if {-1 == [lsearch -exact $full_vector $packname]} {
+		    lappend full_vector $packname
+		}
+	    }
+	}
 	
 	set flength [llength $full_vector]
 	if {0 == $flength} continue
@@ -1291,7 +1304,8 @@ proc mibd_list {mibddir chromolist increment begin_range end_range} {
 	for {set marker $begin_marker } $test {incr marker $increment} {
 	    set testname [format "%s/mibd.%s.%d.gz" $mdir $chromo \
 	                  $marker]
-	    if {[file exists $testname]} {
+	    if {[file exists $testname] || \
+		    -1 != [lsearch -exact $packed $testname]} {
 		lappend mlist $testname
 	    }
 	}
@@ -1574,7 +1588,7 @@ proc get_locus {mibdfilename} {
 # Usage:   multipoint [<LOD1> [<LOD2> [<LOD3> ...]]] [-overwrite] [-restart]
 #                     [-renew mod] [-nullbase] [-plot] [-score]
 #                     [-cparm <plist>] [-rhoq <fixed value>] [-saveall]
-#                     [-ctparm <plist>] [-se]
+#                     [-ctparm <plist>] [-se] [-noprefetch]
 #
 #          Zero or more criterion LOD scores may be specified.  If none are
 #          specified, multipoint will make one full scan and then stop.  If
@@ -1666,6 +1680,10 @@ proc get_locus {mibdfilename} {
 #                        The default is to start from the previous linkage
 #                        model if on the same chromosome.
 #
+#          -noprefetch   Don't decompress the next mibd file in the
+#                        background while the current locus is maximized
+#                        (see Note 6).
+#
 #          -epistasis N   Use current loaded model as the base for a one-pass
 #                         epistasis scan.  N is the index of the mibdN to
 #                         be included in epistatic interactions (e.g. 1 for
@@ -1765,6 +1783,14 @@ proc get_locus {mibdfilename} {
 #              which takes one argument, the pass number (which starts at 1
 #              for the first pass).  Within this routine, the user can change
 #              the selected chromosomes or interval.
+#
+#          6.  While each locus is maximized, the mibd file for the next
+#              locus is decompressed into memory on a background thread
+#              (see matrix prefetch), so the next matrix load does not wait
+#              on gunzip.  Each linkage model also starts from the previous
+#              linkage model on the same chromosome (unless -nullbase is
+#              used), with h2q starting near its previous value.  Neither
+#              affects the results written to multipoint.out.
 # -
 
 proc multipoint {args} {
@@ -1806,6 +1832,7 @@ proc multipoint {args} {
     set atemplate 0
     set searg ""
     set nullifneg 0
+    set prefetch 1
 
     set lod_criteria [read_arglist $args \
 	    -overwrite {set force_overwrite 1} -ov {set force_overwrite 1} \
@@ -1824,6 +1851,7 @@ proc multipoint {args} {
 	    -link linkproc \
 	    -se {set searg -se} \
 	    -nullifneg {set nullifneg 1} \
+	    -noprefetch {set prefetch 0} \
 	    -nullbase {set reuse_null 1}]
 
     ensure_integer $epistasis
@@ -2114,10 +2142,13 @@ proc scanpass {mibdlist} {
             upvar FLOAT_RHOQ FLOAT_RHOQ
             upvar linkproc linkproc
             upvar searg searg
+            upvar prefetch prefetch
 
             set h2q_index [expr $Solar_Fixed_Loci + 1]
             set minlike ""
+            set mibdpos 0
 	    foreach mibdfile $mibdlist {
+		incr mibdpos
 
 # Set new_chromosome and locus; loading null model if necessary
 
@@ -2202,6 +2233,11 @@ proc scanpass {mibdlist} {
 			option ScoreOnlyIndex $h2q_index
 			option MaxIter 1
 		    }
+# Decompress next mibd file while this locus is maximized
+		    set next_mibdfile [lindex $mibdlist $mibdpos]
+		    if {$prefetch && "" != $next_mibdfile} {
+			catch {matrix prefetch $next_mibdfile}
+		    }
 		    if {$con_rhoq != $FLOAT_RHOQ} {
 			parameter rhoq1 = $con_rhoq
 			constraint rhoq1 = $con_rhoq
@@ -13749,6 +13785,20 @@ proc tmaximize {args} {
 	set outfile [full_filename $outfile]
     }
 
+# Use the stored fit of an identical model if there is one (see fitcache)
+
+    set fitkey ""
+    set fitout $outfile
+    if {".out" != [string range $outfile end-3 end]} {
+	append fitout .out
+    }
+    if {[fitcache_usable $opts]} {
+	set fitkey [fitkey]
+	if {[fitcache_fetch $fitkey $fitout $quiet rets]} {
+	    return $rets
+	}
+    }
+
 # Check for multivariate
 
     set ts [trait]
@@ -14046,9 +14096,234 @@ proc tmaximize {args} {
 	    break
 	}
     }
+    if {!$code && "" != $fitkey} {
+	fitcache_store $fitkey $fitout $rets
+    }
     return -code $code $rets
 }
 
+
+# solar::fitcache --
+#
+# Purpose:  Report on or clear the maximize fit cache
+#
+# Usage:    fitcache stats     ; return cache hits, misses and stores in
+#                              ;   this session, and stored fits
+#           fitcache reset     ; zero the session counts
+#           fitcache clear     ; delete all stored fits in this directory
+#
+# Notes:    maximize stores each successful fit in subdirectory .fitcache
+#           of the working directory.  Each fit is keyed by a signature of
+#           the model:
+#
+#             trait, covariates, omega, mu, constraints and options
+#             parameter starting values and boundaries
+#             matrix files loaded, phenotype files and pedindex.out,
+#               by checksum
+#
+#           When a model with the same signature is maximized again, in
+#           this session or a later one, maximize does not run.  It
+#           restores the stored parameter estimates, standard errors,
+#           loglikelihood and quadratic, and copies the stored output file
+#           to the requested output file.  Commands such as polygenic,
+#           bayesavg, multipoint and boundary, which maximize identical
+#           models repeatedly, then skip those maximizations.
+#
+#           maximize -who, -runwho, -sampledata and -initpar always run.
+#           So do EVD2 models, and models with the zscore or pedlike
+#           options.  Failed maximizations are not stored.
+#
+#           "fitcache stats" returns a list of names and values which
+#           may be given to "array set".
+#
+#           To turn the cache off, give the command "option fitcache 0".
+#           FitCache is a session option and is not saved in model files.
+#           The signature of the current model is returned by the
+#           command "fitkey -signature", and its key by "fitkey".
+#-
+
+proc fitcache {args} {
+    global SOLAR_FitCache
+    fitcache_init
+    if {$args == "stats"} {
+	set stored [llength [glob -nocomplain [fitcache_dir]/*.ret]]
+	return [list hits $SOLAR_FitCache(hits) \
+		    misses $SOLAR_FitCache(misses) \
+		    stores $SOLAR_FitCache(stores) stored $stored]
+    } elseif {$args == "reset"} {
+	foreach name {hits misses stores} {
+	    set SOLAR_FitCache($name) 0
+	}
+	return ""
+    } elseif {$args == "clear"} {
+	file delete -force [fitcache_dir]
+	return ""
+    }
+    error "Usage: fitcache stats | reset | clear"
+}
+
+proc fitcache_dir {} {
+    return .fitcache
+}
+
+proc fitcache_init {} {
+    global SOLAR_FitCache
+    if {![info exists SOLAR_FitCache(hits)]} {
+	foreach name {hits misses stores} {
+	    set SOLAR_FitCache($name) 0
+	}
+    }
+}
+
+# Only ordinary maximizations are cached
+
+proc fitcache_usable {opts} {
+    if {{} != $opts || ![option fitcache]} {
+	return 0
+    }
+    if {"evd2" == [string tolower [option modeltype]] || \
+	    0 != [option evdphase] || 0 != [option evdmat]} {
+	return 0
+    }
+    if {0 != [option zscore] || 0 != [option pedlike]} {
+	return 0
+    }
+    return 1
+}
+
+# Restore the stored fit for key, if any, into the current model
+
+proc fitcache_fetch {key outfile quiet retsname} {
+    upvar $retsname rets
+    global SOLAR_FitCache
+    fitcache_init
+    set base [fitcache_dir]/$key
+    if {![file exists $base.ret] || ![file exists $base.mod] || \
+	    ![file exists $base.out]} {
+	incr SOLAR_FitCache(misses)
+	return 0
+    }
+    set rfile [open $base.ret]
+    set quad [gets $rfile]
+    set rets [read -nonewline $rfile]
+    close $rfile
+    set mfile [open $base.mod]
+    set lines [split [read -nonewline $mfile] \n]
+    close $mfile
+
+    if {[catch {fitkey -bind}]} {
+	incr SOLAR_FitCache(misses)
+	return 0
+    }
+    foreach name [parameter -names] {
+	parameter $name se 0 score 0
+    }
+    foreach line $lines {
+	if {[string match "parameter *" $line] || \
+		[string match "constraint *" $line] || \
+		[string match "loglike set *" $line]} {
+	    eval $line
+	}
+    }
+    quadratic set $quad
+    file copy -force $base.out $outfile
+    incr SOLAR_FitCache(hits)
+    if {!$quiet} {
+	puts "    *** Using stored fit of identical model ($key)"
+    }
+    return 1
+}
+
+# Store a successful fit.  Files are renamed into place so that another
+# process never sees a partial entry; failure to store is not an error.
+
+proc fitcache_store {key outfile rets} {
+    global SOLAR_FitCache
+    fitcache_init
+    set base [fitcache_dir]/$key
+    set tmp $base.[pid]
+    if {[catch {
+	file mkdir [fitcache_dir]
+	save model $tmp.mod
+	file copy -force $outfile $tmp.out
+	set rfile [open $tmp.ret w]
+	puts $rfile [quadratic]
+	puts -nonewline $rfile $rets
+	close $rfile
+	foreach ext {mod out ret} {
+	    file rename -force $tmp.$ext $base.$ext
+	}
+    }]} {
+	foreach ext {mod out ret} {
+	    catch {file delete $tmp.$ext}
+	}
+	return
+    }
+    incr SOLAR_FitCache(stores)
+}
+
+
+# solar::fitkey -- private
+#
+# Purpose:  Return the fit cache key or signature of the current model
+#
+# Usage:    fitkey [-signature]
+#           fitkey -bind    ; bind trait and phenotypes as maximize would
+#
+# Notes:    See fitcache.
+#-
+
+# solar::profile --
+#
+# Purpose:  Time the phases of maximization
+#
+# Usage:    profile on        ; zero the counts and start profiling
+#           profile off       ; stop profiling (counts are kept)
+#           profile reset     ; zero the counts
+#           profile report [-json] [-out <filename>]
+#                             ; report the counts (also "profile")
+#
+# Notes:    While profiling is on, each phase of maximization records the
+#           number of times it was entered, the wall time spent in it and,
+#           where it reads data, the number of bytes read:
+#
+#             maximize      whole maximizations (Loglike::maximize)
+#             build_index   indexing the phenotypes files; bytes are the
+#                             sizes of the files scanned
+#             preped        merging pedigree and phenotype data (PREPED
+#                             and PINPUT)
+#             optima        discrete trait maximization (OPTIMA)
+#             search        quantitative trait maximization (SEARCH)
+#             fun           likelihood evaluations (FUN)
+#             fun_deriv     likelihood and derivative evaluations (FUN)
+#             ddfun         likelihood evaluations for discrete traits and
+#                             EVD models (DDFUN)
+#             direct        per-pedigree likelihood and factorization
+#                             (DIRECT)
+#             omegac        evaluations of the omega expression
+#             scratch_read  reads of the pedigree scratch storage
+#             matrix_load   loading matrix files; bytes are the file sizes
+#             phen_seek     finding each individual's phenotype records
+#
+#           Phases nest (fun includes direct, which includes omegac), so
+#           the times do not add up to the total.  The percentages are of
+#           the wall time during which profiling was on.  Timing every
+#           omegac and scratch_read call adds some overhead to those
+#           phases; when profiling is off the cost is negligible.
+#
+#           -json returns the same counts as a JSON object with the
+#           fields enabled, wall_seconds and phases (each phase having
+#           name, calls, seconds and bytes).  -out writes the report to
+#           a file instead of returning it.
+#
+#           Example:
+#
+#             profile on
+#             polygenic
+#             profile off
+#             profile report -json -out profile.json
+#-
+
 # New in version 4.4.0, cmaximize is Tcl, ccmaximize is C++
 # cmaximize handles trap for zscore
 
@@ -16223,6 +16498,7 @@ proc zscore {args} {
 # Usage:   polygenic [-screen] [-all] [-p | -prob <p>] [-fix <covar>]
 #                    [-testcovar <covar>] [-testrhoe] [-testrhog] [-testrhoc]
 #                    [-sporadic] [-keephouse] [-testrhop] [-rhopse] [-fphi]
+#                    [-threads <n>]
 #
 #          (screencov is an alias for 'polygenic -screen')
 #          (sporadic is an alias for 'polygenic -sporadic')
@@ -16317,6 +16593,13 @@ proc zscore {args} {
 #            
 #           -fphi     Option to run polygenic using fphi function.
 #
+#          -threads <n>  During covariate screening, maximize up to n of
+#                     the models with one covariate suspended at the same
+#                     time, each in a separate SOLAR process.  Each model
+#                     starts from the model with all covariates, as usual,
+#                     and the results and output files are the same as
+#                     without -threads.
+#
 # Notes:    (1) Output is written to directory selected by 'outdir' command,
 #           or, if none is selected, to a directory named by the trait.  This
 #           is called the "maximization output directory."  Polygenic results
@@ -16543,8 +16826,10 @@ proc polygenic args {
     set rhopse 0
     set residinor 0
     set use_fphi 0
+    set nthreads 1
     set extra_args [read_arglist $args \
 	    -screen {set covscreen 1} -s {set covscreen 1} \
+	    -threads nthreads \
 	    -prob user_probability_level -p user_probability_level \
 	    -fix {lappend fix_list VALUE} \
 	    -f {lappend fix_list VALUE} \
@@ -16590,6 +16875,9 @@ proc polygenic args {
     if {$user_probability_level != -1} {
 	set probability_level $user_probability_level
     }
+    if {![is_integer $nthreads] || $nthreads < 1} {
+	error "polygenic: -threads must be a positive integer"
+    }
 
     ensure_float $probability_level
     if {$probability_level > 1 || $probability_level < 0} {
@@ -16736,17 +17024,25 @@ puts "**********************************************************************"
     set report_list {}
     set remove_covar_list {}
 
+    if {$nthreads > 1 && [llength $covar_list] > 1} {
+	array set screen_loglike [polygenic_screen_threads $nthreads \
+	    [full_filename $basemodel] $qu $covar_list]
+    }
+
     set covindex -1
     foreach covar $covar_list {
         incr covindex
         puts " "
 	puts "    *** Testing covariate $covar by suspending it ***"
-	model load [full_filename $basemodel]
-	covariate suspend $covar
-        option standerr 0
-	eval maximize $qu -o no$covar
-	model save [full_filename no$covar]
-	set chill [expr 2.0 * ($bll - [loglike])]
+	if {![info exists screen_loglike($covar)]} {
+	    model load [full_filename $basemodel]
+	    covariate suspend $covar
+	    option standerr 0
+	    eval maximize $qu -o no$covar
+	    model save [full_filename no$covar]
+	    set screen_loglike($covar) [loglike]
+	}
+	set chill [expr 2.0 * ($bll - $screen_loglike($covar))]
 	set deg 1
 	set testchi [catch {set pstring [chi $chill $deg]}]
 	if {$testchi != 0} {set pstring "p = 1.0"}
@@ -16767,7 +17063,7 @@ puts "**********************************************************************"
 	    lappend remove_covar_list $covar
 	}
 
-	set ll [loglike]
+	set ll $screen_loglike($covar)
         catch {[set ll [format "%.6f" $ll]]}
 	putsat $logs_file \
 "\n    *** Loglikelihood w/o covar $covar is $ll"
@@ -17946,6 +18242,101 @@ proc rhocap {word} {
 		[string range $word 4 end]]
 }
 
+# solar::polygenic_screen_threads -- private
+#
+# Purpose:  Maximize covariate screening models for polygenic -threads
+#
+# Usage:    polygenic_screen_threads <n> <basemodel> <qu> <covariates>
+#
+#           Covariates are dealt out in turn to <n> workers (see
+#           solar_worker), each of which maximizes the base model with one
+#           covariate suspended at a time.  The no<covar> models and output
+#           files are moved into the maximization output directory.
+#
+#           Returns a list of covariates and loglikelihoods suitable for
+#           array set.
+# -
+
+proc polygenic_screen_threads {nworkers basemodel qu covar_list} {
+
+    set ncovars [llength $covar_list]
+    if {$nworkers > $ncovars} {
+	set nworkers $ncovars
+    }
+    set channels {}
+    for {set k 0} {$k < $nworkers} {incr k} {
+	set jobs {}
+	for {set i $k} {$i < $ncovars} {incr i $nworkers} {
+	    lappend jobs [lindex $covar_list $i]
+	}
+	lappend channels [solar_worker [full_filename polygenic.w$k] {} \
+	    [list polygenic_screen_worker $basemodel $qu $jobs]]
+    }
+    puts "    *** Running $ncovars models in $nworkers worker processes"
+    while {{} != $channels} {
+	foreach record [solar_worker_read channels polygenic_screen] {
+	    set results([lindex $record 0]) [lrange $record 1 end]
+	}
+    }
+    set loglikes {}
+    set errmsg ""
+    foreach covar $covar_list {
+	set workdir [full_filename polygenic.w[expr \
+		[lsearch -exact $covar_list $covar] % $nworkers]]
+	foreach file [glob -nocomplain $workdir/no$covar.mod \
+			  $workdir/no$covar.out] {
+	    file rename -force $file [full_filename [file tail $file]]
+	}
+	if {![info exists results($covar)]} {
+	    if {"" == $errmsg} {
+		set errmsg "No result for model without covariate $covar"
+	    }
+	} elseif {"ok" != [lindex $results($covar) 0]} {
+	    if {"" == $errmsg} {
+		set errmsg [lindex $results($covar) 1]
+	    }
+	} else {
+	    lappend loglikes $covar [lindex $results($covar) 1]
+	}
+    }
+    for {set k 0} {$k < $nworkers} {incr k} {
+	file delete -force [full_filename polygenic.w$k]
+    }
+    if {"" != $errmsg} {
+	error $errmsg
+    }
+    return $loglikes
+}
+
+# solar::polygenic_screen_worker -- private
+#
+# Purpose:  Maximize one worker's share of models for polygenic -threads
+#
+# Usage:    polygenic_screen_worker <basemodel> <qu> <covariates>
+#
+#           Reports "polygenic_screen <covar> ok <loglike>" or
+#           "polygenic_screen <covar> error <message>" for each covariate.
+# -
+
+proc polygenic_screen_worker {basemodel qu covar_list} {
+
+    foreach covar $covar_list {
+	if {[catch {
+	    model load $basemodel
+	    covariate suspend $covar
+	    option standerr 0
+	    eval maximize $qu -o no$covar
+	    model save [full_filename no$covar]
+	} errmsg]} {
+	    puts "polygenic_screen [list $covar error $errmsg]"
+	} else {
+	    puts "polygenic_screen [list $covar ok [loglike]]"
+	}
+	flush stdout
+    }
+    return ""
+}
+
 # solar::relpairs --
 # solar::relatives --
 #
@@ -19311,7 +19702,7 @@ proc siminf {args} {
 # Purpose:  Perform "Twopoint" analysis on directory of ibd files
 #
 # Usage:    twopoint [-append] [-overwrite] [-grid] [-cparm {[<parameter>]*}]
-#                    -saveall
+#                    -saveall [-threads <n>]
 #
 #           -overwrite  (or -ov) Overwrite existing twopoint.out file.
 #
@@ -19346,6 +19737,19 @@ proc siminf {args} {
 #
 #           -saveall  Save all twopoint models in the maximization output
 #                     directory.  The models are named "ibd.<marker>".
+#
+#           -threads <n>  Maximize up to n markers at the same time, each in
+#                     a separate SOLAR process.  The processes work in
+#                     directories named twopoint.w<k> in the maximization
+#                     output directory, which are removed when they finish.
+#                     A summary of the markers done and the best LOD so far
+#                     is shown every few seconds, and results are written
+#                     to twopoint.out in marker order when all markers are
+#                     done.  Any markers not completed are reported and can
+#                     be run with -append.  -grid and -cparm cannot be
+#                     used with -threads (with -cparm each marker starts
+#                     from the previous marker's model, so markers cannot
+#                     be run independently).
 # Notes:
 #          The trait or outdir must be specified before running twopoint.
 #
@@ -19380,6 +19784,7 @@ proc twopoint {args} {
     set append 0
     set overwrite 0
     set saveall 0
+    set threads 1
     set plist \'
 
     set badargs [read_arglist $args \
@@ -19388,11 +19793,21 @@ proc twopoint {args} {
 	    -grid {set gridding 1} \
 	    -saveall {set saveall 1} \
 	    -cparm plist \
+	    -threads threads \
 	]
 
     if {{} != $badargs} {
 	error "Invalid argument(s) to twopoint: $badargs"
     }
+    if {![is_integer $threads] || $threads < 1} {
+	error "twopoint: -threads must be a positive integer"
+    }
+    if {$threads > 1 && $gridding} {
+	error "twopoint: -grid cannot be used with -threads; use the grid command"
+    }
+    if {$threads > 1 && "\'" != $plist} {
+	error "twopoint: -cparm cannot be used with -threads"
+    }
 
     if {"\'" != $plist} {
 	set noparama "-cparm"
@@ -19520,64 +19935,48 @@ proc twopoint {args} {
 
     set highest_new_lod -10000
     set highest_new_record ""
-    set newrs {}
-    global Solar_Fixed_Loci
-    set Solar_Fixed_Loci 0
-    set h2q_index 1
-    for {set i 0} {$i < $do_file_list_len} {incr i} {
-	set do_file [lindex $do_file_list $i]
-
-	ifverbplus puts "\n    *** Analyzing new ibd $do_file\n"
-
-        if {!$aparama} {
+    if {$threads > 1} {
+	set best [twopoint_threads $threads $do_file_list $saveall \
+		      $headings $formats $expressions]
+	set highest_new_lod [lindex $best 0]
+	set highest_new_record [lindex $best 1]
+    } else {
+	set newrs {}
+	global Solar_Fixed_Loci
+	set Solar_Fixed_Loci 0
+	if {!$aparama} {
 	    load model [full_filename null0.mod]
+	    model context save twopoint
 	}
-	eval linkmod $noparama -2p $do_file
-	set highest 0
-#
-# maximize but catch errors
-#  unfortunately, maxtry doesn't catch all errors
-#
-	if {0 != [catch {set max_status [maxtry 1 $h2q_index $do_file [full_filename temp] 1]}]} {
-	    set max_status "Unknown retry error"
-	} elseif {$saveall} {
-	    save model [full_filename [file tail [file rootname $do_file]]]
-	}
-	set boundary_error_flag 0
-	if {$max_status == "" && ![catch {loglike}]} {
-	    set loglik [loglike]
-	    set flod [lodn 0]
-	    if {$flod > $highest_new_lod} {
-		save model [full_filename t]
-		file copy -force [full_filename temp.out] [full_filename t.out]
+	for {set i 0} {$i < $do_file_list_len} {incr i} {
+	    set do_file [lindex $do_file_list $i]
+
+	    ifverbplus puts "\n    *** Analyzing new ibd $do_file\n"
+
+	    set marker_result [twopoint_maximize $do_file $resultf $aparama \
+				   $saveall $highest_new_lod \
+				   [lindex $do_file_list [expr $i + 1]]]
+	    set flod [lindex $marker_result 0]
+	    set result [lindex $marker_result 1]
+	    set name [lindex $marker_result 3]
+	    set highest 0
+	    if {"" != $flod && $flod > $highest_new_lod} {
 		set highest_new_lod $flod
 		set highest 1
 	    }
-	    set flod [format %.4f $flod]
-	} else {
-	    puts "error maximizing $do_file: $max_status"
-	    if {$max_status != "Convergence Error"} {
-		set boundary_error_flag 1
+	    lappend newrs $result
+	    set gridresult ""
+	    if {$gridding} {
+		set gridresult [grid -twopoint $name]
+	    }
+	    if {"" != $gridresult} {
+		set result $gridresult
+	    }
+	    if {$highest} {
+		set highest_new_record $result
 	    }
-	    set loglik NaN
-	    set flod " "
-	}
-	file delete [full_filename temp.out]
-	set first_char [expr 4 + [string first "ibd." $do_file]]
-	set last_char [expr [string last ".gz" $do_file] - 1]
-	set name [string range $do_file $first_char $last_char]
-	set result [resultfile $resultf -write]
-	lappend newrs $result
-	set gridresult ""
-	if {$gridding} {
-	    set gridresult [grid -twopoint $name]
-	}
-	if {"" != $gridresult} {
-	    set result $gridresult
-	}
-	if {$highest} {
-	    set highest_new_record $result
 	}
+	catch {model context delete twopoint}
     }
     if {$highest_old_lod > -10000} {
 	puts "\n[centerline "Highest Old Result" 72]\n"
@@ -19616,6 +20015,291 @@ proc twopoint {args} {
 }
 
 
+# solar::twopoint_maximize -- private
+#
+# Purpose:  Maximize the twopoint linkage model for one ibd file
+#
+# Usage:    twopoint_maximize <ibdfile> <resultfile> <cparm> <saveall> <lod>
+#                             [<next ibdfile>]
+#
+#           The linkage model is made from the null model in model
+#           context twopoint (or the current model, if <cparm> is 1),
+#           maximized, and its result written with resultfile.  The next
+#           ibd file, if given, is prefetched (see matrix prefetch) while
+#           this one is maximized.  If its LOD is higher than <lod>, the
+#           model is saved as t.mod and t.out.  Returns a list of the
+#           unformatted LOD (blank if maximization failed), the result
+#           line, the error status, and the marker name.
+# -
+
+proc twopoint_maximize {do_file resultf aparama saveall best_lod \
+			    {next_file ""}} {
+
+    set h2q_index 1
+    if {$aparama} {
+	set noparama "-cparm"
+    } else {
+	set noparama ""
+	model context load twopoint
+    }
+    eval linkmod $noparama -2p $do_file
+# Decompress next ibd file while this marker is maximized
+    if {"" != $next_file} {
+	catch {matrix prefetch $next_file}
+    }
+#
+# maximize but catch errors
+#  unfortunately, maxtry doesn't catch all errors
+#
+    if {0 != [catch {set max_status [maxtry 1 $h2q_index $do_file [full_filename temp] 1]}]} {
+	set max_status "Unknown retry error"
+    } elseif {$saveall} {
+	save model [full_filename [file tail [file rootname $do_file]]]
+    }
+    set lod ""
+    if {$max_status == "" && ![catch {loglike}]} {
+	set lod [lodn 0]
+	if {$lod > $best_lod} {
+	    save model [full_filename t]
+	    file copy -force [full_filename temp.out] [full_filename t.out]
+	}
+	set flod [format %.4f $lod]
+    } else {
+	puts "error maximizing $do_file: $max_status"
+	set flod " "
+    }
+    file delete [full_filename temp.out]
+    set first_char [expr 4 + [string first "ibd." $do_file]]
+    set last_char [expr [string last ".gz" $do_file] - 1]
+    set name [string range $do_file $first_char $last_char]
+    set result [resultfile $resultf -write]
+    return [list $lod $result $max_status $name]
+}
+
+# solar::twopoint_threads -- private
+#
+# Purpose:  Run twopoint markers in a pool of SOLAR worker processes
+#
+# Usage:    twopoint_threads <n> <ibdfiles> <saveall> <headings>
+#                            <formats> <expressions>
+#
+#           The ibd files are dealt out in turn to <n> workers (see
+#           solar_worker).  Each worker maximizes in its own directory
+#           twopoint.w<k> under the maximization output directory, starting
+#           from copies of the null models.  A summary of the best LOD so far
+#           is shown as results come back, and when all workers finish the
+#           results are appended to twopoint.out in marker order.  The best
+#           model is left as t.mod and t.out.  Returns the best LOD and its
+#           result line.
+# -
+
+proc twopoint_threads {nworkers do_file_list saveall headings formats expressions} {
+
+    set nfiles [llength $do_file_list]
+    if {$nworkers > $nfiles} {
+	set nworkers $nfiles
+    }
+    set copies [glob -nocomplain [full_filename null*.mod] \
+		    [full_filename null*.out] [full_filename lodadj.info]]
+    set channels {}
+    for {set k 0} {$k < $nworkers} {incr k} {
+	set jobs {}
+	for {set i $k} {$i < $nfiles} {incr i $nworkers} {
+	    lappend jobs $i [lindex $do_file_list $i]
+	}
+	lappend channels [solar_worker [full_filename twopoint.w$k] $copies \
+	    [list twopoint_worker $saveall $headings $formats $expressions \
+		 $jobs]]
+    }
+    puts "    *** Running $nfiles markers in $nworkers worker processes"
+#
+# Gather results as workers report them
+#
+    set ndone 0
+    set best_lod -10000
+    set best_index -1
+    set last_report [clock seconds]
+    while {{} != $channels} {
+	set records [solar_worker_read channels twopoint_result]
+	foreach record $records {
+	    set i [lindex $record 0]
+	    set lod [lindex $record 1]
+	    set results($i) [lindex $record 2]
+	    incr ndone
+	    if {"" == $lod} {
+		puts "error maximizing [lindex $do_file_list $i]: [lindex $record 3]"
+	    } elseif {$lod > $best_lod || ($lod == $best_lod && $i < $best_index)} {
+		set best_lod $lod
+		set best_index $i
+	    }
+	}
+	if {{} != $records && ([clock seconds] - $last_report >= 5 || {} == $channels)} {
+	    set last_report [clock seconds]
+	    set summary "    *** $ndone of $nfiles markers done"
+	    if {$best_index > -1} {
+		set best_name [lindex $results($best_index) 0]
+		set summary "$summary, best LOD [format %.4f $best_lod] ($best_name)"
+	    }
+	    puts $summary
+	    flush stdout
+	}
+    }
+#
+# Write results in marker order and collect models from worker directories
+#
+    set missing 0
+    set outfile [open [full_filename twopoint.out] a]
+    for {set i 0} {$i < $nfiles} {incr i} {
+	if {[info exists results($i)]} {
+	    puts $outfile $results($i)
+	} else {
+	    incr missing
+	}
+    }
+    close $outfile
+    set best_record ""
+    if {$best_index > -1} {
+	set best_record $results($best_index)
+	set workdir [full_filename twopoint.w[expr $best_index % $nworkers]]
+	file copy -force $workdir/t.mod [full_filename t.mod]
+	file copy -force $workdir/t.out [full_filename t.out]
+    }
+    for {set k 0} {$k < $nworkers} {incr k} {
+	set workdir [full_filename twopoint.w$k]
+	if {$saveall} {
+	    foreach model [glob -nocomplain $workdir/ibd.*.mod] {
+		file rename -force $model [full_filename [file tail $model]]
+	    }
+	}
+	file delete -force $workdir
+    }
+    if {$missing} {
+	puts "\n    *** $missing markers were not completed by their workers"
+	puts "    *** Use twopoint -append to run them"
+    }
+    return [list $best_lod $best_record]
+}
+
+# solar::twopoint_worker -- private
+#
+# Purpose:  Maximize one worker's share of markers for twopoint -threads
+#
+# Usage:    twopoint_worker <saveall> <headings> <formats> <expressions>
+#                           {<index> <ibdfile> ...}
+#
+#           Each result is written to standard output as twopoint_result
+#           followed by a list of the marker index, unformatted LOD, result
+#           line and error status.  Every marker starts from the null
+#           model, which is kept in model context twopoint so neither it
+#           nor its matrices are read again for each marker.
+# -
+
+proc twopoint_worker {saveall headings formats expressions jobs} {
+
+    global Solar_Fixed_Loci
+    set Solar_Fixed_Loci 0
+    set resultf [resultfile -create [full_filename twopoint.out] -returnonly \
+		     -headings $headings -expressions $expressions \
+		     -formats $formats]
+    set best_lod -10000
+    load model [full_filename null0.mod]
+    model context save twopoint
+    set jobpos 1
+    foreach {i do_file} $jobs {
+	incr jobpos 2
+	set marker_result [twopoint_maximize $do_file $resultf 0 $saveall \
+			       $best_lod [lindex $jobs $jobpos]]
+	set lod [lindex $marker_result 0]
+	if {"" != $lod && $lod > $best_lod} {
+	    set best_lod $lod
+	}
+	puts "twopoint_result [list $i $lod [lindex $marker_result 1] \
+				 [lindex $marker_result 2]]"
+	flush stdout
+    }
+    return ""
+}
+
+# solar::solar_worker -- private
+#
+# Purpose:  Start a SOLAR worker process with its own output directory
+#
+# Usage:    solar_worker <workdir> <files> <command>
+#
+#           <workdir> is emptied, the listed files are copied into it, and
+#           a SOLAR process is started in the current working directory
+#           with <workdir> as its maximization output directory.  Session
+#           settings that affect maximization (verbosity, e2squeeze,
+#           e2lower, h2rf and lodp) are copied to the worker before it
+#           evaluates <command>.  Pedigree, phenotypes and ibddir are
+#           loaded from the working directory as at startup.
+#
+#           Returns a non-blocking channel reading the worker's output.
+#           See solar_worker_read.
+# -
+
+proc solar_worker {workdir files command} {
+
+    file delete -force $workdir
+    file mkdir $workdir
+    foreach file $files {
+	file copy -force $file $workdir
+    }
+    set wfile [open $workdir/worker.tcl w]
+    puts $wfile [list outdir $workdir]
+    puts $wfile [verbosity]
+    foreach var {Solar_E2_Squeeze Solar_E2_Lower_Bound Solar_H2R_Upper_Factor \
+		     Solar_qsd_fraction SOLAR_LODP SOLAR_LODP_RHOQ} {
+	global $var
+	if {[info exists $var]} {
+	    puts $wfile [list set ::$var [set $var]]
+	}
+    }
+    puts $wfile $command
+    close $wfile
+    set channel [open "|[list [info nameofexecutable] \
+	    "source [list $workdir/worker.tcl]"] 2>@1" r]
+    fconfigure $channel -blocking 0
+    return $channel
+}
+
+# solar::solar_worker_read -- private
+#
+# Purpose:  Read results from SOLAR worker processes
+#
+# Usage:    solar_worker_read <channels variable> <tag>
+#
+#           Workers report each result as a line beginning with <tag>,
+#           followed by a list.  Returns the lists read from all channels
+#           so far, waiting briefly if there are none.  Other output is
+#           ignored.  Channels of workers that have exited are closed and
+#           removed from the variable.
+# -
+
+proc solar_worker_read {channels_var tag} {
+
+    upvar $channels_var channels
+    set records {}
+    set taglen [string length "$tag "]
+    foreach channel $channels {
+	while {-1 < [gets $channel line]} {
+	    if {"$tag " == [string range $line 0 [expr $taglen - 1]]} {
+		lappend records [string range $line $taglen end]
+	    }
+	}
+	if {[eof $channel]} {
+	    fconfigure $channel -blocking 1
+	    catch {close $channel}
+	    set pos [lsearch -exact $channels $channel]
+	    set channels [lreplace $channels $pos $pos]
+	}
+    }
+    if {{} == $records && {} != $channels} {
+	after 200
+    }
+    return $records
+}
+
 # solar::e2squeeze -- private
 # 
 # Purpose:  Set bounds around e2 based on previous value
@@ -20597,6 +21281,121 @@ proc topline {filename} {
 # for solar.tcl itself to be scanned.
 
 
+# solar::split_solar_tcl -- private
+#
+# Purpose:  Split solar.tcl into one autoload file per procedure
+#
+# Usage:    split_solar_tcl <libdir>
+#
+# Notes:    Each procedure in <libdir>/solar.tcl is written to its own file
+#           in <libdir>/solar.d, and <libdir>/tclIndex is rewritten to
+#           autoload each procedure from its own file.  Without this, the
+#           first use of any procedure sources all of solar.tcl.  Index
+#           entries for other files (such as auto.tcl) are kept.
+#
+#           solar.tcl itself is not changed and must remain in <libdir>,
+#           where it is used to locate the library and to find help text.
+#           install_solar.sh runs this after copying the library.  It must
+#           be run again if solar.tcl in <libdir> is changed.
+#
+#           The procedures split out are checked against those found by
+#           auto_mkindex in solar.tcl.  If they differ, it is an error and
+#           tclIndex is not changed.
+# -
+
+proc split_solar_tcl {libdir} {
+    set infile [open [file join $libdir solar.tcl] r]
+    set script [read $infile]
+    close $infile
+
+    set unitdir [file join $libdir solar.d]
+    file delete -force $unitdir
+    file mkdir $unitdir
+
+    set entries {}
+    set pnames {}
+    set command ""
+    set lineno 0
+    foreach line [split $script \n] {
+	incr lineno
+	append command $line \n
+	if {![info complete $command]} {
+	    continue
+	}
+	set trimmed [string trim $command]
+	set command ""
+	if {"" == $trimmed || "#" == [string index $trimmed 0]} {
+	    continue
+	}
+	if {![regexp {^proc[ \t]+([^ \t\n]+)} $trimmed junk pname]} {
+	    file delete -force $unitdir
+	    error "split_solar_tcl: command other than proc ends at line $lineno"
+	}
+	regsub -all {[^A-Za-z0-9_.-]} $pname _ fname
+	set lname [string tolower $fname]
+	if {[info exists used($lname)]} {
+	    append fname _$lineno
+	}
+	set used([string tolower $fname]) 1
+	set ofile [open [file join $unitdir $fname.tcl] w]
+	puts $ofile $trimmed
+	close $ofile
+	lappend entries "set [list auto_index($pname)] \[list source \[file join \$dir solar.d [list $fname.tcl]\]\]"
+	lappend pnames $pname
+    }
+
+# Check against the procedures auto_mkindex finds in solar.tcl
+
+    set checkdir [file join $libdir solar.d.check]
+    file delete -force $checkdir
+    file mkdir $checkdir
+    file copy [file join $libdir solar.tcl] $checkdir
+    auto_mkindex $checkdir solar.tcl
+    set indexed {}
+    foreach line [listfile [file join $checkdir tclIndex]] {
+	if {[regexp {^set auto_index\((.*)\) } $line junk pname]} {
+	    lappend indexed $pname
+	}
+    }
+    file delete -force $checkdir
+    set missing {}
+    foreach pname $indexed {
+	if {-1 == [lsearch -exact $pnames $pname]} {
+	    lappend missing $pname
+	}
+    }
+    set nsplit [llength [lsort -unique $pnames]]
+    set nindexed [llength [lsort -unique $indexed]]
+    if {{} != $missing || $nsplit != $nindexed} {
+	file delete -force $unitdir
+	error "split_solar_tcl: $nsplit procedures split out of solar.tcl but auto_mkindex found $nindexed\nMissing: $missing"
+    }
+
+    set kept {}
+    set indexname [file join $libdir tclIndex]
+    if {[file exists $indexname]} {
+	foreach line [listfile $indexname] {
+	    if {[string match "set auto_index*" $line] && \
+		    ![string match "*solar.tcl*" $line] && \
+		    ![string match "*solar.d*" $line]} {
+		lappend kept $line
+	    }
+	}
+    }
+    set ofile [open $indexname.new w]
+    puts $ofile "# Tcl autoload index file, version 2.0"
+    puts $ofile "# This file is generated by split_solar_tcl"
+    puts $ofile "# Each solar.tcl procedure is loaded from its own file in solar.d"
+    puts $ofile ""
+    foreach line [concat $kept $entries] {
+	puts $ofile $line
+    }
+    close $ofile
+    file rename -force $indexname.new $indexname
+    return "[llength $entries] procedures written to $unitdir"
+}
+
+
 
 # solar::needk2 --
 #
@@ -25660,7 +26459,7 @@ proc cleanme {name args} {
 #                    [-list <listfile>] [-fix [cov|param]]
 #                    [-size_log_n] [-nose] [-old_log_n]
 #                    [-sporadic] [-h2rf h2r_factor] [-saveall]
-#                    [-qtn] [-stop] [-nostop]
+#                    [-qtn] [-stop] [-nostop] [-threads <n>]
 #
 #           bayesavg -r[estart]   ;# (see also -redo)
 #
@@ -25795,6 +26594,22 @@ proc cleanme {name args} {
 #                      -nostop.  To include all snps in the starting model,
 #                      use the separate command "allsnp".
 #
+#               -threads <n>  Maximize up to n models of the same size at
+#                      the same time, each in a separate SOLAR process.  Each
+#                      model starts from the estimates of the best model one
+#                      element smaller that it contains, which usually
+#                      saves iterations; if that does not converge, the model
+#                      is maximized from the base model as usual.  Models of
+#                      each size are written to the output file in the usual
+#                      order once all of them are done, and the -stop rule is
+#                      applied between sizes as usual.  When log(n) is
+#                      already known (-log_n, -size_log_n, or -nose), the
+#                      model with all elements is maximized first, and
+#                      larger models are skipped once their BIC could not
+#                      be within the cutoff of the best BIC even with the
+#                      loglikelihood of that model.  -restart and -redo
+#                      continue without -threads.
+#
 # Output:   In addition to the terminal display, the following files are
 #           created (<outname> is "bayesavg" for linkage analysis or 
 #           "bayesavg_cov" for covariate analysis):
@@ -25948,6 +26763,7 @@ proc bayesavg {args} {
     set nostop 0
     set maxcomb 2000000
     set maxcomb_increment 1000000
+    set threads 1
 
 # Read arguments
 
@@ -25974,6 +26790,7 @@ proc bayesavg {args} {
 	    -log_n use_log_n \
 	    -old_log_n {set old_log_n 1} \
 	    -nostop {set nostop 1} \
+	    -threads threads \
 	    -ov {set overwrite 1} -overwrite {set overwrite 1}]
 
     set fix_list [string tolower $fix_list]
@@ -25989,6 +26806,9 @@ proc bayesavg {args} {
     if {$sporadic_first && $use_sporadic} {
 	error "Arguments -sporadic_first and -sporadic (only) are incompatible"
     }
+    if {![is_integer $threads] || $threads < 1} {
+	error "bayesavg: -threads must be a positive integer"
+    }
 
 # Remember previous arguments if restarting
 
@@ -26669,6 +27489,22 @@ proc bayesavg {args} {
 
     set number_models_written 0
 #
+# With -threads, all combinations are done by worker processes
+#
+    if {$threads > 1 && !$restart && !$redo} {
+	set maxdf $n
+	if {$max_comb && $max_comb < $n} {
+	    set maxdf $max_comb
+	}
+	set driver [bayesavg_threads $threads $n $maxdf $prefix $basemodel \
+		$covar $covarlist $paramlist $stop $nostop $cutoff \
+		$log_n_est [expr {{} != $use_log_n}] $null_loglike $saveall \
+		$resultf $outname $minBIC]
+	set minBICmodel [lindex $driver 0]
+	set bad_results [lindex $driver 1]
+	set combno $ncomb
+    }
+#
 # Big loop begins here
 #
     for {} {!$early_exit && ($combno < $ncomb)} {incr combno} {
@@ -26745,26 +27581,8 @@ proc bayesavg {args} {
 #
 # Create model from base by restoring elements
 #
-	load model [full_filename $basemodel]
-	if {$covar} {
-	    for {set i 0} {$i < $n} {incr i} {
-		set covi [lindex $covarlist $i]
-		if {-1 != [lsearch $comb [expr $i + 1]]} {
-		    covariate restore $covi
-		}
-	    }
-	} else {
-	    foreach ce $comb {
-		set param [lindex $paramlist [expr $ce - 1]]
-		if {-1==[string first "-" $param]} {
-		    constraint delete $param
-		} else {
-		    constraint delete <$param>
-		}
-		carve_new_value $param 0.01 h2r
-		parameter $param lower 0
-	    }
-	}
+	bayesavg_comb [full_filename $basemodel] $covar $covarlist $paramlist \
+	    $comb
 #
 # Maximize and save results
 #
@@ -27777,6 +28595,315 @@ proc max_bayesavg {outfilename comb} {
     }
     return "Convergence problem with combination: $comb"
 }
+# solar::bayesavg_comb -- private
+#
+# Purpose:  Build a bayesavg model from the base model
+#
+# Usage:    bayesavg_comb <basemodel> <covar> <covarlist> <paramlist> <comb>
+#                         [<estimates>]
+#
+#           The elements numbered in <comb> are restored to the base model.
+#           <estimates> is an optional list of parameter names and values
+#           (from a model with some of the same elements) used as starting
+#           values.  Values outside the current boundaries are ignored.
+#           Linkage elements not given a starting value start at 0.01.
+# -
+
+proc bayesavg_comb {basemodel covar covarlist paramlist comb {estimates {}}} {
+
+    load model $basemodel
+    if {$covar} {
+	foreach ce $comb {
+	    covariate restore [lindex $covarlist [expr $ce - 1]]
+	}
+    }
+    set started {}
+    foreach {pname value} $estimates {
+	if {![if_parameter_exists $pname]} {
+	    continue
+	}
+	set lower [parameter $pname lower]
+	set upper [parameter $pname upper]
+	if {($lower == 0 && $upper == 0) || \
+		($value > $lower && $value < $upper)} {
+	    parameter $pname = $value
+	    lappend started [string tolower $pname]
+	}
+    }
+    if {!$covar} {
+	foreach ce $comb {
+	    set param [lindex $paramlist [expr $ce - 1]]
+	    if {-1==[string first "-" $param]} {
+		constraint delete $param
+	    } else {
+		constraint delete <$param>
+	    }
+	    if {-1 == [lsearch -exact $started [string tolower $param]]} {
+		carve_new_value $param 0.01 h2r
+	    }
+	    parameter $param lower 0
+	}
+    }
+    return ""
+}
+
+# solar::bayesavg_threads -- private
+#
+# Purpose:  Maximize all bayesavg models in worker processes
+#
+# Usage:    bayesavg_threads <n> <N> <maxdf> <prefix> <basemodel> <covar>
+#                            <covarlist> <paramlist> <stop> <nostop>
+#                            <cutoff> <log_n> <prune> <null_loglike>
+#                            <saveall> <resultfile> <outname> <minBIC>
+#
+#           Models are done one size (df) at a time.  The models of each
+#           size are dealt out in turn to up to <n> workers (see
+#           solar_worker), each starting from the estimates of the best
+#           model one element smaller.  Results are then written and the
+#           stop rule applied in the same order as bayesavg does without
+#           -threads.  If <prune> is set, log(n) is final, so sizes whose
+#           BIC would be too large even with the loglikelihood of the model
+#           with all elements are skipped.
+#
+#           Returns the model with the lowest BIC and the convergence
+#           errors.
+# -
+
+proc bayesavg_threads {nworkers n maxdf prefix basemodel covar covarlist \
+	paramlist stop nostop cutoff log_n_est prune null_loglike saveall \
+	resultf outname minBIC} {
+
+    set minBICmodel ""
+    set last_minBICmodel ""
+    set bad_results {}
+    set this_df 0
+    set models_in_this_df 1
+    set best_bic 0.0
+    set best_bic_in_df 0.0
+    set best_model_in_df $basemodel
+    set lambda_max ""
+    set saturated ""
+    if {$prune && $maxdf == $n} {
+	set satcomb {}
+	for {set i 1} {$i <= $n} {incr i} {
+	    lappend satcomb $i
+	}
+	set saturated [catenate $prefix [join $satcomb _]]
+    }
+    for {set df 1} {$df <= $maxdf} {incr df} {
+#
+# Apply stop rule and window bound before starting models of this size
+#
+	putsout $outname.history \
+	    "    *** Best BIC in degree $this_df is $best_bic_in_df for model $best_model_in_df"
+	if {$stop && $models_in_this_df == 0} {
+	    putsout $outname.history \
+		"        *** No models with degree $this_df were in window"
+	    if {!$nostop} {
+		putsout $outname.history \
+		    "        *** Exiting main loop by stop rule"
+		break
+	    }
+	}
+	if {"" != $lambda_max && \
+		$df * $log_n_est - $lambda_max - $cutoff >= $best_bic} {
+	    putsout $outname.history \
+		"        *** Models with degree $df or more cannot be in window"
+	    putsout $outname.history \
+		"        *** Exiting main loop by window bound"
+	    break
+	}
+#
+# Start models of this size, each from the best smaller model it contains
+#
+	set group {}
+	combinations $n $df -list group
+	set jobs {}
+	foreach comb $group {
+	    set cname [catenate $prefix [join $comb _]]
+	    if {[info exists results($cname)]} {
+		continue
+	    }
+	    set estimates {}
+	    set best_loglike ""
+	    if {$df > 1} {
+		for {set i 0} {$i < $df} {incr i} {
+		    set sname [catenate $prefix [join [lreplace $comb $i $i] _]]
+		    if {[info exists fitted($sname)] && ("" == $best_loglike || \
+			    [lindex $fitted($sname) 0] > $best_loglike)} {
+			set best_loglike [lindex $fitted($sname) 0]
+			set estimates [lindex $fitted($sname) 1]
+		    }
+		}
+	    }
+	    lappend jobs [list $cname $comb $estimates]
+	}
+	if {$df == 1 && "" != $saturated} {
+	    lappend jobs [list $saturated $satcomb {}]
+	}
+	set njobs [llength $jobs]
+	set nw $nworkers
+	if {$nw > $njobs} {
+	    set nw $njobs
+	}
+	set channels {}
+	for {set k 0} {$k < $nw} {incr k} {
+	    set wjobs {}
+	    for {set i $k} {$i < $njobs} {incr i $nw} {
+		lappend wjobs [lindex $jobs $i]
+		set worker([lindex [lindex $jobs $i] 0]) $k
+	    }
+	    lappend channels [solar_worker [full_filename bayesavg.w$k] {} \
+		[list bayesavg_worker [full_filename $basemodel] $covar \
+		     $covarlist $paramlist $wjobs]]
+	}
+	while {{} != $channels} {
+	    foreach record [solar_worker_read channels bayesavg_result] {
+		set cname [lindex $record 0]
+		set results($cname) [lrange $record 1 end]
+		set workdir [full_filename bayesavg.w$worker($cname)]
+		if {[file exists $workdir/$cname.mod]} {
+		    file rename -force $workdir/$cname.mod \
+			[full_filename $cname.mod]
+		}
+	    }
+	}
+	for {set k 0} {$k < $nw} {incr k} {
+	    file delete -force [full_filename bayesavg.w$k]
+	}
+	if {"" != $saturated && [info exists results($saturated)] && \
+		"ok" == [lindex $results($saturated) 0]} {
+	    set lodp [lod [lindex $results($saturated) 2] $null_loglike]
+	    set lambda_max [expr $lodp * 2 * log (10)]
+	}
+	array unset fitted
+#
+# Write results in combination order
+#
+	foreach comb $group {
+	    set cname [catenate $prefix [join $comb _]]
+	    if {![info exists results($cname)]} {
+		error "bayesavg: no result for model $cname"
+	    }
+	    set status [lindex $results($cname) 0]
+	    if {"fatal" == $status} {
+		error [lindex $results($cname) 1]
+	    }
+	    if {"ok" != $status} {
+		lappend bad_results [lindex $results($cname) 1]
+		if {[llength $bad_results] > 5} {
+		    bayesavg_bad_results $outname.est $bad_results 0
+		}
+		continue
+	    }
+	    set fitted($cname) [lrange $results($cname) 2 3]
+	    unset results($cname)
+	    set save_this_one 0
+	    set c_loglike [oldmodel $cname loglike]
+	    set lodp [lod $c_loglike $null_loglike]
+	    set lambda [expr $lodp * 2 * log (10)]
+	    set BIC [expr ($df * $log_n_est) - $lambda]
+	    if {$BIC < $minBIC} {
+		set save_this_one 1
+		set minBIC $BIC
+		set last_minBICmodel $minBICmodel
+		set minBICmodel $cname
+	    }
+	    resultfile $resultf -write
+	    if {!$save_this_one && !$saveall} {
+		delete_files_forcibly [full_filename $cname.mod]
+	    }
+	    if {$df != $this_df} {
+		set this_df $df
+		set models_in_this_df 0
+		set best_bic_in_df $BIC
+		set best_model_in_df $cname
+	    }
+	    if {$BIC < $best_bic_in_df} {
+		set best_bic_in_df $BIC
+		set best_model_in_df $cname
+	    }
+	    if {$BIC - $cutoff < $best_bic} {
+		set models_in_this_df 1
+	    }
+	    if {$BIC < $best_bic} {
+		set best_bic $BIC
+	    }
+	    if {!$saveall && $save_this_one == 1} {
+		if {"" != $last_minBICmodel && \
+			[catenate $prefix 0] != $last_minBICmodel} {
+		    delete_files_forcibly \
+			[full_filename $last_minBICmodel.mod]
+		}
+	    }
+	}
+    }
+    if {"" != $saturated && [info exists results($saturated)]} {
+	delete_files_forcibly [full_filename $saturated.mod]
+    }
+    return [list $minBICmodel $bad_results]
+}
+
+# solar::bayesavg_worker -- private
+#
+# Purpose:  Maximize one worker's share of models for bayesavg -threads
+#
+# Usage:    bayesavg_worker <basemodel> <covar> <covarlist> <paramlist> <jobs>
+#
+#           Each job is a model name, its elements, and starting estimates.
+#           Reports "bayesavg_result <name> ok {} <loglike> <estimates>",
+#           "bayesavg_result <name> error <message>" for convergence
+#           failures, or "bayesavg_result <name> fatal <message>" for other
+#           errors.
+# -
+
+proc bayesavg_worker {basemodel covar covarlist paramlist jobs} {
+
+    foreach job $jobs {
+	set cname [lindex $job 0]
+	set comb [lindex $job 1]
+	set estimates [lindex $job 2]
+	set status ok
+	if {[catch {
+	    set error_msg ""
+	    if {{} != $estimates} {
+		bayesavg_comb $basemodel $covar $covarlist $paramlist $comb \
+		    $estimates
+		set error_msg [maximize_quietly last.out]
+	    }
+	    if {{} == $estimates || "" != $error_msg} {
+		bayesavg_comb $basemodel $covar $covarlist $paramlist $comb
+		if {$covar} {
+		    set error_msg [maximize_quietly last.out]
+		} else {
+		    set error_msg [max_bayesavg last.out $comb]
+		}
+	    }
+	    if {"" == $error_msg} {
+		suspend2constrain
+		model save [full_filename $cname]
+	    }
+	} errmsg]} {
+	    set status fatal
+	    set error_msg $errmsg
+	}
+	if {"ok" == $status && "" != $error_msg} {
+	    set status error
+	}
+	if {"ok" == $status} {
+	    set estimates {}
+	    foreach pname [parameter -names] {
+		lappend estimates $pname [parameter $pname =]
+	    }
+	    puts "bayesavg_result [list $cname ok {} [loglike] $estimates]"
+	} else {
+	    puts "bayesavg_result [list $cname $status $error_msg]"
+	}
+	flush stdout
+    }
+    return ""
+}
+
 
 # solar::combinations --
 #
@@ -30933,6 +32060,8 @@ proc unique {name list} {
 # Purpose:: transpose on MathMatrix or comma delimited file
 #
 # Usage: transpose <MathMatrix>  ;# returns id of transposed MathMatrix
+#        transpose -inplace <MathMatrix>  ;# transpose within same storage
+#        transpose -out <MathMatrix2> <MathMatrix>  ;# into existing matrix
 #        transpose <infile> <outfile>  ;# transposes CSV file
 #
 # Note: All records must have same length.  First record is treated like all
@@ -30956,6 +32085,8 @@ proc transpose {args} {
     set nargs [llength $args]
     if {$nargs == 1} {
 	return [ctranspose $args]
+    } elseif {[lindex $args 0] == "-inplace" || [lindex $args 0] == "-out"} {
+	return [eval ctranspose $args]
     } elseif {$nargs != 2} {
     error "Usage: transpose <csvinput> <csvoutput>  OR  transpose <MathMatrix>"
     }
@@ -32207,10 +33338,26 @@ proc make_solar_aliases {} {
 #           load model <modelname>     ; load model from a file
 #           model                      ; display model on terminal
 #           model new                  ; reset to new empty model
+#
+#           model context save <name>   ; keep a copy of model in memory
+#           model context load <name>   ; make copy current model again
+#           model context delete <name> ; delete a copy
+#           model context names         ; names of all copies
 # 
 # Notes:    An extension .mod is automatically appended if not specified.
 #           You must specify directory path if you want to save model
 #           in a subdirectory of the current directory.
+#
+#           Model contexts are like model files kept in memory, for
+#           scripts that return to the same model many times.  "model
+#           context load" does not read matrix files again for matrices
+#           the current model has loaded with the same "matrix load"
+#           command, and parameter values are restored exactly rather
+#           than to ParameterFormat digits.  Contexts last until deleted
+#           or the end of the session.  The twopoint command uses them to
+#           start each marker from the null model.  There is still only
+#           one current model, and maximize works on it; contexts do not
+#           let several models be maximized at once in one process.
 # - 
 
 # solar::load --
@@ -32681,6 +33828,16 @@ proc save {args} {
 #                        the second derivative is used to compute an
 #                        expected first derivative.
 #
+#    AnalyticDeriv 0     (1) computes exact first derivatives (scores) of the
+#                        likelihood and uses the average information matrix
+#                        as the Hessian, in place of numerical differences
+#                        and the BFGS update.  This applies only to
+#                        univariate EVD models (option modeltype evd) with
+#                        the standard sporadic or polygenic omega, no
+#                        discrete trait and no ascertained pedigrees; other
+#                        models use numerical derivatives regardless.  The
+#                        default (0) always uses numerical derivatives.
+#
 #    PedLike 0           Intended for use by pedlike and pedlod commands only.
 #                        Produces files "pedexclude.dat" and "pedlike.dat"
 #                        during maximization.
@@ -32784,6 +33941,10 @@ proc save {args} {
 #    MatrixNumberFormat 15  number of significant digits used for writing
 #                           results of matrix operations.  15 works best.
 #
+#    FitCache 1          The default (1) lets maximize reuse the stored fit of
+#                        an identical model.  (0) always maximizes.  This is
+#                        a session option.  See "help fitcache".
+#
 #    ExpNotation 0       1 forces exponential notation (but only for certain
 #                        commands, mga is the only one currently).  0 is
 #                        auto mode, which typically uses fixed point while
@@ -32881,6 +34042,14 @@ proc save {args} {
 #               by a PROBND field in the phenotypes file.  To switch
 #               proband detection off, you may rename that field, or
 #               use the command "field proband -none".
+#
+#           (7) The first time a phenotype is used in maximization, its
+#               column is read and converted to numbers once, and saved in
+#               a file named <filename>.pcol next to the phenotypes file
+#               (if that directory is writable).  Later maximizations, even
+#               in later sessions, use the saved columns as long as the
+#               phenotypes file has not been modified.  The .pcol file may
+#               be deleted at any time.
 #-
 
 # solar::trait --
@@ -33254,6 +34423,8 @@ proc save {args} {
 #           
 #           matrix debug                   ; print info about sample matrices
 #           matrix -return                 ; return sample matrix commands
+#           matrix prefetch <filename>     ; decompress sample matrix file
+#                                          ;   in background for next load
 # 
 #           <option> == -sample            ; remove missing ID's from sample
 #           <option> == -allow             ; default missing ID's to diagonal 1
@@ -35288,7 +36459,7 @@ proc marker {args} {
 #
 # Usage:    load freq [-nosave] <filename>    ; loads freq file
 #           freq unload                ; unloads allele frequencies
-#           freq mle [-nose] [-hwe] [<marker> ...]
+#           freq mle [-nose] [-hwe] [-all] [-threads <n>] [<marker> ...]
 #                                      ; computes MLE allele frequencies
 #           freq save <filename>       ; saves allele frequencies to a file
 #           freq show [<marker> ...]   ; displays allele frequencies
@@ -35325,6 +36496,12 @@ proc marker {args} {
 #           the allele frequency-based model (which assumes HWE).  When
 #           this test has been conducted, the associated p-values will be
 #           displayed by the 'marker show' command.
+#
+#           The '-all' option computes MLEs for all markers with currently
+#           loaded genotype data, as when no marker is named.  With
+#           '-threads <n>', up to n markers are run at the same time.  The
+#           results are then read and saved in marker order, so they are the
+#           same as when markers are run one at a time.
 #           
 #           The file created by the 'freq save' command is written in a
 #           format suitable for subsequent loading with the 'freq load'
@@ -35353,10 +36530,14 @@ proc freq {args} {
     set nosave 0
     set nose 0
     set hwe 0
+    set all 0
+    set threads 1
 
     set mrklist [ read_arglist $args -nosave {set nosave 1} \
                                      -nose {set nose 1} \
-                                     -hwe {set hwe 1} ]
+                                     -hwe {set hwe 1} \
+                                     -all {set all 1} \
+                                     -threads threads ]
     set arg1 [lindex $mrklist 0]
 
     if {$arg1 == "load"} {
@@ -35419,10 +36600,47 @@ proc freq {args} {
     }
 
     if {$arg1 == "mle"} {
-        if {[llength $mrklist] == 1} {
-            eval lappend mrklist [marker names]
+        if {[llength $mrklist] == 1 || $all} {
+            set mrklist [concat mle [marker names]]
+        }
+        if {![is_integer $threads] || $threads < 1} {
+            error "freq mle: -threads must be a positive integer"
         }
         set err 0
+        if {$threads > 1} {
+            set runlist {}
+            foreach mrk [lrange $mrklist 1 end] {
+                if {[cfreq nall $mrk] == 0} {
+                    puts "Cannot run allfreq for marker $mrk: no data"
+                } else {
+                    lappend runlist $mrk
+                }
+            }
+            set options {}
+            if {$nose} {lappend options -nose}
+            if {$hwe} {lappend options -hwe}
+            set failures [eval cfreq mle -threads $threads $options $runlist]
+            foreach failure $failures {
+                set err 1
+                set errmsg [lindex $failure 1]
+                if {[llength $errmsg] == 1} {
+                    set id [get_id $errmsg]
+                    if {[llength $id] == 2} {
+                        puts \
+"\nMarker [lindex $failure 0]: Mendelian inconsistency found near individual FAMID = [lindex $id 0] ID = [lindex $id 1]"
+                    } else {
+                        puts \
+"\nMarker [lindex $failure 0]: Mendelian inconsistency found near individual ID = [lindex $id 0]"
+                    }
+                } else {
+                    puts "\nMarker [lindex $failure 0]: $errmsg"
+                }
+            }
+            if {$err && [llength $mrklist] > 2} {
+                error "Errors were encountered for one or more markers."
+            }
+            return
+        }
         for {set i 1} {$i < [llength $mrklist]} {incr i} {
             set mrk [lindex $mrklist $i]
             if {[cfreq nall $mrk] == 0} {
@@ -36849,6 +38067,13 @@ proc ibs {args} {
 #           MibdWin   size (in cM) of the multipoint IBD window - the MIBDs at
 #                     a given chromosome location depend only on markers inside
 #                     or on the boundary of the window centered at that location
+#           Threads   number of marker IBD jobs (ibd with no marker) run
+#                     at once, each in its own process, and the number of
+#                     multipoint IBD locations (mibd) computed at once by
+#                     multipnt; the default is 1.  Progress bars are not
+#                     shown when more than one marker job is run at once.
+#                     With one job, the Monte Carlo method spreads its
+#                     imputations over all cores (or OMP_NUM_THREADS, if set).
 #
 # Usage:    ibdoption                   ; displays current IBD options
 #
@@ -36870,6 +38095,9 @@ proc ibs {args} {
 #
 #           ibdoption mibdwin           ; displays the multipoint IBD window size
 #           ibdoption mibdwin <size>    ; sets the multipoint IBD window size
+#
+#           ibdoption threads           ; displays the number of IBD jobs
+#           ibdoption threads <n>       ; sets the number of IBD jobs run at once
 #-
 
 
@@ -36880,7 +38108,12 @@ proc ibs {args} {
 # Usage:    mibd relate [-mxnrel <n>]   ; creates relative-class file
 #           mibd merge                  ; merges marker IBDs
 #           mibd means [-typed | -all]  ; computes mean IBD by relative-class
-#           mibd [<from> <to>] <incr>   ; computes multipoint IBDs
+#           mibd [<from> <to>] <incr> [-pack [-half] [-delete]]
+#                                       ; computes multipoint IBDs
+#
+#           mibd pack [-half] [-delete] [<chromo> ...]
+#                                     ; packs MIBDs for specified chromosomes
+#                                     ; into one file per chromosome
 #
 #           mibd export [-file <filename>] [-overwrite] [-append]
 #                       [-nod7] [-ibdid] [-byloc] [<chromo> ...]
@@ -37084,6 +38317,32 @@ proc ibs {args} {
 #           wish to use the earlier version of SimWalk2, it is now necessary
 #           to include the '-version 2.82' option.
 #
+#           The 'mibd pack' command stores all the MIBD files of a chromosome
+#           in a single file named 'mibd.<chromo>.pack' in the mibddir.
+#           Adjacent locations are stored as differences from each other,
+#           so the pack is much smaller than the separate files, and moving
+#           from one location to the next during a multipoint scan is
+#           faster.  The matrix and multipoint commands (and anything else
+#           that loads mibd files through the matrix command) read a
+#           location from the pack whenever the file mibd.<chromo>.<loc>.gz
+#           itself is not present, so the original files may be deleted
+#           after packing.  If no chromosomes are specified, every
+#           chromosome with MIBD files in the mibddir is packed.  Giving
+#           the -pack option when computing MIBDs packs the chromosome once
+#           the computation is complete.  The options are
+#
+#               -half                 Store IBD and D7 as half precision
+#                                       (about 3 significant digits) floating
+#                                       point numbers.  This halves the size
+#                                       again, but the values loaded are no
+#                                       longer exactly those computed.
+#
+#               -delete               Delete the MIBD files which were packed.
+#
+#           CSV format matrix files cannot be packed.  Commands such as
+#           'mibd export' which read the MIBD files directly require the
+#           separate files.
+#
 # Notes:    The computed multipoint IBDs are stored in gzipped files with
 #           names of the form 'mibd.<chromo>.<loc>.gz', where <chrom> is the
 #           chromosome number and <loc> is the chromosomal location.
@@ -37112,6 +38371,26 @@ proc mibd {args} {
     set usefreq 0
     set qter 0
     set version 0
+    set pack 0
+    set half 0
+    set delete 0
+
+# -half and -delete belong to mibd pack, and -pack to computing MIBDs, so
+# they are parsed only for those and are invalid for other subcommands
+
+    if {[lindex $args 0] == "pack"} {
+        set args [concat pack [read_arglist [lrange $args 1 end] \
+                                   -half {set half 1} \
+                                   -delete {set delete 1}]]
+    } elseif {[llength $args] && [is_float [lindex $args 0]]} {
+        set args [read_arglist $args \
+                      -pack {set pack 1} \
+                      -half {set half 1} \
+                      -delete {set delete 1}]
+        if {!$pack && ($half || $delete)} {
+            error "Options -half and -delete require -pack"
+        }
+    }
 
     set chrlist [ read_arglist $args \
                       -file fname -f fname \
@@ -39179,6 +40458,23 @@ error "You must specify the analysis package for which to prepare input files."
         return
     }
 
+    if {[llength $chrlist] && [lindex $chrlist 0] == "pack"} {
+        if {[catch {mibddir} errmsg]} {
+            error $errmsg
+        }
+        set mdir [mibddir]
+        set chromos [lrange $chrlist 1 end]
+        if {![llength $chromos]} {
+            foreach mibdfile [glob -nocomplain $mdir/mibd.*.*.gz] {
+                set chromos [setappend chromos [get_chromosome $mibdfile]]
+            }
+        }
+        foreach chromo $chromos {
+            mibd_pack $mdir $chromo $half $delete
+        }
+        return
+    }
+
     if {[llength $chrlist]} {
 # A map file containing cM locations must be loaded for other mibd commands
         map test
@@ -39188,9 +40484,38 @@ error "You must specify the analysis package for which to prepare input files."
         }
     }
 
+    if {$pack} {
+        eval cmibd $args
+        mibd_pack [mibddir] [cmap chrnum] $half $delete
+        return
+    }
+
     eval cmibd $args
 }
 
+# solar::mibd_pack -- private
+#
+# Purpose:  Pack the mibd files of one chromosome (see mibd pack)
+#
+# Usage:    mibd_pack <mibddir> <chromo> <half> <delete>
+# -
+
+proc mibd_pack {mdir chromo half delete} {
+    set cargs [list write $mdir $chromo]
+    if {$half} {
+        lappend cargs -half
+    }
+    set npos [eval cmibdpack $cargs]
+    puts "Packed $npos locations of chromosome $chromo into\
+          $mdir/mibd.$chromo.pack"
+    if {$delete} {
+        foreach loc [cmibdpack locations $mdir $chromo] {
+            delete_files_forcibly $mdir/mibd.$chromo.$loc.gz
+        }
+    }
+    return ""
+}
+
 
 # solar::field --
 #
@@ -47797,7 +49122,7 @@ proc getcor {par1 par2 outfilename} {
 #               [-format csv | pedsys | fortran]  [-noevd] [-notsame]
 #               [-saveall] [-slowse] [-evdse]
 #               [-fixupper <boundary>] [-fixlower <boundary>]
-#               [-ixsnp <SNP>]
+#               [-ixsnp <SNP>] [-native]
 #
 # SPECIAL NOTE: no filenames or snp names should begin with hyphen (-)
 #               SNPS should be specified by their actual names, but the
@@ -47902,6 +49227,18 @@ proc getcor {par1 par2 outfilename} {
 # -fixlower   fix snp beta parameter lower boundaries to this value
 # -fixupper   fix snp beta parameter upper boundaries to this value
 #
+# -native     Evaluate all SNPs with the built-in C++ engine instead of
+#             maximizing a SOLAR model for each SNP.  The polygenic null
+#             model and its eigen decomposition are computed once and SNPs
+#             are fitted in parallel.  SNPs with missing dosages get a null
+#             model for their own sample.  Output columns and file naming
+#             are unchanged.  Requires a single quantitative trait, and the
+#             trait and covariates must be fields of the first phenotypes
+#             file.  The null model must be a standard polygenic model
+#             (omega pvar*(phi2*h2r + I*e2), with no household, linkage or
+#             other variance parameters).  Not compatible with -ixsnp,
+#             -slowse, -evdse, -saveall, -fixupper or -fixlower.
+#
 # Notes:
 #
 #  The genotype covariates are numeric variables giving the observed
@@ -47957,6 +49294,7 @@ proc mgassoc {args} {
     set samplesame 0
     set saveall 0
     set samplesametrustme 0
+    set native 0
     if {[option samplesametrustme] == 1} {
 	set samplesametrustme 1
     }
@@ -48014,6 +49352,7 @@ proc mgassoc {args} {
                      -fixupper fixupper \
 		     -fixlower fixlower \
 		     -ixsnp ixsnp \
+		     -native {set native 1} \
                      -q {set quietsub 1} \
 		     ]
     if {!$nose && $seevd} {
@@ -48113,6 +49452,38 @@ proc mgassoc {args} {
     }
     ifdebug0 puts "snps in each file:\n$snpsinfile"
 #
+# Native engine evaluates all SNPs in C++ against one null model per sample
+#
+    if {$native} {
+	if {$ntraits != 1} {
+	    error "mga -native requires a single trait"
+	}
+	if {$ixsnp != "" || $fixupper != "" || $fixlower != ""} {
+	    error "mga -native does not support -ixsnp, -fixupper or -fixlower"
+	}
+	if {!$nose || $saveall} {
+	    error "mga -native does not support -slowse, -evdse or -saveall"
+	}
+# The native null model has only phi2 and I variance components
+	if {"omega=pvar*(phi2*h2r+I*e2)" != [string map {" " ""} [omega]]} {
+	    error "mga -native requires the standard polygenic omega"
+	}
+	set betas [covariate -betanames]
+	foreach par [parameter -names] {
+	    if {-1 == [lsearch -exact {mean sd e2 h2r} $par] && \
+		    -1 == [lsearch -exact $betas $par]} {
+		error "mga -native requires a polygenic model, but it has parameter $par"
+	    }
+	}
+	foreach con [constraint command] {
+	    if {"e2+h2r=1" != [string map {" " ""} [lrange $con 1 end]]} {
+		error "mga -native requires a polygenic model, but it has constraint [lrange $con 1 end]"
+	    }
+	}
+	mga_native $ofile $format $snpwide $allphenf $snpsinfile $quietsub
+	return ""
+    }
+#
 # setup starting model (not maximized yet until we get first snp)
 #
     if {$ixsnp != ""} {
@@ -48658,6 +50029,112 @@ $snp_maf $snp_mac $snp_sd]"
     }
 }
 
+# solar::mga_native -- private
+#
+# Purpose:  Run mga SNP tests with the cmga native engine
+#
+# Usage:    mga_native <outfile> <format> <snpwidth> <phenfiles> <snpsinfile>
+#                      <quiet>
+#
+#           <snpsinfile> is a list of SNP lists, one for each file in
+#           <phenfiles>.  The trait and covariates are read from the first
+#           file.  Output lines are identical to those written by mga.
+# -
+
+proc mga_native {ofile format snpwide phenfiles snpsinfile quietsub} {
+    global SOLAR_mga_last_out
+    global SOLAR_mga_header
+
+    set nullsnps {}
+    foreach cov [covariate] {
+	if {[string range $cov 0 3] == "snp_"} {
+	    puts "snp $cov already included in null model"
+	    lappend nullsnps [string range $cov 4 end]
+	}
+    }
+    if {[option ExpNotation]} {
+	set fs e
+    } else {
+	set fs z
+    }
+    set headerneeded [expr !([file exists $ofile])]
+    set traitfile [lindex $phenfiles 0]
+    set written 0
+    for {set iphen 0} {$iphen < [llength $phenfiles]} {incr iphen} {
+	set snps {}
+	foreach snp [lindex $snpsinfile $iphen] {
+	    if {[lsearch -exact $nullsnps $snp] == -1} {
+		lappend snps $snp
+	    }
+	}
+	if {{} == $snps} {
+	    continue
+	}
+	set snpfile [lindex $phenfiles $iphen]
+	puts "    ** Evaluating SNPs found in $snpfile..."
+	if {$format != "csv"} {
+	    mga_codefile $ofile $snpwide
+	}
+	set results [cmga -phenfile $traitfile -snpfile $snpfile -snps $snps]
+
+	if {$headerneeded} {
+	    puts " "
+	    if {$format == "fortran"} {
+		set outheader "[fformat "%-$snpwide\s %5s %10s %10s" SNP "NAv" \
+		    "chi  " "p(SNP) "] [fformat "%12s %12s %12s" "bSNP  " \
+		    "bSNPse " "Varexp "] est_maf est_mac dosage_sd"
+	    } elseif {$format == "csv"} {
+		set outheader \
+		    "SNP,NAv,chi,p(SNP),bSNP,bSNPse,Varexp,est_maf,est_mac,dosage_sd"
+	    } else {
+		set outheader ""
+	    }
+	    if {"" != $outheader} {
+		set SOLAR_mga_header $outheader
+		putsout -d. $ofile $outheader
+	    }
+	    set headerneeded 0
+	}
+
+	set outfile [open $ofile a]
+	foreach result $results {
+	    set snp [lindex $result 0]
+	    if {[llength $result] == 1} {
+		if {$format != "csv"} {
+		    set outline [fformat %-11s $snp]
+		} else {
+		    set outline "$snp,,,,,,,,,"
+		}
+	    } else {
+		foreach {snp navail chi pval bsnp varexp maf mac sd} $result {}
+		set se_ 10e20
+		if {$chi > 0} {
+		    catch {
+			set se_ [expr sqrt ($bsnp*$bsnp/$chi)]
+		    }
+		}
+		if {$format == "csv"} {
+		    set outline [fformat \
+ "%s,%d,%10.6$fs,%10.6$fs,%12.6$fs,%12.6$fs,%12.6$fs,%12.6$fs,%12.6$fs,%12.6$fs" \
+ $snp $navail $chi $pval $bsnp $se_ $varexp $maf $mac $sd]
+		} else {
+		    set outline [fformat \
+ "%-$snpwide\s %5d %10.6y %10.6y %12.6y %12.6y %12.6y %12.6y %12.6y %12.6y" \
+ $snp $navail $chi $pval $bsnp $se_ $varexp $maf $mac $sd]
+		}
+		set SOLAR_mga_last_out $outline
+	    }
+	    puts $outfile $outline
+	    puts $outline
+	    set written 1
+	}
+	close $outfile
+    }
+    if {$written && !$quietsub} {
+	puts "\n    ** results written to $ofile"
+    }
+}
+
 proc snplistfile {filename} {
     set retlist {}
     set infile [open $filename]
@@ -51277,6 +52754,7 @@ proc snphap {args} {
 # Purpose:  Simulate a QTL and (optionally) a linked marker
 #
 # Usage:    simqtl [-seed <seed>] [-inform] [-gfile <genotype_file>]
+#                  [-nrep <#replicates> [-threads <#threads>]]
 #
 #           simqtl -model
 #
@@ -51312,6 +52790,22 @@ proc snphap {args} {
 #                      genotypes are read from a file rather than simulated.
 #                      This argument specifies the name of this file.
 #
+#             -nrep    Simulate this many independent replicates in one
+#                      run. The pedigrees and kinship matrices are set up
+#                      once, then all replicates and pedigrees are simulated
+#                      in parallel. Replicate <n> is written to the files
+#                      "simqtl.<n>.phn", "simqtl.<n>.qtl", and, if there is a
+#                      linked marker, "simqtl.<n>.mrk". Each replicate and
+#                      pedigree has its own random number stream derived
+#                      from the seed, so the results for a given seed do not
+#                      depend on the number of threads. (They do differ
+#                      from the results of a single simulation with the
+#                      same seed.) If no seed is given, one is drawn from
+#                      the drand random number generator.
+#
+#             -threads The number of threads used with -nrep. The default
+#                      (or 0) is to use all available processors.
+#
 #           The simulated trait values are written to the file "simqtl.phn".
 #           A simulated trait value will not be assigned to any individual
 #           who has an unknown age, or who is missing data for any other
@@ -51527,25 +53021,33 @@ proc simqtl {args} {
     set model 0
     set seed ""
     set inform 0
+    set nrep ""
+    set threads ""
 
     read_arglist $args -nloc nloc -nall lnall -freq lfreq -ntrt ntrt \
         -cov lcov -beta lbeta -mage mage -cmean lcmean -mean lmean \
         -sdev lsdev -h2r lh2r -rhog lrhog -rhoe lrhoe -theta theta \
         -mfreq lmfreq -gfile gfile -model {set model 1} -seed seed \
-        -inform {set inform 1}
+        -inform {set inform 1} -nrep nrep -threads threads
 
     if {($nloc != 1 || $lnall != "" || $lfreq != "" || $ntrt != 1 || \
             $lcov != "" || $lbeta != "" || $mage || $lcmean != "" || \
             $lmean != "" || $lsdev != "" || $lh2r != "" || $lrhog != "" || \
             $lrhoe != "" || $theta != "" || $lmfreq != "") && \
-           ($gfile != "" || $model || $seed != "" || $inform)} {
+           ($gfile != "" || $model || $seed != "" || $inform || \
+            $nrep != "" || $threads != "")} {
         error "Invalid simqtl command"
     }
 
-    if {($gfile != "" || $seed != "" || $inform) && $model} {
+    if {($gfile != "" || $seed != "" || $inform || $nrep != "" || \
+            $threads != "") && $model} {
         error "Invalid simqtl command"
     }
 
+    if {$threads != "" && $nrep == ""} {
+        error "simqtl: -threads requires -nrep"
+    }
+
     if {$model} {
         csimqtl -model
         return
@@ -51563,6 +53065,25 @@ proc simqtl {args} {
         return
     }
 
+    if {$nrep != ""} {
+        set cargs "-nrep $nrep"
+        if {$threads != ""} {
+            lappend cargs -threads $threads
+        }
+        if {$gfile != ""} {
+            lappend cargs -gfile
+        }
+        if {$seed != ""} {
+            lappend cargs -seed $seed
+        }
+        if {$inform} {
+            lappend cargs -inform
+        }
+        write_simqtl_data
+        eval csimqtl $cargs
+        return
+    }
+
     if {$gfile != ""} {
         write_simqtl_data
         if {$seed != ""} {
@@ -53422,6 +54943,11 @@ puts "saving fphi_web result in out.txt file"
 #   calling this command.  If the phenotype contains a class column and you wish to 
 #   perform the calculations by class then use the -class option by listing the classes
 #   separated by commas, for example -class 0,1,2,3 . 	
+#
+#   Traits with the same missing individuals share a single covariate fit,
+#   and traits are residualized and inormalized in parallel blocks.  The
+#   number of threads can be set with the OMP_NUM_THREADS environment
+#   variable.
 #-
 
 #- 
@@ -53920,13 +55446,12 @@ proc oldest_fphi {args} {
 #       R is "square root of F" i.e. (Y - XB)
 #     Using custom function PermuteY
 
-    set Ys [permutey $XB $R $nP]
-
 # Section 3(b)
 # If there are covariates
 #   F3 = (HxY) etimes (HxY)
 #     Hx = (I - X(X'X)^-1 X')
 #     (May 9 pdf was wrong, corrected on July 9)
+#   permutey multiplies by Hx as it goes, so Ys itself is never stored
 
     if {[llength [covariates]]} {
 	set Xt [transpose $X]
@@ -53935,18 +55460,19 @@ proc oldest_fphi {args} {
 	set Hx [minus $Ip $Xp]
 
 	ifdebug0 puts "beginning to multiply Hx times Ys"
-	set HxY [times $Hx $Ys]
+	set HxY [permutey $XB $R $nP $Hx]
 	ifdebug0 puts "end multiplication"
 	ifdebug0 puts "HxY is $HxY"
 
-	set F3 [times -e $HxY $HxY]
+	set F3 [times -e -inplace $HxY $HxY]
 
     } else {
 
 # If no covariates
 #   F3 = Y etimes Y
 
-	set F3 [times -e $Ys $Ys]
+	set Ys [permutey $XB $R $nP]
+	set F3 [times -e -inplace $Ys $Ys]
     }
     ifdebug0 puts "F3 is $F3"
 #
@@ -54021,6 +55547,12 @@ proc oldest_fphi {args} {
 #         dinverse $m        ;# Fast inverse for diagonal matrix
 #                            ;#  Matrix must be diagonal!  This is not checked!
 #
+#         times, plus, minus, and transpose also accept these options
+#         before their arguments to reuse existing matrix storage:
+#
+#           -out $d          ;# store result in existing matrix d
+#           -inplace         ;# store result in first matrix argument
+#
 #         ols $y $x  ;# ordinary least squares (lldt fastest) for y=xb+e
 #         solve [<method>] $y $x   ;# other methods, default is
 #                                  ;# FullPivHouseholderQR
@@ -54044,6 +55576,7 @@ proc oldest_fphi {args} {
 #                                        as a tcl nested list (can be input to
 #                                        matrix new)
 #         output $m <filename>        ;# write out matrix as csv file
+#                                     ;# or binary if <filename> ends in .mm
 #         
 #         row $m <row>       ;# extract row as a column vector: 1,2,...
 #         col $m <col>       ;# extract column as a column vector: 1,2,...
@@ -54056,6 +55589,9 @@ proc oldest_fphi {args} {
 #         shuffle $v         ;# shuffle the elements of vector v
 #         shuffle $v n       ;# shuffle the elements of vector v into n-1 cols
 #                            ;# retaining first column unshuffled
+#         permutey $XB $R $nP [$M] ;# FPHI permutations: first col XB+R,
+#                                  ;# then nP cols of XB + shuffled R,
+#                                  ;# multiplied by M if given
 #         identity <rows>    ;# create an identity matrix
 #
 # Matrix commands for creating, loading, and deleting matrixes
@@ -54074,10 +55610,13 @@ proc oldest_fphi {args} {
 #        load matrix -noheader design.mat.csv  ;# .mat.csv are headerless
 #        load matrix -cols {{1} 1 age bmi '2020' end} phen.csv
 #                           ;# first column is all 1's
+#        load matrix big.mm ;# binary file written by output
 #
 # Delete and reset commands:
 #
 #         matrix delete $m
+#         matrix retain $m     ;# add a reference to m, so one more
+#                              ;#   matrix delete is needed to free it
 #         matrix reset         ;# free all MathMatrix storage and ID's
 #                              ;# do reset as much as possible to free memory
 #
@@ -54176,6 +55715,33 @@ proc oldest_fphi {args} {
 #
 # If a matrix filename ends in ".mat.csv" it will automatically be handled as
 # headerless matrix file and the -noheader argument is not required.
+#
+# Large matrices are much faster to save and reload in binary form.  If the
+# output filename ends in ".mm", output writes the dimensions followed by the
+# values as doubles in column major order.  load matrix recognizes such files
+# by their contents, whatever their name, and maps them directly into memory.
+# The -cols and -rows options do not apply to binary files.
+#
+# Each arithmetic operation normally creates a new matrix, so a loop such as
+#
+#   for {set i 0} {$i < 100} {incr i} {set a [plus $a $b]}
+#
+# would leave 100 matrices allocated.  Use -inplace or -out to reuse storage:
+#
+#   for {set i 0} {$i < 100} {incr i} {plus -inplace $a $b}
+#
+# The returned identifier is that of the destination matrix.  A matrix
+# product into one of its own operands is computed through a temporary.
+#
+# shuffle, permutey, and permutef compute their permutations in parallel
+# (threads as set by OMP_NUM_THREADS).  Each permutation has its own random
+# stream, so for a given seed the result is the same for any number of
+# threads.  permutey and permutef use the ShuffleReseeding option (see
+# "help option") and by default give the same permutations every time.
+#
+# If the same matrix is kept in more than one place, use matrix retain for
+# each additional holder rather than copying it.  Each holder then does its
+# own matrix delete, and the storage is freed by the last one.
 #-
 
 
@@ -54197,6 +55763,7 @@ proc oldest_fphi {args} {
 #          
 # Usage: plink_converter -i <input base name> -o <output base name> optional:<-bin>
 #							<-max> <maximum snps per file> -perchromo
+#							-solar -binary -threads <n>
 #
 # Example: plink_converter -i test -o test -bin -max 50000
 #          
@@ -54207,6 +55774,16 @@ proc oldest_fphi {args} {
 #             labeled <output_base_name>_<file number>.csv will be created.
 #	     -perchromo Switch that separates output by chromosome.
 # 	     -solar Outputs snp data as 1/1,1/2,or 2/2
+#            -binary Writes each output file in a binary, column addressable
+#                 format (extension .sgb) instead of .csv.  Values are those
+#                 of -bin, and the same table of assignment values is
+#                 written.  A .sgb file can be loaded and used wherever a
+#                 .csv file of snp data can (load phenotypes, snp, mga and
+#                 gwas), and is read without parsing text.
+#            -threads <n> Number of output files converted at the same time.
+#                 Each output file is decoded and written by one thread, so
+#                 use -max or -perchromo to split large sets.  Default is
+#                 the OpenMP default.
 #	    
 #-
 
@@ -54229,7 +55806,9 @@ proc oldest_fphi {args} {
 #			file will be written to output.  Any snp with a pvalue less than or equal
 #			to the threshold will be included.
 #
-#
+#	    The annotation file is indexed by snp name once, and the gwas file is
+#	    read as a stream, so output rows follow the order of the gwas file.
+#	    Snps without annotation data are given N/A for each annotation field.
 #
 # -
 